@@ -0,0 +1,550 @@
+#include "APU.hpp"
+#include "Gameboy.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr u8 s_DutyTable[4] = { 0b00000001, 0b10000001, 0b10000111, 0b01111110 };
+static constexpr u8 s_WaveShift[4] = { 4, 0, 1, 2 };
+static constexpr u16 s_NoiseDivisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+// Bits that read back as 1, FF10-FF2F (NR52 is handled separately)
+static constexpr u8 s_ReadMask[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,
+    0x00, 0x00, 0x70,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// First register of each channel (NRx0)
+static constexpr u16 s_ChannelBase[4] = { 0xFF10, 0xFF15, 0xFF1A, 0xFF1F };
+
+// Full scale is 4 channels x 15 x master volume 8
+static constexpr float s_OutputScale = 60.0f;
+
+// One pole DC blocker, a few Hz at common sample rates
+static constexpr float s_HighPass = 0.001f;
+
+const APU::Kernel *APU::GetKernel() {
+    static const std::vector<float> s_Table = [] {
+        // Windowed sinc cut off a bit below Nyquist, one row per sub-sample phase,
+        // each normalized so a step integrates to exactly its height
+        static constexpr double s_Cutoff = 0.9;
+
+        std::vector<float> table(s_Phases * s_Taps);
+        for (usize phase = 0; phase < s_Phases; phase++) {
+            double frac = (phase + 0.5) / s_Phases;
+            double sum = 0;
+
+            for (usize tap = 0; tap < s_Taps; tap++) {
+                double x = tap - frac - (s_Taps / 2.0 - 1.0);
+                double sinc = (x == 0) ? 1.0 : std::sin(M_PI * s_Cutoff * x) / (M_PI * s_Cutoff * x);
+                double u = (tap + 1.0 - frac) / (s_Taps + 1.0);
+                double window = 0.42 - 0.5 * std::cos(2 * M_PI * u) + 0.08 * std::cos(4 * M_PI * u);
+
+                table[phase * s_Taps + tap] = static_cast<float>(sinc * window);
+                sum += sinc * window;
+            }
+
+            for (usize tap = 0; tap < s_Taps; tap++) {
+                table[phase * s_Taps + tap] = static_cast<float>(table[phase * s_Taps + tap] / sum);
+            }
+        }
+
+        return table;
+    }();
+
+    return reinterpret_cast<const Kernel*>(s_Table.data());
+}
+
+// Register values the boot ROM leaves behind
+APU::APU()
+    : m_Kernel(GetKernel())
+{
+    static constexpr u8 s_PostBoot[0x17] = {
+        0x80, 0xBF, 0xF3, 0xFF, 0xBF,
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+        0xFF, 0xFF, 0x00, 0x00, 0xBF,
+        0x77, 0xF3, 0xF1,
+    };
+    std::copy(std::begin(s_PostBoot), std::end(s_PostBoot), m_Regs);
+
+    // The boot sound is over but channel 1 is still on
+    m_Channels[0].Enabled = true;
+    m_Channels[0].DAC = true;
+}
+
+void APU::SetSampleRate(u32 rate) {
+    if (rate != 0 && (rate < s_MinSampleRate || rate > s_MaxSampleRate)) {
+        LOG_WARN("APU: sample rate %u Hz out of range, using %u Hz\n", rate, std::clamp(rate, s_MinSampleRate, s_MaxSampleRate));
+        rate = std::clamp(rate, s_MinSampleRate, s_MaxSampleRate);
+    }
+
+    m_SampleRate = rate;
+    m_Factor = rate ? (static_cast<u64>(rate) << 32) / s_ClockRate : 0;
+    m_Time = 0;
+
+    m_Left.assign(rate ? s_BufferSize : 0, 0.0f);
+    m_Right.assign(rate ? s_BufferSize : 0, 0.0f);
+    m_SumLeft = m_SumRight = 0;
+    m_DcLeft = m_DcRight = 0;
+    m_MixLeft = m_MixRight = 0;
+    UpdateMix(0);
+}
+
+void APU::SetRateAdjust(double ratio) {
+    ratio = std::clamp(ratio, 1.0 / s_MaxRateAdjust, s_MaxRateAdjust);
+    m_Factor = static_cast<u64>(m_SampleRate * ratio * 4294967296.0 / s_ClockRate);
+}
+
+u16 APU::GetFrequency(usize ch) const {
+    return static_cast<u16>(((GetReg(s_ChannelBase[ch] + 4) & 0x07) << 8) | GetReg(s_ChannelBase[ch] + 3));
+}
+
+void APU::SetFrequency(usize ch, u16 freq) {
+    Reg(s_ChannelBase[ch] + 3) = freq & 0xFF;
+    Reg(s_ChannelBase[ch] + 4) = (GetReg(s_ChannelBase[ch] + 4) & ~0x07) | ((freq >> 8) & 0x07);
+}
+
+u32 APU::GetPeriod(usize ch) const {
+    switch (ch) {
+        case 0:
+        case 1: return (2048 - GetFrequency(ch)) * 4;
+        case 2: return (2048 - GetFrequency(ch)) * 2;
+        default: {
+            u8 nr43 = GetReg(0xFF22);
+            return static_cast<u32>(s_NoiseDivisors[nr43 & 0x07]) << (nr43 >> 4);
+        }
+    }
+}
+
+u8 APU::GetOutput(usize ch) const {
+    const Channel &c = m_Channels[ch];
+    if (!c.Enabled) return 0;
+
+    switch (ch) {
+        case 0:
+        case 1: {
+            u8 duty = GetReg(s_ChannelBase[ch] + 1) >> 6;
+            return ((s_DutyTable[duty] >> c.Position) & 1) ? c.Volume : 0;
+        }
+        case 2: {
+            u8 byte = m_Regs[0x20 + c.Position / 2];
+            u8 sample = (c.Position & 1) ? (byte & 0x0F) : (byte >> 4);
+            return sample >> s_WaveShift[(GetReg(0xFF1C) >> 5) & 0x03];
+        }
+        default: return (c.Lfsr & 1) ? 0 : c.Volume;
+    }
+}
+
+void APU::Trigger(usize ch) {
+    Channel &c = m_Channels[ch];
+    u16 base = s_ChannelBase[ch];
+
+    c.Enabled = c.DAC;
+    if (c.Length == 0) {
+        c.Length = (ch == 2) ? 256 : 64;
+    }
+    c.Timer = GetPeriod(ch);
+
+    if (ch == 2) {
+        c.Position = 0;
+    } else {
+        c.Volume = GetReg(base + 2) >> 4;
+        c.EnvelopeTimer = GetReg(base + 2) & 0x07;
+    }
+
+    if (ch == 3) {
+        c.Lfsr = 0x7FFF;
+    }
+
+    if (ch == 0) {
+        u8 nr10 = GetReg(0xFF10);
+        u8 period = (nr10 >> 4) & 0x07;
+        u8 shift = nr10 & 0x07;
+
+        c.Shadow = GetFrequency(0);
+        c.SweepTimer = period ? period : 8;
+        c.SweepEnabled = period || shift;
+        if (shift) {
+            CalculateSweep();
+        }
+    }
+}
+
+// Next sweep frequency, going past 2047 turns the channel off
+u16 APU::CalculateSweep() {
+    Channel &c = m_Channels[0];
+    u8 nr10 = GetReg(0xFF10);
+
+    u16 delta = c.Shadow >> (nr10 & 0x07);
+    u16 freq = (nr10 & 0x08) ? c.Shadow - delta : c.Shadow + delta;
+    if (freq > 2047) {
+        c.Enabled = false;
+    }
+
+    return freq;
+}
+
+void APU::StepFrameSequencer() {
+    u8 step = m_FrameSequencerStep;
+    m_FrameSequencerStep = (step + 1) & 7;
+
+    if ((step & 1) == 0) {
+        for (usize ch = 0; ch < 4; ch++) {
+            Channel &c = m_Channels[ch];
+            if ((GetReg(s_ChannelBase[ch] + 4) & 0x40) && c.Length > 0 && --c.Length == 0) {
+                c.Enabled = false;
+            }
+        }
+    }
+
+    if (step == 2 || step == 6) {
+        Channel &c = m_Channels[0];
+        u8 nr10 = GetReg(0xFF10);
+        u8 period = (nr10 >> 4) & 0x07;
+
+        if (c.SweepTimer > 0) c.SweepTimer--;
+        if (c.SweepTimer == 0) {
+            c.SweepTimer = period ? period : 8;
+
+            if (c.SweepEnabled && period) {
+                u16 freq = CalculateSweep();
+                if (freq <= 2047 && (nr10 & 0x07)) {
+                    c.Shadow = freq;
+                    SetFrequency(0, freq);
+                    CalculateSweep();
+                }
+            }
+        }
+    }
+
+    if (step == 7) {
+        for (usize ch : { 0, 1, 3 }) {
+            Channel &c = m_Channels[ch];
+            u8 envelope = GetReg(s_ChannelBase[ch] + 2);
+            u8 period = envelope & 0x07;
+            if (period == 0) continue;
+
+            if (c.EnvelopeTimer > 0) c.EnvelopeTimer--;
+            if (c.EnvelopeTimer == 0) {
+                c.EnvelopeTimer = period;
+                if ((envelope & 0x08) && c.Volume < 15) {
+                    c.Volume++;
+                } else if (!(envelope & 0x08) && c.Volume > 0) {
+                    c.Volume--;
+                }
+            }
+        }
+    }
+
+    for (usize ch = 0; ch < 4; ch++) {
+        UpdateOutput(ch, 0);
+    }
+}
+
+void APU::StepWaveform(usize ch, u32 steps) {
+    Channel &c = m_Channels[ch];
+
+    switch (ch) {
+        case 0:
+        case 1: c.Position = (c.Position + steps) & 7; break;
+        case 2: c.Position = (c.Position + steps) & 31; break;
+        default: {
+            bool narrow = GetReg(0xFF22) & 0x08;
+            for (u32 i = 0; i < steps; i++) {
+                u16 bit = (c.Lfsr ^ (c.Lfsr >> 1)) & 1;
+                c.Lfsr = (c.Lfsr >> 1) | (bit << 14);
+                if (narrow) {
+                    c.Lfsr = (c.Lfsr & ~(1 << 6)) | (bit << 6);
+                }
+            }
+        } break;
+    }
+}
+
+// Walks every channel from one waveform step to the next over `cycles`. When the
+// channel can't be heard only where it ends up matters, so the steps are skipped
+// over in one go.
+void APU::RunChannels(u32 cycles) {
+    bool synthesis = m_SampleRate && m_Synthesis;
+    u8 panning = GetReg(0xFF25);
+
+    for (usize ch = 0; ch < 4; ch++) {
+        Channel &c = m_Channels[ch];
+        if (!c.Enabled) continue;
+
+        bool silent = !(panning & (0x11 << ch)) ||
+            ((ch == 2) ? ((GetReg(0xFF1C) & 0x60) == 0) : (c.Volume == 0));
+
+        if (!synthesis || silent) {
+            if (c.Timer > cycles) {
+                c.Timer -= cycles;
+                continue;
+            }
+
+            u32 period = GetPeriod(ch);
+            u32 rest = cycles - c.Timer;
+            StepWaveform(ch, 1 + rest / period);
+            c.Timer = period - rest % period;
+            c.Output = GetOutput(ch);
+            continue;
+        }
+
+        u32 period = GetPeriod(ch);
+        u32 t = 0;
+        while (c.Timer <= cycles - t) {
+            t += c.Timer;
+            c.Timer = period;
+            StepWaveform(ch, 1);
+            UpdateOutput(ch, t);
+        }
+
+        c.Timer -= cycles - t;
+    }
+}
+
+void APU::UpdateOutput(usize ch, u32 cycles) {
+    u8 output = GetOutput(ch);
+    if (output != m_Channels[ch].Output) {
+        m_Channels[ch].Output = output;
+        UpdateMix(cycles);
+    }
+}
+
+void APU::UpdateMix(u32 cycles) {
+    // While synthesis is off the buffer keeps the level it had, and catches up
+    // with one step once it is back on
+    if (m_SampleRate == 0 || !m_Synthesis) return;
+
+    u8 nr50 = GetReg(0xFF24);
+    u8 nr51 = GetReg(0xFF25);
+
+    i32 left = 0, right = 0;
+    for (usize ch = 0; ch < 4; ch++) {
+        u8 output = m_Channels[ch].Output;
+        if (nr51 & (0x10 << ch)) left += output;
+        if (nr51 & (0x01 << ch)) right += output;
+    }
+    left *= ((nr50 >> 4) & 0x07) + 1;
+    right *= (nr50 & 0x07) + 1;
+
+    if (left != m_MixLeft || right != m_MixRight) {
+        AddDelta(cycles, left - m_MixLeft, right - m_MixRight);
+        m_MixLeft = left;
+        m_MixRight = right;
+    }
+}
+
+void APU::AddDelta(u32 cycles, i32 left, i32 right) {
+    u64 pos = m_Time + cycles * m_Factor;
+    usize index = static_cast<usize>(pos >> 32);
+    const float *kernel = m_Kernel[(pos >> (32 - s_PhaseBits)) & (s_Phases - 1)];
+
+    float *outLeft = &m_Left[index];
+    float *outRight = &m_Right[index];
+    float dl = static_cast<float>(left), dr = static_cast<float>(right);
+    for (usize tap = 0; tap < s_Taps; tap++) {
+        outLeft[tap] += kernel[tap] * dl;
+        outRight[tap] += kernel[tap] * dr;
+    }
+}
+
+void APU::Sync(u64 now) {
+    while (m_LastSync < now) {
+        // Enough room for one frame sequencer period of samples, drop the oldest if
+        // nobody is reading
+        if (m_SampleRate && GetAvailable() + 2 * s_Taps + ((u64(s_FrameSequencerPeriod) * m_Factor) >> 32) >= s_BufferSize) {
+            ReadSamples(nullptr, GetAvailable() / 2);
+        }
+
+        u32 cycles = static_cast<u32>(std::min<u64>(now - m_LastSync, m_FrameSequencerTimer));
+        if (m_Power) {
+            RunChannels(cycles);
+        }
+
+        if (m_SampleRate && m_Synthesis) {
+            m_Time += cycles * m_Factor;
+        }
+
+        m_LastSync += cycles;
+        m_FrameSequencerTimer -= cycles;
+
+        if (m_FrameSequencerTimer == 0) {
+            m_FrameSequencerTimer = s_FrameSequencerPeriod;
+            if (m_Power) {
+                StepFrameSequencer();
+            }
+        }
+    }
+}
+
+usize APU::ReadSamples(i16 *out, usize frames) {
+    if (m_SampleRate == 0) return 0;
+
+    usize available = GetAvailable();
+    usize count = std::min(frames, available);
+
+    for (usize i = 0; i < count; i++) {
+        m_SumLeft += m_Left[i];
+        m_SumRight += m_Right[i];
+
+        float left = m_SumLeft - m_DcLeft;
+        float right = m_SumRight - m_DcRight;
+        m_DcLeft += left * s_HighPass;
+        m_DcRight += right * s_HighPass;
+
+        if (out) {
+            out[2 * i + 0] = static_cast<i16>(std::clamp(left * s_OutputScale, -32768.0f, 32767.0f));
+            out[2 * i + 1] = static_cast<i16>(std::clamp(right * s_OutputScale, -32768.0f, 32767.0f));
+        }
+    }
+
+    // Steps that were added ahead of the read position move to the front
+    usize used = std::min(available + s_Taps, s_BufferSize);
+    std::copy(m_Left.begin() + count, m_Left.begin() + used, m_Left.begin());
+    std::copy(m_Right.begin() + count, m_Right.begin() + used, m_Right.begin());
+    std::fill(m_Left.begin() + used - count, m_Left.begin() + used, 0.0f);
+    std::fill(m_Right.begin() + used - count, m_Right.begin() + used, 0.0f);
+
+    m_Time -= static_cast<u64>(count) << 32;
+    return count;
+}
+
+u8 APU::Read(u16 addr) {
+    Sync(Gameboy::Get().GetTicks());
+
+    if (addr >= 0xFF30) {
+        return GetReg(addr);
+    }
+
+    if (addr == 0xFF26) {
+        u8 val = (m_Power ? 0x80 : 0x00) | 0x70;
+        for (usize ch = 0; ch < 4; ch++) {
+            if (m_Channels[ch].Enabled) val |= 1 << ch;
+        }
+        return val;
+    }
+
+    return GetReg(addr) | s_ReadMask[addr - 0xFF10];
+}
+
+void APU::Write(u16 addr, u8 val) {
+    Sync(Gameboy::Get().GetTicks());
+
+    if (addr >= 0xFF30) {
+        Reg(addr) = val;
+        return;
+    }
+
+    if (addr == 0xFF26) {
+        bool power = val & 0x80;
+        if (m_Power && !power) {
+            PowerOff();
+        } else if (!m_Power && power) {
+            m_Power = true;
+            m_FrameSequencerStep = 0;
+        }
+        return;
+    }
+
+    // Everything but NR52 ignores writes while powered off
+    if (!m_Power) return;
+
+    Reg(addr) = val;
+
+    switch (addr) {
+        case 0xFF11:
+        case 0xFF16:
+        case 0xFF20: {
+            m_Channels[(addr - 0xFF10) / 5].Length = 64 - (val & 0x3F);
+        } break;
+        case 0xFF1B: m_Channels[2].Length = 256 - val; break;
+        case 0xFF12:
+        case 0xFF17:
+        case 0xFF21: {
+            Channel &c = m_Channels[(addr - 0xFF10) / 5];
+            c.DAC = (val & 0xF8) != 0;
+            if (!c.DAC) c.Enabled = false;
+        } break;
+        case 0xFF1A: {
+            m_Channels[2].DAC = (val & 0x80) != 0;
+            if (!m_Channels[2].DAC) m_Channels[2].Enabled = false;
+        } break;
+        case 0xFF14:
+        case 0xFF19:
+        case 0xFF1E:
+        case 0xFF23: {
+            if (val & 0x80) Trigger((addr - 0xFF10) / 5);
+        } break;
+    }
+
+    for (usize ch = 0; ch < 4; ch++) {
+        UpdateOutput(ch, 0);
+    }
+    UpdateMix(0);
+}
+
+void APU::PowerOff() {
+    std::fill(m_Regs, m_Regs + 0x16, 0);
+    for (Channel &c : m_Channels) {
+        c = Channel();
+    }
+    m_Power = false;
+
+    UpdateMix(0);
+}
+
+void APU::Serialize(StateWriter &state) const {
+    state.Write(m_Regs);
+    state.Write(m_Power);
+    state.Write(m_LastSync);
+    state.Write(m_FrameSequencerTimer);
+    state.Write(m_FrameSequencerStep);
+
+    // Field by field, the struct has padding
+    for (const Channel &c : m_Channels) {
+        state.Write(c.Enabled);
+        state.Write(c.DAC);
+        state.Write(c.Length);
+        state.Write(c.Volume);
+        state.Write(c.EnvelopeTimer);
+        state.Write(c.Timer);
+        state.Write(c.Position);
+        state.Write(c.Lfsr);
+        state.Write(c.Shadow);
+        state.Write(c.SweepTimer);
+        state.Write(c.SweepEnabled);
+        state.Write(c.Output);
+    }
+}
+
+void APU::Deserialize(StateReader &state) {
+    state.Read(m_Regs);
+    state.Read(m_Power);
+    state.Read(m_LastSync);
+    state.Read(m_FrameSequencerTimer);
+    state.Read(m_FrameSequencerStep);
+
+    for (Channel &c : m_Channels) {
+        state.Read(c.Enabled);
+        state.Read(c.DAC);
+        state.Read(c.Length);
+        state.Read(c.Volume);
+        state.Read(c.EnvelopeTimer);
+        state.Read(c.Timer);
+        state.Read(c.Position);
+        state.Read(c.Lfsr);
+        state.Read(c.Shadow);
+        state.Read(c.SweepTimer);
+        state.Read(c.SweepEnabled);
+        state.Read(c.Output);
+    }
+
+    // The output carries on from where it was, at the loaded channel levels
+    UpdateMix(0);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SaveState.hpp"
+
+// The four DMG sound channels (two squares, the first with sweep, wave and noise),
+// their length / envelope / sweep units and the 512 Hz frame sequencer.
+//
+// Nothing runs per instruction: the APU catches up to the machine's cycle count
+// when one of its registers is accessed and at the end of each frame, walking
+// from one channel edge to the next. Every change of a channel's output adds a
+// band-limited step into a buffer at the output sample rate, and reading
+// samples integrates that buffer, so sound is alias free without running
+// anything at the 4 MHz clock.
+class APU {
+public:
+    APU();
+
+    // Output rates in Hz that the sample buffer has room for
+    static constexpr u32 s_MinSampleRate = 8000;
+    static constexpr u32 s_MaxSampleRate = 192000;
+
+    // 0 (the default) keeps emulating the channels but doesn't produce samples.
+    // Other rates are clamped to s_MinSampleRate..s_MaxSampleRate.
+    void SetSampleRate(u32 rate);
+    u32 GetSampleRate() const { return m_SampleRate; }
+
+    // Stretches the output by `ratio` (around 1.0, at most s_MaxRateAdjust) without
+    // touching what is buffered, for rate control against the sound card's clock
+    void SetRateAdjust(double ratio);
+
+    // Speculative frames (run-ahead) emulate the channels but leave the output alone
+    void SetSynthesis(bool enabled) { m_Synthesis = enabled; }
+
+    u8 Read(u16 addr);
+    void Write(u16 addr, u8 val);
+
+    // Catches up to the machine's cycle count
+    void Sync(u64 now);
+
+    // Stereo samples ready to be read, after a Sync
+    usize GetAvailable() const { return m_SampleRate ? static_cast<usize>(m_Time >> 32) : 0; }
+
+    // Reads up to `frames` interleaved stereo samples, out may be null to drop them
+    usize ReadSamples(i16 *out, usize frames);
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
+private:
+    struct Channel {
+        bool Enabled;
+        bool DAC;
+        u16 Length;
+        u8 Volume;
+        u8 EnvelopeTimer;
+        u32 Timer;          // Cycles until the next waveform step
+        u8 Position;        // Duty step or wave sample
+        u16 Lfsr;
+        u16 Shadow;         // Sweep
+        u8 SweepTimer;
+        bool SweepEnabled;
+        u8 Output;          // 0-15 as last sent to the mixer
+    };
+
+    u8 &Reg(u16 addr) { return m_Regs[addr - 0xFF10]; }
+    u8 GetReg(u16 addr) const { return m_Regs[addr - 0xFF10]; }
+
+    u16 GetFrequency(usize ch) const;
+    void SetFrequency(usize ch, u16 freq);
+    u32 GetPeriod(usize ch) const;
+    u8 GetOutput(usize ch) const;
+
+    void Trigger(usize ch);
+    u16 CalculateSweep();
+
+    void StepFrameSequencer();
+    void StepWaveform(usize ch, u32 steps);
+    void RunChannels(u32 cycles);
+
+    // Output changes at `cycles` after m_LastSync
+    void UpdateOutput(usize ch, u32 cycles);
+    void UpdateMix(u32 cycles);
+    void AddDelta(u32 cycles, i32 left, i32 right);
+
+    void PowerOff();
+
+private:
+    static constexpr u32 s_ClockRate = 4194304;
+    static constexpr u32 s_FrameSequencerPeriod = 8192;
+
+    static constexpr usize s_Taps = 16;
+    static constexpr usize s_PhaseBits = 5;
+    static constexpr usize s_Phases = 1 << s_PhaseBits;
+    static constexpr usize s_BufferSize = 8192;
+    static constexpr double s_MaxRateAdjust = 2.0;
+
+    // Sync keeps one frame sequencer period of samples, plus the kernel's tail, free
+    static_assert(s_MaxSampleRate * s_MaxRateAdjust * s_FrameSequencerPeriod / s_ClockRate + 2 * s_Taps < s_BufferSize);
+
+    // Registers FF10-FF3F, wave RAM included
+    u8 m_Regs[0x30] = {};
+    Channel m_Channels[4] = {};
+    bool m_Power = true;
+
+    u64 m_LastSync = 0;
+    u32 m_FrameSequencerTimer = s_FrameSequencerPeriod;
+    u8 m_FrameSequencerStep = 0;
+
+    // Output, not part of the machine state
+    u32 m_SampleRate = 0;
+    bool m_Synthesis = true;
+    u64 m_Factor = 0;       // Samples per cycle, 32.32 fixed point
+    u64 m_Time = 0;         // Sample position of m_LastSync, 32.32 fixed point
+    i32 m_MixLeft = 0;
+    i32 m_MixRight = 0;
+    std::vector<float> m_Left;
+    std::vector<float> m_Right;
+    float m_SumLeft = 0, m_SumRight = 0;
+    float m_DcLeft = 0, m_DcRight = 0;
+
+    // Band-limited step derivative per sub-sample phase, shared by all instances
+    using Kernel = float[s_Taps];
+    static const Kernel *GetKernel();
+    const Kernel *m_Kernel;
+};
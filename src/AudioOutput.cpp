@@ -0,0 +1,209 @@
+#include "AudioOutput.hpp"
+#include "APU.hpp"
+#include "Log.hpp"
+
+#include <chrono>
+#include <cstring>
+
+AudioOutput::~AudioOutput() {
+    CloseDevice();
+    CloseCapture();
+}
+
+bool AudioOutput::OpenDevice(u32 sampleRate) {
+    CloseDevice();
+
+    SDL_AudioSpec want = {};
+    want.freq = static_cast<int>(sampleRate);
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = s_DeviceFrames;
+    want.callback = Callback;
+    want.userdata = this;
+
+    // With no changes allowed SDL converts to whatever the hardware wants
+    SDL_AudioSpec have;
+    m_Device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+    if (m_Device == 0) {
+        LOG_WARN("No audio device (%s), running without sound\n", SDL_GetError());
+        return false;
+    }
+
+    m_Ring = std::make_unique<Ring>();
+    m_SampleRate = sampleRate;
+    m_DeviceFrames = have.samples;
+    m_Playing = false;
+    m_Level = 0;
+    m_RateAdjust = 0;
+    return true;
+}
+
+void AudioOutput::CloseDevice() {
+    if (m_Device == 0) return;
+
+    SDL_CloseAudioDevice(m_Device);
+    m_Device = 0;
+    m_Playing = false;
+    m_Ring.reset();
+}
+
+bool AudioOutput::OpenCapture(const std::string &path, u32 sampleRate) {
+    CloseCapture();
+
+    m_Capture.open(path, std::ios::binary);
+    if (!m_Capture) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    m_CaptureWav = path.size() >= 4 && path.compare(path.size() - 4, 4, ".wav") == 0;
+    m_CaptureRate = sampleRate;
+    m_CaptureFrames = 0;
+
+    if (m_CaptureWav) {
+        WriteWavHeader(0);
+    }
+    return true;
+}
+
+void AudioOutput::CloseCapture() {
+    if (!m_Capture.is_open()) return;
+
+    if (m_CaptureWav) {
+        m_Capture.seekp(0);
+        WriteWavHeader(m_CaptureFrames);
+    }
+    m_Capture.close();
+}
+
+// 16-bit stereo PCM, written again with the sizes when the capture is closed
+void AudioOutput::WriteWavHeader(u64 frames) {
+    u32 dataSize = static_cast<u32>(std::min<u64>(frames * 4, 0xFFFFFFFF - 36));
+
+    struct {
+        char Riff[4] = { 'R', 'I', 'F', 'F' };
+        u32 RiffSize;
+        char Wave[4] = { 'W', 'A', 'V', 'E' };
+        char Fmt[4] = { 'f', 'm', 't', ' ' };
+        u32 FmtSize = 16;
+        u16 Format = 1;
+        u16 Channels = 2;
+        u32 SampleRate;
+        u32 ByteRate;
+        u16 BlockAlign = 4;
+        u16 BitsPerSample = 16;
+        char Data[4] = { 'd', 'a', 't', 'a' };
+        u32 DataSize;
+    } header;
+    static_assert(sizeof(header) == 44);
+
+    header.RiffSize = 36 + dataSize;
+    header.SampleRate = m_CaptureRate;
+    header.ByteRate = m_CaptureRate * 4;
+    header.DataSize = dataSize;
+
+    m_Capture.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void AudioOutput::OnFrame(APU &apu, bool play) {
+    // Whoever set the sample rate reads the samples itself
+    if (!m_Ring && !m_Capture.is_open()) return;
+
+    usize frames = apu.GetAvailable();
+    if (frames == 0) return;
+
+    m_Samples.resize(2 * frames);
+    frames = apu.ReadSamples(m_Samples.data(), frames);
+
+    if (m_Capture.is_open()) {
+        m_Capture.write(reinterpret_cast<const char*>(m_Samples.data()), 2 * frames * sizeof(i16));
+        m_CaptureFrames += frames;
+    }
+
+    if (!m_Ring) return;
+
+    // Off speed the device is paused and primed again afterwards
+    m_Active = play;
+    if (!play) {
+        if (m_Playing) {
+            SDL_PauseAudioDevice(m_Device, 1);
+            m_Playing = false;
+        }
+        apu.SetRateAdjust(1.0);
+        return;
+    }
+
+    // Measured before this frame goes in, which is where WaitForSpace leaves it
+    usize level = m_Ring->GetSize();
+    m_Level += (static_cast<double>(level) - m_Level) * 0.1;
+
+    // Fewer samples per frame while the ring is above half full, more below
+    double error = (m_Level - s_TargetSamples) / s_TargetSamples;
+    m_RateAdjust = -s_MaxRateAdjust * std::clamp(error, -1.0, 1.0);
+    apu.SetRateAdjust(1.0 + m_RateAdjust);
+
+    usize pushed = m_Ring->Push(m_Samples.data(), 2 * frames);
+    m_Dropped += frames - pushed / 2;
+
+    if (!m_Playing && m_Ring->GetSize() >= s_TargetSamples) {
+        m_Level = static_cast<double>(m_Ring->GetSize());
+        SDL_PauseAudioDevice(m_Device, 0);
+        m_Playing = true;
+    }
+
+    if (m_Playing) {
+        double latency = (m_Ring->GetSize() / 2 + m_DeviceFrames) * 1000.0 / m_SampleRate;
+        m_LatencySum += latency;
+        m_LatencyCount++;
+        m_MaxLatency = std::max(m_MaxLatency, latency);
+    }
+}
+
+void AudioOutput::WaitForSpace() {
+    if (!m_Playing) return;
+
+    u64 played = m_Played;
+    u32 idle = 0;
+    while (m_Ring->GetSize() > s_TargetSamples) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        // A device that stopped calling back must not hang the emulation
+        if (m_Played != played) {
+            played = m_Played;
+            idle = 0;
+        } else if (++idle >= 100) {
+            LOG_WARN("Audio device stopped playing, pacing without it\n");
+            SDL_PauseAudioDevice(m_Device, 1);
+            m_Playing = false;
+            return;
+        }
+    }
+}
+
+// Runs on SDL's audio thread, only touches the ring and the counters
+void AudioOutput::Callback(void *userdata, u8 *stream, int len) {
+    AudioOutput *self = static_cast<AudioOutput*>(userdata);
+    i16 *out = reinterpret_cast<i16*>(stream);
+    usize samples = static_cast<usize>(len) / sizeof(i16);
+
+    usize count = self->m_Ring->Pop(out, samples);
+    if (count < samples) {
+        memset(out + count, 0, (samples - count) * sizeof(i16));
+        if (self->m_Active) {
+            self->m_Underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    self->m_Played.fetch_add(count / 2, std::memory_order_relaxed);
+}
+
+AudioStats AudioOutput::GetStats() const {
+    AudioStats stats;
+    stats.Frames = m_Played;
+    stats.Underruns = m_Underruns;
+    stats.Dropped = m_Dropped;
+    stats.LatencyMs = m_LatencyCount ? m_LatencySum / m_LatencyCount : 0.0;
+    stats.MaxLatencyMs = m_MaxLatency;
+    stats.RateAdjust = m_RateAdjust * 100.0;
+    return stats;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SpscQueue.hpp"
+
+#include <atomic>
+
+class APU;
+
+struct AudioStats {
+    u64 Frames = 0;           // Stereo frames the device played
+    u64 Underruns = 0;        // Callbacks that ran out of samples
+    u64 Dropped = 0;          // Frames that didn't fit into the ring
+    double LatencyMs = 0;     // Mean time from the ring to the device
+    double MaxLatencyMs = 0;
+    double RateAdjust = 0;    // Current resampling correction, in percent
+};
+
+// Takes what the APU produced once per frame and sends it to the sound card and/or
+// a capture file.
+//
+// The emulation thread writes into a lock-free ring that the SDL callback drains.
+// To keep the ring half full the APU's output rate is nudged by up to +-0.5%
+// (dynamic rate control), too little to hear but enough to absorb the difference
+// between the emulated clock and the sound card's. At 1x the ring also paces the
+// emulation, see WaitForSpace.
+class AudioOutput {
+public:
+    ~AudioOutput();
+
+    // Needs SDL_INIT_AUDIO. Logs and returns false if there is no device.
+    bool OpenDevice(u32 sampleRate);
+    void CloseDevice();
+
+    // Primed and unpaused
+    bool IsPlaying() const { return m_Playing; }
+
+    // WAV if the name ends in .wav, otherwise raw interleaved 16-bit stereo. The
+    // capture gets every sample, at any speed.
+    bool OpenCapture(const std::string &path, u32 sampleRate);
+    void CloseCapture();
+
+    // Called by the emulation thread once per frame. Samples only go to the device
+    // while `play` is set, the rest of the time it is paused.
+    void OnFrame(APU &apu, bool play);
+
+    // Audio as the master clock: blocks until the device has played the ring down
+    // to its target level
+    void WaitForSpace();
+
+    AudioStats GetStats() const;
+
+private:
+    static void Callback(void *userdata, u8 *stream, int len);
+
+    void WriteWavHeader(u64 frames);
+
+private:
+    static constexpr usize s_RingSamples = 8192;        // Interleaved, 4096 frames
+    static constexpr usize s_TargetSamples = s_RingSamples / 2;
+    static constexpr u16 s_DeviceFrames = 512;
+    static constexpr double s_MaxRateAdjust = 0.005;
+
+    using Ring = SpscQueue<i16, s_RingSamples>;
+
+    std::unique_ptr<Ring> m_Ring;
+    SDL_AudioDeviceID m_Device = 0;
+    u32 m_SampleRate = 0;
+    u32 m_DeviceFrames = 0;
+    bool m_Playing = false;
+    std::atomic<bool> m_Active = false;
+
+    std::vector<i16> m_Samples;
+
+    std::ofstream m_Capture;
+    bool m_CaptureWav = false;
+    u32 m_CaptureRate = 0;
+    u64 m_CaptureFrames = 0;
+
+    // Ring level smoothed over a few frames, in samples
+    double m_Level = 0;
+    double m_RateAdjust = 0;
+
+    std::atomic<u64> m_Played = 0;
+    std::atomic<u64> m_Underruns = 0;
+    u64 m_Dropped = 0;
+    double m_LatencySum = 0;
+    u64 m_LatencyCount = 0;
+    double m_MaxLatency = 0;
+};
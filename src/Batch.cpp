@@ -0,0 +1,605 @@
+#include "Batch.hpp"
+#include "Gameboy.hpp"
+
+#include <cstring>
+
+namespace {
+
+constexpr usize s_Lanes = Batch::s_MaxLanes;
+
+// Eight lanes of words fill an SSE register, which every x86-64 has; sixteen would
+// take AVX2 registers the default build doesn't use
+using V8  = u8  __attribute__((vector_size(s_Lanes)));
+using V16 = u16 __attribute__((vector_size(2 * s_Lanes)));
+
+// F as the CPU would have it
+constexpr u8 s_FlagZ = 0x80;
+constexpr u8 s_FlagN = 0x40;
+constexpr u8 s_FlagH = 0x20;
+constexpr u8 s_FlagC = 0x10;
+
+V8 Load(const u8 *src) {
+    V8 val;
+    memcpy(&val, src, sizeof(val));
+    return val;
+}
+
+V16 Load(const u16 *src) {
+    V16 val;
+    memcpy(&val, src, sizeof(val));
+    return val;
+}
+
+// Only the lanes in `mask` take `val`
+void Store(u8 *dest, V8 val, V8 mask) {
+    val = (val & mask) | (Load(dest) & ~mask);
+    memcpy(dest, &val, sizeof(val));
+}
+
+void Store(u16 *dest, V16 val, V16 mask) {
+    val = (val & mask) | (Load(dest) & ~mask);
+    memcpy(dest, &val, sizeof(val));
+}
+
+V16 Widen(V8 val) { return __builtin_convertvector(val, V16); }
+V8 Narrow(V16 val) { return __builtin_convertvector(val, V8); }
+
+// All ones or all zeroes per lane
+V8 Splat(u8 val) {
+    V8 vec;
+    memset(&vec, val, sizeof(vec));
+    return vec;
+}
+
+V16 Splat16(u16 val) {
+    V16 vec;
+    for (usize i = 0; i < s_Lanes; i++) {
+        vec[i] = val;
+    }
+    return vec;
+}
+
+V16 WidenMask(V8 mask) { return Widen(mask) * 0x0101; }
+
+V8 FlagZ(V8 res) { return (V8)(res == 0) & s_FlagZ; }
+V8 FlagH(V8 operands) { return (operands & 0x10) << 1; }     // a ^ b ^ result
+V8 FlagC(V16 res) { return (Narrow(res >> 8) & 1) << 4; }   // The 9 bit result
+
+V8 LaneMask(u32 lanes) {
+    V8 mask = {};
+    for (usize i = 0; i < s_Lanes; i++) {
+        mask[i] = ((lanes >> i) & 1) ? 0xFF : 0;
+    }
+    return mask;
+}
+
+u32 LaneBits(V8 mask) {
+    u32 lanes = 0;
+    for (usize i = 0; i < s_Lanes; i++) {
+        lanes |= (mask[i] & 1) << i;
+    }
+    return lanes;
+}
+
+template <typename Fn>
+void ForEachLane(u32 lanes, Fn fn) {
+    while (lanes != 0) {
+        usize lane = __builtin_ctz(lanes);
+        lanes &= lanes - 1;
+        fn(lane);
+    }
+}
+
+}
+
+bool Batch::Add(Gameboy &lane) {
+    if (m_LaneCount == s_MaxLanes) return false;
+
+    m_Lanes[m_LaneCount++] = &lane;
+    return true;
+}
+
+void Batch::LoadLane(usize lane) {
+    const CPU &cpu = m_Lanes[lane]->m_CPU;
+
+    m_Regs.R8[0][lane] = cpu.m_Reg.B;
+    m_Regs.R8[1][lane] = cpu.m_Reg.C;
+    m_Regs.R8[2][lane] = cpu.m_Reg.D;
+    m_Regs.R8[3][lane] = cpu.m_Reg.E;
+    m_Regs.R8[4][lane] = cpu.m_Reg.H;
+    m_Regs.R8[5][lane] = cpu.m_Reg.L;
+    m_Regs.R8[7][lane] = cpu.m_Reg.A;
+    m_Regs.F[lane] = cpu.GetF();
+    m_Regs.SP[lane] = cpu.m_Reg.SP;
+    m_Regs.PC[lane] = cpu.m_Reg.PC;
+}
+
+void Batch::StoreLane(usize lane) {
+    CPU &cpu = m_Lanes[lane]->m_CPU;
+
+    cpu.m_Reg.B = m_Regs.R8[0][lane];
+    cpu.m_Reg.C = m_Regs.R8[1][lane];
+    cpu.m_Reg.D = m_Regs.R8[2][lane];
+    cpu.m_Reg.E = m_Regs.R8[3][lane];
+    cpu.m_Reg.H = m_Regs.R8[4][lane];
+    cpu.m_Reg.L = m_Regs.R8[5][lane];
+    cpu.m_Reg.A = m_Regs.R8[7][lane];
+    cpu.SetF(m_Regs.F[lane]);
+    cpu.m_Reg.SP = m_Regs.SP[lane];
+    cpu.m_Reg.PC = m_Regs.PC[lane];
+}
+
+void Batch::Update(usize lane, u16 pc) {
+    Gameboy &gameboy = *m_Lanes[lane];
+    const CPU &cpu = gameboy.m_CPU;
+    u32 bit = 1u << lane;
+
+    if (gameboy.m_PPU.GetCurrentFrame() != m_Frame[lane] || gameboy.m_Ticks >= gameboy.m_BlankFrameEnd) {
+        m_Running &= ~bit;
+        return;
+    }
+
+    // Only ROM code is the same for every lane in the same bank, and the memory
+    // probe has to see each instruction
+    bool alone = cpu.m_Halted || (cpu.m_IME && (cpu.m_IE & cpu.m_IF & 0x1F)) || pc > 0x7FFD ||
+        gameboy.m_Cheats.IsPatched(pc) || gameboy.m_Cheats.IsPatched(pc + 2) || MemoryProbe::Enabled;
+
+    m_Bank[lane] = (pc + 2 >= 0x4000) ? gameboy.m_Cartrige.GetRomBank() : 0;
+    m_Alone = alone ? (m_Alone | bit) : (m_Alone & ~bit);
+}
+
+// For as long as the lane couldn't join the others anyway
+void Batch::StepAlone(usize lane) {
+    Gameboy &gameboy = *m_Lanes[lane];
+    CPU &cpu = gameboy.m_CPU;
+    u32 bit = 1u << lane;
+
+    StoreLane(lane);
+    gameboy.Bind();
+
+    do {
+        gameboy.Advance(cpu.Step<false>());
+        Update(lane, cpu.m_Reg.PC);
+        m_Stats.Peeled++;
+    } while ((m_Running & m_Alone & bit) != 0);
+
+    LoadLane(lane);
+}
+
+void Batch::RunFrame() {
+    m_Running = 0;
+    m_Alone = 0;
+
+    for (usize i = 0; i < m_LaneCount; i++) {
+        Gameboy &gameboy = *m_Lanes[i];
+        if (gameboy.m_AccurateTiming) {
+            gameboy.RunFrame();
+            continue;
+        }
+
+        gameboy.Bind();
+        m_Frame[i] = gameboy.m_PPU.GetCurrentFrame();
+        gameboy.m_BlankFrameEnd = gameboy.m_Ticks + 2 * Gameboy::s_CyclesPerFrame;
+
+        LoadLane(i);
+        m_Running |= 1u << i;
+        Update(i, m_Regs.PC[i]);
+    }
+
+    u32 lanes = m_Running;
+
+    while (m_Running != 0) {
+        ForEachLane(m_Running & m_Alone, [this](usize lane) { StepAlone(lane); });
+
+        u32 ready = m_Running & ~m_Alone;
+        if (ready == 0) continue;
+
+        // The lane furthest behind leads, so lanes that went separate ways meet again
+        // where their code does
+        usize leader = __builtin_ctz(ready);
+        ForEachLane(ready, [this, &leader](usize lane) {
+            if (m_Lanes[lane]->m_Ticks < m_Lanes[leader]->m_Ticks) leader = lane;
+        });
+
+        u16 pc = m_Regs.PC[leader];
+        u32 mask = 0;
+        ForEachLane(ready, [this, pc, leader, &mask](usize lane) {
+            if (m_Regs.PC[lane] == pc && m_Bank[lane] == m_Bank[leader]) mask |= 1u << lane;
+        });
+
+        m_Lanes[leader]->Bind();
+        const Memory &memory = m_Lanes[leader]->m_Memory;
+        u8 code[3] = { memory.Read(pc), memory.Read(pc + 1), memory.Read(pc + 2) };
+
+        if (!Execute(mask, code)) {
+            ForEachLane(mask, [this](usize lane) { StepAlone(lane); });
+            continue;
+        }
+
+        m_Stats.Steps++;
+        m_Stats.LaneInstructions += __builtin_popcount(mask);
+
+        ForEachLane(mask, [this, pc](usize lane) {
+            Gameboy &gameboy = *m_Lanes[lane];
+            gameboy.Bind();
+            gameboy.m_CPU.m_Instructions++;
+
+            if ((m_Branched >> lane) & 1) {
+                StoreLane(lane);
+                gameboy.m_CPU.CheckIdleLoop(pc);
+            }
+
+            gameboy.Advance(m_Cycles[lane]);
+            Update(lane, m_Regs.PC[lane]);
+        });
+    }
+
+    ForEachLane(lanes, [this](usize lane) {
+        Gameboy &gameboy = *m_Lanes[lane];
+        StoreLane(lane);
+        gameboy.Bind();
+
+        if (gameboy.m_PPU.GetCurrentFrame() != m_Frame[lane]) {
+            gameboy.OnFrame();
+        } else {
+            gameboy.OnBlankFrame();
+        }
+    });
+}
+
+// Every lane in `mask` is at the same PC in the same code. Lanes outside it keep
+// their registers: each result is blended in under the mask.
+bool Batch::Execute(u32 mask, const u8 *code) {
+    u8 opcode = code[0];
+    u8 imm8 = code[1];
+    u16 imm16 = code[1] | (code[2] << 8);
+    u16 pc = m_Regs.PC[__builtin_ctz(mask)];
+
+    V8 mask8 = LaneMask(mask);
+    V16 mask16 = WidenMask(mask8);
+    V8 f = Load(m_Regs.F);
+
+    auto get8 = [this](u8 idx) { return Load(m_Regs.R8[idx]); };
+    auto set8 = [this, mask8](u8 idx, V8 val) { Store(m_Regs.R8[idx], val, mask8); };
+    auto setF = [this, mask8](V8 val) { Store(m_Regs.F, val, mask8); };
+
+    // BC DE HL SP
+    auto get16 = [this, get8](u8 idx) {
+        if (idx == 3) return Load(m_Regs.SP);
+        return (Widen(get8(2 * idx)) << 8) | Widen(get8(2 * idx + 1));
+    };
+    auto set16 = [this, set8, mask16](u8 idx, V16 val) {
+        if (idx == 3) {
+            Store(m_Regs.SP, val, mask16);
+        } else {
+            set8(2 * idx, Narrow(val >> 8));
+            set8(2 * idx + 1, Narrow(val));
+        }
+    };
+
+    // Memory is per lane, each access goes through that lane's instance
+    auto read = [this](V16 addr, u32 lanes) {
+        V8 val = {};
+        ForEachLane(lanes, [&](usize lane) {
+            m_Lanes[lane]->Bind();
+            val[lane] = m_Lanes[lane]->m_Memory.Read(addr[lane]);
+        });
+        return val;
+    };
+    auto read16 = [this](V16 addr, u32 lanes) {
+        V16 val = {};
+        ForEachLane(lanes, [&](usize lane) {
+            m_Lanes[lane]->Bind();
+            val[lane] = m_Lanes[lane]->m_Memory.Read16(addr[lane]);
+        });
+        return val;
+    };
+    auto write = [this](V16 addr, V8 val, u32 lanes) {
+        ForEachLane(lanes, [&](usize lane) {
+            m_Lanes[lane]->Bind();
+            m_Lanes[lane]->m_Memory.Write(addr[lane], val[lane]);
+        });
+    };
+    auto write16 = [this](V16 addr, V16 val, u32 lanes) {
+        ForEachLane(lanes, [&](usize lane) {
+            m_Lanes[lane]->Bind();
+            m_Lanes[lane]->m_Memory.Write16(addr[lane], val[lane]);
+        });
+    };
+
+    // B C D E H L (HL) A
+    auto getR8 = [&](u8 idx) { return idx == 6 ? read(get16(2), mask) : get8(idx); };
+    auto setR8 = [&](u8 idx, V8 val) {
+        if (idx == 6) {
+            write(get16(2), val, mask);
+        } else {
+            set8(idx, val);
+        }
+    };
+
+    // (BC) (DE) (HL+) (HL-)
+    auto r16Mem = [&](u8 idx) {
+        if (idx < 2) return get16(idx);
+
+        V16 hl = get16(2);
+        set16(2, idx == 2 ? hl + 1 : hl - 1);
+        return hl;
+    };
+
+    // NZ Z NC C, lanes where it holds are all ones
+    auto condition = [f](u8 cond) {
+        V8 set = (V8)((f & Splat(cond < 2 ? s_FlagZ : s_FlagC)) != 0);
+        return (cond & 1) ? set : V8(~set);
+    };
+
+    auto alu = [&](u8 func, V8 val) {
+        V8 a = get8(7);
+        V16 res16 = Widen(a);
+        V16 carry = Widen((f >> 4) & 1);
+        switch (func) {
+            case 0: res16 += Widen(val); break;
+            case 1: res16 += Widen(val) + carry; break;
+            case 2: case 7: res16 -= Widen(val); break;
+            case 3: res16 -= Widen(val) + carry; break;
+            case 4: set8(7, a & val); setF(FlagZ(a & val) | s_FlagH); return;
+            case 5: set8(7, a ^ val); setF(FlagZ(a ^ val)); return;
+            case 6: set8(7, a | val); setF(FlagZ(a | val)); return;
+        }
+
+        // A borrow leaves bit 8 set, as a carry does
+        V8 res = Narrow(res16);
+        setF(FlagZ(res) | Splat(func >= 2 ? s_FlagN : 0) | FlagH(a ^ val ^ res) | FlagC(res16));
+        if (func != 7) set8(7, res);
+    };
+
+    // RLC RRC RL RR SLA SRA SWAP SRL, with the carry out in bit 0 of `carry`
+    auto shift = [f](u8 func, V8 val, V8 &carry) {
+        V8 in = (f >> 4) & 1;
+        switch (func) {
+            case 0: carry = val >> 7; return (val << 1) | carry;
+            case 1: carry = val & 1; return (val >> 1) | (carry << 7);
+            case 2: carry = val >> 7; return (val << 1) | in;
+            case 3: carry = val & 1; return (val >> 1) | (in << 7);
+            case 4: carry = val >> 7; return val << 1;
+            case 5: carry = val & 1; return (val >> 1) | (val & 0x80);
+            case 6: carry = V8{}; return (val >> 4) | (val << 4);
+            default: carry = val & 1; return val >> 1;
+        }
+    };
+
+    u8 length = 1;
+    bool cb = false;
+
+    // Control transfers set these instead of the PC moving past the instruction
+    bool transfer = false;
+    V8 taken = {};
+    V16 target = {};
+    m_Branched = 0;
+
+    switch (opcode) {
+        case 0x00: break;
+
+        case 0x01: case 0x11: case 0x21: case 0x31: { // LD rr,d16
+            set16(opcode >> 4, Splat16(imm16));
+            length = 3;
+            break;
+        }
+        case 0x02: case 0x12: case 0x22: case 0x32: { // LD (rr),A
+            write(r16Mem(opcode >> 4), get8(7), mask);
+            break;
+        }
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A: { // LD A,(rr)
+            set8(7, read(r16Mem(opcode >> 4), mask));
+            break;
+        }
+        case 0x03: case 0x13: case 0x23: case 0x33: { // INC rr
+            set16(opcode >> 4, get16(opcode >> 4) + 1);
+            break;
+        }
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B: { // DEC rr
+            set16(opcode >> 4, get16(opcode >> 4) - 1);
+            break;
+        }
+        case 0x09: case 0x19: case 0x29: case 0x39: { // ADD HL,rr
+            V16 hl = get16(2);
+            V16 val = get16(opcode >> 4);
+            V16 res = hl + val;
+            V8 carry = Narrow((V16)(res < hl)) & s_FlagC;
+            setF((f & s_FlagZ) | FlagH(Narrow((hl ^ val ^ res) >> 8)) | carry);
+            set16(2, res);
+            break;
+        }
+        case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C:
+        case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D: { // INC r, DEC r
+            u8 idx = (opcode >> 3) & 7;
+            bool dec = opcode & 1;
+            V8 val = getR8(idx);
+            V8 res = dec ? val - 1 : val + 1;
+            setF((f & s_FlagC) | FlagZ(res) | Splat(dec ? s_FlagN : 0) | FlagH(val ^ 1 ^ res));
+            setR8(idx, res);
+            break;
+        }
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: { // LD r,d8
+            setR8((opcode >> 3) & 7, Splat(imm8));
+            length = 2;
+            break;
+        }
+        case 0x07: case 0x0F: case 0x17: case 0x1F: { // RLCA RRCA RLA RRA, Z always clear
+            V8 carry;
+            set8(7, shift(opcode >> 3, get8(7), carry));
+            setF(carry << 4);
+            break;
+        }
+        case 0x2F: { // CPL
+            set8(7, ~get8(7));
+            setF(f | s_FlagN | s_FlagH);
+            break;
+        }
+        case 0x37: { // SCF
+            setF((f & s_FlagZ) | s_FlagC);
+            break;
+        }
+        case 0x3F: { // CCF
+            setF((f & s_FlagZ) | ((f & s_FlagC) ^ s_FlagC));
+            break;
+        }
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: { // JR
+            transfer = true;
+            length = 2;
+            taken = (opcode == 0x18) ? V8(~V8{}) : condition((opcode >> 3) & 3);
+            target = Splat16(pc + 2 + static_cast<i8>(imm8));
+            if (target[0] <= pc) m_Branched = LaneBits(taken) & mask;
+            break;
+        }
+        case 0x40 ... 0x75: case 0x77 ... 0x7F: { // LD r,r'
+            setR8((opcode >> 3) & 7, getR8(opcode & 7));
+            break;
+        }
+        case 0x80 ... 0xBF: { // ALU A,r
+            alu((opcode >> 3) & 7, getR8(opcode & 7));
+            break;
+        }
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: { // ALU A,d8
+            alu((opcode >> 3) & 7, Splat(imm8));
+            length = 2;
+            break;
+        }
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xC3: { // JP
+            transfer = true;
+            length = 3;
+            taken = (opcode == 0xC3) ? V8(~V8{}) : condition((opcode >> 3) & 3);
+            target = Splat16(imm16);
+            if (imm16 <= pc) m_Branched = LaneBits(taken) & mask;
+            break;
+        }
+        case 0xE9: { // JP HL
+            transfer = true;
+            taken = ~V8{};
+            target = get16(2);
+            break;
+        }
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xCD: { // CALL
+            transfer = true;
+            length = 3;
+            taken = (opcode == 0xCD) ? V8(~V8{}) : condition((opcode >> 3) & 3);
+            target = Splat16(imm16);
+
+            u32 calls = LaneBits(taken) & mask;
+            V16 sp = get16(3) - 2;
+            write16(sp, Splat16(pc + 3), calls);
+            Store(m_Regs.SP, sp, WidenMask(LaneMask(calls)));
+            break;
+        }
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xC9: { // RET
+            transfer = true;
+            taken = (opcode == 0xC9) ? V8(~V8{}) : condition((opcode >> 3) & 3);
+
+            u32 returns = LaneBits(taken) & mask;
+            V16 sp = get16(3);
+            target = read16(sp, returns);
+            Store(m_Regs.SP, sp + 2, WidenMask(LaneMask(returns)));
+            break;
+        }
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: { // RST
+            transfer = true;
+            taken = ~V8{};
+            target = Splat16(opcode & 0x38);
+
+            V16 sp = get16(3) - 2;
+            write16(sp, Splat16(pc + 1), mask);
+            set16(3, sp);
+            break;
+        }
+        case 0xC1: case 0xD1: case 0xE1: case 0xF1: { // POP
+            u8 idx = (opcode >> 4) & 3;
+            V16 sp = get16(3);
+            V16 val = read16(sp, mask);
+            if (idx == 3) {
+                set8(7, Narrow(val >> 8));
+                setF(Narrow(val) & 0xF0);
+            } else {
+                set16(idx, val);
+            }
+            set16(3, sp + 2);
+            break;
+        }
+        case 0xC5: case 0xD5: case 0xE5: case 0xF5: { // PUSH
+            u8 idx = (opcode >> 4) & 3;
+            V16 val = (idx == 3) ? ((Widen(get8(7)) << 8) | Widen(f)) : get16(idx);
+            V16 sp = get16(3) - 2;
+            set16(3, sp);
+            write16(sp, val, mask);
+            break;
+        }
+        case 0xCB: {
+            u8 op = imm8;
+            u8 idx = op & 7;
+            u8 bit = (op >> 3) & 7;
+            V8 val = getR8(idx);
+            switch (op >> 6) {
+                case 0: {
+                    V8 carry;
+                    V8 res = shift(bit, val, carry);
+                    setR8(idx, res);
+                    setF(FlagZ(res) | (carry << 4));
+                    break;
+                }
+                case 1: setF((f & s_FlagC) | FlagZ(val & static_cast<u8>(1 << bit)) | s_FlagH); break;
+                case 2: setR8(idx, val & static_cast<u8>(~(1 << bit))); break;
+                case 3: setR8(idx, val | static_cast<u8>(1 << bit)); break;
+            }
+            length = 2;
+            cb = true;
+            break;
+        }
+        case 0xE0: { // LDH (a8),A
+            write(Splat16(0xFF00 | imm8), get8(7), mask);
+            length = 2;
+            break;
+        }
+        case 0xF0: { // LDH A,(a8)
+            set8(7, read(Splat16(0xFF00 | imm8), mask));
+            length = 2;
+            break;
+        }
+        case 0xE2: { // LD (C),A
+            write(Widen(get8(1)) | 0xFF00, get8(7), mask);
+            break;
+        }
+        case 0xF2: { // LD A,(C)
+            set8(7, read(Widen(get8(1)) | 0xFF00, mask));
+            break;
+        }
+        case 0xEA: { // LD (a16),A
+            write(Splat16(imm16), get8(7), mask);
+            length = 3;
+            break;
+        }
+        case 0xFA: { // LD A,(a16)
+            set8(7, read(Splat16(imm16), mask));
+            length = 3;
+            break;
+        }
+        case 0xF9: { // LD SP,HL
+            set16(3, get16(2));
+            break;
+        }
+
+        // HALT, STOP, DAA, EI/DI/RETI, the SP arithmetic and LD (a16),SP, and the
+        // opcodes that don't exist
+        default: return false;
+    }
+
+    V16 next = Splat16(pc + length);
+    V8 cycles = Splat(CPU::GetCycles(cb ? 0xCB : opcode, cb, false));
+
+    if (transfer) {
+        V16 jumps = WidenMask(taken);
+        next = (target & jumps) | (next & ~jumps);
+        cycles = (taken & CPU::GetCycles(opcode, false, true)) | (cycles & ~taken);
+    }
+
+    Store(m_Regs.PC, next, mask16);
+    memcpy(m_Cycles, &cycles, sizeof(cycles));
+    return true;
+}
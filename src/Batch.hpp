@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Common.hpp"
+
+class Gameboy;
+
+struct BatchStats {
+    u64 Steps = 0;              // Instructions run in lockstep, by one or more lanes
+    u64 LaneInstructions = 0;   // Lane instructions those took care of
+    u64 Peeled = 0;             // Lane steps left to the scalar core
+};
+
+// Experimental: runs up to s_MaxLanes instances of the same ROM (clones, usually)
+// in lockstep, one frame at a time.
+//
+// The lanes' registers and flags live here as structure of arrays while a frame
+// runs. The lanes whose PC and ROM bank match the one furthest behind run that
+// instruction together, as vector operations over all of them; their memory
+// accesses go lane by lane through each instance's own Memory, which its PPU,
+// timer and MBC have to see. A lane that is halted, has an interrupt to take, runs
+// code outside the ROM or a cheat patches, or reaches an instruction the lockstep
+// core leaves out (HALT, STOP, DAA, EI/DI/RETI, SP arithmetic), is peeled off to
+// the scalar core for that step. Each lane gets the same frames it would running on
+// its own. Lanes on the accurate core just run their own frame.
+class Batch {
+public:
+    static constexpr usize s_MaxLanes = 8;
+
+    // False if the batch is full. The instance has to outlive the batch.
+    bool Add(Gameboy &lane);
+    usize GetLaneCount() const { return m_LaneCount; }
+
+    // Every lane to its next VBlank, or two frames' worth of cycles while its LCD is
+    // off, as Gameboy::RunFrame does
+    void RunFrame();
+
+    const BatchStats &GetStats() const { return m_Stats; }
+
+private:
+    // The lanes' CPU registers in and out of their CPU objects
+    void LoadLane(usize lane);
+    void StoreLane(usize lane);
+
+    // After a lane's step, with its PC: whether it is done with the frame, or must
+    // run the next instruction on its own
+    void Update(usize lane, u16 pc);
+
+    // On the scalar core while the lane can't run in lockstep, at least one step
+    void StepAlone(usize lane);
+
+    // Runs the instruction at `code` for the lanes in `mask`, all at the same PC,
+    // and the cycles each took in m_Cycles. False if the lanes must run it alone.
+    bool Execute(u32 mask, const u8 *code);
+
+private:
+    // By lane, B C D E H L - A in the order the opcodes number them
+    struct Registers {
+        alignas(64) u8 R8[8][s_MaxLanes];
+        alignas(64) u8 F[s_MaxLanes];
+        alignas(64) u16 SP[s_MaxLanes];
+        alignas(64) u16 PC[s_MaxLanes];
+    };
+
+    Registers m_Regs;
+
+    Gameboy *m_Lanes[s_MaxLanes] = {};
+    usize m_LaneCount = 0;
+
+    u32 m_Running = 0;      // Lanes still in the frame
+    u32 m_Alone = 0;        // Lanes whose next step is scalar
+    u32 m_Branched = 0;     // Lanes that took a backward branch, for idle loop checks
+
+    usize m_Frame[s_MaxLanes] = {};
+    u16 m_Bank[s_MaxLanes] = {};     // ROM bank the lane's PC is in, 0 below 4000
+    alignas(64) u8 m_Cycles[s_MaxLanes] = {};
+
+    BatchStats m_Stats;
+};
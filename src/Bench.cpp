@@ -0,0 +1,1044 @@
+#include "Bench.hpp"
+#include "Batch.hpp"
+#include "Gameboy.hpp"
+#include "Hash.hpp"
+#include "LinkCable.hpp"
+#include "Log.hpp"
+#include "StateStore.hpp"
+#include "WarmStart.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <random>
+
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static double MicrosSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static void Report(const char *name, std::vector<double> &samples) {
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0;
+    for (double sample : samples) total += sample;
+
+    printf("  %-6s mean %8.2f us   p50 %8.2f us   p99 %8.2f us   max %8.2f us\n", name,
+        total / samples.size(), samples[samples.size() / 2], samples[samples.size() * 99 / 100], samples.back());
+}
+
+// Boots the ROM for a few seconds of game time so the state isn't all zeroes
+static void Warmup(Gameboy &gameboy, usize frames) {
+    for (usize i = 0; i < frames; i++) {
+        gameboy.RunFrame();
+    }
+}
+
+static int BenchState(Gameboy &gameboy, usize iterations) {
+    Warmup(gameboy, 300);
+
+    std::vector<u8> buffer;
+    std::vector<double> saves, loads;
+    saves.reserve(iterations);
+    loads.reserve(iterations);
+
+    for (usize i = 0; i < iterations; i++) {
+        auto start = Clock::now();
+        gameboy.SaveState(buffer);
+        saves.push_back(MicrosSince(start));
+
+        start = Clock::now();
+        if (!gameboy.LoadState(buffer.data(), buffer.size())) {
+            return 1;
+        }
+        loads.push_back(MicrosSince(start));
+
+        gameboy.RunFrame();
+    }
+
+    printf("Save state: %lu bytes, %lu iterations\n", buffer.size(), iterations);
+    Report("save", saves);
+    Report("load", loads);
+    return 0;
+}
+
+// Captures every frame, then rewinds all the way back checking each restored state
+static int BenchRewind(Gameboy &gameboy, usize frames) {
+    Warmup(gameboy, 300);
+
+    Rewind &rewind = gameboy.GetRewind();
+    rewind.Configure(32, 1, 0);
+
+    std::vector<u8> buffer;
+    std::vector<u64> hashes;
+    hashes.reserve(frames);
+
+    for (usize i = 0; i < frames; i++) {
+        // Captures at the frame boundary, which isn't reached while the LCD is off
+        usize frame = gameboy.GetPPU().GetCurrentFrame();
+        gameboy.RunFrame();
+        if (gameboy.GetPPU().GetCurrentFrame() == frame) continue;
+
+        gameboy.SaveState(buffer);
+        hashes.push_back(Hash64(buffer.data(), buffer.size()));
+    }
+
+    RewindStats stats = rewind.GetStats();
+    printf("Rewind: %lu frames run, %lu kept in %.2f MB, %lu bytes per snapshot (%.1fx smaller than %lu)\n",
+        frames, stats.Snapshots, stats.BytesUsed / (1024.0 * 1024.0), stats.BytesUsed / std::max<usize>(stats.Snapshots, 1),
+        stats.BytesUsed ? double(stats.RawBytes) / stats.BytesUsed : 0.0, buffer.size());
+    printf("  capture mean %8.2f us   max %8.2f us\n", stats.AvgCaptureUs, stats.MaxCaptureUs);
+
+    std::vector<double> steps;
+    usize mismatches = 0;
+    for (usize i = hashes.size() - 1; i > 0 && rewind.GetStats().Snapshots > 0; i--) {
+        auto start = Clock::now();
+        rewind.StepBack();
+        steps.push_back(MicrosSince(start));
+
+        gameboy.SaveState(buffer);
+        if (Hash64(buffer.data(), buffer.size()) != hashes[i - 1]) mismatches++;
+    }
+
+    Report("step", steps);
+    printf("  %lu of %lu restored states differ from the original\n", mismatches, steps.size());
+    return mismatches == 0 ? 0 : 1;
+}
+
+static usize GetResidentBytes() {
+    std::ifstream fs("/proc/self/statm");
+    usize pages = 0, resident = 0;
+    fs >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static u64 HashState(Gameboy &gameboy, std::vector<u8> &buffer) {
+    gameboy.SaveState(buffer);
+    return Hash64(buffer.data(), buffer.size());
+}
+
+// Branches one state into many futures, each running a few frames on its own input
+static int BenchClone(Gameboy &gameboy, usize branches) {
+    static constexpr usize s_FramesPerBranch = 10;
+
+    Warmup(gameboy, 300);
+
+    std::vector<u8> buffer;
+    u64 rootHash = HashState(gameboy, buffer);
+
+    // Identical inputs must give identical futures, whichever copy runs them
+    std::unique_ptr<Gameboy> first = gameboy.Clone(), second = gameboy.Clone();
+    for (usize i = 0; i < 60; i++) {
+        first->GetUI().SetInput(i & 0xF0);
+        first->RunFrame();
+        second->GetUI().SetInput(i & 0xF0);
+        second->RunFrame();
+    }
+    bool deterministic = HashState(*first, buffer) == HashState(*second, buffer);
+    first.reset();
+    second.reset();
+
+    usize residentBefore = GetResidentBytes();
+
+    std::vector<std::unique_ptr<Gameboy>> clones;
+    clones.reserve(branches);
+    std::vector<double> cloneTimes;
+    cloneTimes.reserve(branches);
+
+    for (usize i = 0; i < branches; i++) {
+        auto start = Clock::now();
+        clones.push_back(gameboy.Clone());
+        cloneTimes.push_back(MicrosSince(start));
+    }
+
+    std::mt19937 rng(1234);
+    auto start = Clock::now();
+    for (std::unique_ptr<Gameboy> &clone : clones) {
+        clone->GetUI().SetInput(rng() & 0xFF);
+        for (usize frame = 0; frame < s_FramesPerBranch; frame++) {
+            clone->RunFrame();
+        }
+    }
+    double runSecs = MicrosSince(start) / 1e6;
+
+    usize residentAfter = GetResidentBytes();
+    usize privateBytes = 0;
+    for (const std::unique_ptr<Gameboy> &clone : clones) {
+        privateBytes += clone->GetPrivateBytes();
+    }
+
+    gameboy.Bind();
+    bool rootIntact = HashState(gameboy, buffer) == rootHash;
+
+    double cloneTotal = 0;
+    for (double t : cloneTimes) cloneTotal += t;
+
+    printf("Clone: %lu branches of %lu frames, %.0f clones/s, %.0f branch frames/s\n",
+        branches, s_FramesPerBranch, branches / (cloneTotal / 1e6), branches * s_FramesPerBranch / runSecs);
+    Report("clone", cloneTimes);
+    // Every clone that runs a frame redraws, and so owns, its framebuffer
+    usize framebufferBytes = gameboy.GetPPU().GetFramebuffer().size() * sizeof(u32) + sizeof(Gameboy);
+    printf("  memory per clone: %.1f KB private (%.1f KB of it RAM pages), %.1f KB resident (full state is %.1f KB)\n",
+        privateBytes / 1024.0 / branches, (privateBytes / branches - std::min(privateBytes / branches, framebufferBytes)) / 1024.0,
+        (residentAfter - residentBefore) / 1024.0 / branches, buffer.size() / 1024.0);
+    printf("  identical inputs give identical clones: %s, original untouched: %s\n",
+        deterministic ? "yes" : "NO", rootIntact ? "yes" : "NO");
+
+    return (deterministic && rootIntact) ? 0 : 1;
+}
+
+// Presents `frames` frames from `state` with `buttons` pressed from the first frame boundary on,
+// hashing what would be on screen after each
+static std::vector<u64> PresentedHashes(Gameboy &gameboy, const std::vector<u8> &state, u8 buttons, usize frames) {
+    gameboy.LoadState(state.data(), state.size());
+    gameboy.GetUI().SetInput(buttons);
+    gameboy.GetUI().LatchInput();
+
+    // Only VBlanks present a picture, RunFrame calls that time out with the LCD off don't count
+    std::vector<u64> hashes;
+    for (usize i = 0; hashes.size() < frames && i < 4 * frames; i++) {
+        usize frame = gameboy.GetPPU().GetCurrentFrame();
+        gameboy.RunFrame();
+        if (gameboy.GetPPU().GetCurrentFrame() == frame) continue;
+
+        const std::vector<u32> &framebuffer = gameboy.GetPresentedFramebuffer();
+        hashes.push_back(Hash64(framebuffer.data(), framebuffer.size() * sizeof(u32)));
+    }
+
+    return hashes;
+}
+
+// Input-to-photon latency: frames between pressing a button and the presented picture
+// first differing from the run where it wasn't pressed, with 0..maxRunAhead run-ahead
+static int BenchLatency(Gameboy &gameboy, usize maxRunAhead) {
+    static constexpr usize s_Frames = 30;
+    static const char *s_Buttons[] = { "A", "B", "Select", "Start", "Right", "Left", "Up", "Down" };
+
+    Warmup(gameboy, 600);
+
+    std::vector<u8> state;
+    gameboy.SaveState(state);
+
+    printf("Latency in frames from press to first changed frame on screen:\n");
+    for (usize runAhead = 0; runAhead <= maxRunAhead; runAhead++) {
+        gameboy.SetRunAhead(runAhead);
+
+        auto start = Clock::now();
+        std::vector<u64> idle = PresentedHashes(gameboy, state, 0, s_Frames);
+        double fps = s_Frames / (MicrosSince(start) / 1e6);
+
+        std::string line;
+        for (u8 button = 0; button < 8; button++) {
+            std::vector<u64> pressed = PresentedHashes(gameboy, state, 1 << button, s_Frames);
+
+            usize latency = 0;
+            usize count = std::min(pressed.size(), idle.size());
+            while (latency < count && pressed[latency] == idle[latency]) latency++;
+
+            char entry[32];
+            if (latency < count) {
+                snprintf(entry, sizeof(entry), " %s %lu", s_Buttons[button], latency + 1);
+            } else {
+                snprintf(entry, sizeof(entry), " %s -", s_Buttons[button]);
+            }
+            line += entry;
+        }
+
+        printf("  run-ahead %lu:%s  (%.0f fps)\n", runAhead, line.c_str(), fps);
+    }
+
+    gameboy.SetRunAhead(0);
+    return 0;
+}
+
+// Episode reset: emulating the intro from power on every time, against restoring the
+// cached warm start in place
+static int BenchReset(Gameboy &gameboy, usize iterations) {
+    static constexpr usize s_IntroFrames = 600;
+    static constexpr usize s_ColdRuns = 5;
+    static constexpr usize s_EpisodeFrames = 10;
+
+    WarmStart warmStart;
+    warmStart.Parse(std::to_string(s_IntroFrames));
+
+    std::vector<u8> buffer;
+    std::vector<double> cold;
+    u64 coldHash = 0;
+    for (usize i = 0; i < s_ColdRuns; i++) {
+        auto start = Clock::now();
+        gameboy.Reset();
+        for (usize frame = 0; frame < s_IntroFrames; frame++) {
+            gameboy.GetUI().SetInput(0);
+            gameboy.RunFrame();
+        }
+        cold.push_back(MicrosSince(start));
+        coldHash = HashState(gameboy, buffer);
+    }
+
+    bool hit = false;
+    auto start = Clock::now();
+    warmStart.Apply(gameboy, &hit);
+    double first = MicrosSince(start);
+    bool identical = HashState(gameboy, buffer) == coldHash;
+
+    std::vector<double> warm;
+    warm.reserve(iterations);
+    for (usize i = 0; i < iterations; i++) {
+        for (usize frame = 0; frame < s_EpisodeFrames; frame++) {
+            gameboy.GetUI().SetInput(i & 0xFF);
+            gameboy.RunFrame();
+        }
+
+        start = Clock::now();
+        warmStart.Apply(gameboy);
+        warm.push_back(MicrosSince(start));
+    }
+
+    printf("Reset to %lu frames after power on, first warm start %.0f us (%s)\n",
+        s_IntroFrames, first, hit ? "from the disk cache" : "emulated and cached");
+    Report("cold", cold);
+    Report("warm", warm);
+    printf("  warm start matches emulating the intro: %s\n", identical ? "yes" : "NO");
+    return identical ? 0 : 1;
+}
+
+// Appends `count` states from several writer threads into a scratch store, then loads
+// random ones back from several reader threads
+static int BenchStore(Gameboy &gameboy, usize count) {
+    static constexpr usize s_PoolSize = 256;
+
+    Warmup(gameboy, 300);
+
+    // Real, distinct states: one per frame with changing input
+    std::vector<std::vector<u8>> pool(s_PoolSize);
+    std::vector<u64> poolHashes(s_PoolSize);
+    for (usize i = 0; i < s_PoolSize; i++) {
+        gameboy.GetUI().SetInput(i & 0xF0);
+        gameboy.RunFrame();
+        poolHashes[i] = HashState(gameboy, pool[i]);
+    }
+
+    std::string dir = (std::filesystem::temp_directory_path() / ("gbemu-store-" + std::to_string(getpid()))).string();
+    std::filesystem::remove_all(dir);
+
+    usize threads = std::max(2u, std::thread::hardware_concurrency());
+    u64 romHash = gameboy.GetCartrige().GetRomHash();
+
+    StateStore store(dir);
+    std::atomic<usize> rawBytes = 0, storedBytes = 0;
+    std::atomic<bool> failed = false;
+
+    auto start = Clock::now();
+    std::vector<std::thread> writers;
+    for (usize t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+            std::unique_ptr<StateStore::Writer> writer = store.OpenWriter();
+            if (!writer) {
+                failed = true;
+                return;
+            }
+
+            for (usize i = t; i < count; i += threads) {
+                // The frame field remembers which pool state this is
+                if (!writer->Append(i % s_PoolSize, romHash, pool[i % s_PoolSize])) failed = true;
+            }
+
+            if (!writer->Flush()) failed = true;
+            rawBytes += writer->GetRawBytes();
+            storedBytes += writer->GetStoredBytes();
+        });
+    }
+    for (std::thread &writer : writers) writer.join();
+    double writeSecs = MicrosSince(start) / 1e6;
+
+    std::unique_ptr<StateStore::Reader> reader = store.OpenReader();
+    if (failed || !reader || reader->GetCount() != count) {
+        LOG_ERROR("State store write failed\n");
+        std::filesystem::remove_all(dir);
+        return 1;
+    }
+
+    std::atomic<usize> mismatches = 0;
+    start = Clock::now();
+    std::vector<std::thread> readers;
+    for (usize t = 0; t < threads; t++) {
+        readers.emplace_back([&, t] {
+            std::mt19937_64 rng(t);
+            std::vector<u8> state;
+            for (usize i = t; i < count; i += threads) {
+                usize index = rng() % count;
+                if (!reader->Load(index, state) || Hash64(state.data(), state.size()) != poolHashes[reader->GetEntry(index).Frame]) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : readers) thread.join();
+    double readSecs = MicrosSince(start) / 1e6;
+
+    printf("State store: %lu states of %lu bytes from %lu threads, %.1fx compressed (%.1f KB each)\n",
+        count, pool[0].size(), threads, double(rawBytes) / storedBytes, storedBytes / 1024.0 / count);
+    printf("  write %6.2f GB/s of states (%.0f states/s)\n", rawBytes / writeSecs / 1e9, count / writeSecs);
+    printf("  read  %6.0f random states/s (%.2f GB/s), %lu mismatches\n", count / readSecs, rawBytes / readSecs / 1e9, mismatches.load());
+
+    reader.reset();
+    std::filesystem::remove_all(dir);
+    return mismatches == 0 ? 0 : 1;
+}
+
+// Many instances at once, each streaming its trajectory to disk, against the same
+// instances without writers
+static int BenchTrajectory(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Instances = 64;
+
+    Warmup(gameboy, 300);
+
+    std::string dir = (std::filesystem::temp_directory_path() / ("gbemu-trajectory-" + std::to_string(getpid()))).string();
+    std::filesystem::create_directories(dir);
+
+    std::vector<u16> ram;
+    TrajectoryWriter::ParseAddresses("C000-C0FF", ram);
+
+    usize threads = std::max(1u, std::thread::hardware_concurrency());
+
+    auto run = [&](bool write, u64 *bytes, u64 *stalls) {
+        std::vector<std::unique_ptr<Gameboy>> instances;
+        for (usize i = 0; i < s_Instances; i++) {
+            instances.push_back(gameboy.Clone());
+            if (write) {
+                instances.back()->GetTrajectory().Open(dir + "/" + std::to_string(i), ram, 32);
+            }
+        }
+
+        auto start = Clock::now();
+        std::vector<std::thread> workers;
+        for (usize t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                for (usize i = t; i < s_Instances; i += threads) {
+                    for (usize frame = 0; frame < frames; frame++) {
+                        instances[i]->GetUI().SetInput((frame / 30 + i) & 0xFF);
+                        instances[i]->RunFrame();
+                    }
+                }
+            });
+        }
+        for (std::thread &worker : workers) worker.join();
+
+        *bytes = 0;
+        *stalls = 0;
+        for (std::unique_ptr<Gameboy> &instance : instances) {
+            TrajectoryWriter &trajectory = instance->GetTrajectory();
+            *bytes += trajectory.GetBytes();
+            *stalls += trajectory.GetStalls();
+            trajectory.Close();
+        }
+
+        return MicrosSince(start) / 1e6;
+    };
+
+    u64 bytes = 0, stalls = 0;
+    double plainSecs = run(false, &bytes, &stalls);
+    double writeSecs = run(true, &bytes, &stalls);
+
+    // Every instance ran `frames` frames, but only VBlanks are recorded
+    usize expected = 0;
+    for (usize i = 0; i < s_Instances; i++) {
+        std::error_code ec;
+        usize size = std::filesystem::file_size(dir + "/" + std::to_string(i) + ".frames.npy", ec);
+        expected += ec ? 0 : (size - 128) / (160 * 144);
+    }
+
+    printf("Trajectory: %lu instances x %lu frames on %lu threads\n", s_Instances, frames, threads);
+    printf("  without writers %8.0f frames/s\n", s_Instances * frames / plainSecs);
+    printf("  with writers    %8.0f frames/s, %.1f MB/s, %lu frames on disk, %lu stalls\n",
+        s_Instances * frames / writeSecs, bytes / writeSecs / 1e6, expected, stalls);
+
+    gameboy.Bind();
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// Frame time and jitter of the pacer at a few speeds, emulating real frames in between
+static int BenchPacing(Gameboy &gameboy, usize frames) {
+    static constexpr double s_Speeds[] = { 1.0, 2.0, 8.0 };
+
+    Warmup(gameboy, 300);
+
+    Pacer &pacer = gameboy.GetPacer();
+    printf("Pacing to %.4f Hz:\n", Pacer::s_RefreshRate);
+
+    for (double speed : s_Speeds) {
+        pacer.SetSpeed(speed);
+        for (usize i = 0; i < frames; i++) {
+            gameboy.RunFrame();
+            pacer.WaitForNextFrame();
+        }
+
+        PacerStats stats = pacer.GetStats();
+        printf("  %.2fx: frame time %.4f ms (target %.4f ms), jitter %.4f ms, max error %.4f ms, %lu late\n",
+            speed, stats.MeanMs, stats.TargetMs, stats.JitterMs, stats.MaxErrorMs, stats.Late);
+    }
+
+    return 0;
+}
+
+// Two copies of the machine linked together, each on its own thread, driven into a
+// two player game
+static int BenchLink(Gameboy &gameboy, usize frames) {
+    Warmup(gameboy, 300);
+
+    // A side may wait for the other around a transfer, so both stop as soon as either
+    // is done. Unplugging lets the other finish the frame it may be waiting in.
+    std::atomic<bool> done = false;
+
+    auto run = [frames, &done](Gameboy *instance, LinkPort *port, bool master, double *fps) {
+        auto start = Clock::now();
+        usize i = 0;
+        for (; i < frames && !done; i++) {
+            // Both skip the intro and pick the second (two player) option, after that the
+            // first player keeps pressing Start to get through the menus
+            u8 buttons = 0;
+            if (i >= 10 && i < 15) buttons = 1 << 3;
+            else if (i >= 60 && i < 65) buttons = 1 << 4;
+            else if (master && i >= 120 && i % 60 < 5) buttons = 1 << 3;
+
+            instance->GetUI().SetInput(buttons);
+            instance->RunFrame();
+        }
+        done = true;
+        *fps = i / (MicrosSince(start) / 1e6);
+        if (port) port->Unplug();
+    };
+
+    double soloFps = 0;
+    std::unique_ptr<Gameboy> solo = gameboy.Clone();
+    run(solo.get(), nullptr, true, &soloFps);
+    solo.reset();
+    done = false;
+
+    std::unique_ptr<Gameboy> first = gameboy.Clone(), second = gameboy.Clone();
+    LinkCable::Connect(first->GetSerial(), second->GetSerial());
+
+    LinkPort *firstPort = static_cast<LinkPort*>(first->GetSerial().GetDevice());
+    LinkPort *secondPort = static_cast<LinkPort*>(second->GetSerial().GetDevice());
+
+    double firstFps = 0, secondFps = 0;
+    std::thread thread(run, second.get(), secondPort, false, &secondFps);
+    run(first.get(), firstPort, true, &firstFps);
+    thread.join();
+
+    printf("Link: %lu frames, unlinked %.0f fps, linked %.0f / %.0f fps\n", frames, soloFps, firstFps, secondFps);
+    printf("  bytes clocked: %lu / %lu, answered: %lu / %lu, waits: %lu / %lu\n",
+        firstPort->GetTransfers(), secondPort->GetTransfers(), firstPort->GetAnswered(), secondPort->GetAnswered(),
+        firstPort->GetStalls(), secondPort->GetStalls());
+
+    gameboy.Bind();
+    return 0;
+}
+
+// Emulation speed with sample synthesis off and on, from the same state. Runs are
+// interleaved so both see the same machine load.
+static int BenchAudio(Gameboy &gameboy, usize frames) {
+    static constexpr u32 s_SampleRate = 48000;
+    static constexpr usize s_Rounds = 5;
+
+    Warmup(gameboy, 300);
+
+    std::vector<i16> samples(2 * 4096);
+    usize produced = 0;
+    i32 peak = 0;
+
+    auto run = [&](u32 rate) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        APU &apu = instance->GetAPU();
+        apu.SetSampleRate(rate);
+
+        auto start = Clock::now();
+        for (usize i = 0; i < frames; i++) {
+            instance->GetUI().SetInput((i / 30) & 0x0F);
+            instance->RunFrame();
+
+            usize count = apu.ReadSamples(samples.data(), samples.size() / 2);
+            produced += count;
+            for (usize j = 0; j < 2 * count; j++) {
+                peak = std::max<i32>(peak, std::abs(samples[j]));
+            }
+        }
+
+        return frames / (MicrosSince(start) / 1e6);
+    };
+
+    double silentFps = 0, audioFps = 0;
+    for (usize round = 0; round < s_Rounds; round++) {
+        silentFps = std::max(silentFps, run(0));
+        audioFps = std::max(audioFps, run(s_SampleRate));
+    }
+
+    printf("Audio: %lu frames, best of %lu\n", frames, s_Rounds);
+    printf("  without samples %8.0f fps\n", silentFps);
+    printf("  at %u Hz     %8.0f fps (%.1f%% slower), %.1f samples per frame, peak %d\n",
+        s_SampleRate, audioFps, 100.0 * (1.0 - audioFps / silentFps), double(produced) / (s_Rounds * frames), peak);
+
+    gameboy.Bind();
+    return 0;
+}
+
+// The input the frame comparisons drive the game with. Lanes that should part ways
+// each get theirs shifted by `lane`.
+static u8 GetInput(usize frame, usize lane = 0) {
+    return static_cast<u8>((frame / 30 + lane) & 0x0F);
+}
+
+static u64 HashPresented(Gameboy &gameboy) {
+    const std::vector<u32> &framebuffer = gameboy.GetPresentedFramebuffer();
+    return Hash64(framebuffer.data(), framebuffer.size() * sizeof(u32));
+}
+
+// `frames` frames on that input, in seconds. With `hashes`, every presented frame
+// is hashed into it.
+static double RunFrames(Gameboy &instance, usize frames, std::vector<u64> *hashes = nullptr) {
+    if (hashes) hashes->clear();
+
+    auto start = Clock::now();
+    for (usize i = 0; i < frames; i++) {
+        instance.GetUI().SetInput(GetInput(i));
+        instance.RunFrame();
+
+        if (hashes) hashes->push_back(HashPresented(instance));
+    }
+
+    return MicrosSince(start) / 1e6;
+}
+
+// Batch::s_MaxLanes clones of `gameboy` through `frames` frames, in lockstep or one
+// after another, on the same input or each on its own. Returns the seconds it took;
+// `hashes` gets every lane's frames, lane by lane for each frame.
+static double RunLanes(Gameboy &gameboy, usize frames, bool batched, bool ownInput, std::vector<u64> &hashes,
+                       u64 *instructions = nullptr, BatchStats *stats = nullptr)
+{
+    std::vector<std::unique_ptr<Gameboy>> instances;
+    Batch batch;
+    for (usize i = 0; i < Batch::s_MaxLanes; i++) {
+        instances.push_back(gameboy.Clone());
+        batch.Add(*instances.back());
+    }
+
+    auto countInstructions = [&instances]() {
+        u64 count = 0;
+        for (const std::unique_ptr<Gameboy> &instance : instances) count += instance->GetCPU().GetInstructionCount();
+        return count;
+    };
+    u64 startCount = countInstructions();
+
+    hashes.clear();
+
+    auto start = Clock::now();
+    for (usize frame = 0; frame < frames; frame++) {
+        for (usize i = 0; i < instances.size(); i++) {
+            instances[i]->GetUI().SetInput(GetInput(frame, ownInput ? i : 0));
+        }
+
+        if (batched) {
+            batch.RunFrame();
+        } else {
+            for (std::unique_ptr<Gameboy> &instance : instances) instance->RunFrame();
+        }
+
+        for (std::unique_ptr<Gameboy> &instance : instances) {
+            hashes.push_back(HashPresented(*instance));
+        }
+    }
+    double secs = MicrosSince(start) / 1e6;
+
+    if (instructions) *instructions = countInstructions() - startCount;
+    if (stats && batched) *stats = batch.GetStats();
+    return secs;
+}
+
+// Index of the first hash that differs, the size if none does
+static usize FirstMismatch(const std::vector<u64> &a, const std::vector<u64> &b) {
+    usize i = 0;
+    while (i < a.size() && i < b.size() && a[i] == b[i]) i++;
+    return i;
+}
+
+// How often the lazy PPU has to catch up; it used to be ticked after every instruction
+static int BenchPPU(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Rounds = 5;
+
+    Warmup(gameboy, 300);
+
+    double fps = 0;
+    u64 syncs = 0, cycles = 0;
+    for (usize round = 0; round < s_Rounds; round++) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        u64 startSyncs = instance->GetPPU().GetSyncCount();
+        u64 startTicks = instance->GetTicks();
+
+        fps = std::max(fps, frames / RunFrames(*instance, frames));
+
+        syncs = instance->GetPPU().GetSyncCount() - startSyncs;
+        cycles = instance->GetTicks() - startTicks;
+    }
+
+    printf("PPU: %lu frames, best of %lu: %.0f fps\n", frames, s_Rounds, fps);
+    printf("  %.1f catch-ups per frame, one every %.0f cycles\n",
+        double(syncs) / frames, double(cycles) / std::max<u64>(syncs, 1));
+
+    gameboy.Bind();
+    return 0;
+}
+
+// The same frames on the fast and the accurate memory timing core
+static int BenchTiming(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Rounds = 5;
+
+    Warmup(gameboy, 300);
+
+    auto run = [&](bool accurate) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        instance->SetAccurateTiming(accurate);
+        return frames / RunFrames(*instance, frames);
+    };
+
+    double fastFps = 0, accurateFps = 0;
+    for (usize round = 0; round < s_Rounds; round++) {
+        fastFps = std::max(fastFps, run(false));
+        accurateFps = std::max(accurateFps, run(true));
+    }
+
+    printf("Memory timing: %lu frames, best of %lu, this ROM runs %s by default\n",
+        frames, s_Rounds, gameboy.IsAccurateTiming() ? "accurate" : "fast");
+    printf("  fast     %8.0f fps\n", fastFps);
+    printf("  accurate %8.0f fps (%.1f%% slower)\n", accurateFps, 100.0 * (1.0 - accurateFps / fastFps));
+
+    gameboy.Bind();
+    return 0;
+}
+
+// Skipping idle loops against running them, which must give the same frames
+static int BenchIdle(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Rounds = 5;
+
+    Warmup(gameboy, 300);
+
+    std::vector<u64> hashes[2];
+    IdleStats stats;
+    u64 cycles = 0;
+    auto run = [&](bool skip) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        instance->GetCPU().SetIdleSkip(skip);
+        IdleStats before = instance->GetCPU().GetIdleStats();
+        u64 startTicks = instance->GetTicks();
+
+        double fps = frames / RunFrames(*instance, frames, &hashes[skip]);
+
+        const IdleStats &after = instance->GetCPU().GetIdleStats();
+        stats.Skips = after.Skips - before.Skips;
+        stats.SkippedCycles = after.SkippedCycles - before.SkippedCycles;
+        stats.Rejected = after.Rejected - before.Rejected;
+        cycles = instance->GetTicks() - startTicks;
+        return fps;
+    };
+
+    double runFps = 0, skipFps = 0;
+    for (usize round = 0; round < s_Rounds; round++) {
+        runFps = std::max(runFps, run(false));
+        skipFps = std::max(skipFps, run(true));
+    }
+
+    usize mismatch = FirstMismatch(hashes[0], hashes[1]);
+
+    printf("Idle loops: %lu frames, best of %lu\n", frames, s_Rounds);
+    printf("  run     %8.0f fps\n", runFps);
+    printf("  skipped %8.0f fps (%.2fx), %.1f skips per frame, %.1f%% of cycles skipped, %lu loops rejected\n",
+        skipFps, skipFps / runFps, double(stats.Skips) / frames, 100.0 * stats.SkippedCycles / std::max<u64>(cycles, 1), stats.Rejected);
+
+    gameboy.Bind();
+    if (mismatch < frames) {
+        LOG_ERROR("  frame %lu differs with skipping\n", mismatch);
+        return 1;
+    }
+
+    printf("  all frames identical\n");
+    return 0;
+}
+
+// Raw interpreter throughput, the frames themselves don't matter
+static int BenchCPU(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Rounds = 5;
+
+    Warmup(gameboy, 300);
+
+    double ips = 0, fps = 0;
+    for (usize round = 0; round < s_Rounds; round++) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        u64 startCount = instance->GetCPU().GetInstructionCount();
+
+        double secs = RunFrames(*instance, frames);
+
+        ips = std::max(ips, (instance->GetCPU().GetInstructionCount() - startCount) / secs);
+        fps = std::max(fps, frames / secs);
+    }
+
+    printf("CPU: %lu frames, best of %lu, %s core\n", frames, s_Rounds, gameboy.IsAccurateTiming() ? "accurate" : "fast");
+    printf("  %.2f M instructions/s, %.0f fps\n", ips / 1e6, fps);
+
+    gameboy.Bind();
+    return 0;
+}
+
+// Compiled blocks against the interpreter, which must give the same frames
+static int BenchJit(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Rounds = 5;
+
+    Warmup(gameboy, 300);
+
+    std::vector<u64> hashes[2];
+    JitStats stats;
+    u64 instructions = 0;
+    auto run = [&](bool jit) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        if (instance->SetJit(jit) != jit) return 0.0;
+        u64 startCount = instance->GetCPU().GetInstructionCount();
+
+        double secs = RunFrames(*instance, frames, &hashes[jit]);
+
+        instructions = instance->GetCPU().GetInstructionCount() - startCount;
+        if (jit) stats = instance->GetJit()->GetStats();
+        return instructions / secs;
+    };
+
+    double interpretedIps = 0, compiledIps = 0;
+    for (usize round = 0; round < s_Rounds; round++) {
+        interpretedIps = std::max(interpretedIps, run(false));
+        compiledIps = std::max(compiledIps, run(true));
+    }
+
+    gameboy.Bind();
+    if (compiledIps == 0) {
+        LOG_ERROR("JIT: not available here\n");
+        return 1;
+    }
+
+    usize mismatch = FirstMismatch(hashes[0], hashes[1]);
+
+    printf("JIT: %lu frames, best of %lu\n", frames, s_Rounds);
+    printf("  interpreted %6.2f M instructions/s\n", interpretedIps / 1e6);
+    printf("  compiled    %6.2f M instructions/s (%.2fx), %.1f%% of instructions in %lu blocks (%lu rejected), %.1f instructions per run\n",
+        compiledIps / 1e6, compiledIps / interpretedIps, 100.0 * stats.Instructions / std::max<u64>(instructions, 1),
+        stats.Compiled, stats.Rejected, double(stats.Instructions) / std::max<u64>(stats.Runs, 1));
+
+    if (mismatch < frames) {
+        LOG_ERROR("  frame %lu differs with the JIT\n", mismatch);
+        return 1;
+    }
+
+    printf("  all frames identical\n");
+    return 0;
+}
+
+// Lanes run in lockstep against as many instances run one after another, which must
+// give the same frames. On the same input the lanes stay together, on their own
+// they part ways.
+static int BenchBatch(Gameboy &gameboy, usize frames) {
+    static constexpr usize s_Rounds = 3;
+    static constexpr usize s_Lanes = Batch::s_MaxLanes;
+
+    Warmup(gameboy, 300);
+
+    std::vector<u64> hashes[2];
+    BatchStats stats;
+    u64 instructions = 0;
+    auto run = [&](bool batched, bool ownInput) {
+        double secs = RunLanes(gameboy, frames, batched, ownInput, hashes[batched], &instructions, &stats);
+        return instructions / secs;
+    };
+
+    printf("Batch: %lu lanes x %lu frames, best of %lu\n", s_Lanes, frames, s_Rounds);
+
+    bool identical = true;
+    for (bool ownInput : { false, true }) {
+        double scalarIps = 0, lockstepIps = 0;
+        for (usize round = 0; round < s_Rounds; round++) {
+            scalarIps = std::max(scalarIps, run(false, ownInput));
+            lockstepIps = std::max(lockstepIps, run(true, ownInput));
+        }
+
+        printf("  %s input: scalar %6.2f M instructions/s, lockstep %6.2f M instructions/s (%.2fx)\n",
+            ownInput ? "own " : "same", scalarIps / 1e6, lockstepIps / 1e6, lockstepIps / scalarIps);
+        printf("    %.1f%% of instructions in lockstep, %.1f lanes each, %lu scalar steps\n",
+            100.0 * stats.LaneInstructions / std::max<u64>(instructions, 1),
+            double(stats.LaneInstructions) / std::max<u64>(stats.Steps, 1), stats.Peeled);
+
+        usize mismatch = FirstMismatch(hashes[0], hashes[1]);
+        if (mismatch < hashes[0].size()) {
+            LOG_ERROR("    frame %lu of lane %lu differs in lockstep\n", mismatch / s_Lanes, mismatch % s_Lanes);
+            identical = false;
+        }
+    }
+
+    gameboy.Bind();
+    if (!identical) return 1;
+
+    printf("  all frames identical\n");
+    return 0;
+}
+
+// Real time playback through the sound card with audio as the clock, as Run does it
+static int BenchAudioOutput(Gameboy &gameboy, usize frames) {
+    static constexpr u32 s_SampleRate = 48000;
+
+    Warmup(gameboy, 300);
+
+    SDL_Init(SDL_INIT_AUDIO);
+    AudioOutput &audio = gameboy.GetAudio();
+    if (!audio.OpenDevice(s_SampleRate)) {
+        SDL_Quit();
+        return 1;
+    }
+    gameboy.GetAPU().SetSampleRate(s_SampleRate);
+
+    auto start = Clock::now();
+    for (usize i = 0; i < frames; i++) {
+        gameboy.RunFrame();
+
+        if (audio.IsPlaying()) {
+            audio.WaitForSpace();
+        } else {
+            gameboy.GetPacer().WaitForNextFrame();
+        }
+    }
+    double secs = MicrosSince(start) / 1e6;
+
+    AudioStats stats = audio.GetStats();
+    printf("Audio output: %lu frames in %.2f s (%.3f fps, DMG %.3f fps)\n", frames, secs, frames / secs, Pacer::s_RefreshRate);
+    printf("  played %.2f s, latency %.1f ms (max %.1f ms), %lu underruns, %lu frames dropped, rate adjust %+.3f%%\n",
+        double(stats.Frames) / s_SampleRate, stats.LatencyMs, stats.MaxLatencyMs, stats.Underruns, stats.Dropped, stats.RateAdjust);
+
+    audio.CloseDevice();
+    SDL_Quit();
+    return 0;
+}
+
+int Bench::RunTool(int argc, char **argv) {
+    if (argc < 4) {
+        LOG_ERROR("Usage: %s --bench <state|rewind|clone|latency|link|reset|store|trajectory|pacing|audio|audio-out|ppu|timing|idle|cpu|jit|batch> <rom> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::string name(argv[2]);
+    usize iterations = (argc >= 5) ? std::stoul(argv[4]) : 1000;
+
+    char rewindOff[] = "--rewind", zero[] = "0";
+    char *args[] = { argv[0], argv[3], rewindOff, zero };
+    Gameboy gameboy(4, args);
+
+    // Reports go straight to stdout, so none of them can be dropped by the log ring.
+    // Whatever loading logged comes first.
+    Log::Flush();
+
+    int result = 1;
+    if (name == "state") {
+        result = BenchState(gameboy, iterations);
+    } else if (name == "rewind") {
+        result = BenchRewind(gameboy, iterations);
+    } else if (name == "clone") {
+        result = BenchClone(gameboy, iterations);
+    } else if (name == "latency") {
+        result = BenchLatency(gameboy, (argc >= 5) ? iterations : 3);
+    } else if (name == "link") {
+        result = BenchLink(gameboy, iterations);
+    } else if (name == "reset") {
+        result = BenchReset(gameboy, iterations);
+    } else if (name == "store") {
+        result = BenchStore(gameboy, iterations);
+    } else if (name == "trajectory") {
+        result = BenchTrajectory(gameboy, iterations);
+    } else if (name == "pacing") {
+        result = BenchPacing(gameboy, iterations);
+    } else if (name == "audio") {
+        result = BenchAudio(gameboy, iterations);
+    } else if (name == "audio-out") {
+        result = BenchAudioOutput(gameboy, iterations);
+    } else if (name == "ppu") {
+        result = BenchPPU(gameboy, iterations);
+    } else if (name == "timing") {
+        result = BenchTiming(gameboy, iterations);
+    } else if (name == "idle") {
+        result = BenchIdle(gameboy, iterations);
+    } else if (name == "cpu") {
+        result = BenchCPU(gameboy, iterations);
+    } else if (name == "jit") {
+        result = BenchJit(gameboy, iterations);
+    } else if (name == "batch") {
+        result = BenchBatch(gameboy, iterations);
+    } else {
+        LOG_ERROR("Unknown benchmark '%s'\n", name.c_str());
+    }
+
+    Log::Flush();
+    return result;
+}
+
+int Bench::RunChecks(int argc, char **argv) {
+    if (argc < 3) {
+        LOG_ERROR("Usage: %s --check <rom> [frames]\n", argv[0]);
+        return 1;
+    }
+
+    usize frames = (argc >= 4) ? std::stoul(argv[3]) : 300;
+
+    char rewindOff[] = "--rewind", zero[] = "0";
+    char *args[] = { argv[0], argv[2], rewindOff, zero };
+    Gameboy gameboy(4, args);
+    Log::Flush();
+
+    Warmup(gameboy, 300);
+
+    int result = 0;
+    auto report = [&result](const char *name, usize mismatch, usize count, usize lanes) {
+        if (mismatch < count) {
+            LOG_ERROR("%s: frame %lu of lane %lu differs\n", name, mismatch / lanes, mismatch % lanes);
+            result = 1;
+        } else {
+            printf("%s: %lu frames identical\n", name, count / lanes);
+        }
+    };
+
+    // What the others are held to: the interpreter, running every idle loop
+    std::vector<u64> expected, hashes;
+    auto run = [&](bool idleSkip, bool jit) {
+        std::unique_ptr<Gameboy> instance = gameboy.Clone();
+        instance->GetCPU().SetIdleSkip(idleSkip);
+        if (instance->SetJit(jit) != jit) return false;
+
+        RunFrames(*instance, frames, &hashes);
+        return true;
+    };
+
+    run(false, false);
+    expected.swap(hashes);
+
+    run(true, false);
+    report("idle skip", FirstMismatch(expected, hashes), frames, 1);
+
+    if (run(false, true)) {
+        report("jit", FirstMismatch(expected, hashes), frames, 1);
+    } else {
+        printf("jit: not available here, skipped\n");
+    }
+
+    for (bool ownInput : { false, true }) {
+        RunLanes(gameboy, frames, false, ownInput, expected);
+        RunLanes(gameboy, frames, true, ownInput, hashes);
+        report(ownInput ? "batch, own input" : "batch, same input", FirstMismatch(expected, hashes), expected.size(), Batch::s_MaxLanes);
+    }
+
+    gameboy.Bind();
+    Log::Flush();
+    return result;
+}
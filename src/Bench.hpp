@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Common.hpp"
+
+// Headless micro benchmarks: gbemu --bench <name> <rom> [iterations]
+namespace Bench {
+    int RunTool(int argc, char **argv);
+
+    // gbemu --check <rom> [frames]: idle loop skipping, the JIT and the lockstep
+    // batch core against the plain interpreter, frame by frame. Nonzero if any
+    // frame differs; `make test` runs it on every ROM in tests/.
+    int RunChecks(int argc, char **argv);
+}
@@ -1,39 +1,206 @@
 #include "CPU.hpp"
 #include "Gameboy.hpp"
+#include "Jit.hpp"
 #include "Log.hpp"
 
+template <bool Accurate>
 u8 CPU::Step() {
-    u8 opcode = ReadMem(m_Reg.PC);
+    if constexpr (Accurate) m_Elapsed = 0;
 
-    if (HandleInterrupts()) return 12;
+    u8 opcode = ReadMem<false>(m_Reg.PC);
+
+    if (HandleInterrupts<Accurate>()) return GetRemaining<Accurate>(12);
 
     if (m_Halted) return 4;
 
+    if constexpr (!Accurate) {
+        u8 cycles;
+        if (m_Jit && m_Jit->Run(cycles)) return cycles;
+    }
+
+    if constexpr (MemoryProbe::Enabled) Gameboy::Get().GetMemory().OnExecute(m_Reg.PC);
+
     // PrintInstruction(opcode);
 
+    // The opcode fetch is the instruction's first M-cycle
+    if constexpr (Accurate) Cycle();
+
     m_Reg.PC++;
     m_Jumped = false;
     m_IsCB = false;
+    m_Instructions++;
 
-    Execute(opcode);
+    Execute<Accurate>(opcode);
 
-    return GetCycles(opcode);
+    return GetRemaining<Accurate>(GetCycles(opcode, m_IsCB, m_Jumped));
 }
 
-u8 CPU::GetCycles(u8 opcode) {
-    if (m_IsCB) {
+template u8 CPU::Step<false>();
+template u8 CPU::Step<true>();
+
+void CPU::Cycle() {
+    Gameboy::Get().Advance(4);
+    m_Elapsed += 4;
+}
+
+template <bool Accurate>
+u8 CPU::GetRemaining(u8 cycles) const {
+    if constexpr (Accurate) {
+        return cycles > m_Elapsed ? cycles - m_Elapsed : 0;
+    } else {
+        return cycles;
+    }
+}
+
+u8 CPU::GetCycles(u8 opcode, bool cb, bool jumped) {
+    if (cb) {
         return 4 * s_CyclesCB[opcode];
-    } else if (m_Jumped) {
+    } else if (jumped) {
         return 4 * s_CyclesJumped[opcode];
     } else {
         return 4 * s_CyclesNormal[opcode];
     }
 }
 
-bool CPU::HandleInterrupts() {
-    if (!m_IME) return false;
+// A loop that came back to the same branch with the same registers, and in between
+// only ran straight-line code reading memory that nothing but an interrupt handler,
+// the PPU or the next frame's input can change, does exactly the same again until
+// one of those events. Every iteration that starts before it is skipped in one go.
+void CPU::CheckIdleLoop(u16 branch) {
+    if (!m_IdleSkip) return;
+
+    Gameboy &gameboy = Gameboy::Get();
+    u64 now = gameboy.GetTicks();
+    u64 period = now - m_IdleTime;
+    m_Reg.F = GetF();   // Compared below
+    bool repeated = (branch == m_IdleBranch && m_Reg.AF == m_IdleRegs.AF && m_Reg.BC == m_IdleRegs.BC &&
+        m_Reg.DE == m_IdleRegs.DE && m_Reg.HL == m_IdleRegs.HL && m_Reg.SP == m_IdleRegs.SP);
+
+    m_IdleBranch = branch;
+    m_IdleRegs = m_Reg;
+    m_IdleTime = now;
+
+    u64 armed = m_IdleDeadline;
+    m_IdleDeadline = 0;
+    if (!repeated) return;
+
+    u32 loop = (static_cast<u32>(m_Reg.PC) << 16) | branch;
+    if (loop == m_IdleRejected) return;
+
+    u32 cycles = 0;
+    bool readsPPU = false;
+    if (!IsIdleLoop(m_Reg.PC, branch, cycles, readsPPU)) {
+        m_IdleRejected = loop;
+        m_IdleStats.Rejected++;
+        return;
+    }
 
+    // An interrupt or a detour through other code in between shows in the period
+    if (period != cycles) return;
+
+    // The iteration that made the loop look idle must have read what the skipped ones
+    // would: no event may have happened since the last arrival, which would have moved
+    // the deadline. The event itself is left to run.
+    u64 deadline = gameboy.GetIdleDeadline(readsPPU);
+    m_IdleDeadline = deadline;
+    if (deadline != armed || deadline <= now + period) return;
+
+    u32 skip = static_cast<u32>((deadline - now - 1) / period * period);
+    gameboy.Advance(skip);
+    m_IdleTime = now + skip;
+
+    m_IdleStats.Skips++;
+    m_IdleStats.SkippedCycles += skip;
+}
+
+// Decodes the loop body from `start` up to the branch: straight-line code that only
+// reads memory and changes registers, and its cycles with the branch taken
+bool CPU::IsIdleLoop(u16 start, u16 branch, u32 &cycles, bool &readsPPU) {
+    static constexpr u16 s_MaxLength = 16;
+
+    if (branch - start > s_MaxLength || branch >= 0xFE00) return false;
+
+    auto canRead = [&readsPPU](u16 addr) {
+        switch (addr) {
+            case 0x0000 ... 0xFEFF:
+            case 0xFF80 ... 0xFFFF:
+            case 0xFF00: case 0xFF0F: case 0xFF40: case 0xFF42: case 0xFF43: case 0xFF45 ... 0xFF4B:
+                return true;
+            case 0xFF41: case 0xFF44:
+                readsPPU = true;
+                return true;
+            default:
+                return false;
+        }
+    };
+
+    cycles = 4 * s_CyclesJumped[ReadMem<false>(branch)];
+
+    u16 pc = start;
+    while (pc < branch) {
+        u8 opcode = ReadMem<false>(pc);
+        u8 length = 1;
+        u16 addr = 0;
+        bool reads = false;
+
+        if (opcode == 0xCB) {
+            u8 op = ReadMem<false>(pc + 1);
+            length = 2;
+            cycles += 4 * s_CyclesCB[op];
+
+            // Only BIT leaves (HL) alone
+            if ((op & 0x07) == 6) {
+                if (op < 0x40 || op >= 0x80) return false;
+                reads = true;
+                addr = m_Reg.HL;
+            }
+        } else {
+            cycles += 4 * s_CyclesNormal[opcode];
+
+            switch (opcode) {
+                case 0x40 ... 0x75: case 0x77 ... 0xBF: { // LD r,r', ALU A,r
+                    if ((opcode & 0xF8) == 0x70) return false;
+                    if ((opcode & 0x07) == 6) {
+                        reads = true;
+                        addr = m_Reg.HL;
+                    }
+                    break;
+                }
+                case 0x00: case 0x07: case 0x0F: case 0x17: case 0x1F: case 0x27: case 0x2F: case 0x37: case 0x3F:
+                case 0x03: case 0x0B: case 0x13: case 0x1B: case 0x23: case 0x2B: case 0x33: case 0x3B:
+                case 0x04: case 0x05: case 0x0C: case 0x0D: case 0x14: case 0x15: case 0x1C: case 0x1D:
+                case 0x24: case 0x25: case 0x2C: case 0x2D: case 0x3C: case 0x3D:
+                    break;
+                case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+                case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+                    length = 2;
+                    break;
+                case 0x0A: reads = true; addr = m_Reg.BC; break;
+                case 0x1A: reads = true; addr = m_Reg.DE; break;
+                case 0xF0: reads = true; addr = 0xFF00 | ReadMem<false>(pc + 1); length = 2; break;
+                case 0xF2: reads = true; addr = 0xFF00 | m_Reg.C; break;
+                case 0xFA: reads = true; addr = ReadMem16<false>(pc + 1); length = 3; break;
+                default: return false;
+            }
+        }
+
+        if (reads && !canRead(addr)) return false;
+        pc += length;
+    }
+
+    return pc == branch;
+}
+
+template <bool Accurate>
+bool CPU::HandleInterrupts() {
     u8 enabledInterrupts = (m_IE & m_IF & 0x1F);
+
+    // A pending interrupt ends HALT even when it isn't serviced
+    if (!m_IME) {
+        if (enabledInterrupts != 0) m_Halted = false;
+        return false;
+    }
+
     if (enabledInterrupts == 0) return false;
 
     if (m_Halted) {
@@ -44,7 +211,7 @@ bool CPU::HandleInterrupts() {
     for (u8 i = 0; i < 5; i++) {
         if (BIT(enabledInterrupts, i)) {
             m_Reg.SP -= 2;
-            WriteMem16(m_Reg.SP, m_Reg.PC);
+            WriteMem16<Accurate>(m_Reg.SP, m_Reg.PC);
             m_Reg.PC = intAddrs[i];
 
             SET_BIT(m_IF, i, 0);
@@ -58,26 +225,24 @@ bool CPU::HandleInterrupts() {
 }
 
 void CPU::PrintInstruction(u8 opcode) {
-    Log::Info("[0x%04X] ", m_Reg.PC);
-    Log::Info("%6s (0x%02X, 0x%04X) ", s_OpcodeNames[opcode], opcode, ReadMem16(m_Reg.PC + 1));
-    Log::Info("AF = 0x%04X, ", m_Reg.AF);
-    Log::Info("BC = 0x%04X, ", m_Reg.BC);
-    Log::Info("DE = 0x%04X, ", m_Reg.DE);
-    Log::Info("HL = 0x%04X, ", m_Reg.HL);
-    Log::Info("SP = 0x%04X\n", m_Reg.SP);
+    LOG_DEBUG("[0x%04X] %6s (0x%02X, 0x%04X) AF = 0x%04X, BC = 0x%04X, DE = 0x%04X, HL = 0x%04X, SP = 0x%04X\n",
+        m_Reg.PC, s_OpcodeNames[opcode], opcode, ReadMem16<false>(m_Reg.PC + 1),
+        GetAF(), m_Reg.BC, m_Reg.DE, m_Reg.HL, m_Reg.SP);
 }
 
+template <bool Accurate>
 void CPU::Execute(u8 opcode) {
     u8 block = (opcode & 0b11000000) >> 6;
     switch (block) {
-        case 0: ExecuteBlock0(opcode); break;
-        case 1: ExecuteBlock1(opcode); break;
-        case 2: ExecuteBlock2(opcode); break;
-        case 3: ExecuteBlock3(opcode); break;
+        case 0: ExecuteBlock0<Accurate>(opcode); break;
+        case 1: ExecuteBlock1<Accurate>(opcode); break;
+        case 2: ExecuteBlock2<Accurate>(opcode); break;
+        case 3: ExecuteBlock3<Accurate>(opcode); break;
         default: break;
     }
 }
 
+template <bool Accurate>
 void CPU::ExecuteBlock0(u8 opcode) {
     if (opcode == 0x00 || opcode == 0x10) return; // NOP, STOP
 
@@ -86,22 +251,22 @@ void CPU::ExecuteBlock0(u8 opcode) {
     switch (col) {
         case 0b0001: {
             u8 dest = row;
-            SetR16(dest, GetImm16());
+            SetR16(dest, GetImm16<Accurate>());
             return;
         }
         case 0b0010: {
             u8 dest = row;
-            SetR16Mem(dest, m_Reg.A);
+            SetR16Mem<Accurate>(dest, m_Reg.A);
             return;
         }
         case 0b1010: {
             u8 src = row;
-            m_Reg.A = GetR16Mem(src);
+            m_Reg.A = GetR16Mem<Accurate>(src);
             return;
         }
         case 0b1000: {
             if (row == 0b00) {
-                WriteMem(GetImm16(), m_Reg.SP);
+                WriteMem<Accurate>(GetImm16<Accurate>(), m_Reg.SP);
                 return;
             }
             break;
@@ -120,9 +285,9 @@ void CPU::ExecuteBlock0(u8 opcode) {
             u8 operand = row;
             u16 val = GetR16(operand);
             u32 res = m_Reg.HL + val;
-            SetFlagN(false);
-            SetFlagH((m_Reg.HL & 0xFFF) + (val & 0xFFF) > 0xFFF);
-            SetFlagC(res > 0xFFFF);
+            m_FlagN = false;
+            m_FlagH = (m_Reg.HL ^ val ^ res) >> 8;
+            m_FlagC = res >> 8;
             m_Reg.HL = res;
             return;
         }
@@ -133,38 +298,38 @@ void CPU::ExecuteBlock0(u8 opcode) {
     switch (col) {
         case 0b100: {
             u8 operand = row;
-            Inc(operand);
+            Inc<Accurate>(operand);
             return;
         }
         case 0b101: {
             u8 operand = row;
-            Dec(operand);
+            Dec<Accurate>(operand);
             return;
         }
         case 0b110: {
             u8 dest = row;
-            SetR8(dest, GetImm8());
+            SetR8<Accurate>(dest, GetImm8<Accurate>());
             return;
         }
         case 0b111: {
             switch (row) {
                 case 0b000: { // RLCA
-                    Rlc(7);
+                    Rlc<Accurate>(7);
                     SetFlagZ(false);
                     return;
                 }
                 case 0b001: { // RRCA
-                    Rrc(7);
+                    Rrc<Accurate>(7);
                     SetFlagZ(false);
                     return;
                 }
                 case 0b010: { // RLA
-                    Rl(7);
+                    Rl<Accurate>(7);
                     SetFlagZ(false);
                     return;
                 }
                 case 0b011: { // RRA
-                    Rr(7);
+                    Rr<Accurate>(7);
                     SetFlagZ(false);
                     return;
                 }
@@ -195,8 +360,13 @@ void CPU::ExecuteBlock0(u8 opcode) {
         case 0b000: { // JR
             u8 cond = row;
             if (cond == 0b011 || CheckCondition(cond & 0b011)) {
-                m_Reg.PC += static_cast<i8>(ReadMem(m_Reg.PC)) + 1;
+                u16 branch = m_Reg.PC - 1;
+                m_Reg.PC += static_cast<i8>(ReadMem<Accurate>(m_Reg.PC)) + 1;
                 m_Jumped = true;
+
+                if constexpr (!Accurate) {
+                    if (m_Reg.PC <= branch) CheckIdleLoop(branch);
+                }
             } else {
                 m_Reg.PC++;
             }
@@ -205,6 +375,7 @@ void CPU::ExecuteBlock0(u8 opcode) {
     }
 }
 
+template <bool Accurate>
 void CPU::ExecuteBlock1(u8 opcode) {
     if (opcode == 0x76) {
         m_Halted = true;
@@ -213,24 +384,26 @@ void CPU::ExecuteBlock1(u8 opcode) {
 
     u8 src  = (opcode & 0b00000111);
     u8 dest = (opcode & 0b00111000) >> 3;
-    SetR8(dest, GetR8(src));
+    SetR8<Accurate>(dest, GetR8<Accurate>(src));
 }
 
+template <bool Accurate>
 void CPU::ExecuteBlock2(u8 opcode) {
     u8 operand = (opcode & 0b00000111);
     u8 func    = (opcode & 0b00111000) >> 3;
     switch (func) {
-        case 0: Add(GetR8(operand)); break;
-        case 1: Adc(GetR8(operand)); break;
-        case 2: Sub(GetR8(operand)); break;
-        case 3: Sbc(GetR8(operand)); break;
-        case 4: And(GetR8(operand)); break;
-        case 5: Xor(GetR8(operand)); break;
-        case 6:  Or(GetR8(operand)); break;
-        case 7:  Cp(GetR8(operand)); break;
+        case 0: Add(GetR8<Accurate>(operand)); break;
+        case 1: Adc(GetR8<Accurate>(operand)); break;
+        case 2: Sub(GetR8<Accurate>(operand)); break;
+        case 3: Sbc(GetR8<Accurate>(operand)); break;
+        case 4: And(GetR8<Accurate>(operand)); break;
+        case 5: Xor(GetR8<Accurate>(operand)); break;
+        case 6:  Or(GetR8<Accurate>(operand)); break;
+        case 7:  Cp(GetR8<Accurate>(operand)); break;
     }
 }
 
+template <bool Accurate>
 void CPU::ExecuteBlock3(u8 opcode) {
     switch (opcode) {
         case 0xF3: { // DI
@@ -242,39 +415,39 @@ void CPU::ExecuteBlock3(u8 opcode) {
             return;
         }
         case 0xCB: { // PREFIX CB
-            ExecuteCB();
+            ExecuteCB<Accurate>();
             return;
         }
         case 0xE0: {
-            WriteMem(0xFF00 | GetImm8(), m_Reg.A);
+            WriteMem<Accurate>(0xFF00 | GetImm8<Accurate>(), m_Reg.A);
             return;
         }
         case 0xE2: {
-            WriteMem(0xFF00 | m_Reg.C, m_Reg.A);
+            WriteMem<Accurate>(0xFF00 | m_Reg.C, m_Reg.A);
             return;
         }
         case 0xEA: {
-            WriteMem(GetImm16(), m_Reg.A);
+            WriteMem<Accurate>(GetImm16<Accurate>(), m_Reg.A);
             return;
         }
         case 0xF0: {
-            m_Reg.A = ReadMem(0xFF00 | GetImm8());
+            m_Reg.A = ReadMem<Accurate>(0xFF00 | GetImm8<Accurate>());
             return;
         }
         case 0xF2: {
-            m_Reg.A = ReadMem(0xFF00 | m_Reg.C);
+            m_Reg.A = ReadMem<Accurate>(0xFF00 | m_Reg.C);
             return;
         }
         case 0xFA: {
-            m_Reg.A = ReadMem(GetImm16());
+            m_Reg.A = ReadMem<Accurate>(GetImm16<Accurate>());
             return;
         }
         case 0xE8: {
-            m_Reg.SP = AddSPImm8();
+            m_Reg.SP = AddSPImm8<Accurate>();
             return;
         }
         case 0xF8: {
-            m_Reg.HL = AddSPImm8();
+            m_Reg.HL = AddSPImm8<Accurate>();
             return;
         }
         case 0xF9: {
@@ -282,17 +455,22 @@ void CPU::ExecuteBlock3(u8 opcode) {
             return;
         }
         case 0xC9: {
-            Ret();
+            Ret<Accurate>();
             return;
         }
         case 0xD9: {
-            Ret();
+            Ret<Accurate>();
             m_IME = true;
             return;
         }
         case 0xC3: {
-            m_Reg.PC = ReadMem16(m_Reg.PC);
+            u16 branch = m_Reg.PC - 1;
+            m_Reg.PC = ReadMem16<Accurate>(m_Reg.PC);
             m_Jumped = true;
+
+            if constexpr (!Accurate) {
+                if (m_Reg.PC <= branch) CheckIdleLoop(branch);
+            }
             return;
         }
         case 0xE9: {
@@ -301,7 +479,7 @@ void CPU::ExecuteBlock3(u8 opcode) {
             return;
         }
         case 0xCD: {
-            Call();
+            Call<Accurate>();
             return;
         }
     }
@@ -311,12 +489,12 @@ void CPU::ExecuteBlock3(u8 opcode) {
     switch (col) {
         case 0b0001: {
             u8 dest = row;
-            Pop(dest);
+            Pop<Accurate>(dest);
             return;
         }
         case 0b0101: {
             u8 src = row;
-            Push(src);
+            Push<Accurate>(src);
             return;
         }
     }
@@ -327,18 +505,18 @@ void CPU::ExecuteBlock3(u8 opcode) {
         case 0b110: {
             u8 func = row;
             switch (func) {
-                case 0: Add(GetImm8()); return;
-                case 1: Adc(GetImm8()); return;
-                case 2: Sub(GetImm8()); return;
-                case 3: Sbc(GetImm8()); return;
-                case 4: And(GetImm8()); return;
-                case 5: Xor(GetImm8()); return;
-                case 6:  Or(GetImm8()); return;
-                case 7:  Cp(GetImm8()); return;
+                case 0: Add(GetImm8<Accurate>()); return;
+                case 1: Adc(GetImm8<Accurate>()); return;
+                case 2: Sub(GetImm8<Accurate>()); return;
+                case 3: Sbc(GetImm8<Accurate>()); return;
+                case 4: And(GetImm8<Accurate>()); return;
+                case 5: Xor(GetImm8<Accurate>()); return;
+                case 6:  Or(GetImm8<Accurate>()); return;
+                case 7:  Cp(GetImm8<Accurate>()); return;
             }
         }
         case 0b111: { // RST
-            Rst(opcode);
+            Rst<Accurate>(opcode);
             return;
         }
     }
@@ -347,17 +525,25 @@ void CPU::ExecuteBlock3(u8 opcode) {
     col = (opcode & 0b00100111);
     switch (col) {
         case 0b0000: {
+            // Checking the condition takes an M-cycle of its own
+            if constexpr (Accurate) Cycle();
+
             u8 cond = row;
             if (CheckCondition(cond)) {
-                Ret();
+                Ret<Accurate>();
             }
             return;
         }
         case 0b0010: {
             u8 cond = row;
             if (CheckCondition(cond)) {
-                m_Reg.PC = ReadMem16(m_Reg.PC);
+                u16 branch = m_Reg.PC - 1;
+                m_Reg.PC = ReadMem16<Accurate>(m_Reg.PC);
                 m_Jumped = true;
+
+                if constexpr (!Accurate) {
+                    if (m_Reg.PC <= branch) CheckIdleLoop(branch);
+                }
             } else {
                 m_Reg.PC += 2;
             }
@@ -366,7 +552,7 @@ void CPU::ExecuteBlock3(u8 opcode) {
         case 0b0100: {
             u8 cond = row;
             if (CheckCondition(cond)) {
-                Call();
+                Call<Accurate>();
             } else {
                 m_Reg.PC += 2;
             }
@@ -375,10 +561,11 @@ void CPU::ExecuteBlock3(u8 opcode) {
     }
 }
 
+template <bool Accurate>
 void CPU::ExecuteCB() {
     m_IsCB = true;
 
-    u8 opcode = GetImm8();
+    u8 opcode = GetImm8<Accurate>();
 
     u8 block = (opcode & 0b11000000) >> 6;
     u8 row = (opcode & 0b00111000) >> 3;
@@ -388,54 +575,73 @@ void CPU::ExecuteCB() {
         case 0: {
             u8 operand = col;
             switch (row) {
-                case 0: Rlc(operand);  return;
-                case 1: Rrc(operand);  return;
-                case 2: Rl(operand);   return;
-                case 3: Rr(operand);   return;
-                case 4: Sla(operand);  return;
-                case 5: Sra(operand);  return;
-                case 6: Swap(operand); return;
-                case 7: Srl(operand);  return;
+                case 0: Rlc<Accurate>(operand);  return;
+                case 1: Rrc<Accurate>(operand);  return;
+                case 2: Rl<Accurate>(operand);   return;
+                case 3: Rr<Accurate>(operand);   return;
+                case 4: Sla<Accurate>(operand);  return;
+                case 5: Sra<Accurate>(operand);  return;
+                case 6: Swap<Accurate>(operand); return;
+                case 7: Srl<Accurate>(operand);  return;
             }
         }
         case 1: {
             u8 bit = row;
             u8 operand = col;
-            Bit(operand, bit);
+            Bit<Accurate>(operand, bit);
             return;
         }
         case 2: {
             u8 bit = row;
             u8 operand = col;
-            Res(operand, bit);
+            Res<Accurate>(operand, bit);
             return;
         }
         case 3: {
             u8 bit = row;
             u8 operand = col;
-            Set(operand, bit);
+            Set<Accurate>(operand, bit);
             return;
         }
     }
 }
 
-u8 CPU::ReadMem(u16 addr) const {
-    return Gameboy::Get().GetMemory().Read(addr);
+template <bool Accurate>
+u8 CPU::ReadMem(u16 addr) {
+    u8 val = Gameboy::Get().GetMemory().Read(addr);
+    if constexpr (Accurate) Cycle();
+    return val;
 }
 
-u16 CPU::ReadMem16(u16 addr) const {
-    return Gameboy::Get().GetMemory().Read16(addr);
+template <bool Accurate>
+u16 CPU::ReadMem16(u16 addr) {
+    if constexpr (Accurate) {
+        u8 low = ReadMem<true>(addr);
+        return static_cast<u16>(ReadMem<true>(addr + 1) << 8) | low;
+    } else {
+        return Gameboy::Get().GetMemory().Read16(addr);
+    }
 }
 
+template <bool Accurate>
 void CPU::WriteMem(u16 addr, u8 val) {
     Gameboy::Get().GetMemory().Write(addr, val);
+    if constexpr (Accurate) Cycle();
 }
 
+// Only pushes write 16 bits, the accurate core stores the high byte first as they do
+template <bool Accurate>
 void CPU::WriteMem16(u16 addr, u16 val) {
-    Gameboy::Get().GetMemory().Write16(addr, val);
+    if constexpr (Accurate) {
+        WriteMem<true>(addr + 1, static_cast<u8>(val >> 8));
+        WriteMem<true>(addr, static_cast<u8>(val));
+    } else {
+        Gameboy::Get().GetMemory().Write16(addr, val);
+    }
 }
 
-u8 CPU::GetR8(u8 idx) const {
+template <bool Accurate>
+u8 CPU::GetR8(u8 idx) {
     switch (idx) {
         case 0: return m_Reg.B;
         case 1: return m_Reg.C;
@@ -443,13 +649,14 @@ u8 CPU::GetR8(u8 idx) const {
         case 3: return m_Reg.E;
         case 4: return m_Reg.H;
         case 5: return m_Reg.L;
-        case 6: return ReadMem(m_Reg.HL);
+        case 6: return ReadMem<Accurate>(m_Reg.HL);
         case 7: return m_Reg.A;
     }
 
     return 0;
 }
 
+template <bool Accurate>
 void CPU::SetR8(u8 idx, u8 val) {
     switch (idx) {
         case 0: m_Reg.B = val; break;
@@ -458,7 +665,7 @@ void CPU::SetR8(u8 idx, u8 val) {
         case 3: m_Reg.E = val; break;
         case 4: m_Reg.H = val; break;
         case 5: m_Reg.L = val; break;
-        case 6: WriteMem(m_Reg.HL, val); break;
+        case 6: WriteMem<Accurate>(m_Reg.HL, val); break;
         case 7: m_Reg.A = val; break;
     }
 }
@@ -483,35 +690,39 @@ void CPU::SetR16(u8 idx, u16 val) {
     }
 }
 
+template <bool Accurate>
 u8 CPU::GetR16Mem(u8 idx) {
     u8 val;
     switch (idx) {
-        case 0: val = ReadMem(m_Reg.BC); break;
-        case 1: val = ReadMem(m_Reg.DE); break;
-        case 2: val = ReadMem(m_Reg.HL); m_Reg.HL++; break;
-        case 3: val = ReadMem(m_Reg.HL); m_Reg.HL--; break;
+        case 0: val = ReadMem<Accurate>(m_Reg.BC); break;
+        case 1: val = ReadMem<Accurate>(m_Reg.DE); break;
+        case 2: val = ReadMem<Accurate>(m_Reg.HL); m_Reg.HL++; break;
+        case 3: val = ReadMem<Accurate>(m_Reg.HL); m_Reg.HL--; break;
     }
 
     return val;
 }
 
+template <bool Accurate>
 void CPU::SetR16Mem(u8 idx, u8 val) {
     switch (idx) {
-        case 0: WriteMem(m_Reg.BC, val); break;
-        case 1: WriteMem(m_Reg.DE, val); break;
-        case 2: WriteMem(m_Reg.HL, val); m_Reg.HL++; break;
-        case 3: WriteMem(m_Reg.HL, val); m_Reg.HL--; break;
+        case 0: WriteMem<Accurate>(m_Reg.BC, val); break;
+        case 1: WriteMem<Accurate>(m_Reg.DE, val); break;
+        case 2: WriteMem<Accurate>(m_Reg.HL, val); m_Reg.HL++; break;
+        case 3: WriteMem<Accurate>(m_Reg.HL, val); m_Reg.HL--; break;
     }
 }
 
+template <bool Accurate>
 u8 CPU::GetImm8() {
-    u8 val = ReadMem(m_Reg.PC);
+    u8 val = ReadMem<Accurate>(m_Reg.PC);
     m_Reg.PC++;
     return val;
 }
 
+template <bool Accurate>
 u16 CPU::GetImm16() {
-    u16 val = ReadMem16(m_Reg.PC);
+    u16 val = ReadMem16<Accurate>(m_Reg.PC);
     m_Reg.PC += 2;
     return val;
 }
@@ -527,33 +738,37 @@ bool CPU::CheckCondition(u8 cond) const {
     return false;
 }
 
+template <bool Accurate>
 void CPU::Inc(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
+    u8 res = val + 1;
 
-    SetFlagZ(((val + 1) & 0xFF) == 0);
-    SetFlagN(false);
-    SetFlagH((val & 0xF) + 1 > 0xF);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = val ^ 1 ^ res;
 
-    SetR8(operand, val + 1);
+    SetR8<Accurate>(operand, res);
 }
 
+template <bool Accurate>
 void CPU::Dec(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
+    u8 res = val - 1;
+
+    m_FlagZ = res;
+    m_FlagN = true;
+    m_FlagH = val ^ 1 ^ res;
 
-    SetFlagZ(((val - 1) & 0xFF) == 0);
-    SetFlagN(true);
-    SetFlagH(((val - 1) & 0xF) == 0xF);
-    
-    SetR8(operand, val - 1);
+    SetR8<Accurate>(operand, res);
 }
 
 void CPU::Add(u8 val) {
     u16 res = m_Reg.A + val;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(false);
-    SetFlagH((m_Reg.A & 0xF) + (val & 0xF) > 0xF);
-    SetFlagC(res > 0xFF);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = m_Reg.A ^ val ^ res;
+    m_FlagC = res;
 
     m_Reg.A = res;
 }
@@ -562,121 +777,135 @@ void CPU::Adc(u8 val) {
     u16 c = GetFlagC();
     u16 res = m_Reg.A + val + c;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(false);
-    SetFlagH((m_Reg.A & 0xF) + (val & 0xF) + c > 0xF);
-    SetFlagC(res > 0xFF);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = m_Reg.A ^ val ^ res;
+    m_FlagC = res;
 
     m_Reg.A = res;
 }
 
 void CPU::Sub(u8 val) {
-    i16 res = m_Reg.A - val;
+    // A borrow leaves bit 8 set
+    u16 res = m_Reg.A - val;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(true);
-    SetFlagH((m_Reg.A & 0xF) - (val & 0xF) < 0);
-    SetFlagC(res < 0);
+    m_FlagZ = res;
+    m_FlagN = true;
+    m_FlagH = m_Reg.A ^ val ^ res;
+    m_FlagC = res;
 
     m_Reg.A = res;
 }
 
 void CPU::Sbc(u8 val) {
     u16 c = GetFlagC();
-    i16 res = m_Reg.A - val - c;
+    u16 res = m_Reg.A - val - c;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(true);
-    SetFlagH((m_Reg.A & 0xF) - (val & 0xF) - c < 0);
-    SetFlagC(res < 0);
+    m_FlagZ = res;
+    m_FlagN = true;
+    m_FlagH = m_Reg.A ^ val ^ res;
+    m_FlagC = res;
 
     m_Reg.A = res;
 }
 
 void CPU::And(u8 val) {
-    u16 res = m_Reg.A & val;
+    u8 res = m_Reg.A & val;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(false);
-    SetFlagH(true);
-    SetFlagC(false);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0x10;
+    m_FlagC = 0;
 
     m_Reg.A = res;
 }
 
 void CPU::Or(u8 val) {
-    u16 res = m_Reg.A | val;
+    u8 res = m_Reg.A | val;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(false);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = 0;
 
     m_Reg.A = res;
 }
 
 void CPU::Xor(u8 val) {
-    u16 res = m_Reg.A ^ val;
+    u8 res = m_Reg.A ^ val;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(false);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = 0;
 
     m_Reg.A = res;
 }
 
+template <bool Accurate>
 void CPU::Push(u8 src) {
+    if constexpr (Accurate) Cycle();
+
     m_Reg.SP -= 2;
     switch (src) {
-        case 0: WriteMem16(m_Reg.SP, m_Reg.BC); break;
-        case 1: WriteMem16(m_Reg.SP, m_Reg.DE); break;
-        case 2: WriteMem16(m_Reg.SP, m_Reg.HL); break;
-        case 3: WriteMem16(m_Reg.SP, m_Reg.AF); break;
+        case 0: WriteMem16<Accurate>(m_Reg.SP, m_Reg.BC); break;
+        case 1: WriteMem16<Accurate>(m_Reg.SP, m_Reg.DE); break;
+        case 2: WriteMem16<Accurate>(m_Reg.SP, m_Reg.HL); break;
+        case 3: WriteMem16<Accurate>(m_Reg.SP, GetAF()); break;
     }
 }
 
+template <bool Accurate>
 void CPU::Pop(u8 dest) {
     switch (dest) {
-        case 0: m_Reg.BC = ReadMem16(m_Reg.SP); break;
-        case 1: m_Reg.DE = ReadMem16(m_Reg.SP); break;
-        case 2: m_Reg.HL = ReadMem16(m_Reg.SP); break;
-        case 3: m_Reg.AF = ReadMem16(m_Reg.SP) & 0xFFF0; break;
+        case 0: m_Reg.BC = ReadMem16<Accurate>(m_Reg.SP); break;
+        case 1: m_Reg.DE = ReadMem16<Accurate>(m_Reg.SP); break;
+        case 2: m_Reg.HL = ReadMem16<Accurate>(m_Reg.SP); break;
+        case 3: SetAF(ReadMem16<Accurate>(m_Reg.SP)); break;
     }
     m_Reg.SP += 2;
 }
 
 void CPU::Cp(u8 val) {
-    i16 res = m_Reg.A - val;
+    u16 res = m_Reg.A - val;
 
-    SetFlagZ((res & 0xFF) == 0);
-    SetFlagN(true);
-    SetFlagH((m_Reg.A & 0xF) - (val & 0xF) < 0);
-    SetFlagC(res < 0);
+    m_FlagZ = res;
+    m_FlagN = true;
+    m_FlagH = m_Reg.A ^ val ^ res;
+    m_FlagC = res;
 }
 
+template <bool Accurate>
 void CPU::Rst(u8 opcode) {
+    if constexpr (Accurate) Cycle();
+
     m_Reg.SP -= 2;
-    WriteMem16(m_Reg.SP, m_Reg.PC);
+    WriteMem16<Accurate>(m_Reg.SP, m_Reg.PC);
     m_Reg.PC = opcode & 0x38;
     m_Jumped = true;
 }
 
+template <bool Accurate>
 void CPU::Call() {
+    u16 target = ReadMem16<Accurate>(m_Reg.PC);
+    if constexpr (Accurate) Cycle();
+
     m_Reg.SP -= 2;
-    WriteMem16(m_Reg.SP, m_Reg.PC + 2);
-    m_Reg.PC = ReadMem16(m_Reg.PC);
+    WriteMem16<Accurate>(m_Reg.SP, m_Reg.PC + 2);
+    m_Reg.PC = target;
     m_Jumped = true;
 }
 
+template <bool Accurate>
 void CPU::Ret() {
-    m_Reg.PC = ReadMem16(m_Reg.SP);
+    m_Reg.PC = ReadMem16<Accurate>(m_Reg.SP);
     m_Reg.SP += 2;
     m_Jumped = true;
 }
 
+template <bool Accurate>
 u16 CPU::AddSPImm8() {
-    i8 val = GetImm8();
+    i8 val = GetImm8<Accurate>();
     i32 res = m_Reg.SP + val;
 
     SetFlagZ(false);
@@ -692,119 +921,130 @@ u16 CPU::AddSPImm8() {
     return res;
 }
 
+template <bool Accurate>
 void CPU::Rlc(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = (val >> 7) & 1;
     u8 res = (val << 1) | c;
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Rrc(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = val & 1;
     u8 res = (val >> 1) | (c << 7);
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Rl(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = (val >> 7) & 1;
     u8 res = (val << 1) | GetFlagC();
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Rr(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = val & 1;
     u8 res = (val >> 1) | (GetFlagC() << 7);
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Sla(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = (val >> 7) & 1;
     u8 res = val << 1;
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Sra(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = val & 1;
     u8 res = static_cast<i8>(val) >> 1;
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Swap(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 res = ((val & 0xF0) >> 4) | ((val & 0xF) << 4);
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(false);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = 0;
 }
 
+template <bool Accurate>
 void CPU::Srl(u8 operand) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     u8 c = val & 1;
     u8 res = val >> 1;
-    SetR8(operand, res);
+    SetR8<Accurate>(operand, res);
 
-    SetFlagZ(res == 0);
-    SetFlagN(false);
-    SetFlagH(false);
-    SetFlagC(c);
+    m_FlagZ = res;
+    m_FlagN = false;
+    m_FlagH = 0;
+    m_FlagC = c << 8;
 }
 
+template <bool Accurate>
 void CPU::Bit(u8 operand, u8 bit) {
-    u8 val = GetR8(operand);
-    SetFlagZ(!BIT(val, bit));
-    SetFlagN(false);
-    SetFlagH(true);
+    u8 val = GetR8<Accurate>(operand);
+    m_FlagZ = val & (1 << bit);
+    m_FlagN = false;
+    m_FlagH = 0x10;
 }
 
+template <bool Accurate>
 void CPU::Res(u8 operand, u8 bit) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     SET_BIT(val, bit, 0);
-    SetR8(operand, val);
+    SetR8<Accurate>(operand, val);
 }
 
 
+template <bool Accurate>
 void CPU::Set(u8 operand, u8 bit) {
-    u8 val = GetR8(operand);
+    u8 val = GetR8<Accurate>(operand);
     SET_BIT(val, bit, 1);
-    SetR8(operand, val);
+    SetR8<Accurate>(operand, val);
 }
 
 void CPU::Daa() {
@@ -821,11 +1061,22 @@ void CPU::Daa() {
     }
 
     m_Reg.A += n ? -off : off;
-    SetFlagZ(m_Reg.A == 0);
-    SetFlagH(0);
+    m_FlagZ = m_Reg.A;
+    m_FlagH = 0;
     SetFlagC((off & 0x60) != 0);
 }
 
+u8 CPU::GetF() const {
+    return (GetFlagZ() << FlagBit::Z) | (GetFlagN() << FlagBit::N) | (GetFlagH() << FlagBit::H) | (GetFlagC() << FlagBit::C);
+}
+
+void CPU::SetF(u8 val) {
+    m_FlagZ = ~val & 0x80;
+    m_FlagN = BIT(val, FlagBit::N);
+    m_FlagH = val >> 1;
+    m_FlagC = val << 4;
+}
+
 const u8 CPU::s_CyclesNormal[0x100] = {
     1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
     1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
@@ -1171,4 +1422,32 @@ const char *CPU::s_OpcodeNames[0x100] = {
 	[0xFD] = "           ",
 	[0xFE] = "CP d8      ",
 	[0xFF] = "RST 38H    ",
-};
\ No newline at end of file
+};
+
+void CPU::Serialize(StateWriter &state) const {
+    state.Write(GetAF());
+    state.Write(m_Reg.BC);
+    state.Write(m_Reg.DE);
+    state.Write(m_Reg.HL);
+    state.Write(m_Reg.SP);
+    state.Write(m_Reg.PC);
+    state.Write(m_IME);
+    state.Write(m_IF);
+    state.Write(m_IE);
+    state.Write(m_Halted);
+}
+
+void CPU::Deserialize(StateReader &state) {
+    u16 af = 0;
+    state.Read(af);
+    SetAF(af);
+    state.Read(m_Reg.BC);
+    state.Read(m_Reg.DE);
+    state.Read(m_Reg.HL);
+    state.Read(m_Reg.SP);
+    state.Read(m_Reg.PC);
+    state.Read(m_IME);
+    state.Read(m_IF);
+    state.Read(m_IE);
+    state.Read(m_Halted);
+}
\ No newline at end of file
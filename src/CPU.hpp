@@ -1,6 +1,15 @@
 #pragma once
 
 #include "Common.hpp"
+#include "SaveState.hpp"
+
+class Jit;
+
+struct IdleStats {
+    u64 Skips = 0;
+    u64 SkippedCycles = 0;
+    u64 Rejected = 0;       // Repeating loops that read or write something they may not
+};
 
 class CPU {
 public:
@@ -13,7 +22,12 @@ public:
     };
 
 public:
-    u8 Step();
+    // Runs one instruction (or interrupt dispatch, or HALT step) and returns the
+    // cycles it took. The fast core does every memory access at the start and leaves
+    // the whole count to the caller. The accurate core gives each access its own
+    // M-cycle, advancing the rest of the machine before the next one, and returns
+    // only what is left over.
+    template <bool Accurate> u8 Step();
 
     u8 GetIF() const { return m_IF; }
     u8 GetIE() const { return m_IE; }
@@ -23,54 +37,89 @@ public:
 
     void RequestInterrupt(Interrupt in) { m_IF |= in; }
 
+    // Skipping of polling loops, on by default. Only the fast core does it.
+    void SetIdleSkip(bool enabled) { m_IdleSkip = enabled; }
+    const IdleStats &GetIdleStats() const { return m_IdleStats; }
+
+    // Compiled blocks the fast core runs where it can, null for none. Not owned.
+    void SetJit(Jit *jit) { m_Jit = jit; }
+
+    // Instructions executed so far, for benchmarks
+    u64 GetInstructionCount() const { return m_Instructions; }
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
 private:
-    u8 GetCycles(u8 opcode);
-    bool HandleInterrupts();
+    friend class Jit;
+    friend class Batch;
+
+    // For CB instructions `opcode` is the 0xCB prefix
+    static u8 GetCycles(u8 opcode, bool cb, bool jumped);
+    template <bool Accurate> bool HandleInterrupts();
     void PrintInstruction(u8 opcode);
 
-    void Execute(u8 opcode);
+    // One M-cycle of the accurate core, and what is left of `cycles` after them
+    void Cycle();
+    template <bool Accurate> u8 GetRemaining(u8 cycles) const;
+
+    // After a taken backward branch at `branch`
+    void CheckIdleLoop(u16 branch);
+    bool IsIdleLoop(u16 start, u16 branch, u32 &cycles, bool &readsPPU);
 
-    void ExecuteBlock0(u8 opcode);
-    void ExecuteBlock1(u8 opcode);
-    void ExecuteBlock2(u8 opcode);
-    void ExecuteBlock3(u8 opcode);
+    template <bool Accurate> void Execute(u8 opcode);
 
-    void ExecuteCB();
+    template <bool Accurate> void ExecuteBlock0(u8 opcode);
+    template <bool Accurate> void ExecuteBlock1(u8 opcode);
+    template <bool Accurate> void ExecuteBlock2(u8 opcode);
+    template <bool Accurate> void ExecuteBlock3(u8 opcode);
+
+    template <bool Accurate> void ExecuteCB();
 
     enum FlagBit { C = 4, H = 5, N = 6, Z = 7 };
 
-    u8 GetFlagC() const { return BIT(m_Reg.F, FlagBit::C); }
-    u8 GetFlagH() const { return BIT(m_Reg.F, FlagBit::H); }
-    u8 GetFlagN() const { return BIT(m_Reg.F, FlagBit::N); }
-    u8 GetFlagZ() const { return BIT(m_Reg.F, FlagBit::Z); }
+    // The flags are kept as the ALU left them and only worked out when read: Z is
+    // set when m_FlagZ is 0, H is bit 4 of m_FlagH (operands ^ result, for adds and
+    // subtracts alike) and C bit 8 of m_FlagC (the 9 bit result)
+    u8 GetFlagC() const { return (m_FlagC >> 8) & 1; }
+    u8 GetFlagH() const { return (m_FlagH >> 4) & 1; }
+    u8 GetFlagN() const { return m_FlagN; }
+    u8 GetFlagZ() const { return m_FlagZ == 0; }
+
+    void SetFlagC(bool val) { m_FlagC = val << 8; }
+    void SetFlagH(bool val) { m_FlagH = val << 4; }
+    void SetFlagN(bool val) { m_FlagN = val; }
+    void SetFlagZ(bool val) { m_FlagZ = !val; }
 
-    void SetFlagC(u8 val) { SET_BIT(m_Reg.F, FlagBit::C, val); }
-    void SetFlagH(u8 val) { SET_BIT(m_Reg.F, FlagBit::H, val); }
-    void SetFlagN(u8 val) { SET_BIT(m_Reg.F, FlagBit::N, val); }
-    void SetFlagZ(u8 val) { SET_BIT(m_Reg.F, FlagBit::Z, val); }
+    // F as the CPU would have it, m_Reg.F isn't kept up to date
+    u8 GetF() const;
+    void SetF(u8 val);
 
-    u8 ReadMem(u16 addr) const;
-    u16 ReadMem16(u16 addr) const;
+    u16 GetAF() const { return (m_Reg.A << 8) | GetF(); }
+    void SetAF(u16 val) { m_Reg.A = val >> 8; SetF(val); }
 
-    void WriteMem(u16 addr, u8 val);
-    void WriteMem16(u16 addr, u16 val);
+    template <bool Accurate> u8 ReadMem(u16 addr);
+    template <bool Accurate> u16 ReadMem16(u16 addr);
 
-    u8 GetR8(u8 idx) const;
-    void SetR8(u8 idx, u8 val);
+    template <bool Accurate> void WriteMem(u16 addr, u8 val);
+    template <bool Accurate> void WriteMem16(u16 addr, u16 val);
+
+    template <bool Accurate> u8 GetR8(u8 idx);
+    template <bool Accurate> void SetR8(u8 idx, u8 val);
 
     u16 GetR16(u8 idx) const;
     void SetR16(u8 idx, u16 val);
 
-    u8 GetR16Mem(u8 idx);
-    void SetR16Mem(u8 idx, u8 val);
+    template <bool Accurate> u8 GetR16Mem(u8 idx);
+    template <bool Accurate> void SetR16Mem(u8 idx, u8 val);
 
-    u8 GetImm8();
-    u16 GetImm16();
+    template <bool Accurate> u8 GetImm8();
+    template <bool Accurate> u16 GetImm16();
 
     bool CheckCondition(u8 cond) const;
 
-    void Inc(u8 operand);
-    void Dec(u8 operand);
+    template <bool Accurate> void Inc(u8 operand);
+    template <bool Accurate> void Dec(u8 operand);
 
     void Add(u8 val);
     void Adc(u8 val);
@@ -83,27 +132,27 @@ private:
 
     void Daa();
 
-    void Push(u8 src);
-    void Pop(u8 dest);
+    template <bool Accurate> void Push(u8 src);
+    template <bool Accurate> void Pop(u8 dest);
 
-    void Rst(u8 opcode);
-    void Call();
-    void Ret();
+    template <bool Accurate> void Rst(u8 opcode);
+    template <bool Accurate> void Call();
+    template <bool Accurate> void Ret();
 
-    void Rlc(u8 operand);
-    void Rl(u8 operand);
-    void Rrc(u8 operand);
-    void Rr(u8 operand);
-    void Sla(u8 operand);
-    void Sra(u8 operand);
-    void Swap(u8 operand);
-    void Srl(u8 operand);
+    template <bool Accurate> void Rlc(u8 operand);
+    template <bool Accurate> void Rl(u8 operand);
+    template <bool Accurate> void Rrc(u8 operand);
+    template <bool Accurate> void Rr(u8 operand);
+    template <bool Accurate> void Sla(u8 operand);
+    template <bool Accurate> void Sra(u8 operand);
+    template <bool Accurate> void Swap(u8 operand);
+    template <bool Accurate> void Srl(u8 operand);
 
-    void Bit(u8 operand, u8 bit);
-    void Res(u8 operand, u8 bit);
-    void Set(u8 operand, u8 bit);
+    template <bool Accurate> void Bit(u8 operand, u8 bit);
+    template <bool Accurate> void Res(u8 operand, u8 bit);
+    template <bool Accurate> void Set(u8 operand, u8 bit);
 
-    u16 AddSPImm8();
+    template <bool Accurate> u16 AddSPImm8();
 
 private:
     static const u8 s_CyclesNormal[0x100];
@@ -142,6 +191,12 @@ private:
 
     Registers m_Reg;
 
+    // Lazy flags, F = 0xB0 after the boot ROM
+    u8 m_FlagZ = 0;
+    bool m_FlagN = false;
+    u8 m_FlagH = 0x10;
+    u16 m_FlagC = 0x100;
+
     bool m_IME = false;
     u8 m_IF = 0;
     u8 m_IE = 0;
@@ -149,4 +204,18 @@ private:
     bool m_Halted = false;
     bool m_Jumped = false;
     bool m_IsCB = false;
+
+    u8 m_Elapsed = 0;       // Cycles the accurate core already advanced this instruction
+    u64 m_Instructions = 0;
+
+    // The last taken backward branch, not part of the machine state
+    bool m_IdleSkip = true;
+    u16 m_IdleBranch = 0;
+    u64 m_IdleTime = 0;
+    u64 m_IdleDeadline = 0;
+    Registers m_IdleRegs;
+    u32 m_IdleRejected = 0;
+    IdleStats m_IdleStats;
+
+    Jit *m_Jit = nullptr;
 };
\ No newline at end of file
@@ -1,59 +1,66 @@
 #include "Cartrige.hpp"
+#include "Hash.hpp"
 #include "Log.hpp"
 
 Cartrige::Cartrige(const std::string &filename)
     : m_Filename(filename)
 {
-    std::ifstream fs(filename, std::ios::binary);
-    if (!fs) {
-        Log::Error("Could not open %s\n", filename.c_str());
+    RomLoadStats stats;
+    m_Image = RomLoader::Load(filename, &stats);
+    if (!m_Image) {
         return;
     }
 
-    fs.seekg(0, std::ios::end);
-    usize romSize = fs.tellg();
-    fs.seekg(0, std::ios::beg);
-
-    m_Rom = std::vector<u8>(romSize);
-    fs.read(reinterpret_cast<char*>(&m_Rom[0]), romSize);
-    fs.close();
-
-    m_Header = reinterpret_cast<CartHeader*>(&m_Rom[0x100]);
-    m_Header->Title[15] = '\0';
+    m_Rom = m_Image->data();
+    m_RomSize = m_Image->size();
+    m_Header = reinterpret_cast<const CartHeader*>(&m_Rom[0x100]);
+    m_RomHash = Hash64(m_Rom, m_RomSize);
 
     if (IsMbc1()) {
         m_RamEnable = false;
         m_RomBankMode = true;
         m_RomBankNumber = 1;
         m_RamBankNumber = 0;
-        m_Ram = std::vector<u8>(0x2000, 0);
+        m_Ram = CowBuffer(0x2000);
     }
 
     if (HasBattery()) {
         LoadBattery();
     }
 
-    Log::Info("Cartridge Loaded:\n");
-    Log::Info("  Title    : %s\n", m_Header->Title);
-    Log::Info("  Type     : %x (%s)\n", m_Header->Type, GetType());
-    Log::Info("  ROM Size : %d KB, (Measured %ld bytes)\n", 32 << m_Header->RomSize, m_Rom.size());
-    Log::Info("  RAM Size : %x, (Measured %ld bytes)\n", m_Header->RamSize, m_Ram.size());
-    Log::Info("  LIC Code : %x, %x (%s)\n", m_Header->OldLicCode, m_Header->NewLicCode, GetLicencee());
-    Log::Info("  ROM Vers : %x\n", m_Header->Version);
-
-    u8 checksum = 0;
-    for (usize addr = 0x134; addr <= 0x14C; addr++) {
-        checksum -= m_Rom[addr] + 1;
-    }
+    LOG_INFO("Cartridge Loaded:\n");
+    LOG_INFO("  Title    : %.15s\n", m_Header->Title);
+    LOG_INFO("  Type     : %x (%s)\n", m_Header->Type, GetTypeName(m_Header->Type));
+    LOG_INFO("  ROM Size : %d KB, (Measured %ld bytes)\n", 32 << m_Header->RomSize, m_RomSize);
+    LOG_INFO("  RAM Size : %x, (Measured %ld bytes)\n", m_Header->RamSize, m_Ram.GetSize());
+    LOG_INFO("  LIC Code : %x, %x (%s)\n", m_Header->OldLicCode, m_Header->NewLicCode, GetLicencee());
+    LOG_INFO("  ROM Vers : %x\n", m_Header->Version);
+    LOG_INFO("  Loaded   : %.3f ms (%s%s, %ld bytes on disk)\n",
+        stats.Millis, RomLoader::GetFormatName(stats.Format), stats.Cached ? ", cached" : "", stats.FileSize);
 
-    if (m_Header->Checksum != (checksum & 0xFF)) {
-        Log::Error("Checksum Test Failed\n");
+    if (m_Header->Checksum != ComputeHeaderChecksum(m_Rom)) {
+        LOG_ERROR("Checksum Test Failed\n");
         return;
     }
 }
 
+Cartrige::Cartrige(const Cartrige &other)
+    : m_Filename(other.m_Filename),
+      m_Image(other.m_Image),
+      m_Rom(other.m_Rom),
+      m_RomSize(other.m_RomSize),
+      m_RomHash(other.m_RomHash),
+      m_Header(other.m_Header),
+      m_Ram(other.m_Ram),
+      m_RomBankNumber(other.m_RomBankNumber),
+      m_RamBankNumber(other.m_RamBankNumber),
+      m_RamEnable(other.m_RamEnable),
+      m_RomBankMode(other.m_RomBankMode),
+      m_OwnsBattery(false)
+{}
+
 Cartrige::~Cartrige() {
-    if (HasBattery()) {
+    if (m_OwnsBattery && m_Header && HasBattery()) {
         SaveBattery();
     }
 }
@@ -72,7 +79,37 @@ void Cartrige::Write(u16 addr, u8 val) {
         return;
     }
 
-    Log::Error("ROM Only Cartrige. Can't Write (addr 0x%04X)\n", addr);
+    LOG_DEBUG_RL(10, "ROM Only Cartrige. Can't Write (addr 0x%04X)\n", addr);
+}
+
+std::string Cartrige::GetTitle() const {
+    if (!m_Header) return {};
+
+    const char *title = reinterpret_cast<const char*>(m_Header->Title);
+    return std::string(title, strnlen(title, 15));
+}
+
+u8 Cartrige::ComputeHeaderChecksum(const u8 *rom) {
+    u8 checksum = 0;
+    for (usize addr = 0x134; addr <= 0x14C; addr++) {
+        checksum -= rom[addr] + 1;
+    }
+
+    return checksum;
+}
+
+u16 Cartrige::ComputeGlobalChecksum(const u8 *rom, usize size) {
+    u16 checksum = 0;
+    for (usize addr = 0; addr < size; addr++) {
+        if (addr == 0x14E || addr == 0x14F) continue;
+        checksum += rom[addr];
+    }
+
+    return checksum;
+}
+
+u16 Cartrige::GetGlobalChecksum(const CartHeader &header) {
+    return static_cast<u16>((header.GlobalChecksum & 0xFF) << 8) | (header.GlobalChecksum >> 8);
 }
 
 bool Cartrige::IsMbc1() const {
@@ -88,25 +125,34 @@ bool Cartrige::HasBattery() const {
 void Cartrige::LoadBattery() {
     std::ifstream fs(m_Filename + ".sav", std::ios::binary);
     if (!fs) {
-        Log::Error("Could not open %s.sav\n", m_Filename.c_str());
+        LOG_ERROR("Could not open %s.sav\n", m_Filename.c_str());
         return;
     }
 
-    fs.read(reinterpret_cast<char*>(&m_Ram[0]), m_Ram.size());
+    std::vector<u8> ram(m_Ram.GetSize(), 0);
+    fs.read(reinterpret_cast<char*>(ram.data()), ram.size());
+    m_Ram.WriteBytes(0, ram.data(), ram.size());
     fs.close();
 }
 
 void Cartrige::SaveBattery() {
     std::ofstream fs(m_Filename + ".sav", std::ios::binary);
     if (!fs) {
-        Log::Error("Could not open %s.sav\n", m_Filename.c_str());
+        LOG_ERROR("Could not open %s.sav\n", m_Filename.c_str());
         return;
     }
 
-    fs.write(reinterpret_cast<char*>(&m_Ram[0]), m_Ram.size());
+    std::vector<u8> ram(m_Ram.GetSize(), 0);
+    m_Ram.ReadBytes(0, ram.data(), ram.size());
+    fs.write(reinterpret_cast<char*>(ram.data()), ram.size());
     fs.close();
 }
 
+// Banks past the end of the RAM wrap around instead of running off it
+usize Cartrige::GetRamOffset(u16 addr) const {
+    return ((addr - 0xA000) + 0x2000 * static_cast<usize>(m_RamBankNumber & 0x3)) % m_Ram.GetSize();
+}
+
 u8 Cartrige::ReadMbc1(u16 addr) const {
     if (0 <= addr && addr <= 0x3FFF) {
         return m_Rom[addr];
@@ -115,13 +161,16 @@ u8 Cartrige::ReadMbc1(u16 addr) const {
     if (0x4000 <= addr && addr <= 0x7FFF) {
         uint32_t realAddr = addr - 0x4000;
         realAddr += 0x4000 * m_RomBankNumber;
-        return m_Rom[realAddr]; 
+
+        // Banks past the end of the ROM wrap around, as the unused bank lines do
+        if (realAddr >= m_RomSize) {
+            realAddr %= m_RomSize;
+        }
+        return m_Rom[realAddr];
     }
 
     if (0xA000 <= addr && addr <= 0xBFFF && m_RamEnable) {
-        addr -= 0xA000;
-        addr += 0x2000 * m_RamBankNumber;
-        return m_Ram[addr];
+        return m_Ram.Read(GetRamOffset(addr));
     }
 
     return 0;
@@ -150,9 +199,7 @@ void Cartrige::WriteMbc1(u16 addr, u8 val) {
     }
 
     if (0xA000 <= addr && addr <= 0xBFFF) {
-        addr -= 0xA000;
-        addr += 0x2000 * m_RamBankNumber;
-        m_Ram[addr] = val;
+        m_Ram.Write(GetRamOffset(addr), val);
     }
 }
 
@@ -375,8 +422,8 @@ const char *Cartrige::GetLicencee() const {
     }
 }
 
-const char *Cartrige::GetType() const {
-    switch (m_Header->Type) {
+const char *Cartrige::GetTypeName(u8 type) {
+    switch (type) {
         case 0x00: return "ROM ONLY";
         case 0x01: return "MBC1";
         case 0x02: return "MBC1+RAM";
@@ -407,4 +454,30 @@ const char *Cartrige::GetType() const {
         case 0xFF: return "HuC1+RAM+BATTERY";
         default: return "(UNDEFINED)";
     }
+}
+
+void Cartrige::Serialize(StateWriter &state) const {
+    state.Write(m_RomBankNumber);
+    state.Write(m_RamBankNumber);
+    state.Write(m_RamEnable);
+    state.Write(m_RomBankMode);
+    state.Write(static_cast<u32>(m_Ram.GetSize()));
+    m_Ram.Serialize(state);
+}
+
+void Cartrige::Deserialize(StateReader &state) {
+    u32 ramSize = 0;
+    state.Read(m_RomBankNumber);
+    state.Read(m_RamBankNumber);
+    state.Read(m_RamEnable);
+    state.Read(m_RomBankMode);
+    state.Read(ramSize);
+
+    if (ramSize != m_Ram.GetSize()) {
+        LOG_ERROR("Save state has %u bytes of cartridge RAM, expected %ld\n", ramSize, m_Ram.GetSize());
+        state.Fail();
+        return;
+    }
+
+    m_Ram.Deserialize(state);
 }
\ No newline at end of file
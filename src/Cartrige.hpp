@@ -1,15 +1,56 @@
 #pragma once
 
 #include "Common.hpp"
+#include "RomLoader.hpp"
+#include "SaveState.hpp"
+#include "CowBuffer.hpp"
+
+// Mapped at 0x0100 - 0x014F of every ROM
+struct CartHeader {
+    u8 Entry[4];
+    u8 Logo[48];
+    u8 Title[16];
+    u16 NewLicCode;
+    u8 SGBFlag;
+    u8 Type;
+    u8 RomSize;
+    u8 RamSize;
+    u8 DestCode;
+    u8 OldLicCode;
+    u8 Version;
+    u8 Checksum;
+    u16 GlobalChecksum; // Big endian
+};
 
 class Cartrige {
 public:
     Cartrige(const std::string &filename);
+    Cartrige(const Cartrige &other);
     ~Cartrige();
 
+    const std::string &GetFilename() const { return m_Filename; }
+    u64 GetRomHash() const { return m_RomHash; }
+
+    // Up to 15 characters, empty if the ROM didn't load
+    std::string GetTitle() const;
+
     u8 Read(u16 addr) const;
     void Write(u16 addr, u8 val);
 
+    // The bank selected at 4000-7FFF, before wrapping to the ROM's size
+    u8 GetRomBank() const { return IsMbc1() ? m_RomBankNumber : 1; }
+
+    static u8 ComputeHeaderChecksum(const u8 *rom);
+    static u16 ComputeGlobalChecksum(const u8 *rom, usize size);
+    static u16 GetGlobalChecksum(const CartHeader &header);
+
+    static const char *GetTypeName(u8 type);
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
+    usize GetPrivateBytes() const { return m_Ram.GetPrivateBytes(); }
+
 private:
     bool IsMbc1() const;
 
@@ -17,38 +58,29 @@ private:
     void LoadBattery();
     void SaveBattery();
 
+    usize GetRamOffset(u16 addr) const;
+
     u8 ReadMbc1(u16 addr) const;
     void WriteMbc1(u16 addr, u8 val);
 
     const char *GetLicencee() const;
-    const char *GetType() const;
 
 private:
     std::string m_Filename;
-    std::vector<u8> m_Rom;
-
-    struct CartHeader {
-        u8 Entry[4];
-        u8 Logo[48];
-        u8 Title[16];
-        u16 NewLicCode;
-        u8 SGBFlag;
-        u8 Type;
-        u8 RomSize;
-        u8 RamSize;
-        u8 DestCode;
-        u8 OldLicCode;
-        u8 Version;
-        u8 Checksum;
-        u16 GlobalChecksum;
-    };
-
-    CartHeader *m_Header;
+    RomImage m_Image;
+    const u8 *m_Rom = nullptr;
+    usize m_RomSize = 0;
+    u64 m_RomHash = 0;
+
+    const CartHeader *m_Header = nullptr;
 
     // MBC1
-    std::vector<u8> m_Ram;
-    u8 m_RomBankNumber;
-    u8 m_RamBankNumber;
-    bool m_RamEnable;
-    bool m_RomBankMode;
+    CowBuffer m_Ram;
+    u8 m_RomBankNumber = 1;
+    u8 m_RamBankNumber = 0;
+    bool m_RamEnable = false;
+    bool m_RomBankMode = true;
+
+    // Only the original instance writes the .sav file, clones just share its RAM
+    bool m_OwnsBattery = true;
 };
\ No newline at end of file
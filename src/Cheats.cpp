@@ -0,0 +1,153 @@
+#include "Cheats.hpp"
+#include "Gameboy.hpp"
+#include "Hash.hpp"
+#include "Log.hpp"
+
+static bool ParseHex(const std::string &digits, usize start, usize count, u16 &val) {
+    val = 0;
+    for (usize i = start; i < start + count; i++) {
+        char c = digits[i];
+        u8 nibble;
+        if ('0' <= c && c <= '9')      nibble = c - '0';
+        else if ('A' <= c && c <= 'F') nibble = c - 'A' + 10;
+        else if ('a' <= c && c <= 'f') nibble = c - 'a' + 10;
+        else return false;
+        val = (val << 4) | nibble;
+    }
+
+    return true;
+}
+
+bool Cheats::Add(const std::string &code) {
+    std::string digits;
+    for (char c : code) {
+        if (c != '-') digits += c;
+    }
+
+    bool ok = false;
+    if (digits.size() == 8 && code.find('-') == std::string::npos) {
+        ok = AddGameShark(digits);
+    } else if (digits.size() == 6 || digits.size() == 9) {
+        ok = AddGameGenie(digits);
+    }
+
+    if (!ok) {
+        LOG_ERROR("Invalid cheat code '%s'\n", code.c_str());
+    }
+
+    return ok;
+}
+
+void Cheats::Clear() {
+    m_RomPatches.clear();
+    m_RamPokes.clear();
+    std::fill(std::begin(m_PatchedPages), std::end(m_PatchedPages), false);
+}
+
+u64 Cheats::GetHash(u64 seed) const {
+    u64 counts[2] = { m_RomPatches.size(), m_RamPokes.size() };
+    seed = Hash64(counts, sizeof(counts), seed);
+
+    // Field by field, the structs have padding
+    for (const RomPatch &patch : m_RomPatches) {
+        u8 fields[] = { static_cast<u8>(patch.Addr), static_cast<u8>(patch.Addr >> 8), patch.Val, patch.HasCompare, patch.Compare };
+        seed = Hash64(fields, sizeof(fields), seed);
+    }
+
+    for (const RamPoke &poke : m_RamPokes) {
+        u8 fields[] = { static_cast<u8>(poke.Addr), static_cast<u8>(poke.Addr >> 8), poke.Val };
+        seed = Hash64(fields, sizeof(fields), seed);
+    }
+
+    return seed;
+}
+
+u8 Cheats::ApplyRomPatches(u16 addr, u8 val) const {
+    for (const RomPatch &patch : m_RomPatches) {
+        if (patch.Addr != addr) continue;
+
+        // With a compare value the patch only hits the bank that holds the original byte
+        if (!patch.HasCompare || patch.Compare == val) return patch.Val;
+    }
+
+    return val;
+}
+
+void Cheats::ApplyRamPokes() {
+    if (m_RamPokes.empty()) return;
+
+    Memory &memory = Gameboy::Get().GetMemory();
+    for (const RamPoke &poke : m_RamPokes) {
+        memory.Write(poke.Addr, poke.Val);
+    }
+}
+
+// ttvvaaaa: type, value, address (little endian). Only type 01, a write to whatever
+// is mapped at the address, is supported; the others pick a RAM bank first.
+bool Cheats::AddGameShark(const std::string &digits) {
+    u16 type, val, addr;
+    if (!ParseHex(digits, 0, 2, type) || !ParseHex(digits, 2, 2, val) || !ParseHex(digits, 4, 4, addr)) {
+        return false;
+    }
+
+    if (type != 0x01) {
+        LOG_ERROR("GameShark: code type %02X is not supported (only 01)\n", type);
+        return false;
+    }
+
+    addr = static_cast<u16>((addr & 0xFF) << 8) | (addr >> 8);
+
+    // Pokes land from inside the PPU's catch-up at VBlank. OAM and the registers
+    // would catch the PPU up again from there, so only plain RAM can be poked.
+    bool ram = (addr >= 0xA000 && addr < 0xFE00) || (addr >= 0xFF80 && addr < 0xFFFF);
+    if (!ram) {
+        LOG_ERROR("GameShark: %04X is not in RAM\n", addr);
+        return false;
+    }
+
+    m_RamPokes.push_back({ addr, static_cast<u8>(val) });
+    LOG_INFO("GameShark: [0x%04X] = 0x%02X every frame\n", addr, val);
+    return true;
+}
+
+// ABC-DEF-GHI: AB value, FCDE ^ 0xF000 address, ror(GI, 2) ^ 0xBA compare, H unused
+bool Cheats::AddGameGenie(const std::string &digits) {
+    u16 val, c, d, e, f;
+    if (!ParseHex(digits, 0, 2, val) || !ParseHex(digits, 2, 1, c) || !ParseHex(digits, 3, 1, d) ||
+        !ParseHex(digits, 4, 1, e) || !ParseHex(digits, 5, 1, f))
+    {
+        return false;
+    }
+
+    RomPatch patch;
+    patch.Addr = static_cast<u16>(((f ^ 0xF) << 12) | (c << 8) | (d << 4) | e);
+    patch.Val = static_cast<u8>(val);
+    patch.HasCompare = false;
+    patch.Compare = 0;
+
+    if (patch.Addr >= 0x8000) {
+        return false;
+    }
+
+    if (digits.size() == 9) {
+        u16 g, h, i;
+        if (!ParseHex(digits, 6, 1, g) || !ParseHex(digits, 7, 1, h) || !ParseHex(digits, 8, 1, i)) {
+            return false;
+        }
+
+        u8 gi = static_cast<u8>((g << 4) | i);
+        patch.HasCompare = true;
+        patch.Compare = static_cast<u8>((gi >> 2) | (gi << 6)) ^ 0xBA;
+    }
+
+    m_RomPatches.push_back(patch);
+    m_PatchedPages[patch.Addr >> 8] = true;
+
+    if (patch.HasCompare) {
+        LOG_INFO("Game Genie: [0x%04X] 0x%02X -> 0x%02X\n", patch.Addr, patch.Compare, patch.Val);
+    } else {
+        LOG_INFO("Game Genie: [0x%04X] -> 0x%02X\n", patch.Addr, patch.Val);
+    }
+
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Common.hpp"
+
+// GameShark RAM pokes and Game Genie ROM substitutions. ROM patches are looked
+// up only on pages that carry one, so Memory::Read pays a single flag test per
+// ROM access and unpatched pages keep the plain path.
+class Cheats {
+public:
+    // Accepts GameShark (01vvaaaa) and Game Genie (ABC-DEF or ABC-DEF-GHI) codes
+    bool Add(const std::string &code);
+    void Clear();
+
+    bool IsEmpty() const { return m_RomPatches.empty() && m_RamPokes.empty(); }
+
+    // Of every active code, for caches of states they shaped
+    u64 GetHash(u64 seed) const;
+
+    bool IsPatched(u16 addr) const { return m_PatchedPages[addr >> 8]; }
+    u8 ApplyRomPatches(u16 addr, u8 val) const;
+
+    // Called once per frame at VBlank, from inside PPU::Sync. Only RAM is poked.
+    void ApplyRamPokes();
+
+private:
+    bool AddGameShark(const std::string &digits);
+    bool AddGameGenie(const std::string &digits);
+
+private:
+    struct RomPatch {
+        u16 Addr;
+        u8 Val;
+        bool HasCompare;
+        u8 Compare;
+    };
+
+    struct RamPoke {
+        u16 Addr;
+        u8 Val;
+    };
+
+    std::vector<RomPatch> m_RomPatches;
+    std::vector<RamPoke> m_RamPokes;
+
+    bool m_PatchedPages[0x80] = {};
+};
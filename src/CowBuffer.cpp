@@ -0,0 +1,78 @@
+#include "CowBuffer.hpp"
+
+#include <cstring>
+
+CowBuffer::CowBuffer(usize size)
+    : m_Size(size)
+{
+    usize count = (size + s_PageMask) >> s_PageBits;
+    m_Pages.reserve(count);
+    m_Data.reserve(count);
+
+    for (usize i = 0; i < count; i++) {
+        m_Pages.push_back(std::make_shared<Page>());
+        m_Pages.back()->fill(0);
+        m_Data.push_back(m_Pages.back()->data());
+    }
+}
+
+void CowBuffer::ReadBytes(usize addr, void *data, usize size) const {
+    u8 *out = static_cast<u8*>(data);
+    while (size > 0) {
+        usize offset = addr & s_PageMask;
+        usize count = std::min(size, s_PageSize - offset);
+        memcpy(out, m_Data[addr >> s_PageBits] + offset, count);
+
+        out += count;
+        addr += count;
+        size -= count;
+    }
+}
+
+void CowBuffer::WriteBytes(usize addr, const void *data, usize size) {
+    const u8 *in = static_cast<const u8*>(data);
+    while (size > 0) {
+        usize page = addr >> s_PageBits;
+        usize offset = addr & s_PageMask;
+        usize count = std::min(size, s_PageSize - offset);
+
+        // Restoring a state mostly writes back what is already there
+        if (memcmp(m_Data[page] + offset, in, count) != 0) {
+            if (IsShared(page)) Unshare(page);
+            memcpy(m_Data[page] + offset, in, count);
+        }
+
+        in += count;
+        addr += count;
+        size -= count;
+    }
+}
+
+void CowBuffer::Serialize(StateWriter &state) const {
+    for (usize addr = 0; addr < m_Size; addr += s_PageSize) {
+        state.WriteBytes(m_Data[addr >> s_PageBits], std::min(s_PageSize, m_Size - addr));
+    }
+}
+
+void CowBuffer::Deserialize(StateReader &state) {
+    Page page;
+    for (usize addr = 0; addr < m_Size; addr += s_PageSize) {
+        usize size = std::min(s_PageSize, m_Size - addr);
+        if (!state.ReadBytes(page.data(), size)) return;
+        WriteBytes(addr, page.data(), size);
+    }
+}
+
+usize CowBuffer::GetPrivateBytes() const {
+    usize bytes = 0;
+    for (const std::shared_ptr<Page> &page : m_Pages) {
+        if (page.use_count() == 1) bytes += s_PageSize;
+    }
+
+    return bytes;
+}
+
+void CowBuffer::Unshare(usize page) {
+    m_Pages[page] = std::make_shared<Page>(*m_Pages[page]);
+    m_Data[page] = m_Pages[page]->data();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SaveState.hpp"
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+// Byte buffer made of 256-byte pages. Copies share every page and a page is only
+// duplicated when one side writes to it while the other still holds it, so
+// clones that barely diverge barely cost memory. Reads are one extra indirection.
+//
+// One buffer is used by one thread at a time, but its copies may be on other
+// threads. A page is written in place only once every other holder dropped it,
+// see IsShared.
+class CowBuffer {
+public:
+    static constexpr usize s_PageBits = 8;
+    static constexpr usize s_PageSize = 1 << s_PageBits;
+    static constexpr usize s_PageMask = s_PageSize - 1;
+
+    explicit CowBuffer(usize size = 0);
+
+    usize GetSize() const { return m_Size; }
+
+    u8 Read(usize addr) const {
+        return m_Data[addr >> s_PageBits][addr & s_PageMask];
+    }
+
+    void Write(usize addr, u8 val) {
+        usize page = addr >> s_PageBits;
+        if (IsShared(page)) [[unlikely]] Unshare(page);
+        m_Data[page][addr & s_PageMask] = val;
+    }
+
+    void ReadBytes(usize addr, void *data, usize size) const;
+    void WriteBytes(usize addr, const void *data, usize size);
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
+    // Bytes held by pages nobody else references
+    usize GetPrivateBytes() const;
+
+private:
+    // use_count() is a relaxed load. When it says we are the last holder, the fence
+    // pairs with the release in the other holder's decrement, so its last reads of
+    // the page (copying it away) happen before our writes. Free on x86.
+    bool IsShared(usize page) const {
+        if (m_Pages[page].use_count() != 1) return true;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return false;
+    }
+
+    void Unshare(usize page);
+
+private:
+    using Page = std::array<u8, s_PageSize>;
+
+    usize m_Size = 0;
+    std::vector<std::shared_ptr<Page>> m_Pages;
+    std::vector<u8*> m_Data;
+};
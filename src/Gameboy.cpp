@@ -1,20 +1,81 @@
 #include "Gameboy.hpp"
 #include "Log.hpp"
-
-Gameboy *Gameboy::s_Gameboy = nullptr;
+#include "RomIndex.hpp"
+#include "Bench.hpp"
+#include "StateHash.hpp"
+#include "WarmStart.hpp"
 
 Gameboy::Gameboy(int argc, char **argv)
     : m_Cartrige(std::string(argv[1]))
 {
-    if (argc == 1 || argc > 3) {
-        Log::Error("Wrong number of arguments!\n");
+    if (argc == 1) {
+        LOG_ERROR("Wrong number of arguments!\n");
         return;
     }
 
-    if (argc == 3) {
-        std::string mainColor(argv[2]);
-        if (mainColor.size() == 2 && mainColor[0] == '-') {
-            switch (mainColor[1]) {
+    m_PPU.SetColors(0xFFFFFF);
+
+    // Rewind is opt-in (--rewind <MB>), it costs a snapshot every interval frames
+    usize rewindMB = 0;
+    u32 rewindInterval = 2;
+    std::string hashLogPath;
+    WarmStart warmStart;
+    bool useWarmStart = false;
+    std::string trajectoryPrefix;
+    std::vector<u16> trajectoryRam;
+    std::string audioCapturePath;
+    m_AccurateTiming = NeedsAccurateTiming(m_Cartrige.GetTitle());
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        if (arg == "--cheat") {
+            if (i + 1 >= argc) {
+                LOG_ERROR("--cheat needs a GameShark (01VVAAAA) or Game Genie (ABC-DEF[-GHI]) code\n");
+                break;
+            }
+
+            m_Cheats.Add(argv[++i]);
+        } else if (arg == "--record" && i + 1 < argc) {
+            m_MoviePath = argv[++i];
+        } else if (arg == "--run-ahead" && i + 1 < argc) {
+            SetRunAhead(std::stoul(argv[++i]));
+        } else if (arg == "--warm-start" && i + 1 < argc) {
+            useWarmStart = warmStart.Parse(argv[++i]);
+        } else if (arg == "--trajectory" && i + 1 < argc) {
+            trajectoryPrefix = argv[++i];
+        } else if (arg == "--trajectory-ram" && i + 1 < argc) {
+            TrajectoryWriter::ParseAddresses(argv[++i], trajectoryRam);
+        } else if (arg == "--hash-log" && i + 1 < argc) {
+            hashLogPath = argv[++i];
+        } else if (arg == "--audio-rate" && i + 1 < argc) {
+            u32 rate = std::strtoul(argv[++i], nullptr, 10);
+            if (rate == 0 || (rate >= APU::s_MinSampleRate && rate <= APU::s_MaxSampleRate)) {
+                m_AudioRate = rate;
+            } else {
+                LOG_ERROR("--audio-rate must be 0 (no sound) or %u-%u Hz\n", APU::s_MinSampleRate, APU::s_MaxSampleRate);
+            }
+        } else if (arg == "--audio-capture" && i + 1 < argc) {
+            audioCapturePath = argv[++i];
+        } else if (arg == "--timing" && i + 1 < argc) {
+            std::string timing(argv[++i]);
+            if (timing == "fast" || timing == "accurate") {
+                m_AccurateTiming = (timing == "accurate");
+            } else {
+                LOG_ERROR("--timing must be 'fast' or 'accurate'\n");
+            }
+        } else if (arg == "--idle-skip" && i + 1 < argc) {
+            m_CPU.SetIdleSkip(std::stoul(argv[++i]) != 0);
+        } else if (arg == "--jit" && i + 1 < argc) {
+            SetJit(std::stoul(argv[++i]) != 0);
+        } else if (arg == "--speed" && i + 1 < argc) {
+            m_Pacer.SetSpeed(std::stod(argv[++i]));
+        } else if (arg == "--rewind" && i + 1 < argc) {
+            rewindMB = std::stoul(argv[++i]);
+        } else if (arg == "--rewind-interval" && i + 1 < argc) {
+            rewindInterval = std::stoul(argv[++i]);
+        } else if (arg.size() == 2 && arg[0] == '-') {
+            switch (arg[1]) {
                 case 'r': m_PPU.SetColors(0xFF0000); break;
                 case 'g': m_PPU.SetColors(0x00FF00); break;
                 case 'b': m_PPU.SetColors(0x0000FF); break;
@@ -22,39 +83,230 @@ Gameboy::Gameboy(int argc, char **argv)
                 case 'c': m_PPU.SetColors(0x00FFFF); break;
                 case 'm': m_PPU.SetColors(0xFF00FF); break;
                 default: {
-                    Log::Error("Wrong format of 2nd argument!\n(Must be -[Color] where [Color] is one of 'r', 'g', 'b', 'y', 'c', 'm')\n");
+                    LOG_ERROR("Wrong format of color argument!\n(Must be -[Color] where [Color] is one of 'r', 'g', 'b', 'y', 'c', 'm')\n");
                     break;
                 }
             }
         } else {
-            Log::Error("Wrong format of 2nd argument!\n(Must be -[Color] where [Color] is one of 'r', 'g', 'b', 'y', 'c', 'm')\n");
+            LOG_ERROR("Unknown argument '%s'\n", arg.c_str());
         }
-    } else {
-        m_PPU.SetColors(0xFFFFFF);
+    }
+
+    // Rewinding would make the recording disagree with what was played
+    if (!m_MoviePath.empty()) {
+        rewindMB = 0;
     }
 
     s_Gameboy = this;
+
+    auto powerOn = std::make_shared<std::vector<u8>>();
+    SaveState(*powerOn);
+    m_PowerOnState = std::move(powerOn);
+
+    if (useWarmStart) {
+        warmStart.Apply(*this);
+    }
+
+    // After the warm start, whose frames are nothing to rewind to
+    if (rewindMB > 0) {
+        m_Rewind.Configure(rewindMB, rewindInterval, 500.0);
+    }
+
+    if (!hashLogPath.empty()) {
+        m_StateHashLog.Open(hashLogPath, m_Cartrige.GetRomHash());
+    }
+
+    if (!trajectoryPrefix.empty()) {
+        m_Trajectory.Open(trajectoryPrefix, trajectoryRam);
+    }
+
+    if (!audioCapturePath.empty() && m_AudioRate > 0 && m_Audio.OpenCapture(audioCapturePath, m_AudioRate)) {
+        m_APU.SetSampleRate(m_AudioRate);
+    }
+}
+
+Gameboy::Gameboy(const Gameboy &other)
+    : m_Memory(other.m_Memory),
+      m_CPU(other.m_CPU),
+      m_PPU(other.m_PPU),
+      m_Cartrige(other.m_Cartrige),
+      m_Timer(other.m_Timer),
+      m_Serial(other.m_Serial),
+      m_APU(other.m_APU),
+      m_UI(other.m_UI),
+      m_Cheats(other.m_Cheats),
+      m_Ticks(other.m_Ticks),
+      m_AccurateTiming(other.m_AccurateTiming),
+      m_IsClone(true),
+      m_PowerOnState(other.m_PowerOnState),
+      m_RunAheadFrames(other.m_RunAheadFrames),
+      m_RunAheadFramebuffer(other.m_RunAheadFramebuffer)
+{
+    // Whatever the original is plugged into stays with it
+    m_Serial.SetDevice(std::make_shared<DebugSerial>());
+    m_APU.SetSampleRate(0);
+
+    // The copied CPU still points at the original's blocks
+    m_CPU.SetJit(nullptr);
+    SetJit(other.m_JitEnabled);
+}
+
+Gameboy::~Gameboy() {
+    if (!m_IsClone) {
+        m_Memory.DumpProbe(m_Cartrige.GetFilename());
+    }
+}
+
+std::unique_ptr<Gameboy> Gameboy::Clone() const {
+    return std::unique_ptr<Gameboy>(new Gameboy(*this));
+}
+
+usize Gameboy::GetPrivateBytes() const {
+    usize bytes = sizeof(Gameboy) + m_Memory.GetPrivateBytes() + m_Cartrige.GetPrivateBytes();
+    if (!m_PPU.IsFramebufferShared()) {
+        bytes += m_PPU.GetFramebuffer().size() * sizeof(u32);
+    }
+
+    return bytes;
+}
+
+// ROMs that time memory accesses within an instruction, by header title
+bool Gameboy::NeedsAccurateTiming(const std::string &title) {
+    static const char *s_Titles[] = { "MEM_TIMING", "MEM_TIMING_2", "INSTR_TIMING" };
+
+    for (const char *accurate : s_Titles) {
+        if (title == accurate) return true;
+    }
+
+    return false;
+}
+
+template <bool Accurate>
+void Gameboy::Step() {
+    Advance(m_CPU.Step<Accurate>());
+}
+
+void Gameboy::Advance(u32 cycles) {
+    m_Ticks += cycles;
+
+    m_Serial.Tick(cycles);
+
+    if (m_Ticks >= m_PPU.GetNextEvent()) {
+        m_PPU.Sync(m_Ticks);
+    }
+
+    if (m_Ticks >= m_Timer.GetNextOverflow()) {
+        m_Timer.Sync(m_Ticks);
+    }
+}
+
+bool Gameboy::SetJit(bool enabled) {
+    if (enabled && MemoryProbe::Enabled) {
+        LOG_WARN("JIT: not available with the memory probe\n");
+        enabled = false;
+    }
+
+    if (enabled && !m_Jit) {
+        m_Jit = std::make_unique<Jit>(m_CPU);
+    }
+
+    if (enabled && !m_Jit->IsAvailable()) {
+        enabled = false;
+    }
+
+    m_JitEnabled = enabled;
+    m_CPU.SetJit(enabled ? m_Jit.get() : nullptr);
+    return enabled;
+}
+
+u64 Gameboy::GetIdleDeadline(bool readsPPU) {
+    u64 deadline = std::min({ m_BlankFrameEnd, m_PPU.GetNextEvent(), m_Timer.GetNextOverflow() });
+    if (m_Serial.GetPendingCycles() > 0) {
+        deadline = std::min(deadline, m_Ticks + m_Serial.GetPendingCycles());
+    }
+
+    if (readsPPU) {
+        m_PPU.Sync(m_Ticks);
+        deadline = std::min(deadline, m_PPU.GetNextModeChange());
+    }
+
+    return deadline;
+}
+
+void Gameboy::OnFrame() {
+    m_APU.Sync(m_Ticks);
+    m_Audio.OnFrame(m_APU, m_Pacer.GetSpeed() == 1.0);
+
+    m_UI.LatchInput();
+
+    // What a linked peer was sent can't be taken back, and rewind and run-ahead both
+    // load states. They pick up again once the cable is gone.
+    bool linked = m_Serial.IsLinked();
+
+    // Neither can the inputs a movie recorded. Run-ahead is fine, it ends where it began.
+    bool rewind = !linked && !m_Movie.IsRecording();
+
+    m_Movie.OnFrame();
+    if (rewind) m_Rewind.OnFrame();
+    m_StateHashLog.OnFrame();
+    m_Trajectory.OnFrame();
+
+    if (m_RunAheadFrames > 0 && !linked) {
+        RunAhead();
+    }
+}
+
+// A frame's worth of cycles went by with the LCD off, sound still has to flow
+void Gameboy::OnBlankFrame() {
+    m_PPU.Sync(m_Ticks);
+    m_APU.Sync(m_Ticks);
+    m_Audio.OnFrame(m_APU, m_Pacer.GetSpeed() == 1.0);
+}
+
+void Gameboy::SetRunAhead(u32 frames) {
+    m_RunAheadFrames = frames;
+    m_RunAheadFramebuffer = m_PPU.GetFramebuffer();
+}
+
+// Speculative frames don't call OnFrame: no input latch, recording or rewind capture
+void Gameboy::RunAhead() {
+    usize frame = m_PPU.GetCurrentFrame();
+
+    SaveState(m_RunAheadState);
+
+    // The channels run as usual, only the samples are thrown away
+    m_APU.SetSynthesis(false);
+    for (u32 i = 0; i < m_RunAheadFrames; i++) {
+        m_PPU.SetRendering(i + 1 == m_RunAheadFrames);
+        RunUntilVBlank();
+    }
+
+    m_APU.SetSynthesis(true);
+    m_RunAheadFramebuffer = m_PPU.GetFramebuffer();
+
+    LoadState(m_RunAheadState.data(), m_RunAheadState.size(), true);
+    m_PPU.SetCurrentFrame(frame);
 }
 
 void Gameboy::Run() {
-    std::future<void> cpuThread = std::async(std::launch::async, [this] {
-        while (!m_Quit) {
-            std::unique_lock<std::mutex> lock(m_Mtx);
+    Bind();
+    m_UI.Open();
 
-            u8 cycles = m_CPU.Step();
-            m_Ticks += cycles;
+    if (m_AudioRate > 0 && m_Audio.OpenDevice(m_AudioRate) && m_APU.GetSampleRate() != m_AudioRate) {
+        m_APU.SetSampleRate(m_AudioRate);
+    }
 
-            m_PPU.Tick(cycles);
-            m_Timer.Tick(cycles);
+    if (!m_MoviePath.empty()) {
+        m_Movie.StartRecording(m_MoviePath);
+    }
 
-            // Debug
-            if (m_Memory.Read(0xFF02) == 0x81) {
-                char c = m_Memory.Read(0xFF01);
-                m_DebugMessage << c;
-                m_Memory.Write(0xFF02, 0);
-            }
+    std::future<void> cpuThread = std::async(std::launch::async, [this] {
+        Bind();
 
-            m_Cond.notify_one();
+        if (m_AccurateTiming) {
+            RunCPU<true>();
+        } else {
+            RunCPU<false>();
         }
     });
 
@@ -67,12 +319,348 @@ void Gameboy::Run() {
 
         m_Cond.wait(lock, [this, prevFrame] { return prevFrame == m_PPU.GetCurrentFrame(); });
 
-        m_UI.Update(m_PPU.GetFramebuffer());
+        m_UI.Update(GetPresentedFramebuffer());
 
         prevFrame++;
     }
+
+    cpuThread.wait();
+    m_Movie.StopRecording();
+
+    PacerStats pacing = m_Pacer.GetStats();
+    if (pacing.TargetMs > 0 && pacing.Frames > 0) {
+        LOG_INFO("Pacing: %lu frames at %.2fx, frame time %.3f ms (target %.3f ms), jitter %.3f ms, max error %.3f ms, %lu late\n",
+            pacing.Frames, m_Pacer.GetSpeed(), pacing.MeanMs, pacing.TargetMs, pacing.JitterMs, pacing.MaxErrorMs, pacing.Late);
+    }
+
+    AudioStats audio = m_Audio.GetStats();
+    if (audio.Frames > 0) {
+        LOG_INFO("Audio: %.1f s played, latency %.1f ms (max %.1f ms), %lu underruns, %lu frames dropped, rate adjust %+.3f%%\n",
+            double(audio.Frames) / m_AudioRate, audio.LatencyMs, audio.MaxLatencyMs, audio.Underruns, audio.Dropped, audio.RateAdjust);
+    }
+
+    if (m_Rewind.IsEnabled()) {
+        const RewindStats &stats = m_Rewind.GetStats();
+        LOG_INFO("Rewind: %lu snapshots in %.2f MB (%.1fx smaller), capture avg %.1f us / max %.1f us every %u frames\n",
+            stats.Snapshots, stats.BytesUsed / (1024.0 * 1024.0), stats.BytesUsed ? double(stats.RawBytes) / stats.BytesUsed : 0.0,
+            stats.AvgCaptureUs, stats.MaxCaptureUs, stats.Interval);
+    }
+
+    if (m_Jit) {
+        const JitStats &stats = m_Jit->GetStats();
+        LOG_INFO("JIT: %lu blocks compiled (%lu rejected, %lu invalidated, %lu flushes), %lu runs, %.1f%% of instructions compiled\n",
+            stats.Compiled, stats.Rejected, stats.Invalidated, stats.Flushes, stats.Runs,
+            m_CPU.GetInstructionCount() ? 100.0 * stats.Instructions / m_CPU.GetInstructionCount() : 0.0);
+    }
+}
+
+template <bool Accurate>
+void Gameboy::RunCPU() {
+    // A scanline more than a frame, so it never fires just ahead of a VBlank
+    static constexpr u32 s_BlankFrameCycles = s_CyclesPerFrame + 456;
+
+    usize frame = m_PPU.GetCurrentFrame();
+    u64 frameStart = m_Ticks;
+    m_BlankFrameEnd = frameStart + s_BlankFrameCycles;
+    while (!m_Quit) {
+        bool frameDone = false;
+        {
+            std::unique_lock<std::mutex> lock(m_Mtx);
+
+            Step<Accurate>();
+
+            if (m_PPU.GetCurrentFrame() != frame) {
+                frame = m_PPU.GetCurrentFrame();
+                OnFrame();
+                frameDone = true;
+            } else if (m_Ticks >= frameStart + s_BlankFrameCycles) {
+                OnBlankFrame();
+                frameDone = true;
+            }
+
+            if (frameDone) {
+                frameStart = m_Ticks;
+                m_BlankFrameEnd = frameStart + s_BlankFrameCycles;
+            }
+
+            m_Cond.notify_one();
+        }
+
+        // Outside the lock, the UI thread presents and reads input meanwhile. At 1x
+        // the sound card is the clock once it plays.
+        if (frameDone) {
+            if (m_Audio.IsPlaying() && m_Pacer.GetSpeed() == 1.0) {
+                m_Audio.WaitForSpace();
+            } else {
+                m_Pacer.WaitForNextFrame();
+            }
+        }
+    }
+}
+
+template <bool Accurate>
+bool Gameboy::RunUntilVBlank() {
+    usize frame = m_PPU.GetCurrentFrame();
+    m_BlankFrameEnd = m_Ticks + 2 * s_CyclesPerFrame;
+
+    // VBlanks are s_CyclesPerFrame apart give or take an instruction, the cap is only
+    // reached while the LCD is off
+    while (m_PPU.GetCurrentFrame() == frame && m_Ticks < m_BlankFrameEnd) {
+        Step<Accurate>();
+    }
+
+    return m_PPU.GetCurrentFrame() != frame;
+}
+
+// The core is chosen once per frame, the fast one has no per-instruction check
+bool Gameboy::RunUntilVBlank() {
+    return m_AccurateTiming ? RunUntilVBlank<true>() : RunUntilVBlank<false>();
+}
+
+void Gameboy::RunFrame() {
+    Bind();
+
+    if (RunUntilVBlank()) {
+        OnFrame();
+    } else {
+        OnBlankFrame();
+    }
+}
+
+void Gameboy::WriteState(StateWriter &state) const {
+    const Joypad &joypad = m_UI.GetJoypad();
+
+    state.BeginSection(StateFormat::MakeTag("MACH"));
+    state.Write(m_Ticks);
+    state.Write(joypad.Action);
+    state.Write(joypad.Directon);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("CPU "));
+    m_CPU.Serialize(state);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("MEM "));
+    m_Memory.Serialize(state);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("PPU "));
+    m_PPU.Serialize(state);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("TIMR"));
+    m_Timer.Serialize(state);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("CART"));
+    m_Cartrige.Serialize(state);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("SERL"));
+    m_Serial.Serialize(state);
+    state.EndSection();
+
+    state.BeginSection(StateFormat::MakeTag("APU "));
+    m_APU.Serialize(state);
+    state.EndSection();
+}
+
+bool Gameboy::ReadState(StateReader &state) {
+    Joypad &joypad = m_UI.GetJoypad();
+
+    if (state.BeginSection(StateFormat::MakeTag("MACH"))) {
+        state.Read(m_Ticks);
+        state.Read(joypad.Action);
+        state.Read(joypad.Directon);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("CPU "))) {
+        m_CPU.Deserialize(state);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("MEM "))) {
+        m_Memory.Deserialize(state);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("PPU "))) {
+        m_PPU.Deserialize(state);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("TIMR"))) {
+        m_Timer.Deserialize(state);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("CART"))) {
+        m_Cartrige.Deserialize(state);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("SERL"))) {
+        m_Serial.Deserialize(state);
+        state.EndSection();
+    }
+
+    if (state.BeginSection(StateFormat::MakeTag("APU "))) {
+        m_APU.Deserialize(state);
+        state.EndSection();
+    }
+
+    return state.IsOk();
+}
+
+bool Gameboy::Reset() {
+    if (!LoadState(m_PowerOnState->data(), m_PowerOnState->size(), true)) return false;
+
+    m_PPU.SetCurrentFrame(0);
+    return true;
+}
+
+bool Gameboy::SaveState(std::vector<u8> &buffer) {
+    // The PPU, the APU and the timer lag behind until something syncs them
+    m_PPU.Sync(m_Ticks);
+    m_APU.Sync(m_Ticks);
+    m_Timer.Sync(m_Ticks);
+
+    StateWriter state(buffer);
+
+    StateFormat::Header header = { StateFormat::s_Magic, StateFormat::s_Version, StateFormat::s_Sections, m_Cartrige.GetRomHash() };
+    state.Write(header);
+    WriteState(state);
+
+    state.Finish();
+    return true;
+}
+
+bool Gameboy::LoadState(const u8 *data, usize size, bool internal) {
+    if (m_Serial.IsLinked()) {
+        LOG_ERROR("States can't be loaded while the link cable is connected\n");
+        return false;
+    }
+
+    // The movie would go on from somewhere its inputs don't lead to
+    if (m_Movie.IsRecording() && !internal) {
+        LOG_ERROR("States can't be loaded while a movie is recording\n");
+        return false;
+    }
+
+    StateReader state(data, size);
+
+    StateFormat::Header header;
+    if (!state.Read(header) || header.Magic != StateFormat::s_Magic) {
+        LOG_ERROR("Not a save state\n");
+        return false;
+    }
+
+    if (header.Version != StateFormat::s_Version || header.Sections != StateFormat::s_Sections) {
+        LOG_ERROR("Save state version %u is not supported (expected %u)\n", header.Version, StateFormat::s_Version);
+        return false;
+    }
+
+    if (header.RomHash != m_Cartrige.GetRomHash()) {
+        LOG_ERROR("Save state was made with a different ROM\n");
+        return false;
+    }
+
+    if (internal) {
+        return ReadState(state);
+    }
+
+    // Sections that don't add up to the whole state are caught before touching anything
+    StateReader layout = state;
+    for (u16 i = 0; i < header.Sections; i++) {
+        layout.SkipSection();
+    }
+
+    if (!layout.IsOk() || layout.GetPosition() != size) {
+        LOG_ERROR("Save state is corrupted\n");
+        return false;
+    }
+
+    // A section whose contents don't match what a component expects is only found
+    // while reading it, which must not leave the machine half loaded
+    StateWriter undo(m_UndoBuffer);
+    WriteState(undo);
+    undo.Finish();
+
+    if (!ReadState(state)) {
+        StateReader restore(m_UndoBuffer.data(), m_UndoBuffer.size());
+        ReadState(restore);
+
+        LOG_ERROR("Save state is corrupted\n");
+        return false;
+    }
+
+    return true;
+}
+
+std::string Gameboy::GetSlotPath(const std::string &name) const {
+    return m_Cartrige.GetFilename() + "." + name + ".state";
+}
+
+bool Gameboy::SaveStateSlot(const std::string &name) {
+    SaveState(m_StateBuffer);
+
+    std::string path = GetSlotPath(name);
+    std::ofstream fs(path, std::ios::binary);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    fs.write(reinterpret_cast<const char*>(m_StateBuffer.data()), m_StateBuffer.size());
+    LOG_INFO("Saved state to slot %s (%ld bytes)\n", name.c_str(), m_StateBuffer.size());
+    return true;
+}
+
+bool Gameboy::LoadStateSlot(const std::string &name) {
+    std::string path = GetSlotPath(name);
+    std::ifstream fs(path, std::ios::binary | std::ios::ate);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    m_StateBuffer.resize(fs.tellg());
+    fs.seekg(0);
+    fs.read(reinterpret_cast<char*>(m_StateBuffer.data()), m_StateBuffer.size());
+
+    if (!LoadState(m_StateBuffer.data(), m_StateBuffer.size())) {
+        return false;
+    }
+
+    LOG_INFO("Loaded state from slot %s\n", name.c_str());
+    return true;
 }
 
 int main(int argc, char **argv) {
+    if (argc >= 2 && std::string(argv[1]) == "--index") {
+        return RomIndex::RunTool(argc, argv);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--play") {
+        return Movie::RunTool(argc, argv);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--bench") {
+        return Bench::RunTool(argc, argv);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--check") {
+        return Bench::RunChecks(argc, argv);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--hash") {
+        return StateHashLog::RunTool(argc, argv);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--compare-hashes") {
+        return StateHashLog::RunCompareTool(argc, argv);
+    }
+
     Gameboy(argc, argv).Run();
 }
\ No newline at end of file
@@ -5,29 +5,133 @@
 #include "PPU.hpp"
 #include "Memory.hpp"
 #include "Timer.hpp"
+#include "Serial.hpp"
+#include "APU.hpp"
 #include "UI.hpp"
 #include "Cartrige.hpp"
+#include "Cheats.hpp"
+#include "Rewind.hpp"
+#include "Movie.hpp"
+#include "StateHash.hpp"
+#include "Trajectory.hpp"
+#include "Pacer.hpp"
+#include "AudioOutput.hpp"
+#include "Jit.hpp"
 
 class Gameboy {
 public:
     Gameboy(int argc, char **argv);
-    ~Gameboy() = default;
+    ~Gameboy();
 
+    // The instance the components on this thread belong to. RunFrame and Run bind
+    // it, so independent instances (clones) can run on the same or other threads.
     static Gameboy &Get() { return *s_Gameboy; }
+    void Bind() { s_Gameboy = this; }
+
+    // Independent copy sharing the ROM and, until either side writes, all RAM pages.
+    // Clones have no window, rewind buffer or movie.
+    std::unique_ptr<Gameboy> Clone() const;
+
+    // Memory only this instance holds (unshared pages and the object itself)
+    usize GetPrivateBytes() const;
 
     void Quit() { m_Quit = true; }
 
+    // Machine cycles since power on
+    u64 GetTicks() const { return m_Ticks; }
+
+    // Moves everything but the CPU `cycles` ahead. Once per instruction with the fast
+    // core, once per M-cycle with the accurate one.
+    void Advance(u32 cycles);
+
+    // Until when nothing a polling loop reads can change: the PPU's next event (the
+    // next mode change too if it reads STAT or LY), timer overflow, the end of a
+    // serial transfer, or the frame loop giving up on a VBlank
+    u64 GetIdleDeadline(bool readsPPU);
+
+    // Picked per ROM at startup (--timing fast|accurate overrides it). The fast core
+    // times whole instructions, the accurate one every memory access, which the
+    // ROMs that measure it need and everything else pays for.
+    bool IsAccurateTiming() const { return m_AccurateTiming; }
+    void SetAccurateTiming(bool accurate) { m_AccurateTiming = accurate; }
+
+    // Compiling hot ROM code to x86-64 for the fast core, off by default (--jit 0|1,
+    // 'j' while running). Fails where executable memory can't be had, and with the
+    // memory probe, which has to see every instruction.
+    bool SetJit(bool enabled);
+    bool IsJitEnabled() const { return m_JitEnabled; }
+    const Jit *GetJit() const { return m_Jit.get(); }
+
     Cartrige &GetCartrige() { return m_Cartrige; }
     CPU      &GetCPU()      { return m_CPU;      }
     PPU      &GetPPU()      { return m_PPU;      }
     Timer    &GetTimer()    { return m_Timer;    }
+    Serial   &GetSerial()   { return m_Serial;   }
+    APU      &GetAPU()      { return m_APU;      }
     UI       &GetUI()       { return m_UI;       }
     Memory   &GetMemory()   { return m_Memory;   }
+    Cheats   &GetCheats()   { return m_Cheats;   }
+    Rewind   &GetRewind()   { return m_Rewind;   }
+    Movie    &GetMovie()    { return m_Movie;    }
+
+    StateHashLog &GetStateHashLog() { return m_StateHashLog; }
+    TrajectoryWriter &GetTrajectory() { return m_Trajectory; }
+    Pacer &GetPacer() { return m_Pacer; }
+    AudioOutput &GetAudio() { return m_Audio; }
 
     void Run();
 
+    // Runs until the next VBlank, or two frames' worth of cycles while the LCD is off.
+    // Not paced, only Run keeps to real time.
+    void RunFrame();
+
+    // After every frame, emulate `frames` more with the current input, show the
+    // last one and roll back. Hides that many frames of the game's input lag.
+    void SetRunAhead(u32 frames);
+
+    // What the screen should show: the run-ahead frame if enabled
+    const std::vector<u32> &GetPresentedFramebuffer() const {
+        return m_RunAheadFrames > 0 ? m_RunAheadFramebuffer : m_PPU.GetFramebuffer();
+    }
+
+    // Back to the state right after construction, in place, at frame 0
+    bool Reset();
+
+    bool SaveState(std::vector<u8> &buffer);
+
+    // `internal` states are ones this machine just saved (run-ahead, rewind, reset).
+    // Others may be damaged and are checked, and the machine is rolled back if one
+    // still fails halfway through.
+    bool LoadState(const u8 *data, usize size, bool internal = false);
+
+    // Named slots are stored next to the ROM as <rom>.<name>.state
+    bool SaveStateSlot(const std::string &name);
+    bool LoadStateSlot(const std::string &name);
+
+private:
+    friend class Batch;
+
+    Gameboy(const Gameboy &other);
+
+    template <bool Accurate> void Step();
+    template <bool Accurate> bool RunUntilVBlank();
+    template <bool Accurate> void RunCPU();
+    bool RunUntilVBlank();
+    void OnFrame();
+    void OnBlankFrame();
+    void RunAhead();
+
+    void WriteState(StateWriter &state) const;
+    bool ReadState(StateReader &state);
+
+    std::string GetSlotPath(const std::string &name) const;
+
 private:
-    static Gameboy *s_Gameboy;
+    static constexpr u32 s_CyclesPerFrame = 70224;
+
+    static bool NeedsAccurateTiming(const std::string &title);
+
+    static inline thread_local Gameboy *s_Gameboy = nullptr;
 
 private:
     Memory m_Memory;
@@ -35,12 +139,34 @@ private:
     PPU m_PPU;
     Cartrige m_Cartrige;
     Timer m_Timer;
+    Serial m_Serial;
+    APU m_APU;
     UI m_UI;
+    Cheats m_Cheats;
+    Rewind m_Rewind;
+    Movie m_Movie;
+    StateHashLog m_StateHashLog;
+    TrajectoryWriter m_Trajectory;
+    Pacer m_Pacer;
+    AudioOutput m_Audio;
+    std::unique_ptr<Jit> m_Jit;     // Kept once made, compiled blocks stay valid
+    bool m_JitEnabled = false;
 
     u64 m_Ticks = 0;
+    u64 m_BlankFrameEnd = 0;    // When the running frame loop gives up on a VBlank
+    bool m_AccurateTiming = false;
+    bool m_IsClone = false;
+    std::string m_MoviePath;
     bool m_Quit = false;
+    u32 m_AudioRate = 48000;
+
+    std::shared_ptr<const std::vector<u8>> m_PowerOnState;
+    std::vector<u8> m_StateBuffer;
+    std::vector<u8> m_UndoBuffer;
 
-    std::stringstream m_DebugMessage;
+    u32 m_RunAheadFrames = 0;
+    std::vector<u8> m_RunAheadState;
+    std::vector<u32> m_RunAheadFramebuffer;
 
     std::mutex m_Mtx;
     std::condition_variable m_Cond;
@@ -0,0 +1,93 @@
+#include "Hash.hpp"
+
+#include <cstring>
+
+static constexpr u64 s_Prime1 = 0x9E3779B185EBCA87ull;
+static constexpr u64 s_Prime2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr u64 s_Prime3 = 0x165667B19E3779F9ull;
+static constexpr u64 s_Prime4 = 0x85EBCA77C2B2AE63ull;
+static constexpr u64 s_Prime5 = 0x27D4EB2F165667C5ull;
+
+static inline u64 Rotl(u64 x, u8 r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 Load64(const u8 *p) {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 Load32(const u8 *p) {
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u64 Round(u64 acc, u64 lane) {
+    acc += lane * s_Prime2;
+    acc = Rotl(acc, 31);
+    return acc * s_Prime1;
+}
+
+static inline u64 MergeRound(u64 acc, u64 val) {
+    acc ^= Round(0, val);
+    return acc * s_Prime1 + s_Prime4;
+}
+
+u64 Hash64(const void *data, usize size, u64 seed) {
+    const u8 *p = static_cast<const u8*>(data);
+    const u8 *end = p + size;
+    u64 h;
+
+    if (size >= 32) {
+        u64 acc[4] = {
+            seed + s_Prime1 + s_Prime2,
+            seed + s_Prime2,
+            seed,
+            seed - s_Prime1,
+        };
+
+        const u8 *limit = end - 32;
+        do {
+            for (u8 i = 0; i < 4; i++) {
+                acc[i] = Round(acc[i], Load64(p + 8 * i));
+            }
+            p += 32;
+        } while (p <= limit);
+
+        h = Rotl(acc[0], 1) + Rotl(acc[1], 7) + Rotl(acc[2], 12) + Rotl(acc[3], 18);
+        for (u8 i = 0; i < 4; i++) {
+            h = MergeRound(h, acc[i]);
+        }
+    } else {
+        h = seed + s_Prime5;
+    }
+
+    h += size;
+
+    while (p + 8 <= end) {
+        h ^= Round(0, Load64(p));
+        h = Rotl(h, 27) * s_Prime1 + s_Prime4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= static_cast<u64>(Load32(p)) * s_Prime1;
+        h = Rotl(h, 23) * s_Prime2 + s_Prime3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p) * s_Prime5;
+        h = Rotl(h, 11) * s_Prime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= s_Prime2;
+    h ^= h >> 29;
+    h *= s_Prime3;
+    h ^= h >> 32;
+    return h;
+}
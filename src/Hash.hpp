@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Common.hpp"
+
+// 64-bit non-cryptographic hash (xxHash64 construction). The main loop keeps four
+// independent lanes over 32-byte stripes, so it pipelines well and costs well
+// under a cycle per byte on large contiguous buffers.
+u64 Hash64(const void *data, usize size, u64 seed = 0);
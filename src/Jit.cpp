@@ -0,0 +1,1077 @@
+#include "Jit.hpp"
+#include "CPU.hpp"
+#include "Gameboy.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+    enum Reg : u8 { EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESI = 6, EDI = 7 };
+    enum AluOp : u8 { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+    enum ShiftOp : u8 { SHL = 4, SHR = 5 };
+    enum Cond : u8 { JE = 0x4, JNE = 0x5 };
+
+    Cond Invert(Cond cc) { return static_cast<Cond>(cc ^ 1); }
+
+    // Encodes the few x86-64 forms blocks need. The CPU object is addressed through
+    // rbx, values live zero-extended in caller-saved 32-bit registers, and only
+    // al/cl/dl are stored as bytes (no REX prefixes needed).
+    class Emitter {
+    public:
+        Emitter(u8 *code, usize capacity) : m_Code(code), m_Capacity(capacity) {}
+
+        usize GetSize() const { return m_Size; }
+        bool Overflowed() const { return m_Size > m_Capacity; }
+
+        // push rbx; mov rbx, rdi
+        void Prologue() { Bytes({ 0x53, 0x48, 0x89, 0xFB }); }
+        // pop rbx; ret
+        void Return() { Bytes({ 0x5B, 0xC3 }); }
+
+        void Load8(Reg dst, i32 disp)  { Bytes({ 0x0F, 0xB6 }); Mem(dst, disp); }
+        void Load16(Reg dst, i32 disp) { Bytes({ 0x0F, 0xB7 }); Mem(dst, disp); }
+        void Store8(i32 disp, Reg src)  { Byte(0x88); Mem(src, disp); }
+        void Store16(i32 disp, Reg src) { Bytes({ 0x66, 0x89 }); Mem(src, disp); }
+
+        void Store8Imm(i32 disp, u8 val)   { Byte(0xC6); Mem(0, disp); Byte(val); }
+        void Store16Imm(i32 disp, u16 val) { Bytes({ 0x66, 0xC7 }); Mem(0, disp); Word(val); }
+        void Add64Imm(i32 disp, i8 val)    { Bytes({ 0x48, 0x83 }); Mem(0, disp); Byte(val); }
+        void Cmp8Imm(i32 disp, u8 val)     { Byte(0x80); Mem(7, disp); Byte(val); }
+        void Test16Imm(i32 disp, u16 val)  { Bytes({ 0x66, 0xF7 }); Mem(0, disp); Word(val); }
+
+        void MovImm(Reg dst, u32 val) { Byte(0xB8 + dst); Dword(val); }
+        void Mov(Reg dst, Reg src) { Byte(0x89); Byte(0xC0 | (src << 3) | dst); }
+        void Alu(AluOp op, Reg dst, Reg src) { Byte((op << 3) | 0x01); Byte(0xC0 | (src << 3) | dst); }
+        void Shift(ShiftOp op, Reg dst, u8 count) { Byte(0xC1); Byte(0xC0 | (op << 3) | dst); Byte(count); }
+        void Test(Reg a, Reg b) { Byte(0x85); Byte(0xC0 | (b << 3) | a); }
+
+        void AluImm(AluOp op, Reg dst, i32 val) {
+            if (val >= -128 && val <= 127) {
+                Byte(0x83); Byte(0xC0 | (op << 3) | dst); Byte(val);
+            } else {
+                Byte(0x81); Byte(0xC0 | (op << 3) | dst); Dword(val);
+            }
+        }
+
+        // setcc dst8; movzx dst, dst8
+        void Set(Cond cc, Reg dst) { Bytes({ 0x0F, static_cast<u8>(0x90 | cc) }); Byte(0xC0 | dst); Bytes({ 0x0F, 0xB6 }); Byte(0xC0 | (dst << 3) | dst); }
+
+        // mov rdi, rbx
+        void MovCPUToArg() { Bytes({ 0x48, 0x89, 0xDF }); }
+
+        // mov rax, fn; call rax. Blocks are entered with the stack 16 byte aligned
+        // after the push in the prologue.
+        void Call(const void *fn) {
+            Bytes({ 0x48, 0xB8 });
+            u64 addr = reinterpret_cast<u64>(fn);
+            Dword(addr);
+            Dword(addr >> 32);
+            Bytes({ 0xFF, 0xD0 });
+        }
+
+        // Forward jump, bound later
+        usize Jump(Cond cc) {
+            Bytes({ 0x0F, static_cast<u8>(0x80 | cc) });
+            usize at = m_Size;
+            Dword(0);
+            return at;
+        }
+
+        void Bind(usize at) {
+            i32 rel = static_cast<i32>(m_Size - (at + 4));
+            if (at + 4 <= m_Capacity) memcpy(m_Code + at, &rel, sizeof(rel));
+        }
+
+    private:
+        void Byte(u8 val) {
+            if (m_Size < m_Capacity) m_Code[m_Size] = val;
+            m_Size++;
+        }
+
+        void Bytes(std::initializer_list<u8> vals) {
+            for (u8 val : vals) Byte(val);
+        }
+
+        void Word(u16 val) { Byte(val); Byte(val >> 8); }
+        void Dword(u32 val) { Word(val); Word(val >> 16); }
+
+        // [rbx + disp]
+        void Mem(u8 reg, i32 disp) {
+            if (disp >= -128 && disp <= 127) {
+                Byte(0x40 | (reg << 3) | EBX);
+                Byte(disp);
+            } else {
+                Byte(0x80 | (reg << 3) | EBX);
+                Dword(disp);
+            }
+        }
+
+    private:
+        u8 *m_Code;
+        usize m_Capacity;
+        usize m_Size = 0;
+    };
+
+    u8 GetLength(u8 opcode) {
+        switch (opcode) {
+            case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+            case 0xC2: case 0xC3: case 0xC4: case 0xCA: case 0xCC: case 0xCD:
+            case 0xD2: case 0xD4: case 0xDA: case 0xDC: case 0xEA: case 0xFA:
+                return 3;
+            case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E:
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            case 0xE0: case 0xF0: case 0xE8: case 0xF8: case 0xCB:
+                return 2;
+            default:
+                return 1;
+        }
+    }
+}
+
+// Emits one block, instruction by instruction, keeping track of the cycle each one
+// starts at and how far compiled code has already advanced the machine
+class Jit::Translator {
+public:
+    Translator(Emitter &emitter, const CPU &cpu);
+
+    // Returns how many instructions the block holds, 0 if none could be compiled
+    u32 Translate(u16 pc, u16 &span, u16 &bytes);
+
+private:
+    enum class Result { Next, End, Stop };
+
+    Result TranslateOne(u8 opcode);
+    Result TranslateBlock0(u8 opcode);
+    Result TranslateBlock3(u8 opcode);
+    void TranslateCB(u8 opcode);
+
+    void EmitAlu(u8 func);
+    void EmitRotate(u8 func);
+    void EmitJump(u16 target, u32 cycles);
+    void EmitCall(u16 target, u16 ret, u32 cycles);
+    void EmitRet(u32 cycles);
+    Cond EmitCondition(u8 cond);
+
+    // r8 by opcode index, (HL) included. Memory clobbers every scratch register.
+    void LoadR8(u8 idx, Reg dst);
+    void StoreR8(u8 idx, Reg src);
+
+    void EmitRead(const void *fn);
+    void EmitWrite(const void *fn);
+    void EmitWriteCheck();
+
+    void EmitExit(u16 pc, u32 count, u32 cycles);
+    void EmitReturn(u32 count, u32 cycles);
+
+    // Cycles since the last helper call, which the next one advances
+    u32 Advance();
+
+    u8 Fetch(u16 addr) const;
+
+private:
+    struct Offsets {
+        i32 R8[8];
+        i32 R16[4];
+        i32 A, PC, SP, HL;
+        i32 FlagZ, FlagN, FlagH, FlagC;
+        i32 Instructions;
+    };
+
+    struct Exit {
+        usize At;
+        u16 PC;
+        u32 Count;
+        u32 Cycles;
+    };
+
+    static constexpr u32 s_MaxInstructions = 32;
+    static constexpr u32 s_MaxCycles = 200;     // What's left to advance has to fit Step's u8
+
+    Emitter &m_Emitter;
+    Offsets m_Off;
+    std::vector<Exit> m_Exits;
+
+    u16 m_PC = 0;           // Of the instruction being translated
+    u32 m_Count = 0;        // Instructions before it
+    u32 m_Offset = 0;       // Cycles from the block's start to it
+    u32 m_Synced = 0;       // Cycles already advanced by helpers
+    u32 m_Cycles = 0;       // Its own cycles, branches not taken
+    bool m_InRam = false;   // Any write may hit the block's own code
+};
+
+template <typename T>
+static i32 OffsetOf(const CPU &cpu, const T &member) {
+    return static_cast<i32>(reinterpret_cast<const u8*>(&member) - reinterpret_cast<const u8*>(&cpu));
+}
+
+Jit::Translator::Translator(Emitter &emitter, const CPU &cpu)
+    : m_Emitter(emitter)
+{
+    const auto &reg = cpu.m_Reg;
+    m_Off.R8[0] = OffsetOf(cpu, reg.B);
+    m_Off.R8[1] = OffsetOf(cpu, reg.C);
+    m_Off.R8[2] = OffsetOf(cpu, reg.D);
+    m_Off.R8[3] = OffsetOf(cpu, reg.E);
+    m_Off.R8[4] = OffsetOf(cpu, reg.H);
+    m_Off.R8[5] = OffsetOf(cpu, reg.L);
+    m_Off.R8[6] = 0;
+    m_Off.R8[7] = OffsetOf(cpu, reg.A);
+    m_Off.R16[0] = OffsetOf(cpu, reg.BC);
+    m_Off.R16[1] = OffsetOf(cpu, reg.DE);
+    m_Off.R16[2] = OffsetOf(cpu, reg.HL);
+    m_Off.R16[3] = OffsetOf(cpu, reg.SP);
+    m_Off.A = m_Off.R8[7];
+    m_Off.HL = m_Off.R16[2];
+    m_Off.SP = m_Off.R16[3];
+    m_Off.PC = OffsetOf(cpu, reg.PC);
+    m_Off.FlagZ = OffsetOf(cpu, cpu.m_FlagZ);
+    m_Off.FlagN = OffsetOf(cpu, cpu.m_FlagN);
+    m_Off.FlagH = OffsetOf(cpu, cpu.m_FlagH);
+    m_Off.FlagC = OffsetOf(cpu, cpu.m_FlagC);
+    m_Off.Instructions = OffsetOf(cpu, cpu.m_Instructions);
+}
+
+u32 Jit::Translator::Translate(u16 pc, u16 &span, u16 &bytes) {
+    m_Emitter.Prologue();
+    m_PC = pc;
+    m_InRam = (pc >= 0xC000);
+
+    // Bank 0, the switchable bank and WRAM are separate code
+    u32 regionEnd = (pc < 0x4000) ? 0x4000 : (m_InRam ? 0xE000 : 0x8000);
+
+    while (true) {
+        bool fits = m_Count < s_MaxInstructions && m_Offset <= s_MaxCycles && m_PC < regionEnd;
+        u8 opcode = fits ? Fetch(m_PC) : 0;
+        u8 length = GetLength(opcode);
+
+        fits = fits && m_PC + length <= regionEnd;
+        for (u16 i = 0; fits && !m_InRam && i < length; i++) {
+            fits = !Gameboy::Get().GetCheats().IsPatched(m_PC + i);
+        }
+
+        m_Cycles = CPU::GetCycles(opcode, opcode == 0xCB, false);
+        Result result = fits ? TranslateOne(opcode) : Result::Stop;
+        if (result == Result::Stop) {
+            EmitExit(m_PC, m_Count, m_Offset - m_Synced);
+            break;
+        }
+
+        span = m_Offset;
+        bytes = m_PC + length - pc;
+        m_Count++;
+        if (result == Result::End) break;
+
+        m_Offset += m_Cycles;
+        m_PC += length;
+    }
+
+    for (const Exit &exit : m_Exits) {
+        m_Emitter.Bind(exit.At);
+        EmitExit(exit.PC, exit.Count, exit.Cycles);
+    }
+
+    return m_Count;
+}
+
+Jit::Translator::Result Jit::Translator::TranslateOne(u8 opcode) {
+    switch (opcode) {
+        case 0x00: return Result::Next;
+
+        // STOP, HALT, DI, EI and RETI change how the interpreter steps
+        case 0x10: case 0x76: case 0xF3: case 0xFB: case 0xD9:
+        // LD (a16),SP, ADD SP,r8 and LD HL,SP+r8 are too rare to bother
+        case 0x08: case 0xE8: case 0xF8:
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+            return Result::Stop;
+    }
+
+    switch (opcode >> 6) {
+        case 0: return TranslateBlock0(opcode);
+        case 1: {
+            // LD r,r'
+            u8 src = opcode & 0b111;
+            u8 dest = (opcode >> 3) & 0b111;
+            if (src == dest) return Result::Next;
+
+            Reg val = (dest == 6) ? ESI : EAX;
+            LoadR8(src, val);
+            StoreR8(dest, val);
+            return Result::Next;
+        }
+        case 2: {
+            // ALU A,r
+            LoadR8(opcode & 0b111, ECX);
+            EmitAlu((opcode >> 3) & 0b111);
+            return Result::Next;
+        }
+        default: return TranslateBlock3(opcode);
+    }
+}
+
+Jit::Translator::Result Jit::Translator::TranslateBlock0(u8 opcode) {
+    Emitter &e = m_Emitter;
+    u8 row = (opcode >> 4) & 0b11;
+
+    switch (opcode & 0b1111) {
+        case 0b0001: { // LD rr,d16
+            e.Store16Imm(m_Off.R16[row], Fetch(m_PC + 1) | (Fetch(m_PC + 2) << 8));
+            return Result::Next;
+        }
+        case 0b0010:   // LD (rr),A
+        case 0b1010: { // LD A,(rr)
+            e.Load16(EDI, m_Off.R16[row == 0 ? 0 : (row == 1 ? 1 : 2)]);
+            if (row >= 2) {
+                e.Mov(EAX, EDI);
+                e.AluImm(row == 2 ? ADD : SUB, EAX, 1);
+                e.Store16(m_Off.HL, EAX);
+            }
+
+            if (opcode & 0b1000) {
+                EmitRead(reinterpret_cast<const void*>(&Jit::Read));
+                e.Store8(m_Off.A, EAX);
+            } else {
+                e.Load8(ESI, m_Off.A);
+                EmitWrite(reinterpret_cast<const void*>(&Jit::Write));
+                EmitWriteCheck();
+            }
+            return Result::Next;
+        }
+        case 0b0011:   // INC rr
+        case 0b1011: { // DEC rr
+            e.Load16(EAX, m_Off.R16[row]);
+            e.AluImm((opcode & 0b1000) ? SUB : ADD, EAX, 1);
+            e.Store16(m_Off.R16[row], EAX);
+            return Result::Next;
+        }
+        case 0b1001: { // ADD HL,rr
+            e.Load16(EAX, m_Off.HL);
+            e.Load16(ECX, m_Off.R16[row]);
+            e.Mov(EDX, EAX);
+            e.Alu(ADD, EDX, ECX);
+            e.Store8Imm(m_Off.FlagN, 0);
+            e.Alu(XOR, EAX, ECX);
+            e.Alu(XOR, EAX, EDX);
+            e.Shift(SHR, EAX, 8);
+            e.Store8(m_Off.FlagH, EAX);
+            e.Store16(m_Off.HL, EDX);
+            e.Shift(SHR, EDX, 8);
+            e.Store16(m_Off.FlagC, EDX);
+            return Result::Next;
+        }
+    }
+
+    u8 reg = (opcode >> 3) & 0b111;
+    switch (opcode & 0b111) {
+        case 0b100:   // INC r
+        case 0b101: { // DEC r
+            bool dec = opcode & 1;
+            LoadR8(reg, EAX);
+            e.Mov(ECX, EAX);
+            e.AluImm(dec ? SUB : ADD, ECX, 1);
+            e.Store8(m_Off.FlagZ, ECX);
+            e.Store8Imm(m_Off.FlagN, dec);
+            e.Alu(XOR, EAX, ECX);
+            e.AluImm(XOR, EAX, 1);
+            e.Store8(m_Off.FlagH, EAX);
+            StoreR8(reg, ECX);
+            return Result::Next;
+        }
+        case 0b110: { // LD r,d8
+            if (reg == 6) {
+                e.MovImm(ESI, Fetch(m_PC + 1));
+                StoreR8(reg, ESI);
+            } else {
+                e.Store8Imm(m_Off.R8[reg], Fetch(m_PC + 1));
+            }
+            return Result::Next;
+        }
+        case 0b111: {
+            switch (reg) {
+                case 0b000: case 0b001: case 0b010: case 0b011: { // RLCA, RRCA, RLA, RRA
+                    e.Load8(EAX, m_Off.A);
+                    EmitRotate(reg);
+                    e.Store8(m_Off.A, ECX);
+                    e.Store8Imm(m_Off.FlagZ, 1);
+                    return Result::Next;
+                }
+                case 0b100: { // DAA
+                    e.MovCPUToArg();
+                    e.Call(reinterpret_cast<const void*>(&Jit::Daa));
+                    return Result::Next;
+                }
+                case 0b101: { // CPL
+                    e.Load8(EAX, m_Off.A);
+                    e.AluImm(XOR, EAX, 0xFF);
+                    e.Store8(m_Off.A, EAX);
+                    e.Store8Imm(m_Off.FlagN, 1);
+                    e.Store8Imm(m_Off.FlagH, 0x10);
+                    return Result::Next;
+                }
+                case 0b110: { // SCF
+                    e.Store8Imm(m_Off.FlagN, 0);
+                    e.Store8Imm(m_Off.FlagH, 0);
+                    e.Store16Imm(m_Off.FlagC, 0x100);
+                    return Result::Next;
+                }
+                case 0b111: { // CCF
+                    e.Store8Imm(m_Off.FlagN, 0);
+                    e.Store8Imm(m_Off.FlagH, 0);
+                    e.Load16(EAX, m_Off.FlagC);
+                    e.AluImm(AND, EAX, 0x100);
+                    e.AluImm(XOR, EAX, 0x100);
+                    e.Store16(m_Off.FlagC, EAX);
+                    return Result::Next;
+                }
+            }
+            break;
+        }
+        case 0b000: { // JR, JR cc
+            u16 target = m_PC + 2 + static_cast<i8>(Fetch(m_PC + 1));
+            u32 taken = CPU::GetCycles(opcode, false, true);
+            if (opcode == 0x18) {
+                EmitJump(target, taken);
+                return Result::End;
+            }
+
+            u32 synced = m_Synced;
+            usize at = e.Jump(Invert(EmitCondition(reg & 0b11)));
+            EmitJump(target, taken);
+            e.Bind(at);
+            m_Synced = synced;
+            return Result::Next;
+        }
+    }
+
+    return Result::Stop;
+}
+
+Jit::Translator::Result Jit::Translator::TranslateBlock3(u8 opcode) {
+    Emitter &e = m_Emitter;
+    u16 imm16 = Fetch(m_PC + 1) | (Fetch(m_PC + 2) << 8);
+    u32 taken = CPU::GetCycles(opcode, false, true);
+
+    switch (opcode) {
+        case 0xCB: {
+            TranslateCB(Fetch(m_PC + 1));
+            return Result::Next;
+        }
+        case 0xE0:   // LDH (a8),A
+        case 0xEA: { // LD (a16),A
+            u16 addr = (opcode == 0xE0) ? 0xFF00 | Fetch(m_PC + 1) : imm16;
+            e.MovImm(EDI, addr);
+            e.Load8(ESI, m_Off.A);
+            EmitWrite(reinterpret_cast<const void*>(&Jit::Write));
+            if (!EndsBlock(addr)) {
+                if (m_InRam) EmitWriteCheck();
+                return Result::Next;
+            }
+
+            EmitExit(m_PC + GetLength(opcode), m_Count + 1, m_Offset + m_Cycles - m_Synced);
+            return Result::End;
+        }
+        case 0xE2: { // LD (C),A
+            e.Load8(EDI, m_Off.R8[1]);
+            e.AluImm(OR, EDI, 0xFF00);
+            e.Load8(ESI, m_Off.A);
+            EmitWrite(reinterpret_cast<const void*>(&Jit::Write));
+            EmitWriteCheck();
+            return Result::Next;
+        }
+        case 0xF0:   // LDH A,(a8)
+        case 0xFA: { // LD A,(a16)
+            e.MovImm(EDI, (opcode == 0xF0) ? 0xFF00 | Fetch(m_PC + 1) : imm16);
+            EmitRead(reinterpret_cast<const void*>(&Jit::Read));
+            e.Store8(m_Off.A, EAX);
+            return Result::Next;
+        }
+        case 0xF2: { // LD A,(C)
+            e.Load8(EDI, m_Off.R8[1]);
+            e.AluImm(OR, EDI, 0xFF00);
+            EmitRead(reinterpret_cast<const void*>(&Jit::Read));
+            e.Store8(m_Off.A, EAX);
+            return Result::Next;
+        }
+        case 0xF9: { // LD SP,HL
+            e.Load16(EAX, m_Off.HL);
+            e.Store16(m_Off.SP, EAX);
+            return Result::Next;
+        }
+        case 0xC3: {
+            EmitJump(imm16, taken);
+            return Result::End;
+        }
+        case 0xE9: { // JP HL
+            e.Load16(EAX, m_Off.HL);
+            e.Store16(m_Off.PC, EAX);
+            EmitReturn(m_Count + 1, m_Offset + taken - m_Synced);
+            return Result::End;
+        }
+        case 0xCD: {
+            EmitCall(imm16, m_PC + 3, taken);
+            return Result::End;
+        }
+        case 0xC9: {
+            EmitRet(taken);
+            return Result::End;
+        }
+    }
+
+    u8 row = (opcode >> 4) & 0b11;
+    switch (opcode & 0b1111) {
+        case 0b0001: { // POP rr
+            e.Load16(EDI, m_Off.SP);
+            EmitRead(reinterpret_cast<const void*>(&Jit::Read16));
+            if (row == 3) {
+                // SetAF
+                e.Mov(ECX, EAX);
+                e.Shift(SHR, ECX, 8);
+                e.Store8(m_Off.A, ECX);
+                e.AluImm(AND, EAX, 0xFF);
+                e.Mov(ECX, EAX);
+                e.AluImm(XOR, ECX, 0xFF);
+                e.AluImm(AND, ECX, 0x80);
+                e.Store8(m_Off.FlagZ, ECX);
+                e.Mov(ECX, EAX);
+                e.Shift(SHR, ECX, 6);
+                e.AluImm(AND, ECX, 1);
+                e.Store8(m_Off.FlagN, ECX);
+                e.Mov(ECX, EAX);
+                e.Shift(SHR, ECX, 1);
+                e.Store8(m_Off.FlagH, ECX);
+                e.Shift(SHL, EAX, 4);
+                e.Store16(m_Off.FlagC, EAX);
+            } else {
+                e.Store16(m_Off.R16[row], EAX);
+            }
+            e.Load16(ECX, m_Off.SP);
+            e.AluImm(ADD, ECX, 2);
+            e.Store16(m_Off.SP, ECX);
+            return Result::Next;
+        }
+        case 0b0101: { // PUSH rr
+            if (row == 3) {
+                // GetAF
+                e.Cmp8Imm(m_Off.FlagZ, 0);
+                e.Set(JE, ESI);
+                e.Shift(SHL, ESI, 7);
+                e.Load8(EDX, m_Off.FlagN);
+                e.Shift(SHL, EDX, 6);
+                e.Alu(OR, ESI, EDX);
+                e.Load8(EDX, m_Off.FlagH);
+                e.AluImm(AND, EDX, 0x10);
+                e.Shift(SHL, EDX, 1);
+                e.Alu(OR, ESI, EDX);
+                e.Load16(EDX, m_Off.FlagC);
+                e.Shift(SHR, EDX, 4);
+                e.AluImm(AND, EDX, 0x10);
+                e.Alu(OR, ESI, EDX);
+                e.Load8(EDX, m_Off.A);
+                e.Shift(SHL, EDX, 8);
+                e.Alu(OR, ESI, EDX);
+            } else {
+                e.Load16(ESI, m_Off.R16[row]);
+            }
+            e.Load16(EAX, m_Off.SP);
+            e.AluImm(SUB, EAX, 2);
+            e.Store16(m_Off.SP, EAX);
+            e.Mov(EDI, EAX);
+            EmitWrite(reinterpret_cast<const void*>(&Jit::Write16));
+            EmitWriteCheck();
+            return Result::Next;
+        }
+    }
+
+    u8 cond = (opcode >> 3) & 0b11;
+    switch (opcode & 0b111) {
+        case 0b110: { // ALU A,d8
+            e.MovImm(ECX, Fetch(m_PC + 1));
+            EmitAlu((opcode >> 3) & 0b111);
+            return Result::Next;
+        }
+        case 0b111: { // RST
+            EmitCall(opcode & 0x38, m_PC + 1, taken);
+            return Result::End;
+        }
+        case 0b000: { // RET cc
+            if (opcode & 0b100000) break;
+
+            u32 synced = m_Synced;
+            usize at = e.Jump(Invert(EmitCondition(cond)));
+            EmitRet(taken);
+            e.Bind(at);
+            m_Synced = synced;
+            return Result::Next;
+        }
+        case 0b010:   // JP cc
+        case 0b100: { // CALL cc
+            if (opcode & 0b100000) break;
+
+            u32 synced = m_Synced;
+            usize at = e.Jump(Invert(EmitCondition(cond)));
+            if (opcode & 0b100) {
+                EmitCall(imm16, m_PC + 3, taken);
+            } else {
+                EmitJump(imm16, taken);
+            }
+            e.Bind(at);
+            m_Synced = synced;
+            return Result::Next;
+        }
+    }
+
+    return Result::Stop;
+}
+
+void Jit::Translator::TranslateCB(u8 opcode) {
+    Emitter &e = m_Emitter;
+    u8 reg = opcode & 0b111;
+    u8 row = (opcode >> 3) & 0b111;
+    u8 bit = 1 << row;
+
+    LoadR8(reg, EAX);
+    switch (opcode >> 6) {
+        case 0: {
+            EmitRotate(row);
+            e.Store8(m_Off.FlagZ, ECX);
+            StoreR8(reg, ECX);
+            return;
+        }
+        case 1: { // BIT
+            e.AluImm(AND, EAX, bit);
+            e.Store8(m_Off.FlagZ, EAX);
+            e.Store8Imm(m_Off.FlagN, 0);
+            e.Store8Imm(m_Off.FlagH, 0x10);
+            return;
+        }
+        case 2: { // RES
+            e.AluImm(AND, EAX, static_cast<u8>(~bit));
+            StoreR8(reg, EAX);
+            return;
+        }
+        case 3: { // SET
+            e.AluImm(OR, EAX, bit);
+            StoreR8(reg, EAX);
+            return;
+        }
+    }
+}
+
+// A in eax, the operand in ecx
+void Jit::Translator::EmitAlu(u8 func) {
+    Emitter &e = m_Emitter;
+    e.Load8(EAX, m_Off.A);
+
+    switch (func) {
+        case 0: case 1: case 2: case 3: case 7: { // ADD, ADC, SUB, SBC, CP
+            bool sub = (func >= 2);
+            e.Mov(EDX, EAX);
+            e.Alu(sub ? SUB : ADD, EDX, ECX);
+            if (func == 1 || func == 3) {
+                e.Load16(ESI, m_Off.FlagC);
+                e.Shift(SHR, ESI, 8);
+                e.AluImm(AND, ESI, 1);
+                e.Alu(sub ? SUB : ADD, EDX, ESI);
+            }
+
+            e.Store8(m_Off.FlagZ, EDX);
+            e.Store8Imm(m_Off.FlagN, sub);
+            e.Alu(XOR, EAX, ECX);
+            e.Alu(XOR, EAX, EDX);
+            e.Store8(m_Off.FlagH, EAX);
+            e.Store16(m_Off.FlagC, EDX);
+            if (func != 7) e.Store8(m_Off.A, EDX);
+            return;
+        }
+        case 4: case 5: case 6: { // AND, XOR, OR
+            e.Alu(func == 4 ? AND : (func == 5 ? XOR : OR), EAX, ECX);
+            e.Store8(m_Off.FlagZ, EAX);
+            e.Store8Imm(m_Off.FlagN, 0);
+            e.Store8Imm(m_Off.FlagH, func == 4 ? 0x10 : 0);
+            e.Store16Imm(m_Off.FlagC, 0);
+            e.Store8(m_Off.A, EAX);
+            return;
+        }
+    }
+}
+
+// RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL of eax into ecx, N, H and C set
+void Jit::Translator::EmitRotate(u8 func) {
+    Emitter &e = m_Emitter;
+
+    // The bit shifted out in edx
+    bool left = (func == 0 || func == 2 || func == 4);
+    e.Mov(EDX, EAX);
+    if (left) {
+        e.Shift(SHR, EDX, 7);
+    } else {
+        e.AluImm(AND, EDX, 1);
+    }
+
+    e.Mov(ECX, EAX);
+    switch (func) {
+        case 0: // RLC
+            e.Shift(SHL, ECX, 1);
+            e.Alu(OR, ECX, EDX);
+            break;
+        case 1: // RRC
+            e.Shift(SHR, ECX, 1);
+            e.Mov(ESI, EDX);
+            e.Shift(SHL, ESI, 7);
+            e.Alu(OR, ECX, ESI);
+            break;
+        case 2: // RL
+        case 3: // RR
+            e.Load16(ESI, m_Off.FlagC);
+            e.Shift(SHR, ESI, 8);
+            e.AluImm(AND, ESI, 1);
+            if (func == 2) {
+                e.Shift(SHL, ECX, 1);
+            } else {
+                e.Shift(SHR, ECX, 1);
+                e.Shift(SHL, ESI, 7);
+            }
+            e.Alu(OR, ECX, ESI);
+            break;
+        case 4: // SLA
+            e.Shift(SHL, ECX, 1);
+            break;
+        case 5: // SRA
+            e.Shift(SHR, ECX, 1);
+            e.Mov(ESI, EAX);
+            e.AluImm(AND, ESI, 0x80);
+            e.Alu(OR, ECX, ESI);
+            break;
+        case 6: // SWAP
+            e.Shift(SHR, ECX, 4);
+            e.Mov(ESI, EAX);
+            e.Shift(SHL, ESI, 4);
+            e.Alu(OR, ECX, ESI);
+            e.MovImm(EDX, 0);
+            break;
+        case 7: // SRL
+            e.Shift(SHR, ECX, 1);
+            break;
+    }
+
+    e.AluImm(AND, ECX, 0xFF);
+    e.Shift(SHL, EDX, 8);
+    e.Store8Imm(m_Off.FlagN, 0);
+    e.Store8Imm(m_Off.FlagH, 0);
+    e.Store16(m_Off.FlagC, EDX);
+}
+
+// Taken jumps backwards get the idle loop check the interpreter gives them
+void Jit::Translator::EmitJump(u16 target, u32 cycles) {
+    Emitter &e = m_Emitter;
+    e.Store16Imm(m_Off.PC, target);
+
+    if (target <= m_PC) {
+        e.MovCPUToArg();
+        e.MovImm(ESI, m_PC);
+        e.MovImm(EDX, Advance());
+        e.Call(reinterpret_cast<const void*>(&Jit::CheckIdleLoop));
+    }
+
+    EmitReturn(m_Count + 1, m_Offset + cycles - m_Synced);
+}
+
+void Jit::Translator::EmitCall(u16 target, u16 ret, u32 cycles) {
+    Emitter &e = m_Emitter;
+    e.Load16(EAX, m_Off.SP);
+    e.AluImm(SUB, EAX, 2);
+    e.Store16(m_Off.SP, EAX);
+    e.Mov(EDI, EAX);
+    e.MovImm(ESI, ret);
+    EmitWrite(reinterpret_cast<const void*>(&Jit::Write16));
+    EmitExit(target, m_Count + 1, m_Offset + cycles - m_Synced);
+}
+
+void Jit::Translator::EmitRet(u32 cycles) {
+    Emitter &e = m_Emitter;
+    e.Load16(EDI, m_Off.SP);
+    EmitRead(reinterpret_cast<const void*>(&Jit::Read16));
+    e.Store16(m_Off.PC, EAX);
+    e.Load16(ECX, m_Off.SP);
+    e.AluImm(ADD, ECX, 2);
+    e.Store16(m_Off.SP, ECX);
+    EmitReturn(m_Count + 1, m_Offset + cycles - m_Synced);
+}
+
+// Compares for `cond` (NZ, Z, NC, C) and returns the jump taken when it holds
+Cond Jit::Translator::EmitCondition(u8 cond) {
+    if (cond < 2) {
+        m_Emitter.Cmp8Imm(m_Off.FlagZ, 0);
+        return (cond == 0) ? JNE : JE;
+    }
+
+    m_Emitter.Test16Imm(m_Off.FlagC, 0x100);
+    return (cond == 2) ? JE : JNE;
+}
+
+void Jit::Translator::LoadR8(u8 idx, Reg dst) {
+    if (idx != 6) {
+        m_Emitter.Load8(dst, m_Off.R8[idx]);
+        return;
+    }
+
+    m_Emitter.Load16(EDI, m_Off.HL);
+    EmitRead(reinterpret_cast<const void*>(&Jit::Read));
+    if (dst != EAX) m_Emitter.Mov(dst, EAX);
+}
+
+// Writing (HL) has to be the last thing the instruction does
+void Jit::Translator::StoreR8(u8 idx, Reg src) {
+    if (idx != 6) {
+        m_Emitter.Store8(m_Off.R8[idx], src);
+        return;
+    }
+
+    if (src != ESI) m_Emitter.Mov(ESI, src);
+    m_Emitter.Load16(EDI, m_Off.HL);
+    EmitWrite(reinterpret_cast<const void*>(&Jit::Write));
+    EmitWriteCheck();
+}
+
+// Address in edi
+void Jit::Translator::EmitRead(const void *fn) {
+    m_Emitter.MovImm(ESI, Advance());
+    m_Emitter.Call(fn);
+}
+
+// Address in edi, value in esi
+void Jit::Translator::EmitWrite(const void *fn) {
+    m_Emitter.MovImm(EDX, Advance());
+    m_Emitter.Call(fn);
+}
+
+// Leaves the block after this instruction if the write asked to
+void Jit::Translator::EmitWriteCheck() {
+    m_Emitter.Test(EAX, EAX);
+    usize at = m_Emitter.Jump(JNE);
+    m_Exits.push_back({ at, static_cast<u16>(m_PC + GetLength(Fetch(m_PC))), m_Count + 1, m_Offset + m_Cycles - m_Synced });
+}
+
+void Jit::Translator::EmitExit(u16 pc, u32 count, u32 cycles) {
+    m_Emitter.Store16Imm(m_Off.PC, pc);
+    EmitReturn(count, cycles);
+}
+
+void Jit::Translator::EmitReturn(u32 count, u32 cycles) {
+    m_Emitter.Add64Imm(m_Off.Instructions, count);
+    m_Emitter.MovImm(EAX, cycles);
+    m_Emitter.Return();
+}
+
+u32 Jit::Translator::Advance() {
+    u32 cycles = m_Offset - m_Synced;
+    m_Synced = m_Offset;
+    return cycles;
+}
+
+u8 Jit::Translator::Fetch(u16 addr) const {
+    Gameboy &gameboy = Gameboy::Get();
+    return m_InRam ? gameboy.GetMemory().Read(addr) : gameboy.GetCartrige().Read(addr);
+}
+
+Jit::Jit(CPU &cpu)
+    : m_CPU(cpu)
+{
+#if defined(__x86_64__)
+    void *cache = mmap(nullptr, s_CacheSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) {
+        LOG_WARN("JIT: couldn't map %lu KB of executable memory, staying with the interpreter\n", s_CacheSize / 1024);
+        return;
+    }
+    m_Cache = static_cast<u8*>(cache);
+#else
+    LOG_WARN("JIT: only x86-64 is supported, staying with the interpreter\n");
+#endif
+}
+
+Jit::~Jit() {
+    if (m_Cache) munmap(m_Cache, s_CacheSize);
+}
+
+bool Jit::Run(u8 &cycles) {
+    if (!m_Cache) return false;
+
+    Gameboy &gameboy = Gameboy::Get();
+    u64 before = m_CPU.m_Instructions;
+    u32 pending = 0;
+    bool ran = false;
+
+    // Blocks follow each other directly as long as nothing could happen in between:
+    // no event before the end of the previous one and no interrupt to dispatch
+    while (const Block *block = GetBlock(m_CPU.m_Reg.PC)) {
+        u64 deadline = gameboy.GetIdleDeadline(false);
+        if (ran) {
+            if (gameboy.GetTicks() + pending >= deadline) break;
+            if (m_CPU.m_IME && (m_CPU.m_IE & m_CPU.m_IF & 0x1F)) break;
+
+            gameboy.Advance(pending);
+            pending = 0;
+        }
+
+        // Events are only looked at between blocks, so none may fall inside one
+        if (gameboy.GetTicks() + block->Span >= deadline) break;
+
+        bool inRam = m_CPU.m_Reg.PC >= 0xC000;
+        m_RunStart = m_CPU.m_Reg.PC;
+        m_RunBytes = inRam ? block->Bytes : 0;
+        pending = block->Code(&m_CPU);
+        m_RunBytes = 0;
+        ran = true;
+        m_Stats.Runs++;
+    }
+
+    if (!ran) return false;
+
+    m_Stats.Instructions += m_CPU.m_Instructions - before;
+    cycles = pending;
+    return true;
+}
+
+Jit::Block *Jit::GetBlock(u16 pc) {
+    // WRAM has a table of its own, ROM offsets go as far as the largest MBC5 carts
+    std::vector<std::unique_ptr<Page>> *pages = &m_Pages;
+    usize key;
+    if (pc < 0x4000) {
+        key = pc;
+    } else if (pc < 0x8000) {
+        key = Gameboy::Get().GetCartrige().GetRomBank() * 0x4000 + (pc - 0x4000);
+    } else if (pc >= 0xC000 && pc < 0xE000) {
+        pages = &m_RamPages;
+        key = pc - 0xC000;
+    } else {
+        return nullptr;
+    }
+
+    usize index = key >> 8;
+    if (index >= pages->size()) pages->resize(index + 1);
+    if (!(*pages)[index]) (*pages)[index] = std::make_unique<Page>();
+
+    Block &block = (*pages)[index]->Blocks[key & 0xFF];
+    if (block.Code && pages == &m_RamPages) {
+        u8 code[256];
+        Gameboy::Get().GetMemory().ReadWram(pc, code, block.Bytes);
+        if (memcmp(code, &m_Sources[block.Source], block.Bytes) != 0) {
+            block = Block();
+            m_Stats.Invalidated++;
+        }
+    }
+
+    if (block.Code) return &block;
+
+    if (block.Rejected || ++block.Hits < s_HotThreshold) return nullptr;
+
+    if (!Compile(block, pc)) {
+        block.Rejected = true;
+        m_Stats.Rejected++;
+        return nullptr;
+    }
+
+    return &block;
+}
+
+bool Jit::Compile(Block &block, u16 pc) {
+    if (s_CacheSize - m_CacheUsed < s_MaxBlockBytes) Flush();
+
+    if (!Protect(m_CacheUsed, s_MaxBlockBytes, PROT_READ | PROT_WRITE)) return false;
+
+    Emitter emitter(m_Cache + m_CacheUsed, s_MaxBlockBytes);
+    u16 span = 0, bytes = 0;
+    u32 count = Translator(emitter, m_CPU).Translate(pc, span, bytes);
+
+    // The pages may hold blocks compiled before, which can't run until this succeeds
+    if (!Protect(m_CacheUsed, s_MaxBlockBytes, PROT_READ | PROT_EXEC)) {
+        LOG_ERROR("JIT: couldn't make compiled code executable, staying with the interpreter\n");
+        Flush();
+        munmap(m_Cache, s_CacheSize);
+        m_Cache = nullptr;
+        return false;
+    }
+
+    if (count == 0 || emitter.Overflowed()) return false;
+
+    block.Code = reinterpret_cast<BlockFn>(m_Cache + m_CacheUsed);
+    block.Span = span;
+    block.Bytes = bytes;
+    m_CacheUsed += (emitter.GetSize() + 15) & ~usize(15);
+    m_Stats.Compiled++;
+
+    if (pc >= 0xC000) {
+        block.Source = m_Sources.size();
+        m_Sources.resize(block.Source + bytes);
+        Gameboy::Get().GetMemory().ReadWram(pc, &m_Sources[block.Source], bytes);
+    }
+
+    return true;
+}
+
+void Jit::Flush() {
+    for (std::unique_ptr<Page> &page : m_Pages) {
+        if (page) *page = Page();
+    }
+
+    for (std::unique_ptr<Page> &page : m_RamPages) {
+        if (page) *page = Page();
+    }
+
+    m_Sources.clear();
+    m_CacheUsed = 0;
+    m_Stats.Flushes++;
+}
+
+bool Jit::Protect(usize offset, usize size, int prot) {
+    static const usize s_PageSize = sysconf(_SC_PAGESIZE);
+
+    usize start = offset & ~(s_PageSize - 1);
+    usize end = std::min(s_CacheSize, (offset + size + s_PageSize - 1) & ~(s_PageSize - 1));
+    return mprotect(m_Cache + start, end - start, prot) == 0;
+}
+
+u32 Jit::Read(u32 addr, u32 advance) {
+    Gameboy &gameboy = Gameboy::Get();
+    gameboy.Advance(advance);
+    return gameboy.GetMemory().Read(addr);
+}
+
+u32 Jit::Read16(u32 addr, u32 advance) {
+    Gameboy &gameboy = Gameboy::Get();
+    gameboy.Advance(advance);
+    return gameboy.GetMemory().Read16(addr);
+}
+
+u32 Jit::Write(u32 addr, u32 val, u32 advance) {
+    Gameboy &gameboy = Gameboy::Get();
+    gameboy.Advance(advance);
+    gameboy.GetMemory().Write(addr, val);
+    return EndsBlock(addr) || gameboy.GetCPU().m_Jit->IsRunning(addr);
+}
+
+u32 Jit::Write16(u32 addr, u32 val, u32 advance) {
+    Gameboy &gameboy = Gameboy::Get();
+    gameboy.Advance(advance);
+    gameboy.GetMemory().Write16(addr, val);
+
+    const Jit *jit = gameboy.GetCPU().m_Jit;
+    return EndsBlock(addr) || EndsBlock(addr + 1) || jit->IsRunning(addr) || jit->IsRunning(addr + 1);
+}
+
+void Jit::CheckIdleLoop(CPU *cpu, u32 branch, u32 advance) {
+    Gameboy::Get().Advance(advance);
+    cpu->CheckIdleLoop(branch);
+}
+
+void Jit::Daa(CPU *cpu) {
+    cpu->Daa();
+}
+
+bool Jit::EndsBlock(u16 addr) {
+    return addr < 0x8000 || (addr >= 0xFF00 && addr < 0xFF80) || addr == 0xFFFF;
+}
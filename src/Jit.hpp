@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Common.hpp"
+
+class CPU;
+
+struct JitStats {
+    u64 Compiled = 0;
+    u64 Rejected = 0;       // Entry points left to the interpreter
+    u64 Runs = 0;
+    u64 Instructions = 0;   // Executed in compiled blocks
+    u64 Flushes = 0;        // The code cache filled up
+    u64 Invalidated = 0;    // Blocks in RAM whose code was overwritten
+};
+
+// Translates hot basic blocks of ROM and WRAM code into x86-64 for the fast core.
+//
+// A block runs from its entry to the first unconditional jump, call or return;
+// conditional ones leave it only when taken. Registers and lazy flags stay in the
+// CPU object, and every memory access goes through the same Memory calls the
+// interpreter makes, after moving the machine up to the cycle the instruction
+// starts at. A block only runs when it ends before the next event (interrupt,
+// timer, serial, the frame loop's limit), and it stops after any write that may
+// change what comes next: MBC registers, I/O, IE and its own code. This keeps its
+// results identical to the interpreter's. HALT, STOP, EI/DI/RETI, HRAM code and
+// anything a cheat patches stay with the interpreter. ROM blocks are keyed by ROM
+// offset, so bank switches need no invalidation; WRAM blocks keep a copy of their
+// code and are compiled again when it no longer matches. The code cache is never
+// writable and executable at once: only the pages a block is emitted into are
+// made writable, and only while it is.
+class Jit {
+public:
+    Jit(CPU &cpu);
+    ~Jit();
+
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+
+    // False if the code cache couldn't be mapped executable
+    bool IsAvailable() const { return m_Cache != nullptr; }
+
+    // Runs the block at the CPU's PC if there is one and it fits before the next
+    // event, then the blocks after it while they do, counting entries towards
+    // compiling them. On success `cycles` is what the last block took and didn't
+    // advance yet; otherwise the interpreter runs the instruction.
+    bool Run(u8 &cycles);
+
+    const JitStats &GetStats() const { return m_Stats; }
+
+private:
+    using BlockFn = u32 (*)(CPU *cpu);
+
+    struct Block {
+        BlockFn Code = nullptr;
+        u16 Span = 0;           // Cycles up to the start of the last instruction
+        u8 Hits = 0;
+        bool Rejected = false;
+        u16 Bytes = 0;          // Of Game Boy code
+        u32 Source = 0;         // Where a WRAM block's code is kept in m_Sources
+    };
+
+    struct Page {
+        Block Blocks[256];
+    };
+
+    class Translator;
+
+    // The compiled block at `pc`, compiling it once it is hot
+    Block *GetBlock(u16 pc);
+    bool Compile(Block &block, u16 pc);
+    void Flush();
+
+    // mprotect on the cache pages holding [offset, offset + size)
+    bool Protect(usize offset, usize size, int prot);
+
+    // Called from compiled code; each first advances the machine by `advance`
+    static u32 Read(u32 addr, u32 advance);
+    static u32 Read16(u32 addr, u32 advance);
+    static u32 Write(u32 addr, u32 val, u32 advance);
+    static u32 Write16(u32 addr, u32 val, u32 advance);
+    static void CheckIdleLoop(CPU *cpu, u32 branch, u32 advance);
+    static void Daa(CPU *cpu);
+
+    // Writes after which the rest of the block may no longer apply
+    static bool EndsBlock(u16 addr);
+    bool IsRunning(u16 addr) const { return static_cast<u16>(addr - m_RunStart) < m_RunBytes; }
+
+private:
+    static constexpr usize s_CacheSize = 4 * 1024 * 1024;
+    static constexpr usize s_MaxBlockBytes = 16 * 1024;
+    static constexpr u8 s_HotThreshold = 16;
+
+    CPU &m_CPU;
+
+    u8 *m_Cache = nullptr;
+    usize m_CacheUsed = 0;
+
+    // By ROM offset / 256 and WRAM offset / 256, allocated as code is first seen
+    std::vector<std::unique_ptr<Page>> m_Pages;
+    std::vector<std::unique_ptr<Page>> m_RamPages;
+    std::vector<u8> m_Sources;
+
+    // The WRAM block running, whose code writes must not touch
+    u16 m_RunStart = 0;
+    u16 m_RunBytes = 0;
+
+    JitStats m_Stats;
+};
@@ -0,0 +1,148 @@
+#include "LinkCable.hpp"
+
+void LinkCable::Connect(Serial &first, Serial &second) {
+    auto wire = std::make_shared<Wire>();
+    first.SetDevice(std::make_shared<LinkPort>(wire, 0));
+    second.SetDevice(std::make_shared<LinkPort>(wire, 1));
+}
+
+u64 LinkPort::OnLineChange(const SerialLine &line) {
+    SerialLine::Mode previous = m_Line;
+    m_Line = line.State;
+    Post(line);
+
+    // SB changing under a running transfer doesn't start another one
+    if (line.State == previous) return UINT64_MAX;
+
+    if (line.State == SerialLine::Clocking) {
+        m_Completion = line.Time + LinkCable::s_TransferCycles;
+        return m_Completion;
+    }
+
+    // An armed side syncs right away, the peer may already be clocking
+    if (line.State == SerialLine::Armed) {
+        m_ArmedAt = line.Time;
+        return line.Time;
+    }
+
+    return UINT64_MAX;
+}
+
+u64 LinkPort::Sync(Serial &serial, u64 time) {
+    u64 peerTime = GetPeerTime();
+    Drain();
+
+    // A byte on the internal clock lands once the peer got that far, with whatever
+    // the peer showed then. When both clocked at once neither was listening.
+    if ((serial.GetSC() & 0x81) == 0x81 && time >= m_Completion) {
+        if (peerTime < m_Completion) {
+            peerTime = WaitForPeer(m_Completion, m_Completion, false);
+        }
+
+        const SerialLine &peer = GetPeerLine(m_Completion);
+        serial.Complete(peer.State == SerialLine::Armed ? peer.Byte : 0xFF);
+        m_Line = SerialLine::Idle;
+        Post({ m_Completion, serial.GetSB(), SerialLine::Idle });
+        m_Transfers++;
+    }
+
+    // An armed side takes the first byte the peer clocked after it armed. Anything the
+    // peer starts later lands a whole transfer after that.
+    if ((serial.GetSC() & 0x81) == 0x80 && peerTime < time && time - peerTime >= LinkCable::s_TransferCycles) {
+        peerTime = WaitForPeer(time - LinkCable::s_TransferCycles + 1, time, true);
+    }
+
+    while (!m_PeerTransfers.empty() && m_PeerTransfers.front().Time <= time) {
+        SerialLine transfer = m_PeerTransfers.front();
+        m_PeerTransfers.pop_front();
+
+        if ((serial.GetSC() & 0x81) == 0x80 && transfer.Time > m_ArmedAt) {
+            serial.Complete(transfer.Byte);
+            m_Line = SerialLine::Idle;
+            Post({ transfer.Time, serial.GetSB(), SerialLine::Idle });
+            m_Answered++;
+        }
+    }
+
+    // Nothing this side posts from here on is stamped before `time`
+    GetPeerLine(time);
+    Publish(time);
+
+    u64 next = time + LinkCable::s_PublishPeriod;
+    if ((serial.GetSC() & 0x81) == 0x81) {
+        next = std::min(next, m_Completion);
+    } else if ((serial.GetSC() & 0x81) == 0x80) {
+        if (peerTime != UINT64_MAX) next = std::min(next, peerTime + LinkCable::s_TransferCycles);
+        if (!m_PeerTransfers.empty()) next = std::min(next, m_PeerTransfers.front().Time);
+    }
+
+    return next;
+}
+
+void LinkPort::Post(const SerialLine &line) {
+    // A full queue means this side is that far ahead of what the peer has read
+    while (!Outgoing().Push(line)) {
+        if (m_Wire->Unplugged) return;
+        std::this_thread::yield();
+    }
+}
+
+void LinkPort::Publish(u64 time) {
+    if (time <= m_Published) return;
+    m_Published = time;
+    m_Wire->Times[m_Side].store(time, std::memory_order_release);
+}
+
+u64 LinkPort::GetPeerTime() const {
+    if (m_Wire->Unplugged) return UINT64_MAX;
+    return m_Wire->Times[m_Side ^ 1].load(std::memory_order_acquire);
+}
+
+u64 LinkPort::WaitForPeer(u64 time, u64 safe, bool armed) {
+    m_Stalls++;
+
+    // The peer may be waiting for this side in turn, so it gets as far as nothing
+    // still to be posted here is stamped before. An armed side posts when a peer
+    // byte lands, at the earliest a transfer after the peer's time.
+    while (true) {
+        u64 peerTime = GetPeerTime();
+        Drain();
+        if (peerTime >= time) return peerTime;
+
+        u64 published = safe;
+        if (armed) {
+            published = std::min(published, peerTime + LinkCable::s_TransferCycles);
+            if (!m_PeerTransfers.empty()) published = std::min(published, m_PeerTransfers.front().Time);
+        }
+
+        Publish(published);
+        std::this_thread::yield();
+    }
+}
+
+void LinkPort::Drain() {
+    SerialLine lines[32];
+    while (usize count = Incoming().Pop(lines, 32)) {
+        for (usize i = 0; i < count; i++) {
+            const SerialLine &line = lines[i];
+            if (line.State == SerialLine::Clocking && m_PeerState != SerialLine::Clocking) {
+                m_PeerTransfers.push_back({ line.Time + LinkCable::s_TransferCycles, line.Byte, SerialLine::Clocking });
+            }
+
+            m_PeerState = line.State;
+            m_Pending.push_back(line);
+        }
+    }
+}
+
+const SerialLine &LinkPort::GetPeerLine(u64 time) {
+    static const SerialLine s_Unplugged = { 0, 0xFF, SerialLine::Idle };
+    if (m_Wire->Unplugged) return s_Unplugged;
+
+    while (!m_Pending.empty() && m_Pending.front().Time < time) {
+        m_PeerLine = m_Pending.front();
+        m_Pending.pop_front();
+    }
+
+    return m_PeerLine;
+}
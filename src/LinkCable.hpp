@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Common.hpp"
+#include "Serial.hpp"
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <deque>
+
+// Link cable between two in-process instances, each running on its own thread.
+// Each end posts every change of its line through an SPSC queue, stamped with its
+// emulated cycle, and publishes how far it got. The two only wait on each other
+// around a transfer: the side on the internal clock until its peer has reached
+// the cycle the byte lands on, an armed side until the other is within a transfer
+// of it. Otherwise both run freely. A byte moves on the same emulated cycle on
+// every run, however the hosts are scheduled. Nothing on the queues can be taken
+// back, so a linked machine loads no states: no rewind, run-ahead or slots.
+class LinkCable {
+public:
+    static void Connect(Serial &first, Serial &second);
+
+    // 8 bits on the internal clock
+    static constexpr u64 s_TransferCycles = 8 * 512;
+
+    // How often a side publishes its time when nothing else happens
+    static constexpr u64 s_PublishPeriod = s_TransferCycles;
+
+    using Queue = SpscQueue<SerialLine, 256>;
+
+    struct Wire {
+        Queue Queues[2];
+
+        // Each side's emulated cycle, every line it posted before that is in its queue
+        std::atomic<u64> Times[2] = { 0, 0 };
+
+        // Set when either end is unplugged, the other reads an idle line from then on
+        std::atomic<bool> Unplugged = false;
+    };
+};
+
+class LinkPort : public SerialDevice {
+public:
+    LinkPort(std::shared_ptr<LinkCable::Wire> wire, usize side) : m_Wire(std::move(wire)), m_Side(side) {}
+    ~LinkPort() override { Unplug(); }
+
+    // The peer stops waiting for this side and reads an idle line from then on
+    void Unplug() { m_Wire->Unplugged = true; }
+
+    u8 Transfer(u8 out) override { (void)out; return 0xFF; }
+
+    bool IsLink() const override { return true; }
+    u64 OnLineChange(const SerialLine &line) override;
+    u64 Sync(Serial &serial, u64 time) override;
+
+    u64 GetTransfers() const { return m_Transfers; }
+    u64 GetAnswered() const { return m_Answered; }
+    u64 GetStalls() const { return m_Stalls; }
+
+private:
+    LinkCable::Queue &Incoming() { return m_Wire->Queues[m_Side]; }
+    LinkCable::Queue &Outgoing() { return m_Wire->Queues[m_Side ^ 1]; }
+
+    void Post(const SerialLine &line);
+    void Publish(u64 time);
+
+    // The peer's time, UINT64_MAX once it is gone
+    u64 GetPeerTime() const;
+
+    // Waits until the peer got to `time`, returns how far it is
+    u64 WaitForPeer(u64 time, u64 safe, bool armed);
+
+    // Moves what the peer posted into m_Pending, noting the transfers it started
+    void Drain();
+
+    // The peer's line at `time`
+    const SerialLine &GetPeerLine(u64 time);
+
+private:
+    std::shared_ptr<LinkCable::Wire> m_Wire;
+    usize m_Side;
+
+    // This side's line, and the last time published for it
+    SerialLine::Mode m_Line = SerialLine::Idle;
+    u64 m_Published = 0;
+
+    // The peer's lines not yet reached, the last one that was, and the newest drained
+    std::deque<SerialLine> m_Pending;
+    SerialLine m_PeerLine = { 0, 0xFF, SerialLine::Idle };
+    SerialLine::Mode m_PeerState = SerialLine::Idle;
+
+    // When the bytes the peer clocks land, and what they are
+    std::deque<SerialLine> m_PeerTransfers;
+
+    // This side's own transfer: when it lands on the internal clock, when it armed
+    u64 m_Completion = 0;
+    u64 m_ArmedAt = 0;
+
+    u64 m_Transfers = 0;
+    u64 m_Answered = 0;
+    u64 m_Stalls = 0;
+};
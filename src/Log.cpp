@@ -1,5 +1,9 @@
 #include "Log.hpp"
 
+#include <chrono>
+#include <cstdarg>
+#include <ctime>
+
 const char *Red    = "\e[1;31m";
 const char *Green  = "\e[1;32m";
 const char *Yellow = "\e[1;33m";
@@ -11,30 +15,169 @@ const char *White  = "\e[0m";
 // const char *White  = "";
 
 namespace Log {
-    void Info(const char *fstr, ...) {
-        va_list args;
-        va_start(args, fstr);
-        printf("%s", Green);
-        vprintf(fstr, args);
-        printf("%s", White);
-        va_end(args);
+    // Bounded multi-producer / single-consumer ring (Vyukov style sequence slots)
+    class Logger {
+    public:
+        Logger() {
+            for (usize i = 0; i < s_Capacity; i++) {
+                m_Slots[i].Seq.store(i, std::memory_order_relaxed);
+            }
+
+            m_Writer = std::thread([this] { WriterLoop(); });
+        }
+
+        ~Logger() {
+            m_Quit = true;
+            m_Writer.join();
+        }
+
+        void Push(Level level, const char *fstr, va_list args) {
+            usize pos = m_Head.load(std::memory_order_relaxed);
+            Slot *slot;
+            while (true) {
+                slot = &m_Slots[pos & (s_Capacity - 1)];
+                usize seq = slot->Seq.load(std::memory_order_acquire);
+                isize diff = static_cast<isize>(seq) - static_cast<isize>(pos);
+                if (diff == 0) {
+                    if (m_Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else if (diff < 0) {
+                    m_Dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                } else {
+                    pos = m_Head.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->Lvl = level;
+            vsnprintf(slot->Text, sizeof(slot->Text), fstr, args);
+            slot->Seq.store(pos + 1, std::memory_order_release);
+        }
+
+        void Flush() {
+            usize target = m_Head.load(std::memory_order_acquire);
+            while (m_Written.load(std::memory_order_acquire) < target) {
+                std::this_thread::yield();
+            }
+        }
+
+        u64 GetDropped() const { return m_Dropped.load(std::memory_order_relaxed); }
+
+    private:
+        bool Pop() {
+            Slot &slot = m_Slots[m_Tail & (s_Capacity - 1)];
+            if (slot.Seq.load(std::memory_order_acquire) != m_Tail + 1) return false;
+
+            const char *color = White;
+            switch (slot.Lvl) {
+                case Level::Debug: color = White;  break;
+                case Level::Info:  color = Green;  break;
+                case Level::Warn:  color = Yellow; break;
+                case Level::Error: color = Red;    break;
+            }
+            fputs(color, stdout);
+            fputs(slot.Text, stdout);
+            fputs(White, stdout);
+
+            slot.Seq.store(m_Tail + s_Capacity, std::memory_order_release);
+            m_Tail++;
+            return true;
+        }
+
+        void WriterLoop() {
+            while (true) {
+                bool quit = m_Quit;
+
+                usize count = 0;
+                while (Pop()) count++;
+
+                if (count > 0) {
+                    fflush(stdout);
+                    m_Written.store(m_Tail, std::memory_order_release);
+                } else if (quit) {
+                    break;
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+
+            u64 dropped = GetDropped();
+            if (dropped > 0) {
+                printf("%s%lu log messages dropped (ring full)%s\n", Yellow, dropped, White);
+            }
+        }
+
+    private:
+        static constexpr usize s_Capacity = 1024;
+
+        struct Slot {
+            std::atomic<usize> Seq;
+            Level Lvl;
+            char Text[256];
+        };
+
+        Slot m_Slots[s_Capacity];
+
+        alignas(64) std::atomic<usize> m_Head = 0;
+        alignas(64) usize m_Tail = 0;
+        std::atomic<usize> m_Written = 0;
+        std::atomic<u64> m_Dropped = 0;
+        std::atomic<bool> m_Quit = false;
+
+        std::thread m_Writer;
+    };
+
+    static Logger &GetLogger() {
+        static Logger logger;
+        return logger;
     }
 
-    void Warn(const char *fstr, ...) {
-        va_list args;
-        va_start(args, fstr);
-        printf("%s", Yellow);
-        vprintf(fstr, args);
-        printf("%s", White);
-        va_end(args);
+    void WriteV(Level level, const char *fstr, va_list args) {
+        GetLogger().Push(level, fstr, args);
     }
 
-    void Error(const char *fstr, ...) {
+    void Write(Level level, const char *fstr, ...) {
         va_list args;
         va_start(args, fstr);
-        printf("%s", Red);
-        vprintf(fstr, args);
-        printf("%s", White);
+        WriteV(level, fstr, args);
         va_end(args);
     }
-}
\ No newline at end of file
+
+    void Flush() {
+        GetLogger().Flush();
+    }
+
+    u64 GetDropped() {
+        return GetLogger().GetDropped();
+    }
+
+    static u64 CoarseMillis() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<u64>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    RateLimiter::RateLimiter(Level level, u32 perSecond)
+        : m_Level(level), m_PerSecond(perSecond), m_WindowStart(CoarseMillis())
+    {}
+
+    bool RateLimiter::Allow() {
+        if (m_Count.fetch_add(1, std::memory_order_relaxed) < m_PerSecond) {
+            return true;
+        }
+
+        // Only look at the clock once the budget for the current window is spent
+        u64 now = CoarseMillis();
+        u64 start = m_WindowStart.load(std::memory_order_relaxed);
+        if (now - start >= 1000 && m_WindowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+            u32 suppressed = m_Suppressed.exchange(0, std::memory_order_relaxed);
+            if (suppressed > 0) {
+                Write(m_Level, "(%u similar messages suppressed)\n", suppressed);
+            }
+            m_Count.store(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        m_Suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+}
@@ -2,8 +2,86 @@
 
 #include "Common.hpp"
 
+#include <atomic>
+
+// Messages below LOG_LEVEL are compiled out entirely (override with -DLOG_LEVEL=...)
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE  4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
 namespace Log {
-    void Info(const char *fstr, ...);
-    void Warn(const char *fstr, ...);
-    void Error(const char *fstr, ...);
-}
\ No newline at end of file
+    enum Level : u8 { Debug, Info, Warn, Error };
+
+    // Formats the message on the calling thread and pushes it into a lock-free
+    // ring drained by a background writer. Never blocks: if the ring is full the
+    // message is dropped and counted. The ring holds 1024 messages and the writer
+    // wakes every millisecond, so a burst longer than that (a loop logging one
+    // line per item) loses its tail, and the count only shows up at exit. Output
+    // that has to arrive whole, like tool reports and listings, goes to stdout with
+    // printf after a Flush().
+    void Write(Level level, const char *fstr, ...) __attribute__((format(printf, 2, 3)));
+    void WriteV(Level level, const char *fstr, va_list args);
+
+    // Blocks until everything queued so far has reached stdout
+    void Flush();
+
+    u64 GetDropped();
+
+    // Per-callsite limiter, lets through at most `perSecond` messages every second
+    class RateLimiter {
+    public:
+        RateLimiter(Level level, u32 perSecond);
+
+        bool Allow();
+
+    private:
+        Level m_Level;
+        u32 m_PerSecond;
+        std::atomic<u64> m_WindowStart;
+        std::atomic<u32> m_Count = 0;
+        std::atomic<u32> m_Suppressed = 0;
+    };
+}
+
+#define LOG_RATELIMITED(level, perSecond, ...) do {                          \
+        static Log::RateLimiter s_Limiter((level), (perSecond));             \
+        if (s_Limiter.Allow()) Log::Write((level), __VA_ARGS__);             \
+    } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) Log::Write(Log::Debug, __VA_ARGS__)
+#define LOG_DEBUG_RL(n, ...) LOG_RATELIMITED(Log::Debug, n, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#define LOG_DEBUG_RL(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) Log::Write(Log::Info, __VA_ARGS__)
+#define LOG_INFO_RL(n, ...) LOG_RATELIMITED(Log::Info, n, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#define LOG_INFO_RL(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) Log::Write(Log::Warn, __VA_ARGS__)
+#define LOG_WARN_RL(n, ...) LOG_RATELIMITED(Log::Warn, n, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#define LOG_WARN_RL(n, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) Log::Write(Log::Error, __VA_ARGS__)
+#define LOG_ERROR_RL(n, ...) LOG_RATELIMITED(Log::Error, n, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#define LOG_ERROR_RL(n, ...) ((void)0)
+#endif
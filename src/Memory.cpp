@@ -3,18 +3,24 @@
 #include "Log.hpp"
 
 u8 Memory::Read(u16 addr) const {
+    if constexpr (MemoryProbe::Enabled) m_Probe.OnRead(addr);
+
     Cartrige &cart = Gameboy::Get().GetCartrige();
 
     switch (addr) {
-        case 0x0000 ... 0x7FFF: return cart.Read(addr);
-        case 0x8000 ... 0x9FFF: return m_Vram[addr - 0x8000];
+        case 0x0000 ... 0x7FFF: {
+            const Cheats &cheats = Gameboy::Get().GetCheats();
+            if (cheats.IsPatched(addr)) [[unlikely]] return cheats.ApplyRomPatches(addr, cart.Read(addr));
+            return cart.Read(addr);
+        }
+        case 0x8000 ... 0x9FFF: return m_Vram.Read(addr - 0x8000);
         case 0xA000 ... 0xBFFF: return cart.Read(addr);
-        case 0xC000 ... 0xDFFF: return m_Wram[addr - 0xC000];
-        case 0xE000 ... 0xFDFF: Log::Error("Reserved - Echo RAM. Can't Read (addr 0x%04X)\n", addr); return 0;
-        case 0xFE00 ... 0xFE9F: return m_Oam[addr - 0xFE00];
-        case 0xFEA0 ... 0xFEFF: Log::Error("Reserved - Unusable. Can't Read (addr 0x%04X)\n", addr); return 0;
+        case 0xC000 ... 0xDFFF: return m_Wram.Read(addr - 0xC000);
+        case 0xE000 ... 0xFDFF: return m_Wram.Read(addr - 0xE000); // Echo RAM
+        case 0xFE00 ... 0xFE9F: return m_Oam.Read(addr - 0xFE00);
+        case 0xFEA0 ... 0xFEFF: LOG_DEBUG_RL(10, "Reserved - Unusable. Can't Read (addr 0x%04X)\n", addr); return 0;
         case 0xFF00 ... 0xFF7F: return IORead(addr);
-        case 0xFF80 ... 0xFFFE: return m_Hram[addr - 0xFF80];
+        case 0xFF80 ... 0xFFFE: return m_Hram.Read(addr - 0xFF80);
         case 0xFFFF: return Gameboy::Get().GetCPU().GetIE();
         default: return 0;
     }
@@ -23,18 +29,20 @@ u8 Memory::Read(u16 addr) const {
 }
 
 void Memory::Write(u16 addr, u8 val) {
+    if constexpr (MemoryProbe::Enabled) m_Probe.OnWrite(addr);
+
     Cartrige &cart = Gameboy::Get().GetCartrige();
 
     switch (addr) {
         case 0x0000 ... 0x7FFF: cart.Write(addr, val); break;
-        case 0x8000 ... 0x9FFF: m_Vram[addr - 0x8000] = val; break;
+        case 0x8000 ... 0x9FFF: SyncPPU(); m_Vram.Write(addr - 0x8000, val); break;
         case 0xA000 ... 0xBFFF: cart.Write(addr, val); break;
-        case 0xC000 ... 0xDFFF: m_Wram[addr - 0xC000] = val; break;
-        case 0xE000 ... 0xFDFF: Log::Error("Reserved - Echo RAM. Can't Write (addr 0x%04X)\n", addr); break;
-        case 0xFE00 ... 0xFE9F: m_Oam[addr - 0xFE00] = val; break;
-        case 0xFEA0 ... 0xFEFF: Log::Error("Reserved - Unusable. Can't Write (addr 0x%04X)\n", addr); break;
+        case 0xC000 ... 0xDFFF: m_Wram.Write(addr - 0xC000, val); break;
+        case 0xE000 ... 0xFDFF: m_Wram.Write(addr - 0xE000, val); break; // Echo RAM
+        case 0xFE00 ... 0xFE9F: SyncPPU(); m_Oam.Write(addr - 0xFE00, val); break;
+        case 0xFEA0 ... 0xFEFF: LOG_DEBUG_RL(10, "Reserved - Unusable. Can't Write (addr 0x%04X)\n", addr); break;
         case 0xFF00 ... 0xFF7F: IOWrite(addr, val); break;
-        case 0xFF80 ... 0xFFFE: m_Hram[addr - 0xFF80] = val; break;
+        case 0xFF80 ... 0xFFFE: m_Hram.Write(addr - 0xFF80, val); break;
         case 0xFFFF: Gameboy::Get().GetCPU().SetIE(val); break;
         default: break;
     }
@@ -73,8 +81,8 @@ u8 Memory::IORead(u16 addr) const {
             return val;
         }
         // serial data
-        case 0xFF01: return m_SerialData[0];
-        case 0xFF02: return m_SerialData[1];
+        case 0xFF01: return Gameboy::Get().GetSerial().GetSB();
+        case 0xFF02: return Gameboy::Get().GetSerial().GetSC();
         // timer
         case 0xFF04: return timer.GetDIV();
         case 0xFF05: return timer.GetTIMA();
@@ -82,12 +90,14 @@ u8 Memory::IORead(u16 addr) const {
         case 0xFF07: return timer.GetTAC();
         // interputs fired
         case 0xFF0F: return Gameboy::Get().GetCPU().GetIF();
+        // sound
+        case 0xFF10 ... 0xFF3F: return Gameboy::Get().GetAPU().Read(addr);
         // lcd
         case 0xFF40: return lcd.Control;
-        case 0xFF41: return lcd.Status;
+        case 0xFF41: SyncPPU(); return lcd.Status;
         case 0xFF42: return lcd.ScrollY;
         case 0xFF43: return lcd.ScrollX;
-        case 0xFF44: return lcd.LY;
+        case 0xFF44: SyncPPU(); return lcd.LY;
         case 0xFF45: return lcd.LYCompare;
         case 0xFF46: return lcd.DMA;
         case 0xFF47: return lcd.BGPalette;
@@ -107,6 +117,11 @@ void Memory::IOWrite(u16 addr, u8 val) {
     PPU &ppu = Gameboy::Get().GetPPU();
     LCD &lcd = ppu.GetLCD();
 
+    // Lines drawn so far must see the old values
+    if (addr >= 0xFF40 && addr <= 0xFF4B) {
+        SyncPPU();
+    }
+
     switch (addr) {
         // joypad
         case 0xFF00: {
@@ -114,25 +129,27 @@ void Memory::IOWrite(u16 addr, u8 val) {
             joypad.Directon = (BIT(val, 4) == 0);
         } break;
         // serial data
-        case 0xFF01: m_SerialData[0] = val; break;
-        case 0xFF02: m_SerialData[1] = val; break;
+        case 0xFF01: Gameboy::Get().GetSerial().SetSB(val); break;
+        case 0xFF02: Gameboy::Get().GetSerial().SetSC(val); break;
         // timer 
-        case 0xFF04: timer.SetDIV(0);    break;
+        case 0xFF04: timer.ResetDIV();   break;
         case 0xFF05: timer.SetTIMA(val); break;
         case 0xFF06: timer.SetTMA(val);  break;
         case 0xFF07: timer.SetTAC(val);  break;
         // interupts fired
         case 0xFF0F: Gameboy::Get().GetCPU().SetIF(val); break;
+        // sound
+        case 0xFF10 ... 0xFF3F: Gameboy::Get().GetAPU().Write(addr, val); break;
         // lcd
         case 0xFF40: {
             lcd.Control = val;
             ppu.CheckForReset();
         } break;
-        case 0xFF41: lcd.Status    = (lcd.Status & 0b11) | val; break;
+        case 0xFF41: lcd.Status    = (lcd.Status & 0b11) | val; ppu.Schedule(); break;
         case 0xFF42: lcd.ScrollY   = val; break;
         case 0xFF43: lcd.ScrollX   = val; break;
-        case 0xFF44: lcd.LY        = val; break;
-        case 0xFF45: lcd.LYCompare = val; break;
+        case 0xFF44: lcd.LY        = val; ppu.Schedule(); break;
+        case 0xFF45: lcd.LYCompare = val; ppu.Schedule(); break;
         case 0xFF46: {
             lcd.DMA = val;
             DMATransfer(val);
@@ -147,6 +164,10 @@ void Memory::IOWrite(u16 addr, u8 val) {
     }
 }
 
+void Memory::SyncPPU() {
+    Gameboy::Get().GetPPU().Sync(Gameboy::Get().GetTicks());
+}
+
 void Memory::DMATransfer(u8 val) {
     u16 src_start = val << 8;
     u16 dest_start = 0xFE00;
@@ -156,4 +177,22 @@ void Memory::DMATransfer(u8 val) {
         u16 dest = dest_start + i;
         Write(dest, Read(src));
     }
+}
+
+void Memory::Serialize(StateWriter &state) const {
+    m_Vram.Serialize(state);
+    m_Wram.Serialize(state);
+    m_Oam.Serialize(state);
+    m_Hram.Serialize(state);
+}
+
+void Memory::Deserialize(StateReader &state) {
+    m_Vram.Deserialize(state);
+    m_Wram.Deserialize(state);
+    m_Oam.Deserialize(state);
+    m_Hram.Deserialize(state);
+}
+
+usize Memory::GetPrivateBytes() const {
+    return m_Vram.GetPrivateBytes() + m_Wram.GetPrivateBytes() + m_Oam.GetPrivateBytes() + m_Hram.GetPrivateBytes();
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Common.hpp"
+#include "SaveState.hpp"
+#include "CowBuffer.hpp"
+#include "MemoryProbe.hpp"
 
 class Memory {
 public:
@@ -10,16 +13,37 @@ public:
     u16 Read16(u16 addr) const;
     void Write16(u16 addr, u16 val);
 
+    // Direct accessors for the PPU, whose fetches aren't CPU bus accesses
+    u8 ReadVram(u16 addr) const { return m_Vram.Read(addr - 0x8000); }
+    u8 ReadOam(u16 addr) const { return m_Oam.Read(addr - 0xFE00); }
+
+    // For the JIT checking the WRAM code it compiled is still there
+    void ReadWram(u16 addr, void *data, usize size) const { m_Wram.ReadBytes(addr - 0xC000, data, size); }
+
+    void OnExecute(u16 pc) { m_Probe.OnExecute(pc); }
+
+    void DumpProbe(const std::string &prefix) const { m_Probe.Dump(prefix); }
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
+    usize GetPrivateBytes() const;
+
 private:
     u8 IORead(u16 addr) const;
     void IOWrite(u16 addr, u8 val);
 
     void DMATransfer(u8 val);
 
+    // Brings the PPU up to the current cycle before it can be observed or affected
+    static void SyncPPU();
+
 private:
-    u8 m_Vram[0x2000] = {};
-    u8 m_Wram[0x2000] = {};
-    u8 m_Oam[0xA0] = {};
-    u8 m_Hram[0x80] = {};
-    u8 m_SerialData[2];
+    // Copy-on-write so cloned machines share untouched pages
+    CowBuffer m_Vram = CowBuffer(0x2000);
+    CowBuffer m_Wram = CowBuffer(0x2000);
+    CowBuffer m_Oam = CowBuffer(0xA0);
+    CowBuffer m_Hram = CowBuffer(0x80);
+
+    mutable MemoryProbe m_Probe;
 };
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "MemoryProbe.hpp"
+#include "Log.hpp"
+
+#include <cmath>
+
+struct Region {
+    const char *Name;
+    u16 Start;
+    u16 End;
+};
+
+static const Region s_Regions[] = {
+    { "ROM0",     0x0000, 0x3FFF },
+    { "ROMX",     0x4000, 0x7FFF },
+    { "VRAM",     0x8000, 0x9FFF },
+    { "SRAM",     0xA000, 0xBFFF },
+    { "WRAM",     0xC000, 0xDFFF },
+    { "ECHO",     0xE000, 0xFDFF },
+    { "OAM",      0xFE00, 0xFE9F },
+    { "UNUSABLE", 0xFEA0, 0xFEFF },
+    { "IO",       0xFF00, 0xFF7F },
+    { "HRAM",     0xFF80, 0xFFFE },
+    { "IE",       0xFFFF, 0xFFFF },
+};
+
+static const char *GetRegionName(u16 addr) {
+    for (const Region &region : s_Regions) {
+        if (region.Start <= addr && addr <= region.End) return region.Name;
+    }
+
+    return "";
+}
+
+CountingMemoryProbe::CountingMemoryProbe()
+    : m_Reads(0x10000, 0),
+      m_Writes(0x10000, 0),
+      m_Executes(0x10000, 0),
+      m_DataReadsByPC(0x10000, 0),
+      m_DataWritesByPC(0x10000, 0),
+      m_LastPC(0x10000, 0)
+{}
+
+void CountingMemoryProbe::Dump(const std::string &prefix) const {
+    DumpAddresses(prefix + ".mem.csv");
+    DumpPCs(prefix + ".pc.csv");
+    DumpRegions(prefix + ".regions.csv");
+    DumpHeatmap(prefix + ".heatmap.ppm");
+
+    LOG_INFO("Memory probe written to %s.{mem,pc,regions}.csv and %s.heatmap.ppm\n", prefix.c_str(), prefix.c_str());
+}
+
+void CountingMemoryProbe::DumpAddresses(const std::string &path) const {
+    std::ofstream fs(path);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return;
+    }
+
+    fs << "addr,region,reads,writes,executes,last_pc\n";
+
+    char line[96];
+    for (u32 addr = 0; addr < 0x10000; addr++) {
+        if (m_Reads[addr] == 0 && m_Writes[addr] == 0 && m_Executes[addr] == 0) continue;
+
+        snprintf(line, sizeof(line), "0x%04X,%s,%lu,%lu,%lu,0x%04X\n",
+            addr, GetRegionName(addr), m_Reads[addr], m_Writes[addr], m_Executes[addr], m_LastPC[addr]);
+        fs << line;
+    }
+}
+
+void CountingMemoryProbe::DumpPCs(const std::string &path) const {
+    std::ofstream fs(path);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return;
+    }
+
+    fs << "pc,region,executes,data_reads,data_writes\n";
+
+    char line[96];
+    for (u32 pc = 0; pc < 0x10000; pc++) {
+        if (m_Executes[pc] == 0) continue;
+
+        snprintf(line, sizeof(line), "0x%04X,%s,%lu,%lu,%lu\n",
+            pc, GetRegionName(pc), m_Executes[pc], m_DataReadsByPC[pc], m_DataWritesByPC[pc]);
+        fs << line;
+    }
+}
+
+void CountingMemoryProbe::DumpRegions(const std::string &path) const {
+    std::ofstream fs(path);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return;
+    }
+
+    fs << "region,start,end,reads,writes,executes\n";
+
+    char line[96];
+    for (const Region &region : s_Regions) {
+        u64 reads = 0, writes = 0, executes = 0;
+        for (u32 addr = region.Start; addr <= region.End; addr++) {
+            reads += m_Reads[addr];
+            writes += m_Writes[addr];
+            executes += m_Executes[addr];
+        }
+
+        snprintf(line, sizeof(line), "%s,0x%04X,0x%04X,%lu,%lu,%lu\n",
+            region.Name, region.Start, region.End, reads, writes, executes);
+        fs << line;
+    }
+}
+
+void CountingMemoryProbe::DumpHeatmap(const std::string &path) const {
+    std::ofstream fs(path, std::ios::binary);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return;
+    }
+
+    // One pixel per address, row = high byte, column = low byte
+    auto maxOf = [](const std::vector<u64> &counts) {
+        u64 max = 1;
+        for (u64 count : counts) max = std::max(max, count);
+        return std::log1p(static_cast<double>(max));
+    };
+
+    auto scale = [](u64 count, double max) {
+        return static_cast<u8>(255.0 * std::log1p(static_cast<double>(count)) / max);
+    };
+
+    double maxReads = maxOf(m_Reads);
+    double maxWrites = maxOf(m_Writes);
+    double maxExecutes = maxOf(m_Executes);
+
+    std::vector<u8> pixels(0x10000 * 3);
+    for (u32 addr = 0; addr < 0x10000; addr++) {
+        pixels[3 * addr + 0] = scale(m_Writes[addr], maxWrites);
+        pixels[3 * addr + 1] = scale(m_Reads[addr], maxReads);
+        pixels[3 * addr + 2] = scale(m_Executes[addr], maxExecutes);
+    }
+
+    fs << "P6\n256 256\n255\n";
+    fs.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Common.hpp"
+
+// Instrumentation policy for Memory. The policy is picked at compile time: the
+// default NullMemoryProbe is empty and every hook is behind `if constexpr`, so
+// a normal build contains no instrumentation code at all. Build with
+// -DGB_MEMORY_PROBE (make PROBE=1) to count every bus access.
+struct NullMemoryProbe {
+    static constexpr bool Enabled = false;
+
+    void OnRead(u16) {}
+    void OnWrite(u16) {}
+    void OnExecute(u16) {}
+
+    void Dump(const std::string &) const {}
+};
+
+// Keeps per-address read/write/execute counters plus, per instruction address,
+// how many data accesses that instruction issued. Enabling it costs about
+// 20-35% of emulation speed (3000 frames of Pokemon Red / Tetris at -O2), mostly
+// cache misses on the ~2.5 MB of counters.
+class CountingMemoryProbe {
+public:
+    static constexpr bool Enabled = true;
+
+    CountingMemoryProbe();
+
+    void OnRead(u16 addr) {
+        m_Reads[addr]++;
+        m_DataReadsByPC[m_CurrentPC]++;
+        m_LastPC[addr] = m_CurrentPC;
+    }
+
+    void OnWrite(u16 addr) {
+        m_Writes[addr]++;
+        m_DataWritesByPC[m_CurrentPC]++;
+        m_LastPC[addr] = m_CurrentPC;
+    }
+
+    void OnExecute(u16 pc) {
+        m_Executes[pc]++;
+        m_CurrentPC = pc;
+    }
+
+    // Writes <prefix>.mem.csv, <prefix>.pc.csv, <prefix>.regions.csv and a
+    // 256x256 <prefix>.heatmap.ppm (R = writes, G = reads, B = executes, log scaled)
+    void Dump(const std::string &prefix) const;
+
+private:
+    void DumpAddresses(const std::string &path) const;
+    void DumpPCs(const std::string &path) const;
+    void DumpRegions(const std::string &path) const;
+    void DumpHeatmap(const std::string &path) const;
+
+private:
+    std::vector<u64> m_Reads;
+    std::vector<u64> m_Writes;
+    std::vector<u64> m_Executes;
+    std::vector<u64> m_DataReadsByPC;
+    std::vector<u64> m_DataWritesByPC;
+    std::vector<u16> m_LastPC;
+
+    u16 m_CurrentPC = 0;
+};
+
+#ifdef GB_MEMORY_PROBE
+using MemoryProbe = CountingMemoryProbe;
+#else
+using MemoryProbe = NullMemoryProbe;
+static_assert(std::is_empty<MemoryProbe>::value, "disabled memory probe must not carry state");
+#endif
@@ -0,0 +1,184 @@
+#include "Movie.hpp"
+#include "Gameboy.hpp"
+#include "Hash.hpp"
+#include "Log.hpp"
+
+#include <chrono>
+
+bool Movie::StartRecording(const std::string &path, u16 checkpointInterval) {
+    Gameboy &gameboy = Gameboy::Get();
+
+    m_Path = path;
+    m_Header.Magic = s_Magic;
+    m_Header.Version = s_Version;
+    m_Header.CheckpointInterval = std::max<u16>(checkpointInterval, 1);
+    m_Header.RomHash = gameboy.GetCartrige().GetRomHash();
+    m_Header.MainColor = gameboy.GetPPU().GetMainColor();
+
+    gameboy.SaveState(m_StartState);
+    m_Inputs.clear();
+    m_Checkpoints.clear();
+    m_Frame = 0;
+    m_Recording = true;
+
+    // The start is a frame boundary too, it latches the first frame's buttons
+    OnFrame();
+
+    LOG_INFO("Recording movie to %s\n", path.c_str());
+    return true;
+}
+
+bool Movie::StopRecording() {
+    if (!m_Recording) return false;
+    m_Recording = false;
+
+    m_Header.Frames = m_Inputs.size();
+    m_Header.StateSize = m_StartState.size();
+    m_Header.Checkpoints = m_Checkpoints.size();
+
+    std::ofstream fs(m_Path, std::ios::binary);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", m_Path.c_str());
+        return false;
+    }
+
+    fs.write(reinterpret_cast<const char*>(&m_Header), sizeof(m_Header));
+    fs.write(reinterpret_cast<const char*>(m_StartState.data()), m_StartState.size());
+    fs.write(reinterpret_cast<const char*>(m_Inputs.data()), m_Inputs.size());
+    fs.write(reinterpret_cast<const char*>(m_Checkpoints.data()), m_Checkpoints.size() * sizeof(u64));
+
+    LOG_INFO("Movie saved: %lu frames, %lu checkpoints (%s)\n", m_Inputs.size(), m_Checkpoints.size(), m_Path.c_str());
+    return true;
+}
+
+bool Movie::Load(const std::string &path) {
+    std::ifstream fs(path, std::ios::binary);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    fs.read(reinterpret_cast<char*>(&m_Header), sizeof(m_Header));
+    if (!fs || m_Header.Magic != s_Magic || m_Header.Version != s_Version || m_Header.CheckpointInterval == 0) {
+        LOG_ERROR("%s is not a supported movie\n", path.c_str());
+        return false;
+    }
+
+    // The sizes come from the file, they have to add up to what is left of it
+    std::streamoff start = fs.tellg();
+    fs.seekg(0, std::ios::end);
+    u64 left = static_cast<u64>(fs.tellg() - start);
+    fs.seekg(start);
+
+    u64 expected = u64(m_Header.StateSize) + m_Header.Frames + u64(m_Header.Checkpoints) * sizeof(u64);
+    if (expected > left) {
+        LOG_ERROR("%s is truncated\n", path.c_str());
+        return false;
+    }
+
+    m_StartState.resize(m_Header.StateSize);
+    m_Inputs.resize(m_Header.Frames);
+    m_Checkpoints.resize(m_Header.Checkpoints);
+
+    fs.read(reinterpret_cast<char*>(m_StartState.data()), m_StartState.size());
+    fs.read(reinterpret_cast<char*>(m_Inputs.data()), m_Inputs.size());
+    fs.read(reinterpret_cast<char*>(m_Checkpoints.data()), m_Checkpoints.size() * sizeof(u64));
+    if (!fs) {
+        LOG_ERROR("%s is truncated\n", path.c_str());
+        return false;
+    }
+
+    Gameboy &gameboy = Gameboy::Get();
+    if (m_Header.RomHash != gameboy.GetCartrige().GetRomHash()) {
+        LOG_ERROR("%s was recorded with a different ROM\n", path.c_str());
+        return false;
+    }
+
+    gameboy.GetPPU().SetColors(m_Header.MainColor);
+    if (!gameboy.LoadState(m_StartState.data(), m_StartState.size())) {
+        return false;
+    }
+
+    m_Path = path;
+    m_Frame = 0;
+    m_Verified = 0;
+    m_FirstDivergence = -1;
+    m_Playing = true;
+
+    OnFrame();
+    return true;
+}
+
+u64 Movie::HashFramebuffer() const {
+    const std::vector<u32> &framebuffer = Gameboy::Get().GetPPU().GetFramebuffer();
+    return Hash64(framebuffer.data(), framebuffer.size() * sizeof(u32));
+}
+
+void Movie::OnFrame() {
+    if (!m_Recording && !m_Playing) return;
+
+    // m_Frame frames have finished since the start state
+    bool checkpoint = m_Frame > 0 && m_Frame % m_Header.CheckpointInterval == 0;
+    Joypad &joypad = Gameboy::Get().GetUI().GetJoypad();
+
+    if (m_Recording) {
+        if (checkpoint) m_Checkpoints.push_back(HashFramebuffer());
+        m_Inputs.push_back(joypad.GetButtons());
+        m_Frame++;
+        return;
+    }
+
+    usize index = m_Frame / m_Header.CheckpointInterval - 1;
+    if (checkpoint && index < m_Checkpoints.size()) {
+        u64 hash = HashFramebuffer();
+        if (hash == m_Checkpoints[index]) {
+            m_Verified++;
+        } else if (m_FirstDivergence < 0) {
+            m_FirstDivergence = m_Frame;
+            m_Expected = m_Checkpoints[index];
+            m_Actual = hash;
+        }
+    }
+
+    if (m_Frame < m_Inputs.size()) {
+        joypad.SetButtons(m_Inputs[m_Frame]);
+        m_Frame++;
+    }
+}
+
+int Movie::RunTool(int argc, char **argv) {
+    if (argc < 4) {
+        LOG_ERROR("Usage: %s --play <movie> <rom>\n", argv[0]);
+        return 1;
+    }
+
+    char rewindOff[] = "--rewind", zero[] = "0";
+    char *args[] = { argv[0], argv[3], rewindOff, zero };
+    Gameboy gameboy(4, args);
+
+    Movie &movie = gameboy.GetMovie();
+    if (!movie.Load(argv[2])) {
+        Log::Flush();
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (!movie.IsFinished()) {
+        gameboy.RunFrame();
+    }
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("Played %lu frames in %.2f s (%.0f fps), %lu/%lu checkpoints match\n",
+        movie.m_Inputs.size(), secs, movie.m_Inputs.size() / secs, movie.m_Verified, movie.m_Checkpoints.size());
+
+    int result = 0;
+    if (movie.m_FirstDivergence >= 0) {
+        LOG_ERROR("Output diverges first at frame %ld (framebuffer %016lx, expected %016lx)\n",
+            movie.m_FirstDivergence, movie.m_Actual, movie.m_Expected);
+        result = 1;
+    }
+
+    Log::Flush();
+    return result;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Common.hpp"
+
+// Input movie: the buttons latched at every frame boundary plus a framebuffer hash
+// every `CheckpointInterval` frames, starting from an embedded save state.
+//
+// File layout (little endian):
+//   "GBMV", u16 version, u16 checkpoint interval, u64 ROM hash, u32 main color,
+//   u32 frame count, u32 state size, u32 checkpoint count, state,
+//   inputs (1 byte per frame), checkpoints (u64 each)
+class Movie {
+public:
+    bool StartRecording(const std::string &path, u16 checkpointInterval = 1);
+    bool StopRecording();
+
+    bool Load(const std::string &path);
+
+    bool IsRecording() const { return m_Recording; }
+    bool IsPlaying() const { return m_Playing; }
+    bool IsFinished() const { return m_Playing && m_Frame >= m_Inputs.size(); }
+
+    // Frame boundary: records or replays the buttons for the next frame and
+    // checks the one that just finished
+    void OnFrame();
+
+    // gbemu --play <movie> <rom>
+    static int RunTool(int argc, char **argv);
+
+private:
+    u64 HashFramebuffer() const;
+
+private:
+    struct Header {
+        u32 Magic;
+        u16 Version;
+        u16 CheckpointInterval;
+        u64 RomHash;
+        u32 MainColor;
+        u32 Frames;
+        u32 StateSize;
+        u32 Checkpoints;
+    };
+
+    static constexpr u32 s_Magic = 0x564D4247; // "GBMV"
+    static constexpr u16 s_Version = 1;
+
+    std::string m_Path;
+    Header m_Header = {};
+    std::vector<u8> m_StartState;
+    std::vector<u8> m_Inputs;
+    std::vector<u64> m_Checkpoints;
+
+    bool m_Recording = false;
+    bool m_Playing = false;
+    usize m_Frame = 0;
+
+    // Playback results
+    usize m_Verified = 0;
+    isize m_FirstDivergence = -1;
+    u64 m_Expected = 0;
+    u64 m_Actual = 0;
+};
@@ -8,64 +8,127 @@ void LoadPallete(u8 palette, u8 *colors) {
     colors[3] = (palette & 0b11000000) >> 6;
 }
     
-void PPU::Tick(u8 cycles) {
+u32 PPU::GetModeLength(LCDMode mode) {
+    switch (mode) {
+        case LCDMode::AccessOam:  return 80;
+        case LCDMode::AccessVram: return 172;
+        case LCDMode::Hblank:     return 204;
+        default:                  return 456;
+    }
+}
+
+u64 PPU::GetNextModeChange() const {
+    if (!m_LCDEnabled) return ~0ull;
+
+    return m_LastSync - m_Counter + GetModeLength(GetLCDMode());
+}
+
+void PPU::Sync(u64 now) {
+    if (now <= m_LastSync) return;
+
+    u64 elapsed = now - m_LastSync;
+    m_LastSync = now;
     if (!m_LCDEnabled) return;
 
+    m_SyncCount++;
+
+    m_Counter += elapsed;
+    while (m_Counter >= GetModeLength(GetLCDMode())) {
+        m_Counter -= GetModeLength(GetLCDMode());
+        NextMode();
+    }
+
+    if (now >= m_NextEvent) {
+        Schedule();
+    }
+}
+
+// Walks the mode changes ahead without running them, up to the first one that
+// raises an interrupt. VBlank always does, so this stops within a frame.
+void PPU::Schedule() {
+    if (!m_LCDEnabled) {
+        m_NextEvent = ~0ull;
+        return;
+    }
+
+    bool statHblank = BIT(m_LCD.Status, 3);
+    bool statOam = BIT(m_LCD.Status, 5);
+    bool statLyc = BIT(m_LCD.Status, 6);
+
+    LCDMode mode = GetLCDMode();
+    u8 ly = m_LCD.LY;
+    u64 time = m_LastSync - m_Counter;
+
+    while (true) {
+        time += GetModeLength(mode);
+
+        if (mode == LCDMode::AccessOam) {
+            mode = LCDMode::AccessVram;
+        } else if (mode == LCDMode::AccessVram) {
+            mode = LCDMode::Hblank;
+            if (statHblank) break;
+        } else if (mode == LCDMode::Hblank) {
+            if (ly >= m_FrameHeight - 1) break;
+
+            ly++;
+            mode = LCDMode::AccessOam;
+            if (statOam || (statLyc && ly == m_LCD.LYCompare)) break;
+        } else {
+            ly++;
+            if (statLyc && ly == m_LCD.LYCompare) break;
+
+            if (ly > 153) {
+                ly = 0;
+                mode = LCDMode::AccessOam;
+                if (statOam || (statLyc && ly == m_LCD.LYCompare)) break;
+            }
+        }
+    }
+
+    m_NextEvent = time;
+}
+
+void PPU::NextMode() {
     u8 controlBGEnabled = BIT(m_LCD.Control, 0);
     u8 controlObjEnabled = BIT(m_LCD.Control, 1);
     u8 controlLCDEnabled = BIT(m_LCD.Control, 7);
 
-    m_Counter += cycles;
-
     switch (GetLCDMode()) {
         case LCDMode::AccessOam: {
-            if (m_Counter >= 80) {
-                m_Counter %= 80;
-                SetLCDMode(LCDMode::AccessVram);
-            }
+            SetLCDMode(LCDMode::AccessVram);
             break;
         }
         case LCDMode::AccessVram: {
-            if (m_Counter >= 172) {
-                if (controlLCDEnabled && controlBGEnabled) {
-                    WriteBGLine();
-                }
-
-                if (controlLCDEnabled && controlObjEnabled) {
-                    WriteSprites();
-                }
+            if (m_Rendering && controlLCDEnabled && controlBGEnabled) {
+                WriteBGLine();
+            }
 
-                m_Counter %= 172;
-                SetLCDMode(LCDMode::Hblank);
+            if (m_Rendering && controlLCDEnabled && controlObjEnabled) {
+                WriteSprites();
             }
+
+            SetLCDMode(LCDMode::Hblank);
             break;
         }
         case LCDMode::Hblank: {
-            if (m_Counter >= 204) {
-                m_Counter %= 204;
-
-                if (m_LCD.LY >= m_FrameHeight - 1) {
-                    SetLCDMode(LCDMode::Vblank);
-                    m_CurrentFrame++;
-
-                    Gameboy::Get().GetCPU().RequestInterrupt(CPU::Interrupt::Vblank);
-                    Maintain60FPS();
-                } else {
-                    LYIncrement();
-                    SetLCDMode(LCDMode::AccessOam);
-                }
+            if (m_LCD.LY >= m_FrameHeight - 1) {
+                SetLCDMode(LCDMode::Vblank);
+                m_CurrentFrame++;
+
+                Gameboy::Get().GetCPU().RequestInterrupt(CPU::Interrupt::Vblank);
+                Gameboy::Get().GetCheats().ApplyRamPokes();
+            } else {
+                LYIncrement();
+                SetLCDMode(LCDMode::AccessOam);
             }
             break;
         }
         case LCDMode::Vblank: {
-            if (m_Counter >= 456) {
-                m_Counter %= 456;
-                LYIncrement();
+            LYIncrement();
 
-                if (m_LCD.LY > 153) {
-                    LYReset();
-                    SetLCDMode(LCDMode::AccessOam);
-                }
+            if (m_LCD.LY > 153) {
+                LYReset();
+                SetLCDMode(LCDMode::AccessOam);
             }
             break;
         }
@@ -84,6 +147,8 @@ void PPU::CheckForReset() {
         m_Counter = 0;
         LYReset();
     }
+
+    Schedule();
 }
 
 void PPU::LYUpdate(u8 newLY) {
@@ -108,28 +173,6 @@ void PPU::LYReset() {
     LYUpdate(0);
 }
 
-void PPU::Maintain60FPS() {
-    static u8 totalFrames = 0;
-    static u64 startTime = 0;
-    
-    m_TimerEnd = SDL_GetTicks();
-    u32 dt = m_TimerEnd - m_TimerStart;
-
-    const u32 totalFrameTime = 1000 / 60;
-    if (dt < totalFrameTime) {
-        SDL_Delay(totalFrameTime - dt);
-    }
-
-    if (m_TimerEnd - startTime >= 1000) {
-        // LOG_INFO("FPS: %d\n", total_frames);
-        startTime = m_TimerEnd;
-        totalFrames = 0;
-    }
-
-    totalFrames++;
-    m_TimerStart = SDL_GetTicks();
-}
-
 LCDMode PPU::GetLCDMode() const {
     return static_cast<LCDMode>(m_LCD.Status & 0b11);
 }
@@ -156,11 +199,27 @@ void PPU::SetColors(u32 mainColor) {
     m_Colors[3] = 0;
 }
 
+void PPU::CopyShades(u8 *out) const {
+    const std::vector<u32> &framebuffer = *m_Framebuffer;
+    for (usize i = 0; i < framebuffer.size(); i++) {
+        u32 color = framebuffer[i];
+        out[i] = (color == m_Colors[0]) ? 0 : (color == m_Colors[1]) ? 1 : (color == m_Colors[2]) ? 2 : 3;
+    }
+}
+
 bool PPU::InsideWindow(u8 x, u8 y) {
     u8 winEnabled = BIT(m_LCD.Control, 5);
     return winEnabled && (y >= m_LCD.WindowY) && (x >= m_LCD.WindowX - 7);
 }
 
+std::vector<u32> &PPU::GetWritableFramebuffer() {
+    if (m_Framebuffer.use_count() != 1) {
+        m_Framebuffer = std::make_shared<std::vector<u32>>(*m_Framebuffer);
+    }
+
+    return *m_Framebuffer;
+}
+
 void PPU::WriteBGLine() {
     u8 colors[4];
     LoadPallete(m_LCD.BGPalette, colors);
@@ -174,6 +233,8 @@ void PPU::WriteBGLine() {
     u16 tileDataBase = controlBGDataArea ? 0x8000 : 0x9000;
     u16 tileMapBase = controlBGMapArea ? 0x9C00 : 0x9800;
 
+    std::vector<u32> &framebuffer = GetWritableFramebuffer();
+
     for (u8 x = 0; x < m_FrameWidth; x++) {
         u8 bgMapX = (x + m_LCD.ScrollX) % 256;
         u8 bgMapY = (y + m_LCD.ScrollY) % 256;
@@ -192,17 +253,17 @@ void PPU::WriteBGLine() {
         Memory &memory = Gameboy::Get().GetMemory();
 
         u16 tileIdx = 32 * static_cast<u16>(tileY) + static_cast<u16>(tileX);
-        u8 tile = memory.Read(tileMapBase + tileIdx);
+        u8 tile = memory.ReadVram(tileMapBase + tileIdx);
 
         i16 tileOffset = controlBGDataArea ? 16 * tile : 16 * static_cast<i8>(tile);
         u16 pixelOffset = 2 * tilePixelY;
 
-        u8 b1 = memory.Read(tileDataBase + tileOffset + pixelOffset);
-        u8 b2 = memory.Read(tileDataBase + tileOffset + pixelOffset + 1);
+        u8 b1 = memory.ReadVram(tileDataBase + tileOffset + pixelOffset);
+        u8 b2 = memory.ReadVram(tileDataBase + tileOffset + pixelOffset + 1);
 
         u8 colorIdx = (BIT(b2, 7 - tilePixelX) << 1) | BIT(b1, 7 - tilePixelX);
         u32 color = m_Colors[colors[colorIdx]];
-        m_Framebuffer[m_FrameWidth * y + x] = color;
+        framebuffer[m_FrameWidth * y + x] = color;
     }
 }
 
@@ -212,15 +273,17 @@ void PPU::WriteSprites() {
 
     u8 y = m_LCD.LY;
 
+    std::vector<u32> &framebuffer = GetWritableFramebuffer();
+
     for (u8 i = 0; i < 40; i++) {
         u16 spriteAddr = 0xFE00 + 4 * i;
 
         Memory &memory = Gameboy::Get().GetMemory();
 
-        u8 spriteYpos = memory.Read(spriteAddr);
-        u8 spriteXpos = memory.Read(spriteAddr + 1);
-        u8 spriteIdx = memory.Read(spriteAddr + 2);
-        u8 spriteFlags = memory.Read(spriteAddr + 3);
+        u8 spriteYpos = memory.ReadOam(spriteAddr);
+        u8 spriteXpos = memory.ReadOam(spriteAddr + 1);
+        u8 spriteIdx = memory.ReadOam(spriteAddr + 2);
+        u8 spriteFlags = memory.ReadOam(spriteAddr + 3);
 
         u8 pallete = BIT(spriteFlags, 4) ? m_LCD.ObjPalette1 : m_LCD.ObjPalette0;
         u8 colors[4];
@@ -233,8 +296,8 @@ void PPU::WriteSprites() {
         {
             u8 yFlipped = BIT(spriteFlags, 6) ? 8 * mult - 1 - (y - spriteYpos + 16) : (y - spriteYpos + 16); 
 
-            u8 b1 = memory.Read(tileAddr + 2 * yFlipped);
-            u8 b2 = memory.Read(tileAddr + 2 * yFlipped + 1);
+            u8 b1 = memory.ReadVram(tileAddr + 2 * yFlipped);
+            u8 b2 = memory.ReadVram(tileAddr + 2 * yFlipped + 1);
 
             for (u8 x = 0; x < 8; x++) {
                 u8 xFlipped = BIT(spriteFlags, 5) ? 7 - x : x;
@@ -248,9 +311,31 @@ void PPU::WriteSprites() {
                 if (static_cast<i16>(finalXpos) < 0 || finalXpos >= m_FrameWidth) continue;
 
                 usize finalIdx = m_FrameWidth * static_cast<usize>(y) + static_cast<usize>(finalXpos);
-                if (BIT(spriteFlags, 7) && m_Framebuffer[finalIdx] != colors[colors[0]]) continue;
-                m_Framebuffer[finalIdx] = color;
+                if (BIT(spriteFlags, 7) && framebuffer[finalIdx] != colors[colors[0]]) continue;
+                framebuffer[finalIdx] = color;
             }
         }
     }
+}
+
+// The frame counter is left alone: the UI thread paces itself on it
+void PPU::Serialize(StateWriter &state) const {
+    state.Write(m_LCD);
+    state.Write(m_LCDEnabled);
+    state.Write(static_cast<u32>(m_Counter));
+    state.Write(m_LastSync);
+    state.WriteBytes(m_Framebuffer->data(), m_Framebuffer->size() * sizeof(u32));
+}
+
+void PPU::Deserialize(StateReader &state) {
+    u32 counter = 0;
+    state.Read(m_LCD);
+    state.Read(m_LCDEnabled);
+    state.Read(counter);
+    state.Read(m_LastSync);
+    std::vector<u32> &framebuffer = GetWritableFramebuffer();
+    state.ReadBytes(framebuffer.data(), framebuffer.size() * sizeof(u32));
+    m_Counter = counter;
+
+    Schedule();
 }
\ No newline at end of file
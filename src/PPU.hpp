@@ -1,6 +1,9 @@
 #pragma once
 
 #include "Common.hpp"
+#include "SaveState.hpp"
+
+#include <memory>
 
 enum LCDMode {
     Hblank,
@@ -24,48 +27,85 @@ struct LCD {
     u8 WindowX = 7;
 };
 
+// The PPU isn't stepped per instruction. It catches up to the machine's cycle count
+// when its state becomes observable: STAT or LY is read, an LCD register, VRAM or
+// OAM is written, or the next event arrives that the CPU can't poll for (VBlank,
+// an enabled STAT interrupt). Catching up runs every mode change on the way exactly
+// as stepping would have, so the output is the same.
 class PPU {
 public:
-    PPU() : m_Framebuffer(m_FrameWidth * m_FrameHeight, 0) {}
+    PPU() : m_Framebuffer(std::make_shared<std::vector<u32>>(m_FrameWidth * m_FrameHeight, 0)) {}
 
     LCD &GetLCD() { return m_LCD; }
 
-    const std::vector<u32> &GetFramebuffer() const { return m_Framebuffer; }
+    const std::vector<u32> &GetFramebuffer() const { return *m_Framebuffer; }
+    bool IsFramebufferShared() const { return m_Framebuffer.use_count() != 1; }
+
+    // The framebuffer as shades, 0 (lightest) to 3 (darkest), one byte per pixel
+    void CopyShades(u8 *out) const;
     usize GetCurrentFrame() const { return m_CurrentFrame; }
+    void SetCurrentFrame(usize frame) { m_CurrentFrame = frame; }
+
+    // Catches up to `now`
+    void Sync(u64 now);
+
+    // When Sync must be called next even if nobody looks
+    u64 GetNextEvent() const { return m_NextEvent; }
+
+    // When STAT and LY may change next, as of the last Sync
+    u64 GetNextModeChange() const;
+
+    // After writes to FF40, FF41, FF44 or FF45, which move the next event
+    void Schedule();
 
-    void Tick(u8 cycles);
+    // Syncs that had anything to catch up on, for benchmarks
+    u64 GetSyncCount() const { return m_SyncCount; }
 
     void CheckForReset();
 
     void SetColors(u32 mainColor);
+    u32 GetMainColor() const { return m_Colors[0]; }
+
+    // Frames nobody will look at skip drawing, which has no effect on emulation
+    void SetRendering(bool enabled) { m_Rendering = enabled; }
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
 
 private:
     void LYUpdate(u8 newLY);
     void LYIncrement();
     void LYReset();
 
-    void Maintain60FPS();
-
     LCDMode GetLCDMode() const;
     void SetLCDMode(LCDMode mode);
 
+    static u32 GetModeLength(LCDMode mode);
+    void NextMode();
+
     bool InsideWindow(u8 x, u8 y);
 
+    // Copies of a PPU share the framebuffer until one of them draws
+    std::vector<u32> &GetWritableFramebuffer();
+
     void WriteBGLine();
     void WriteSprites();
 
 private:
     usize m_FrameWidth = 160;
     usize m_FrameHeight = 144;
-    std::vector<u32> m_Framebuffer;
+    std::shared_ptr<std::vector<u32>> m_Framebuffer;
 
     u32 m_Colors[4];
 
     LCD m_LCD;
     bool m_LCDEnabled = true;
+    bool m_Rendering = true;
 
     usize m_CurrentFrame = 0;
-    usize m_Counter = 0;
-    u32 m_TimerStart = 0;
-    u32 m_TimerEnd = 0;
+    usize m_Counter = 0;       // Cycles into the current mode
+
+    u64 m_LastSync = 0;
+    u64 m_NextEvent = 0;
+    u64 m_SyncCount = 0;
 };
\ No newline at end of file
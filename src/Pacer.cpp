@@ -0,0 +1,95 @@
+#include "Pacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <time.h>
+
+u64 Pacer::Now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<u64>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+void Pacer::SetSpeed(double multiplier) {
+    if (multiplier > 0) {
+        multiplier = std::clamp(multiplier, 0.25, 8.0);
+        m_PeriodNs = static_cast<u64>(1e9 / (s_RefreshRate * multiplier));
+    } else {
+        multiplier = 0;
+        m_PeriodNs = 0;
+    }
+
+    m_Speed = multiplier;
+    Reset();
+}
+
+void Pacer::StepSpeed(int direction) {
+    const usize count = sizeof(s_Speeds) / sizeof(s_Speeds[0]);
+
+    usize current = std::find(s_Speeds, s_Speeds + count, GetSpeed()) - s_Speeds;
+    if (current == count) current = 2;
+
+    isize next = std::clamp<isize>(static_cast<isize>(current) + direction, 0, count - 1);
+    SetSpeed(s_Speeds[next]);
+}
+
+void Pacer::Reset() {
+    m_Restart = true;
+}
+
+void Pacer::WaitForNextFrame() {
+    u64 period = m_PeriodNs;
+
+    if (m_Restart.exchange(false)) {
+        m_Deadline = Now();
+        m_LastRelease = 0;
+        m_Frames = 0;
+        m_Mean = 0;
+        m_M2 = 0;
+        m_MaxError = 0;
+        m_Late = 0;
+    }
+
+    if (period == 0) return;
+
+    m_Deadline += period;
+
+    u64 now = Now();
+    if (now > m_Deadline + period) {
+        // Too far behind to catch up without a burst of frames, start over from here
+        m_Deadline = now;
+        m_Late++;
+    } else {
+        if (m_Deadline > now + s_SpinNs) {
+            u64 wake = m_Deadline - s_SpinNs;
+            timespec ts = { static_cast<time_t>(wake / 1'000'000'000), static_cast<long>(wake % 1'000'000'000) };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+        }
+
+        while ((now = Now()) < m_Deadline) {}
+    }
+
+    if (m_LastRelease != 0) {
+        double frameTime = static_cast<double>(now - m_LastRelease);
+
+        m_Frames++;
+        double delta = frameTime - m_Mean;
+        m_Mean += delta / m_Frames;
+        m_M2 += delta * (frameTime - m_Mean);
+        m_MaxError = std::max(m_MaxError, std::abs(frameTime - static_cast<double>(period)));
+    }
+
+    m_LastRelease = now;
+}
+
+PacerStats Pacer::GetStats() const {
+    PacerStats stats;
+    stats.Frames = m_Frames;
+    stats.TargetMs = m_PeriodNs / 1e6;
+    stats.MeanMs = m_Mean / 1e6;
+    stats.JitterMs = m_Frames > 1 ? std::sqrt(m_M2 / (m_Frames - 1)) / 1e6 : 0.0;
+    stats.MaxErrorMs = m_MaxError / 1e6;
+    stats.Late = m_Late;
+    return stats;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <atomic>
+
+struct PacerStats {
+    u64 Frames = 0;
+    double TargetMs = 0;      // At the current speed, 0 when uncapped
+    double MeanMs = 0;        // Time between consecutive frame releases
+    double JitterMs = 0;      // Standard deviation of that
+    double MaxErrorMs = 0;    // Largest distance from the target
+    u64 Late = 0;             // Frames that missed their slot and restarted the schedule
+};
+
+// Releases frames at the DMG refresh rate (4194304 / 70224 Hz) times a speed
+// multiplier. Sleeps with clock_nanosleep against absolute deadlines, so errors
+// don't accumulate, and spins the last stretch the scheduler can't hit exactly.
+class Pacer {
+public:
+    static constexpr double s_RefreshRate = 4194304.0 / 70224.0;
+
+    // The steps the speed hotkeys go through, 0 is uncapped
+    static constexpr double s_Speeds[] = { 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 0.0 };
+
+    Pacer() { SetSpeed(1.0); }
+
+    // 0.25x-8x, or 0 to run uncapped. Safe to call from another thread.
+    void SetSpeed(double multiplier);
+    double GetSpeed() const { return m_Speed; }
+
+    // One step along s_Speeds
+    void StepSpeed(int direction);
+
+    // Blocks until the next frame is due
+    void WaitForNextFrame();
+
+    // Starts a new schedule (after a pause) and new statistics
+    void Reset();
+
+    PacerStats GetStats() const;
+
+private:
+    static u64 Now();
+
+private:
+    // Covers timer slack and wake-up latency, also on a busy machine
+    static constexpr u64 s_SpinNs = 1'000'000;
+
+    std::atomic<double> m_Speed = 1.0;
+    std::atomic<u64> m_PeriodNs = 0;
+    std::atomic<bool> m_Restart = true;
+
+    u64 m_Deadline = 0;
+    u64 m_LastRelease = 0;
+
+    // Welford running mean / variance of the frame times, in ns
+    u64 m_Frames = 0;
+    double m_Mean = 0;
+    double m_M2 = 0;
+    double m_MaxError = 0;
+    u64 m_Late = 0;
+};
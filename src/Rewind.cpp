@@ -0,0 +1,212 @@
+#include "Rewind.hpp"
+#include "Gameboy.hpp"
+#include "Log.hpp"
+
+#include <chrono>
+#include <cstring>
+
+static inline u64 Load64(const u8 *p) {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u8 *PutVarint(u8 *out, usize val) {
+    while (val >= 0x80) {
+        *out++ = static_cast<u8>(val) | 0x80;
+        val >>= 7;
+    }
+    *out++ = static_cast<u8>(val);
+    return out;
+}
+
+static inline bool GetVarint(const u8 *&in, const u8 *end, usize &val) {
+    val = 0;
+    for (u8 shift = 0; in < end && shift < 64; shift += 7) {
+        u8 byte = *in++;
+        val |= static_cast<usize>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void Rewind::Configure(usize capacityMB, u32 interval, double budgetUs) {
+    m_Ring.assign(capacityMB * 1024 * 1024, 0);
+    m_BaseInterval = m_Interval = std::max<u32>(interval, 1);
+    m_BudgetUs = budgetUs;
+    Clear();
+}
+
+void Rewind::Clear() {
+    m_Head = 0;
+    m_Used = 0;
+    m_Entries.clear();
+    m_Newest.clear();
+    m_FramesUntilCapture = 0;
+
+    m_Stats.Snapshots = 0;
+    m_Stats.BytesUsed = 0;
+    m_Stats.RawBytes = 0;
+}
+
+void Rewind::OnFrame() {
+    if (!IsEnabled()) return;
+
+    if (m_Active) {
+        StepBack();
+        m_FramesUntilCapture = 0;
+        return;
+    }
+
+    if (m_FramesUntilCapture > 0) {
+        m_FramesUntilCapture--;
+        return;
+    }
+
+    Capture();
+    m_FramesUntilCapture = m_Interval - 1;
+}
+
+// Layout of m_Newest and m_Current doesn't change for a given ROM, so the XOR is
+// over equal sized buffers and mostly zero (WRAM/VRAM rarely change wholesale)
+void Rewind::Capture() {
+    auto start = std::chrono::steady_clock::now();
+
+    Gameboy::Get().SaveState(m_Current);
+
+    if (m_Newest.size() == m_Current.size()) {
+        m_Scratch.resize(m_Current.size() * 2 + 16);
+        usize size = Encode(m_Current.data(), m_Newest.data(), m_Current.size(), m_Scratch.data());
+        Push(m_Scratch.data(), size);
+    } else {
+        Clear();
+    }
+
+    std::swap(m_Newest, m_Current);
+
+    double cost = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    m_Captures++;
+    m_AvgCostUs = (m_Captures == 1) ? cost : m_AvgCostUs * 0.9 + cost * 0.1;
+
+    // Amortized per-frame cost is what the budget is about
+    if (m_BudgetUs > 0) {
+        if (m_AvgCostUs / m_Interval > m_BudgetUs && m_Interval < 60) {
+            m_Interval++;
+        } else if (m_Interval > m_BaseInterval && m_AvgCostUs / (m_Interval - 1) < m_BudgetUs * 0.5) {
+            m_Interval--;
+        }
+    }
+
+    m_Stats.AvgCaptureUs = m_Stats.AvgCaptureUs + (cost - m_Stats.AvgCaptureUs) / m_Captures;
+    m_Stats.MaxCaptureUs = std::max(m_Stats.MaxCaptureUs, cost);
+    m_Stats.Interval = m_Interval;
+}
+
+bool Rewind::StepBack() {
+    if (m_Newest.empty()) return false;
+
+    if (!m_Entries.empty()) {
+        Entry entry = m_Entries.back();
+
+        m_Scratch.resize(entry.Size);
+        usize first = std::min(entry.Size, m_Ring.size() - entry.Offset);
+        memcpy(m_Scratch.data(), &m_Ring[entry.Offset], first);
+        memcpy(m_Scratch.data() + first, m_Ring.data(), entry.Size - first);
+
+        if (!Decode(m_Scratch.data(), entry.Size, m_Newest.data(), m_Newest.size())) {
+            LOG_ERROR("Rewind buffer is corrupted\n");
+            Clear();
+            return false;
+        }
+
+        m_Entries.pop_back();
+        m_Head = entry.Offset;
+        m_Used -= entry.Size;
+        m_Stats.Snapshots--;
+        m_Stats.BytesUsed -= entry.Size;
+        m_Stats.RawBytes -= m_Newest.size();
+    }
+
+    // With the history used up this keeps reloading the oldest state
+    return Gameboy::Get().LoadState(m_Newest.data(), m_Newest.size(), true);
+}
+
+void Rewind::Push(const u8 *data, usize size) {
+    if (size > m_Ring.size()) {
+        Clear();
+        return;
+    }
+
+    while (m_Used + size > m_Ring.size()) {
+        Drop();
+    }
+
+    usize first = std::min(size, m_Ring.size() - m_Head);
+    memcpy(&m_Ring[m_Head], data, first);
+    memcpy(m_Ring.data(), data + first, size - first);
+
+    m_Entries.push_back({ m_Head, size });
+    m_Head = (m_Head + size) % m_Ring.size();
+    m_Used += size;
+
+    m_Stats.Snapshots++;
+    m_Stats.BytesUsed += size;
+    m_Stats.RawBytes += m_Current.size();
+}
+
+void Rewind::Drop() {
+    Entry entry = m_Entries.front();
+    m_Entries.pop_front();
+    m_Used -= entry.Size;
+
+    m_Stats.Snapshots--;
+    m_Stats.BytesUsed -= entry.Size;
+    m_Stats.RawBytes -= m_Newest.size();
+}
+
+// Tokens of (zero run, literal run, literal bytes), lengths as varints. A literal
+// run only ends at two equal bytes in a row, so isolated matches don't cost a token.
+usize Rewind::Encode(const u8 *current, const u8 *previous, usize size, u8 *out) {
+    u8 *start = out;
+    usize i = 0;
+
+    while (i < size) {
+        usize zeroStart = i;
+        while (i + 8 <= size && Load64(current + i) == Load64(previous + i)) i += 8;
+        while (i < size && current[i] == previous[i]) i++;
+
+        usize literalStart = i;
+        while (i < size && (current[i] != previous[i] || (i + 1 < size && current[i + 1] != previous[i + 1]))) i++;
+
+        out = PutVarint(out, literalStart - zeroStart);
+        out = PutVarint(out, i - literalStart);
+        for (usize j = literalStart; j < i; j++) {
+            *out++ = current[j] ^ previous[j];
+        }
+    }
+
+    return out - start;
+}
+
+bool Rewind::Decode(const u8 *data, usize dataSize, u8 *state, usize size) {
+    const u8 *in = data;
+    const u8 *end = data + dataSize;
+    usize pos = 0;
+
+    while (in < end) {
+        usize zeros, literals;
+        if (!GetVarint(in, end, zeros) || !GetVarint(in, end, literals)) return false;
+
+        pos += zeros;
+        if (pos + literals > size || literals > static_cast<usize>(end - in)) return false;
+
+        for (usize j = 0; j < literals; j++) {
+            state[pos + j] ^= in[j];
+        }
+
+        in += literals;
+        pos += literals;
+    }
+
+    return pos == size;
+}
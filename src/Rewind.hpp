@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <deque>
+
+struct RewindStats {
+    usize Snapshots = 0;
+    usize BytesUsed = 0;
+    usize RawBytes = 0;       // What the stored snapshots would take uncompressed
+    double AvgCaptureUs = 0;  // Per captured frame
+    double MaxCaptureUs = 0;
+    u32 Interval = 0;         // Current capture interval in frames
+};
+
+// Keeps the newest save state in full plus a ring of older ones, each stored as
+// the XOR against its successor, run-length encoded. Stepping back decodes one
+// delta into the newest state. When capturing runs over the per-frame budget the
+// interval is stretched, and it is relaxed again once there is headroom.
+class Rewind {
+public:
+    void Configure(usize capacityMB, u32 interval, double budgetUs);
+
+    bool IsEnabled() const { return !m_Ring.empty(); }
+
+    void SetActive(bool active) { m_Active = active; }
+    bool IsActive() const { return m_Active; }
+
+    // Called by the emulation thread once per frame
+    void OnFrame();
+
+    void Capture();
+    bool StepBack();
+
+    void Clear();
+
+    const RewindStats &GetStats() const { return m_Stats; }
+
+private:
+    void Push(const u8 *data, usize size);
+    void Drop();
+
+    static usize Encode(const u8 *current, const u8 *previous, usize size, u8 *out);
+    static bool Decode(const u8 *data, usize dataSize, u8 *state, usize size);
+
+private:
+    struct Entry {
+        usize Offset;
+        usize Size;
+    };
+
+    std::vector<u8> m_Ring;
+    usize m_Head = 0;
+    usize m_Used = 0;
+    std::deque<Entry> m_Entries;
+
+    std::vector<u8> m_Newest;
+    std::vector<u8> m_Current;
+    std::vector<u8> m_Scratch;
+
+    u32 m_Interval = 1;
+    u32 m_BaseInterval = 1;
+    u32 m_FramesUntilCapture = 0;
+    double m_BudgetUs = 0;
+    double m_AvgCostUs = 0;
+    u64 m_Captures = 0;
+    bool m_Active = false;
+
+    RewindStats m_Stats;
+};
@@ -0,0 +1,305 @@
+#include "RomIndex.hpp"
+#include "Cartrige.hpp"
+#include "Hash.hpp"
+#include "Log.hpp"
+#include "RomLoader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static const char s_Magic[4] = { 'G', 'B', 'R', 'I' };
+static const u32 s_Version = 1;
+
+// An entry with an empty path: path length, size, mtime, hash, title, the header
+// bytes, global checksum and flags
+static const usize s_MinEntrySize = 2 + 8 + 8 + 8 + 16 + 5 + 2 + 1;
+
+template <typename T>
+static void Put(std::string &out, const T &val) {
+    out.append(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+static bool GetBytes(const std::string &in, usize &pos, void *dest, usize size) {
+    if (pos + size > in.size()) return false;
+    memcpy(dest, in.data() + pos, size);
+    pos += size;
+    return true;
+}
+
+template <typename T>
+static bool Get(const std::string &in, usize &pos, T &val) {
+    return GetBytes(in, pos, &val, sizeof(T));
+}
+
+bool RomIndex::Load(const std::string &path) {
+    std::ifstream fs(path, std::ios::binary);
+    if (!fs) return false;
+
+    std::string data((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+
+    usize pos = 0;
+    char magic[4];
+    u32 version = 0;
+    u32 count = 0;
+    if (!Get(data, pos, magic) || memcmp(magic, s_Magic, 4) != 0 ||
+        !Get(data, pos, version) || version != s_Version ||
+        !Get(data, pos, count))
+    {
+        LOG_WARN("Ignoring ROM index %s (unknown format)\n", path.c_str());
+        return false;
+    }
+
+    // The count sizes the table, it has to fit in what is left of the file
+    if (count > (data.size() - pos) / s_MinEntrySize) {
+        LOG_WARN("Ignoring ROM index %s (truncated)\n", path.c_str());
+        return false;
+    }
+
+    std::vector<RomInfo> entries(count);
+    for (RomInfo &info : entries) {
+        u16 pathLen = 0;
+        u8 flags = 0;
+        bool ok = Get(data, pos, pathLen) && pos + pathLen <= data.size();
+        if (ok) {
+            info.Path.assign(data, pos, pathLen);
+            pos += pathLen;
+        }
+
+        ok = ok && Get(data, pos, info.Size) && Get(data, pos, info.MTime) && Get(data, pos, info.Hash)
+                && GetBytes(data, pos, info.Title, 16)
+                && Get(data, pos, info.Type) && Get(data, pos, info.RomSize) && Get(data, pos, info.RamSize)
+                && Get(data, pos, info.Version) && Get(data, pos, info.HeaderChecksum)
+                && Get(data, pos, info.GlobalChecksum) && Get(data, pos, flags);
+
+        if (!ok) {
+            LOG_WARN("Ignoring ROM index %s (truncated)\n", path.c_str());
+            return false;
+        }
+
+        info.HeaderValid = BIT(flags, 0);
+        info.GlobalValid = BIT(flags, 1);
+    }
+
+    m_Entries = std::move(entries);
+    return true;
+}
+
+bool RomIndex::Save(const std::string &path) const {
+    std::string data;
+    data.reserve(16 + m_Entries.size() * 96);
+
+    Put(data, s_Magic);
+    Put(data, s_Version);
+    Put(data, static_cast<u32>(m_Entries.size()));
+
+    for (const RomInfo &info : m_Entries) {
+        Put(data, static_cast<u16>(info.Path.size()));
+        data.append(info.Path);
+        Put(data, info.Size);
+        Put(data, info.MTime);
+        Put(data, info.Hash);
+        data.append(info.Title, 16);
+        Put(data, info.Type);
+        Put(data, info.RomSize);
+        Put(data, info.RamSize);
+        Put(data, info.Version);
+        Put(data, info.HeaderChecksum);
+        Put(data, info.GlobalChecksum);
+        Put(data, static_cast<u8>(info.HeaderValid | (info.GlobalValid << 1)));
+    }
+
+    // Write next to the target and rename, so a crashed run never leaves a torn index
+    std::string tmpPath = path + ".tmp";
+    std::ofstream fs(tmpPath, std::ios::binary);
+    if (!fs) {
+        LOG_ERROR("Could not open %s\n", tmpPath.c_str());
+        return false;
+    }
+
+    fs.write(data.data(), data.size());
+    fs.close();
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    if (ec) {
+        LOG_ERROR("Could not write %s (%s)\n", path.c_str(), ec.message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+usize RomIndex::Refresh(const std::string &dir, usize threads) {
+    std::unordered_map<std::string, const RomInfo*> previous;
+    for (const RomInfo &info : m_Entries) {
+        previous[info.Path] = &info;
+    }
+
+    std::vector<RomInfo> entries;
+    std::vector<usize> stale;
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec))
+    {
+        if (ec) break;
+        if (!it->is_regular_file(ec) || !IsRomFile(it->path().string())) continue;
+
+        RomInfo info;
+        info.Path = fs::relative(it->path(), dir, ec).string();
+        info.Size = it->file_size(ec);
+        info.MTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            it->last_write_time(ec).time_since_epoch()).count();
+
+        auto prev = previous.find(info.Path);
+        if (prev != previous.end() && prev->second->Size == info.Size && prev->second->MTime == info.MTime) {
+            entries.push_back(*prev->second);
+        } else {
+            stale.push_back(entries.size());
+            entries.push_back(info);
+        }
+    }
+
+    if (ec) {
+        LOG_ERROR("Could not scan %s (%s)\n", dir.c_str(), ec.message().c_str());
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, stale.size());
+
+    std::atomic<usize> next = 0;
+    std::vector<u8> failed(stale.size(), 0);
+    auto worker = [&] {
+        for (usize i = next++; i < stale.size(); i = next++) {
+            RomInfo &info = entries[stale[i]];
+            if (!ReadRomInfo((fs::path(dir) / info.Path).string(), info)) {
+                LOG_WARN("Could not read %s\n", info.Path.c_str());
+                failed[i] = 1;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (usize i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+
+    for (std::thread &t : workers) {
+        t.join();
+    }
+
+    // Whatever was indexed and isn't there anymore
+    usize removed = previous.size() - (entries.size() - stale.size());
+
+    // Files that couldn't be read stay out of the index, the next refresh tries again
+    for (usize i = stale.size(); i-- > 0;) {
+        if (failed[i]) entries.erase(entries.begin() + stale[i]);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const RomInfo &a, const RomInfo &b) { return a.Path < b.Path; });
+    m_Entries = std::move(entries);
+
+    return stale.size() + removed;
+}
+
+std::vector<const RomInfo*> RomIndex::FilterByType(u8 type) const {
+    std::vector<const RomInfo*> result;
+    for (const RomInfo &info : m_Entries) {
+        if (info.Type == type) result.push_back(&info);
+    }
+
+    return result;
+}
+
+bool RomIndex::IsRomFile(const std::string &path) {
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".gb" || ext == ".gbc" || ext == ".gz" || ext == ".zip";
+}
+
+bool RomIndex::ReadRomInfo(const std::string &path, RomInfo &info) {
+    // Hash the decompressed image, so an archive and its plain ROM hash the same
+    RomImage image = RomLoader::LoadUncached(path);
+    if (!image) return false;
+
+    const std::vector<u8> &rom = *image;
+    info.Hash = Hash64(rom.data(), rom.size());
+
+    CartHeader header;
+    memcpy(&header, &rom[0x100], sizeof(header));
+
+    memcpy(info.Title, header.Title, 16);
+    info.Title[16] = '\0';
+    for (usize i = 0; i < 16; i++) {
+        if (info.Title[i] != '\0' && !isprint(static_cast<u8>(info.Title[i]))) info.Title[i] = '\0';
+    }
+
+    info.Type = header.Type;
+    info.RomSize = header.RomSize;
+    info.RamSize = header.RamSize;
+    info.Version = header.Version;
+    info.HeaderChecksum = header.Checksum;
+    info.GlobalChecksum = Cartrige::GetGlobalChecksum(header);
+    info.HeaderValid = (header.Checksum == Cartrige::ComputeHeaderChecksum(rom.data()));
+    info.GlobalValid = (info.GlobalChecksum == Cartrige::ComputeGlobalChecksum(rom.data(), rom.size()));
+
+    return true;
+}
+
+int RomIndex::RunTool(int argc, char **argv) {
+    if (argc < 3) {
+        LOG_ERROR("Usage: %s --index <dir> [--type <hex>]\n", argv[0]);
+        return 1;
+    }
+
+    std::string dir(argv[2]);
+    int typeFilter = -1;
+    if (argc == 5 && std::string(argv[3]) == "--type") {
+        char *end = nullptr;
+        unsigned long type = strtoul(argv[4], &end, 16);
+        if (end == argv[4] || *end != '\0' || type > 0xFF) {
+            LOG_ERROR("Not a cartridge type: %s (expected a hex byte)\n", argv[4]);
+            return 1;
+        }
+        typeFilter = static_cast<int>(type);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::string indexPath = (fs::path(dir) / s_DefaultName).string();
+    RomIndex index;
+    index.Load(indexPath);
+    usize changed = index.Refresh(dir);
+    if (changed > 0) {
+        index.Save(indexPath);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::vector<const RomInfo*> entries;
+    if (typeFilter >= 0) {
+        entries = index.FilterByType(typeFilter);
+    } else {
+        for (const RomInfo &info : index.GetEntries()) entries.push_back(&info);
+    }
+
+    // The listing goes straight to stdout, the log ring may drop lines of a large one
+    Log::Flush();
+    for (const RomInfo *info : entries) {
+        printf("%016lx  %-16s  %02X %-24s %5lu KB  hdr:%s glb:%s  %s\n",
+            info->Hash, info->Title, info->Type, Cartrige::GetTypeName(info->Type), info->Size / 1024,
+            info->HeaderValid ? "ok" : "BAD", info->GlobalValid ? "ok" : "BAD", info->Path.c_str());
+    }
+
+    printf("%lu ROMs listed, %lu indexed (%lu added, changed or removed) in %.2f ms\n",
+        entries.size(), index.GetEntries().size(), changed, ms);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <unordered_map>
+
+struct RomInfo {
+    std::string Path;
+    u64 Size = 0;
+    i64 MTime = 0; // Nanoseconds
+    u64 Hash = 0;
+
+    char Title[17] = {};
+    u8 Type = 0;
+    u8 RomSize = 0;
+    u8 RamSize = 0;
+    u8 Version = 0;
+    u8 HeaderChecksum = 0;
+    u16 GlobalChecksum = 0;
+
+    bool HeaderValid = false;
+    bool GlobalValid = false;
+};
+
+// On-disk index of a ROM directory (plain, .gz and .zip ROMs), so batch jobs can pick ROMs by header fields
+// without opening every file. Refresh() only re-reads files whose size or mtime
+// changed since the index was written.
+class RomIndex {
+public:
+    static constexpr const char *s_DefaultName = ".gbindex";
+
+    bool Load(const std::string &path);
+    bool Save(const std::string &path) const;
+
+    // Rescans `dir` with `threads` workers (0 = one per core) and returns how many
+    // entries were added, changed or removed
+    usize Refresh(const std::string &dir, usize threads = 0);
+
+    const std::vector<RomInfo> &GetEntries() const { return m_Entries; }
+    std::vector<const RomInfo*> FilterByType(u8 type) const;
+
+    static bool IsRomFile(const std::string &path);
+    static bool ReadRomInfo(const std::string &path, RomInfo &info);
+
+    // Entry point for `gbemu --index <dir> [--type <hex>]`
+    static int RunTool(int argc, char **argv);
+
+private:
+    std::vector<RomInfo> m_Entries;
+};
@@ -0,0 +1,354 @@
+#include "RomLoader.hpp"
+#include "Cartrige.hpp"
+#include "Log.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+static constexpr usize s_ChunkSize = 64 * 1024;
+static constexpr usize s_CacheBudget = 512 * 1024 * 1024;
+
+// What the largest ROM size code (8) says
+static constexpr usize s_MaxRomSize = static_cast<usize>(0x8000) << 8;
+
+static u16 ReadLE16(const u8 *p) { return static_cast<u16>(p[0] | (p[1] << 8)); }
+static u32 ReadLE32(const u8 *p) { return static_cast<u32>(p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24)); }
+
+static bool HasRomExtension(const std::string &name) {
+    std::string ext = fs::path(name).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".gb" || ext == ".gbc";
+}
+
+// Called once the first 0x150 bytes of an image exist. Returns the size the
+// header claims, or 0 if the data can't be a ROM.
+static usize CheckHeader(const u8 *rom, const std::string &path) {
+    const CartHeader *header = reinterpret_cast<const CartHeader*>(&rom[0x100]);
+    if (header->RomSize > 8) {
+        LOG_ERROR("%s: not a ROM image (ROM size code 0x%02X)\n", path.c_str(), header->RomSize);
+        return 0;
+    }
+
+    return static_cast<usize>(0x8000) << header->RomSize;
+}
+
+// Streams `compressedSize` bytes of deflate data from `fs` into `out`, in
+// s_ChunkSize pieces. `windowBits` selects the container (gzip / raw deflate).
+// `sizeHint` comes from the archive, only sizes a valid ROM can have are trusted.
+static bool Inflate(std::ifstream &fs, usize compressedSize, int windowBits, usize sizeHint,
+                    std::vector<u8> &out, const std::string &path)
+{
+    z_stream zs = {};
+    if (inflateInit2(&zs, windowBits) != Z_OK) {
+        LOG_ERROR("%s: %s\n", path.c_str(), zs.msg ? zs.msg : "inflateInit failed");
+        return false;
+    }
+
+    std::vector<u8> in(s_ChunkSize);
+    out.resize(std::clamp<usize>(sizeHint, 0x8000, s_MaxRomSize));
+
+    usize produced = 0;
+    usize remaining = compressedSize;
+    bool headerChecked = false;
+    int ret = Z_OK;
+
+    while (ret != Z_STREAM_END) {
+        if (zs.avail_in == 0) {
+            fs.read(reinterpret_cast<char*>(in.data()), std::min(s_ChunkSize, remaining));
+            usize got = fs.gcount();
+            if (got == 0) {
+                LOG_ERROR("%s: truncated compressed data\n", path.c_str());
+                inflateEnd(&zs);
+                return false;
+            }
+
+            remaining -= got;
+            zs.next_in = in.data();
+            zs.avail_in = got;
+        }
+
+        if (produced == out.size()) {
+            if (out.size() >= s_MaxRomSize) {
+                LOG_ERROR("%s: more than %lu MB of data, not a ROM image\n", path.c_str(), s_MaxRomSize >> 20);
+                inflateEnd(&zs);
+                return false;
+            }
+
+            out.resize(std::min(2 * out.size(), s_MaxRomSize));
+        }
+
+        zs.next_out = out.data() + produced;
+        zs.avail_out = out.size() - produced;
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            LOG_ERROR("%s: %s\n", path.c_str(), zs.msg ? zs.msg : "inflate failed");
+            inflateEnd(&zs);
+            return false;
+        }
+
+        produced = out.size() - zs.avail_out;
+
+        if (!headerChecked && produced >= 0x150) {
+            headerChecked = true;
+
+            usize expected = CheckHeader(out.data(), path);
+            if (expected == 0) {
+                inflateEnd(&zs);
+                return false;
+            }
+
+            if (expected > out.size()) {
+                out.resize(expected);
+            }
+        }
+    }
+
+    inflateEnd(&zs);
+    out.resize(produced);
+    return true;
+}
+
+static bool LoadPlain(std::ifstream &fs, usize fileSize, std::vector<u8> &out, const std::string &path) {
+    out.resize(fileSize);
+    fs.read(reinterpret_cast<char*>(out.data()), fileSize);
+    if (static_cast<usize>(fs.gcount()) != fileSize) {
+        LOG_ERROR("%s: short read\n", path.c_str());
+        return false;
+    }
+
+    return out.size() >= 0x150 && CheckHeader(out.data(), path) != 0;
+}
+
+static bool LoadGzip(std::ifstream &fs, usize fileSize, std::vector<u8> &out, const std::string &path) {
+    // The trailer holds the uncompressed size (mod 2^32), good enough as a hint
+    u8 trailer[4] = {};
+    fs.seekg(fileSize - 4);
+    fs.read(reinterpret_cast<char*>(trailer), 4);
+    fs.seekg(0);
+
+    return Inflate(fs, fileSize, 15 + 16, ReadLE32(trailer), out, path);
+}
+
+static bool LoadZip(std::ifstream &fs, usize fileSize, std::vector<u8> &out, const std::string &path) {
+    // Find the end of central directory record, which may be followed by a comment
+    usize tailSize = std::min<usize>(fileSize, 0xFFFF + 22);
+    std::vector<u8> tail(tailSize);
+    fs.seekg(fileSize - tailSize);
+    fs.read(reinterpret_cast<char*>(tail.data()), tailSize);
+
+    isize eocd = -1;
+    for (isize i = static_cast<isize>(tailSize) - 22; i >= 0; i--) {
+        if (ReadLE32(&tail[i]) == 0x06054B50) {
+            eocd = i;
+            break;
+        }
+    }
+
+    if (eocd < 0) {
+        LOG_ERROR("%s: no zip central directory\n", path.c_str());
+        return false;
+    }
+
+    u16 entries = ReadLE16(&tail[eocd + 10]);
+    u32 dirSize = ReadLE32(&tail[eocd + 12]);
+    u32 dirOffset = ReadLE32(&tail[eocd + 16]);
+
+    // Both come from the file, check them before sizing anything by them
+    if (dirSize > fileSize || dirOffset > fileSize - dirSize) {
+        LOG_ERROR("%s: zip central directory lies outside the file\n", path.c_str());
+        return false;
+    }
+
+    std::vector<u8> dir(dirSize);
+    fs.seekg(dirOffset);
+    fs.read(reinterpret_cast<char*>(dir.data()), dirSize);
+    if (static_cast<usize>(fs.gcount()) != dirSize) {
+        LOG_ERROR("%s: truncated zip central directory\n", path.c_str());
+        return false;
+    }
+
+    usize pos = 0;
+    for (u16 i = 0; i < entries && pos + 46 <= dir.size(); i++) {
+        const u8 *entry = &dir[pos];
+        if (ReadLE32(entry) != 0x02014B50) break;
+
+        u16 method = ReadLE16(entry + 10);
+        u32 compressedSize = ReadLE32(entry + 20);
+        u32 size = ReadLE32(entry + 24);
+        u16 nameLen = ReadLE16(entry + 28);
+        u16 extraLen = ReadLE16(entry + 30);
+        u16 commentLen = ReadLE16(entry + 32);
+        u32 localOffset = ReadLE32(entry + 42);
+        std::string name(reinterpret_cast<const char*>(entry + 46), std::min<usize>(nameLen, dir.size() - pos - 46));
+        pos += 46 + nameLen + extraLen + commentLen;
+
+        if (!HasRomExtension(name)) continue;
+
+        u8 local[30];
+        fs.seekg(localOffset);
+        fs.read(reinterpret_cast<char*>(local), sizeof(local));
+        if (fs.gcount() != sizeof(local) || ReadLE32(local) != 0x04034B50) {
+            LOG_ERROR("%s: bad local header for %s\n", path.c_str(), name.c_str());
+            return false;
+        }
+        fs.seekg(localOffset + 30 + ReadLE16(local + 26) + ReadLE16(local + 28));
+
+        switch (method) {
+            case 0: {
+                if (size > s_MaxRomSize || size > fileSize) {
+                    LOG_ERROR("%s: %s claims %u bytes, not a ROM image\n", path.c_str(), name.c_str(), size);
+                    return false;
+                }
+
+                out.resize(size);
+                fs.read(reinterpret_cast<char*>(out.data()), size);
+                return static_cast<usize>(fs.gcount()) == size && size >= 0x150 && CheckHeader(out.data(), path) != 0;
+            }
+            case 8: return Inflate(fs, compressedSize, -15, size, out, path);
+            default: {
+                LOG_ERROR("%s: unsupported zip method %d for %s\n", path.c_str(), method, name.c_str());
+                return false;
+            }
+        }
+    }
+
+    LOG_ERROR("%s: no .gb/.gbc entry in archive\n", path.c_str());
+    return false;
+}
+
+namespace RomLoader {
+    struct CacheEntry {
+        usize FileSize;
+        i64 MTime;
+        RomImage Image;
+        RomFormat Format;
+    };
+
+    static std::mutex s_CacheMtx;
+    static std::unordered_map<std::string, CacheEntry> s_Cache;
+    static usize s_CacheBytes = 0;
+
+    RomFormat DetectFormat(const std::string &path) {
+        std::ifstream fs(path, std::ios::binary);
+        u8 magic[4] = {};
+        fs.read(reinterpret_cast<char*>(magic), 4);
+
+        if (magic[0] == 0x1F && magic[1] == 0x8B) return RomFormat::Gzip;
+        if (ReadLE32(magic) == 0x04034B50) return RomFormat::Zip;
+        return RomFormat::Plain;
+    }
+
+    const char *GetFormatName(RomFormat format) {
+        switch (format) {
+            case RomFormat::Plain: return "plain";
+            case RomFormat::Gzip:  return "gzip";
+            case RomFormat::Zip:   return "zip";
+            default: return "(UNDEFINED)";
+        }
+    }
+
+    RomImage LoadUncached(const std::string &path, RomLoadStats *stats) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::ifstream fs(path, std::ios::binary);
+        if (!fs) {
+            LOG_ERROR("Could not open %s\n", path.c_str());
+            return nullptr;
+        }
+
+        fs.seekg(0, std::ios::end);
+        usize fileSize = fs.tellg();
+        fs.seekg(0, std::ios::beg);
+
+        RomFormat format = DetectFormat(path);
+
+        auto rom = std::make_shared<std::vector<u8>>();
+        bool ok = false;
+        switch (format) {
+            case RomFormat::Plain: ok = LoadPlain(fs, fileSize, *rom, path); break;
+            case RomFormat::Gzip:  ok = LoadGzip(fs, fileSize, *rom, path);  break;
+            case RomFormat::Zip:   ok = LoadZip(fs, fileSize, *rom, path);   break;
+        }
+
+        if (!ok || rom->size() < 0x150) {
+            LOG_ERROR("Could not load %s\n", path.c_str());
+            return nullptr;
+        }
+
+        if (stats) {
+            stats->Format = format;
+            stats->FileSize = fileSize;
+            stats->Cached = false;
+            stats->Millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        return rom;
+    }
+
+    RomImage Load(const std::string &path, RomLoadStats *stats) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::error_code ec;
+        std::string key = fs::absolute(path, ec).string();
+        usize fileSize = fs::file_size(path, ec);
+        i64 mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+
+        {
+            std::lock_guard<std::mutex> lock(s_CacheMtx);
+            auto it = s_Cache.find(key);
+            if (it != s_Cache.end() && it->second.FileSize == fileSize && it->second.MTime == mtime) {
+                if (stats) {
+                    stats->Format = it->second.Format;
+                    stats->FileSize = fileSize;
+                    stats->Cached = true;
+                    stats->Millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                }
+                return it->second.Image;
+            }
+        }
+
+        RomLoadStats loadStats;
+        RomImage rom = LoadUncached(path, &loadStats);
+        if (!rom) return nullptr;
+
+        if (stats) {
+            *stats = loadStats;
+        }
+
+        std::lock_guard<std::mutex> lock(s_CacheMtx);
+
+        auto old = s_Cache.find(key);
+        if (old != s_Cache.end()) {
+            s_CacheBytes -= old->second.Image->size();
+            s_Cache.erase(old);
+        }
+
+        // Over budget: drop images nobody else holds on to
+        for (auto it = s_Cache.begin(); it != s_Cache.end() && s_CacheBytes + rom->size() > s_CacheBudget;) {
+            if (it->second.Image.use_count() == 1) {
+                s_CacheBytes -= it->second.Image->size();
+                it = s_Cache.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        s_Cache[key] = { fileSize, mtime, rom, loadStats.Format };
+        s_CacheBytes += rom->size();
+        return rom;
+    }
+
+    void ClearCache() {
+        std::lock_guard<std::mutex> lock(s_CacheMtx);
+        s_Cache.clear();
+        s_CacheBytes = 0;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <memory>
+
+// Decompressed ROM contents. Images are immutable once loaded, so every
+// Cartrige (and every clone of one) can share the same buffer.
+using RomImage = std::shared_ptr<const std::vector<u8>>;
+
+enum class RomFormat : u8 {
+    Plain,
+    Gzip,
+    Zip,
+};
+
+struct RomLoadStats {
+    RomFormat Format = RomFormat::Plain;
+    usize FileSize = 0;
+    double Millis = 0.0;
+    bool Cached = false;
+};
+
+namespace RomLoader {
+    // Loads a plain, gzip (.gz) or zip (.zip, first .gb/.gbc entry) ROM. Compressed
+    // data is inflated in chunks straight into the image; the header is checked
+    // as soon as the first 0x150 bytes are out. Results are kept in a process-wide
+    // cache keyed by path, size and mtime.
+    RomImage Load(const std::string &path, RomLoadStats *stats = nullptr);
+
+    // Same, bypassing the cache (used by the indexer, which only needs the bytes once)
+    RomImage LoadUncached(const std::string &path, RomLoadStats *stats = nullptr);
+
+    void ClearCache();
+
+    RomFormat DetectFormat(const std::string &path);
+    const char *GetFormatName(RomFormat format);
+}
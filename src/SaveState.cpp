@@ -0,0 +1,75 @@
+#include "SaveState.hpp"
+
+#include <cstring>
+
+StateWriter::StateWriter(std::vector<u8> &buffer)
+    : m_Buffer(buffer)
+{
+    m_Buffer.resize(m_Buffer.capacity());
+}
+
+void StateWriter::WriteBytes(const void *data, usize size) {
+    if (m_Size + size > m_Buffer.size()) {
+        m_Buffer.resize(std::max(m_Buffer.size() * 2, m_Size + size));
+    }
+
+    memcpy(&m_Buffer[m_Size], data, size);
+    m_Size += size;
+}
+
+void StateWriter::BeginSection(u32 tag) {
+    Write(tag);
+    m_SectionStart = m_Size;
+    Write(static_cast<u32>(0));
+}
+
+void StateWriter::EndSection() {
+    u32 size = static_cast<u32>(m_Size - m_SectionStart - sizeof(u32));
+    memcpy(&m_Buffer[m_SectionStart], &size, sizeof(size));
+}
+
+usize StateWriter::Finish() {
+    m_Buffer.resize(m_Size);
+    return m_Size;
+}
+
+bool StateReader::ReadBytes(void *data, usize size) {
+    if (m_Failed || m_Pos + size > m_Size) {
+        m_Failed = true;
+        return false;
+    }
+
+    memcpy(data, &m_Data[m_Pos], size);
+    m_Pos += size;
+    return true;
+}
+
+bool StateReader::BeginSection(u32 tag) {
+    u32 readTag = 0, size = 0;
+    if (!Read(readTag) || !Read(size) || readTag != tag || m_Pos + size > m_Size) {
+        m_Failed = true;
+        return false;
+    }
+
+    m_SectionEnd = m_Pos + size;
+    return true;
+}
+
+bool StateReader::SkipSection() {
+    u32 tag = 0, size = 0;
+    if (!Read(tag) || !Read(size) || m_Pos + size > m_Size) {
+        m_Failed = true;
+        return false;
+    }
+
+    m_Pos += size;
+    return true;
+}
+
+bool StateReader::EndSection() {
+    if (m_Pos != m_SectionEnd) {
+        m_Failed = true;
+    }
+
+    return !m_Failed;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <type_traits>
+
+// Save state layout (little endian, fields in native layout):
+//   Header  : "GBST", u16 version, u16 section count, u64 ROM hash
+//   Section : u32 tag, u32 size, payload
+// Sections are written in a fixed order and their sizes are checked on load, so a
+// state from an older layout is rejected instead of being misread.
+class StateWriter {
+public:
+    // Reuses `buffer`'s capacity, so steady-state saves don't allocate
+    explicit StateWriter(std::vector<u8> &buffer);
+
+    void WriteBytes(const void *data, usize size);
+
+    template <typename T>
+    void Write(const T &val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        WriteBytes(&val, sizeof(T));
+    }
+
+    void BeginSection(u32 tag);
+    void EndSection();
+
+    // Trims the buffer to what was written
+    usize Finish();
+
+private:
+    std::vector<u8> &m_Buffer;
+    usize m_Size = 0;
+    usize m_SectionStart = 0;
+};
+
+class StateReader {
+public:
+    StateReader(const u8 *data, usize size) : m_Data(data), m_Size(size) {}
+
+    bool ReadBytes(void *data, usize size);
+
+    template <typename T>
+    bool Read(T &val) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return ReadBytes(&val, sizeof(T));
+    }
+
+    bool BeginSection(u32 tag);
+    bool EndSection();
+
+    // Steps over the next section, whatever its tag, only checking that it fits
+    bool SkipSection();
+
+    void Fail() { m_Failed = true; }
+    bool IsOk() const { return !m_Failed; }
+    usize GetPosition() const { return m_Pos; }
+
+private:
+    const u8 *m_Data;
+    usize m_Size;
+    usize m_Pos = 0;
+    usize m_SectionEnd = 0;
+    bool m_Failed = false;
+};
+
+namespace StateFormat {
+    static constexpr u32 s_Magic = 0x54534247; // "GBST"
+    static constexpr u16 s_Version = 7;
+    static constexpr u16 s_Sections = 8;
+
+    constexpr u32 MakeTag(const char (&tag)[5]) {
+        return static_cast<u32>(tag[0]) | (static_cast<u32>(tag[1]) << 8) |
+               (static_cast<u32>(tag[2]) << 16) | (static_cast<u32>(tag[3]) << 24);
+    }
+
+    struct Header {
+        u32 Magic;
+        u16 Version;
+        u16 Sections;
+        u64 RomHash;
+    };
+}
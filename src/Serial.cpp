@@ -0,0 +1,82 @@
+#include "Serial.hpp"
+#include "Gameboy.hpp"
+
+#include <algorithm>
+
+u8 DebugSerial::Transfer(u8 out) {
+    m_Text += static_cast<char>(out);
+    return 0xFF;
+}
+
+Serial::Serial()
+    : m_Device(std::make_shared<DebugSerial>())
+{}
+
+void Serial::SetSC(u8 val) {
+    m_SC = val & 0x81;
+
+    // On the internal clock (0x81) the transfer runs on its own, with the external
+    // clock (0x80) it waits for the other side
+    if ((m_SC & 0x81) == 0x81 && !m_Linked) {
+        m_Cycles = s_TransferCycles;
+    } else {
+        m_Cycles = 0;
+    }
+
+    if (m_Linked) PostLine();
+}
+
+u32 Serial::GetPendingCycles() const {
+    // Linked, Sync may end a transfer. It is never behind, at worst due on the next tick.
+    if (m_Linked) {
+        if (m_Checkpoint <= m_Time) return 1;
+        return static_cast<u32>(std::min<u64>(m_Checkpoint - m_Time, UINT32_MAX));
+    }
+    return m_Cycles;
+}
+
+void Serial::PostLine() {
+    SerialLine line = { m_Time, m_SB, SerialLine::Idle };
+    if ((m_SC & 0x81) == 0x81) {
+        line.State = SerialLine::Clocking;
+    } else if ((m_SC & 0x81) == 0x80) {
+        line.State = SerialLine::Armed;
+    }
+
+    m_Checkpoint = std::min(m_Checkpoint, m_Device->OnLineChange(line));
+}
+
+void Serial::Complete(u8 in) {
+    m_SB = in;
+    m_SC &= 0x7F;
+    Gameboy::Get().GetCPU().RequestInterrupt(CPU::Interrupt::Serial);
+}
+
+void Serial::SetDevice(std::shared_ptr<SerialDevice> device) {
+    bool clocking = m_Linked && (m_SC & 0x81) == 0x81;
+
+    m_Device = std::move(device);
+    m_Linked = m_Device && m_Device->IsLink();
+    m_Time = 0;
+    m_Checkpoint = 0;
+
+    // The new peer learns where this side stands, a byte clocked for a peer that is
+    // gone goes to a plain device on the next tick
+    if (m_Linked) {
+        PostLine();
+    } else if (clocking) {
+        m_Cycles = 1;
+    }
+}
+
+void Serial::Serialize(StateWriter &state) const {
+    state.Write(m_SB);
+    state.Write(m_SC);
+    state.Write(m_Cycles);
+}
+
+void Serial::Deserialize(StateReader &state) {
+    state.Read(m_SB);
+    state.Read(m_SC);
+    state.Read(m_Cycles);
+}
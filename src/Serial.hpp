@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Common.hpp"
+#include "SaveState.hpp"
+
+#include <memory>
+
+class Serial;
+
+// One end of a link from emulated cycle `Time` on, until its next change
+struct SerialLine {
+    enum Mode : u8 {
+        Idle,
+        Armed,      // Waiting for the other side's clock (SC = 0x80)
+        Clocking,   // Clocking 8 bits out on the internal clock (SC = 0x81)
+    };
+
+    u64 Time;
+    u8 Byte;    // SB
+    Mode State;
+};
+
+// What is plugged into the link port
+class SerialDevice {
+public:
+    virtual ~SerialDevice() = default;
+
+    // This side clocked all 8 bits of `out` (SC = 0x81), returns the byte shifted in
+    virtual u8 Transfer(u8 out) = 0;
+
+    // Devices with a clock of their own (another Game Boy) don't use Transfer. Serial
+    // tells them every change of its line, stamped with the emulated cycle since it was
+    // plugged in, and calls Sync once that count reaches the cycle either of them
+    // returned. The device ends the transfers there itself.
+    virtual bool IsLink() const { return false; }
+    virtual u64 OnLineChange(const SerialLine &line) { (void)line; return UINT64_MAX; }
+    virtual u64 Sync(Serial &serial, u64 time) { (void)serial; (void)time; return UINT64_MAX; }
+};
+
+// Collects what the game sends, test ROMs print their results this way
+class DebugSerial : public SerialDevice {
+public:
+    u8 Transfer(u8 out) override;
+
+    const std::string &GetText() const { return m_Text; }
+
+private:
+    std::string m_Text;
+};
+
+// FF01 (SB) / FF02 (SC). A transfer on the internal clock takes 8 bits at 8192 Hz
+// and ends with the Serial interrupt.
+class Serial {
+public:
+    Serial();
+
+    void Tick(u32 cycles) {
+        if (m_Linked) {
+            m_Time += cycles;
+            if (m_Time >= m_Checkpoint) m_Checkpoint = m_Device->Sync(*this, m_Time);
+            return;
+        }
+
+        if (m_Cycles == 0) return;
+
+        if (m_Cycles > cycles) {
+            m_Cycles -= cycles;
+            return;
+        }
+
+        m_Cycles = 0;
+        Complete(m_Device ? m_Device->Transfer(m_SB) : 0xFF);
+    }
+
+    // Cycles until the running transfer ends or the link next syncs, 0 if neither is
+    // coming. Nothing changes on the port before then.
+    u32 GetPendingCycles() const;
+
+    u8 GetSB() const { return m_SB; }
+    u8 GetSC() const { return m_SC | 0x7E; }
+
+    void SetSB(u8 val) {
+        m_SB = val;
+        if (m_Linked) PostLine();
+    }
+    void SetSC(u8 val);
+
+    // Ends the transfer with `in` shifted into SB
+    void Complete(u8 in);
+
+    void SetDevice(std::shared_ptr<SerialDevice> device);
+    SerialDevice *GetDevice() const { return m_Device.get(); }
+    bool IsLinked() const { return m_Linked; }
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
+private:
+    void PostLine();
+
+private:
+    static constexpr u32 s_TransferCycles = 8 * 512;
+
+    u8 m_SB = 0;
+    u8 m_SC = 0;
+    u32 m_Cycles = 0;
+
+    std::shared_ptr<SerialDevice> m_Device;
+
+    // Linked: emulated cycles since the device was plugged in, and when it wants Sync
+    bool m_Linked = false;
+    u64 m_Time = 0;
+    u64 m_Checkpoint = 0;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+// Bounded single-producer / single-consumer ring. Push and Pop never block and
+// each side only writes its own index.
+template <typename T, usize Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool Push(const T &item) {
+        usize head = m_Head.load(std::memory_order_relaxed);
+        if (head - m_Tail.load(std::memory_order_acquire) == Capacity) return false;
+
+        m_Items[head & (Capacity - 1)] = item;
+        m_Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T &item) {
+        usize tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail == m_Head.load(std::memory_order_acquire)) return false;
+
+        item = m_Items[tail & (Capacity - 1)];
+        m_Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Bulk versions, move as many items as fit (or are there) and return how many
+    usize Push(const T *items, usize count) {
+        usize head = m_Head.load(std::memory_order_relaxed);
+        count = std::min(count, Capacity - (head - m_Tail.load(std::memory_order_acquire)));
+
+        for (usize i = 0; i < count; i++) {
+            m_Items[(head + i) & (Capacity - 1)] = items[i];
+        }
+        m_Head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    usize Pop(T *items, usize count) {
+        usize tail = m_Tail.load(std::memory_order_relaxed);
+        count = std::min(count, m_Head.load(std::memory_order_acquire) - tail);
+
+        for (usize i = 0; i < count; i++) {
+            items[i] = m_Items[(tail + i) & (Capacity - 1)];
+        }
+        m_Tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    usize GetSize() const {
+        return m_Head.load(std::memory_order_acquire) - m_Tail.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<usize> m_Head = 0;
+    alignas(64) std::atomic<usize> m_Tail = 0;
+    T m_Items[Capacity];
+};
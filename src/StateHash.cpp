@@ -0,0 +1,213 @@
+#include "StateHash.hpp"
+#include "Gameboy.hpp"
+#include "Hash.hpp"
+#include "Log.hpp"
+
+#include <chrono>
+
+StateHashLog::~StateHashLog() {
+    Close();
+}
+
+bool StateHashLog::Open(const std::string &path, u64 romHash) {
+    m_File.open(path, std::ios::binary);
+    if (!m_File) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    m_Components = StateFormat::s_Sections;
+    m_Frames = 0;
+    m_TotalCostUs = 0;
+
+    Header header = { s_Magic, s_Version, m_Components, romHash };
+    m_File.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // The tags are only known from a serialized state
+    Gameboy::Get().SaveState(m_State);
+    ForEachSection(m_State, [this](u32 tag, const u8*, u32) {
+        m_File.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+    });
+
+    return true;
+}
+
+void StateHashLog::Close() {
+    if (m_File.is_open()) {
+        m_File.close();
+    }
+}
+
+bool StateHashLog::ForEachSection(const std::vector<u8> &state, const std::function<void(u32 tag, const u8 *data, u32 size)> &func) {
+    usize pos = sizeof(StateFormat::Header);
+
+    for (u16 i = 0; i < StateFormat::s_Sections; i++) {
+        u32 tag, size;
+        if (pos + 2 * sizeof(u32) > state.size()) return false;
+
+        memcpy(&tag, &state[pos], sizeof(tag));
+        memcpy(&size, &state[pos + sizeof(u32)], sizeof(size));
+        pos += 2 * sizeof(u32);
+        if (pos + size > state.size()) return false;
+
+        func(tag, &state[pos], size);
+        pos += size;
+    }
+
+    return pos == state.size();
+}
+
+void StateHashLog::OnFrame() {
+    if (!IsOpen()) return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    Gameboy &gameboy = Gameboy::Get();
+    gameboy.SaveState(m_State);
+
+    u64 frame = gameboy.GetPPU().GetCurrentFrame();
+    m_Record.resize(sizeof(u64) * (1 + m_Components));
+    memcpy(m_Record.data(), &frame, sizeof(frame));
+
+    usize offset = sizeof(u64);
+    ForEachSection(m_State, [this, &offset](u32, const u8 *data, u32 size) {
+        u64 hash = Hash64(data, size);
+        memcpy(&m_Record[offset], &hash, sizeof(hash));
+        offset += sizeof(hash);
+    });
+
+    m_File.write(reinterpret_cast<const char*>(m_Record.data()), m_Record.size());
+
+    m_Frames++;
+    m_TotalCostUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int StateHashLog::RunTool(int argc, char **argv) {
+    if (argc < 5) {
+        LOG_ERROR("Usage: %s --hash <rom> <frames> <output> [options]\n", argv[0]);
+        return 1;
+    }
+
+    // Anything after the output goes to the emulator as usual (cheats, colors, ...)
+    char rewindOff[] = "--rewind", zero[] = "0", hashLog[] = "--hash-log";
+    std::vector<char*> args = { argv[0], argv[2], rewindOff, zero, hashLog, argv[4] };
+    args.insert(args.end(), argv + 5, argv + argc);
+    Gameboy gameboy(static_cast<int>(args.size()), args.data());
+
+    usize frames = std::stoul(argv[3]);
+    auto start = std::chrono::steady_clock::now();
+
+    // Bounded in case the LCD stays off. A warm start may have run frames already.
+    usize first = gameboy.GetPPU().GetCurrentFrame();
+    for (usize i = 0; gameboy.GetPPU().GetCurrentFrame() - first < frames && i < 2 * frames; i++) {
+        gameboy.RunFrame();
+    }
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const StateHashLog &log = gameboy.GetStateHashLog();
+
+    // The report goes straight to stdout, after whatever the run logged
+    Log::Flush();
+    printf("Hashed %lu frames in %.2f s (%.0f fps), %.1f us per frame (%.1f%% of the run)\n",
+        log.GetFrames(), secs, log.GetFrames() / secs, log.GetAvgCostUs(), log.GetAvgCostUs() * log.GetFrames() / (secs * 1e4));
+    return 0;
+}
+
+bool StateHashLog::OpenStream(const std::string &path, Stream &stream) {
+    stream.File.open(path, std::ios::binary);
+    if (!stream.File) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    stream.File.read(reinterpret_cast<char*>(&stream.Head), sizeof(stream.Head));
+    if (!stream.File || stream.Head.Magic != s_Magic) {
+        LOG_ERROR("%s is not a state hash log\n", path.c_str());
+        return false;
+    }
+
+    if (stream.Head.Version != s_Version) {
+        LOG_ERROR("%s: version %u is not supported (expected %u)\n", path.c_str(), stream.Head.Version, s_Version);
+        return false;
+    }
+
+    stream.Tags.resize(stream.Head.Components);
+    stream.File.read(reinterpret_cast<char*>(stream.Tags.data()), stream.Tags.size() * sizeof(u32));
+    if (!stream.File) {
+        LOG_ERROR("%s is truncated\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int StateHashLog::RunCompareTool(int argc, char **argv) {
+    if (argc < 4) {
+        LOG_ERROR("Usage: %s --compare-hashes <a> <b>\n", argv[0]);
+        return 1;
+    }
+
+    Stream a, b;
+    if (!OpenStream(argv[2], a) || !OpenStream(argv[3], b)) {
+        Log::Flush();
+        return 1;
+    }
+
+    if (a.Head.RomHash != b.Head.RomHash) {
+        LOG_WARN("The logs were made with different ROMs\n");
+    }
+
+    if (a.Tags != b.Tags) {
+        LOG_ERROR("The logs hash different components, they come from different save state layouts\n");
+        Log::Flush();
+        return 1;
+    }
+
+    usize components = a.Tags.size();
+    std::vector<u64> recordA(1 + components), recordB(1 + components);
+    usize bytes = recordA.size() * sizeof(u64);
+
+    usize frames = 0;
+    int result = 0;
+    while (true) {
+        bool hasA = static_cast<bool>(a.File.read(reinterpret_cast<char*>(recordA.data()), bytes));
+        bool hasB = static_cast<bool>(b.File.read(reinterpret_cast<char*>(recordB.data()), bytes));
+
+        if (!hasA || !hasB) {
+            if (hasA != hasB) {
+                LOG_WARN("%s ends after %lu frames\n", hasA ? argv[3] : argv[2], frames);
+            }
+            break;
+        }
+
+        if (recordA != recordB) {
+            std::string differing;
+            for (usize i = 0; i < components; i++) {
+                if (recordA[1 + i] == recordB[1 + i]) continue;
+
+                char tag[5] = {};
+                memcpy(tag, &a.Tags[i], sizeof(u32));
+                differing += " ";
+                differing += tag;
+            }
+
+            if (recordA[0] != recordB[0]) {
+                LOG_ERROR("Frame numbers diverge after %lu frames (%lu vs %lu)\n", frames, recordA[0], recordB[0]);
+            } else {
+                LOG_ERROR("First difference at frame %lu in:%s\n", recordA[0], differing.c_str());
+            }
+
+            result = 1;
+            break;
+        }
+
+        frames++;
+    }
+
+    Log::Flush();
+    if (result == 0) {
+        printf("%lu frames identical\n", frames);
+    }
+
+    return result;
+}
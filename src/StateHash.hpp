@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <functional>
+
+// Hash of every save state section (CPU, memory, PPU, timer, ...) at each frame
+// boundary, streamed to a file. Two runs that should behave the same can then be
+// compared frame by frame, naming the component that diverged first.
+//
+// File layout (little endian):
+//   "GBHS", u16 version, u16 component count, u64 ROM hash, u32 tag per component,
+//   then per frame: u64 frame number, u64 hash per component
+class StateHashLog {
+public:
+    ~StateHashLog();
+
+    bool Open(const std::string &path, u64 romHash);
+    void Close();
+
+    bool IsOpen() const { return m_File.is_open(); }
+
+    // Called by the emulation thread once per frame
+    void OnFrame();
+
+    u64 GetFrames() const { return m_Frames; }
+    double GetAvgCostUs() const { return m_Frames ? m_TotalCostUs / m_Frames : 0.0; }
+
+    // gbemu --hash <rom> <frames> <output> [options]
+    static int RunTool(int argc, char **argv);
+
+    // gbemu --compare-hashes <a> <b>
+    static int RunCompareTool(int argc, char **argv);
+
+private:
+    struct Header {
+        u32 Magic;
+        u16 Version;
+        u16 Components;
+        u64 RomHash;
+    };
+
+    static constexpr u32 s_Magic = 0x53484247; // "GBHS"
+    static constexpr u16 s_Version = 1;
+
+    // Splits a serialized state into its sections, false if it isn't well formed
+    static bool ForEachSection(const std::vector<u8> &state, const std::function<void(u32 tag, const u8 *data, u32 size)> &func);
+
+    struct Stream {
+        Header Head;
+        std::vector<u32> Tags;
+        std::ifstream File;
+    };
+
+    static bool OpenStream(const std::string &path, Stream &stream);
+
+private:
+    std::ofstream m_File;
+    u16 m_Components = 0;
+
+    std::vector<u8> m_State;
+    std::vector<u8> m_Record;
+
+    u64 m_Frames = 0;
+    double m_TotalCostUs = 0;
+};
@@ -0,0 +1,240 @@
+#include "StateStore.hpp"
+#include "Log.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static bool WriteAll(int fd, const void *data, usize size) {
+    const u8 *bytes = static_cast<const u8*>(data);
+    while (size > 0) {
+        isize written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+std::string StateStore::GetSegmentPath(const std::string &dir, usize segment, const char *extension) {
+    char name[32];
+    snprintf(name, sizeof(name), "segment-%06lu.%s", segment, extension);
+    return (fs::path(dir) / name).string();
+}
+
+std::unique_ptr<StateStore::Writer> StateStore::OpenWriter() {
+    usize segment;
+    {
+        std::lock_guard<std::mutex> lock(m_Mtx);
+
+        if (!m_Scanned) {
+            std::error_code ec;
+            fs::create_directories(m_Dir, ec);
+            while (fs::exists(GetSegmentPath(m_Dir, m_NextSegment, "idx"))) {
+                m_NextSegment++;
+            }
+            m_Scanned = true;
+        }
+
+        segment = m_NextSegment++;
+    }
+
+    auto writer = std::make_unique<Writer>();
+    if (!writer->Open(GetSegmentPath(m_Dir, segment, "idx"), GetSegmentPath(m_Dir, segment, "dat"))) {
+        return nullptr;
+    }
+
+    return writer;
+}
+
+std::unique_ptr<StateStore::Reader> StateStore::OpenReader() const {
+    auto reader = std::make_unique<Reader>();
+    if (!reader->Open(m_Dir)) {
+        return nullptr;
+    }
+
+    return reader;
+}
+
+bool StateStore::Writer::Open(const std::string &indexPath, const std::string &dataPath) {
+    // Readers look for the index, so the data file is there before it
+    m_DataFd = open(dataPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    m_IndexFd = m_DataFd < 0 ? -1 : open(indexPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (m_IndexFd < 0 || m_DataFd < 0) {
+        LOG_ERROR("Could not create state store segment %s\n", indexPath.c_str());
+        return false;
+    }
+
+    IndexHeader header = { s_Magic, s_Version, sizeof(IndexEntry), { 0, 0 } };
+    return WriteAll(m_IndexFd, &header, sizeof(header));
+}
+
+StateStore::Writer::~Writer() {
+    Flush();
+
+    if (m_IndexFd >= 0) close(m_IndexFd);
+    if (m_DataFd >= 0) close(m_DataFd);
+}
+
+bool StateStore::Writer::Append(u64 frame, u64 romHash, const std::vector<u8> &state) {
+    uLongf size = compressBound(state.size());
+    usize offset = m_Data.size();
+    m_Data.resize(offset + size);
+
+    // Fastest level: the states are mostly zero runs and repeated tiles anyway
+    if (compress2(&m_Data[offset], &size, state.data(), state.size(), Z_BEST_SPEED) != Z_OK) {
+        m_Data.resize(offset);
+        LOG_ERROR("Could not compress state for frame %lu\n", frame);
+        return false;
+    }
+    m_Data.resize(offset + size);
+
+    m_Index.push_back({ frame, romHash, m_DataSize + offset, static_cast<u32>(size), static_cast<u32>(state.size()) });
+    m_Count++;
+    m_RawBytes += state.size();
+
+    if (m_Data.size() >= s_BatchBytes) {
+        return Flush();
+    }
+
+    return true;
+}
+
+// Data goes out before the entries pointing at it, so a reader (or a crash)
+// never sees an entry without its state
+bool StateStore::Writer::Flush() {
+    if (m_Index.empty() || m_DataFd < 0) return true;
+
+    if (!WriteAll(m_DataFd, m_Data.data(), m_Data.size()) ||
+        !WriteAll(m_IndexFd, m_Index.data(), m_Index.size() * sizeof(IndexEntry)))
+    {
+        LOG_ERROR("Could not write state store segment: %s\n", strerror(errno));
+        return false;
+    }
+
+    m_DataSize += m_Data.size();
+    m_Data.clear();
+    m_Index.clear();
+    return true;
+}
+
+bool StateStore::Reader::Map(const std::string &path, Mapping &mapping) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    mapping.Size = st.st_size;
+    if (mapping.Size > 0) {
+        void *data = mmap(nullptr, mapping.Size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+
+        mapping.Data = static_cast<const u8*>(data);
+    }
+
+    close(fd);
+    return true;
+}
+
+bool StateStore::Reader::Open(const std::string &dir) {
+    for (usize segment = 0; fs::exists(GetSegmentPath(dir, segment, "idx")); segment++) {
+        Segment seg = {};
+        if (!Map(GetSegmentPath(dir, segment, "idx"), seg.Index)) {
+            LOG_ERROR("Could not map state store segment %lu in %s\n", segment, dir.c_str());
+            return false;
+        }
+
+        // A writer that is just starting hasn't written its header yet, its segment
+        // has no states to offer
+        if (seg.Index.Size < sizeof(IndexHeader)) {
+            if (seg.Index.Data) munmap(const_cast<u8*>(seg.Index.Data), seg.Index.Size);
+            continue;
+        }
+
+        if (!Map(GetSegmentPath(dir, segment, "dat"), seg.Data)) {
+            LOG_ERROR("Could not map state store segment %lu in %s\n", segment, dir.c_str());
+            munmap(const_cast<u8*>(seg.Index.Data), seg.Index.Size);
+            return false;
+        }
+
+        IndexHeader header;
+        memcpy(&header, seg.Index.Data, sizeof(header));
+
+        if (header.Magic != s_Magic || header.Version != s_Version || header.EntrySize != sizeof(IndexEntry)) {
+            LOG_ERROR("Segment %lu in %s is not a supported state store index\n", segment, dir.c_str());
+            return false;
+        }
+
+        // A writer may be mid-batch, only whole entries whose data is there count
+        seg.Count = (seg.Index.Size - sizeof(header)) / sizeof(IndexEntry);
+        while (seg.Count > 0) {
+            const IndexEntry &last = reinterpret_cast<const IndexEntry*>(seg.Index.Data + sizeof(header))[seg.Count - 1];
+            if (last.Offset + last.CompressedSize <= seg.Data.Size) break;
+            seg.Count--;
+        }
+
+        seg.First = m_Count;
+        m_Count += seg.Count;
+        m_Segments.push_back(seg);
+    }
+
+    return true;
+}
+
+StateStore::Reader::~Reader() {
+    for (Segment &seg : m_Segments) {
+        if (seg.Index.Data) munmap(const_cast<u8*>(seg.Index.Data), seg.Index.Size);
+        if (seg.Data.Data) munmap(const_cast<u8*>(seg.Data.Data), seg.Data.Size);
+    }
+}
+
+const StateStore::Reader::Segment &StateStore::Reader::FindSegment(usize index) const {
+    auto it = std::upper_bound(m_Segments.begin(), m_Segments.end(), index,
+        [](usize i, const Segment &seg) { return i < seg.First; });
+    return *(it - 1);
+}
+
+const StateStore::IndexEntry &StateStore::Reader::GetEntry(usize index) const {
+    const Segment &seg = FindSegment(index);
+    return reinterpret_cast<const IndexEntry*>(seg.Index.Data + sizeof(IndexHeader))[index - seg.First];
+}
+
+bool StateStore::Reader::Load(usize index, std::vector<u8> &state) const {
+    if (index >= m_Count) {
+        LOG_ERROR("State %lu is out of range (store has %lu)\n", index, m_Count);
+        return false;
+    }
+
+    const Segment &seg = FindSegment(index);
+    const IndexEntry &entry = GetEntry(index);
+
+    state.resize(entry.StateSize);
+    uLongf size = entry.StateSize;
+    if (uncompress(state.data(), &size, seg.Data.Data + entry.Offset, entry.CompressedSize) != Z_OK || size != entry.StateSize) {
+        LOG_ERROR("State %lu is corrupted\n", index);
+        return false;
+    }
+
+    return true;
+}
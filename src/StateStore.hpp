@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <memory>
+
+// Append-only container of save states for offline datasets. A store is a
+// directory of segments, one per writer, each a data file of zlib compressed
+// states plus an index of fixed-size entries, so any state can be found and
+// loaded without scanning. Readers map every segment read-only and can load
+// from any number of threads.
+//
+// Index file layout (little endian):
+//   "GBSI", u16 version, u16 entry size, 8 reserved bytes, then IndexEntry per state.
+// The header keeps the entries 8-byte aligned in the mapping.
+class StateStore {
+public:
+    struct IndexEntry {
+        u64 Frame;
+        u64 RomHash;
+        u64 Offset;           // Into the segment's data file
+        u32 CompressedSize;
+        u32 StateSize;
+    };
+
+    // Buffers states in memory and appends them in batches. Not thread-safe:
+    // every worker thread opens its own.
+    class Writer {
+    public:
+        ~Writer();
+
+        bool Append(u64 frame, u64 romHash, const std::vector<u8> &state);
+        bool Flush();
+
+        usize GetCount() const { return m_Count; }
+        usize GetRawBytes() const { return m_RawBytes; }
+        usize GetStoredBytes() const { return m_DataSize + m_Data.size(); }
+
+    private:
+        friend class StateStore;
+        bool Open(const std::string &indexPath, const std::string &dataPath);
+
+    private:
+        static constexpr usize s_BatchBytes = 4 * 1024 * 1024;
+
+        int m_IndexFd = -1;
+        int m_DataFd = -1;
+
+        // Pending batch
+        std::vector<u8> m_Data;
+        std::vector<IndexEntry> m_Index;
+
+        u64 m_DataSize = 0;
+        usize m_Count = 0;
+        usize m_RawBytes = 0;
+    };
+
+    // Read-only view of every segment present when it was opened
+    class Reader {
+    public:
+        ~Reader();
+
+        usize GetCount() const { return m_Count; }
+        const IndexEntry &GetEntry(usize index) const;
+
+        bool Load(usize index, std::vector<u8> &state) const;
+
+    private:
+        friend class StateStore;
+        bool Open(const std::string &dir);
+
+    private:
+        struct Mapping {
+            const u8 *Data = nullptr;
+            usize Size = 0;
+        };
+
+        struct Segment {
+            Mapping Index;
+            Mapping Data;
+            usize Count;
+            usize First;      // Global number of the first entry
+        };
+
+        static bool Map(const std::string &path, Mapping &mapping);
+        const Segment &FindSegment(usize index) const;
+
+    private:
+        std::vector<Segment> m_Segments;
+        usize m_Count = 0;
+    };
+
+    explicit StateStore(const std::string &dir) : m_Dir(dir) {}
+
+    // Every call starts a new segment after the ones already in the directory
+    std::unique_ptr<Writer> OpenWriter();
+    std::unique_ptr<Reader> OpenReader() const;
+
+private:
+    struct IndexHeader {
+        u32 Magic;
+        u16 Version;
+        u16 EntrySize;
+        u32 Reserved[2];
+    };
+
+    static_assert(sizeof(IndexHeader) % alignof(IndexEntry) == 0);
+
+    static constexpr u32 s_Magic = 0x49534247; // "GBSI"
+    static constexpr u16 s_Version = 2;
+
+    static std::string GetSegmentPath(const std::string &dir, usize segment, const char *extension);
+
+private:
+    std::string m_Dir;
+    std::mutex m_Mtx;
+    usize m_NextSegment = 0;
+    bool m_Scanned = false;
+};
@@ -1,23 +1,108 @@
-#include "Timer.hpp"
-#include "Gameboy.hpp"
-
-const u16 Timer::s_Dividers[] = { 1024, 16, 64, 256 };
-    
-void Timer::Tick(u8 cycles) {
-    u8 clockSelect = m_TAC & 0b11;
-    u8 timerEnable = BIT(m_TAC, 2);
-
-    u16 divider = s_Dividers[clockSelect];
-    bool timerUpdate = (m_DIV & divider) && (!((m_DIV + cycles) & divider));
-
-    m_DIV += cycles;
-
-    if (timerUpdate && timerEnable) {
-        u16 temp = m_TIMA + cycles;
-        m_TIMA = temp;
-        if (temp > 0xFF) {
-            m_TIMA = m_TMA;
-            Gameboy::Get().GetCPU().RequestInterrupt(CPU::Interrupt::Timer);
-        }
-    }
-}
\ No newline at end of file
+#include "Timer.hpp"
+#include "Gameboy.hpp"
+
+const u16 Timer::s_Dividers[] = { 1024, 16, 64, 256 };
+
+bool Timer::GetSignal(u64 now) const {
+    return IsEnabled() && ((now - m_DivBase) & (GetPeriod() / 2));
+}
+
+void Timer::Sync(u64 now) {
+    if (now <= m_LastSync) return;
+
+    if (IsEnabled()) {
+        u64 period = GetPeriod();
+        Increment((now - m_DivBase) / period - (m_LastSync - m_DivBase) / period);
+    }
+
+    m_LastSync = now;
+    Schedule();
+}
+
+// Any number of edges at once: after the first overflow TIMA counts from TMA up
+void Timer::Increment(u64 edges) {
+    if (edges < 0x100u - m_TIMA) {
+        m_TIMA += edges;
+        return;
+    }
+
+    edges -= 0x100u - m_TIMA;
+    m_TIMA = m_TMA + edges % (0x100u - m_TMA);
+    Gameboy::Get().GetCPU().RequestInterrupt(CPU::Interrupt::Timer);
+}
+
+void Timer::Schedule() {
+    if (!IsEnabled()) {
+        m_NextOverflow = ~0ull;
+        return;
+    }
+
+    u64 period = GetPeriod();
+    u64 edge = (m_LastSync - m_DivBase) / period + (0x100u - m_TIMA);
+    m_NextOverflow = m_DivBase + edge * period;
+}
+
+u8 Timer::GetDIV() const {
+    return static_cast<u8>((Gameboy::Get().GetTicks() - m_DivBase) >> 8);
+}
+
+u8 Timer::GetTIMA() {
+    Sync(Gameboy::Get().GetTicks());
+    return m_TIMA;
+}
+
+// Resetting the divider while the selected bit is set is a falling edge too
+void Timer::ResetDIV() {
+    u64 now = Gameboy::Get().GetTicks();
+    Sync(now);
+
+    if (GetSignal(now)) {
+        Increment(1);
+    }
+
+    m_DivBase = now;
+    Schedule();
+}
+
+void Timer::SetTIMA(u8 val) {
+    Sync(Gameboy::Get().GetTicks());
+    m_TIMA = val;
+    Schedule();
+}
+
+void Timer::SetTMA(u8 val) {
+    Sync(Gameboy::Get().GetTicks());
+    m_TMA = val;
+}
+
+// As does switching to a clear bit or disabling the timer while the old bit is set
+void Timer::SetTAC(u8 val) {
+    u64 now = Gameboy::Get().GetTicks();
+    Sync(now);
+
+    bool before = GetSignal(now);
+    m_TAC = val & 0b111;
+    if (before && !GetSignal(now)) {
+        Increment(1);
+    }
+
+    Schedule();
+}
+
+void Timer::Serialize(StateWriter &state) const {
+    state.Write(m_DivBase);
+    state.Write(m_LastSync);
+    state.Write(m_TIMA);
+    state.Write(m_TMA);
+    state.Write(m_TAC);
+}
+
+void Timer::Deserialize(StateReader &state) {
+    state.Read(m_DivBase);
+    state.Read(m_LastSync);
+    state.Read(m_TIMA);
+    state.Read(m_TMA);
+    state.Read(m_TAC);
+
+    Schedule();
+}
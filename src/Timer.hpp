@@ -1,26 +1,50 @@
 #pragma once
 
 #include "Common.hpp"
+#include "SaveState.hpp"
 
+// DIV and TIMA are never stepped. DIV is the machine's cycle count since it was last
+// reset, and TIMA is brought up to date from the number of falling edges of the
+// selected divider bit whenever it is read or one of FF04-FF07 is written. The only
+// per instruction work is comparing the cycle count against the next overflow.
 class Timer {
 public:
-    void Tick(u8 cycles);
+    // Catches up to `now`, raising the interrupt for any overflow on the way
+    void Sync(u64 now);
 
-    u16 GetDIV() const { return m_DIV >> 8; }
-    u8 GetTIMA() const { return m_TIMA; }
+    // When TIMA overflows next, if nothing is written before then
+    u64 GetNextOverflow() const { return m_NextOverflow; }
+
+    u8 GetDIV() const;
+    u8 GetTIMA();
     u8 GetTMA() const { return m_TMA; }
-    u8 GetTAC() const { return m_TAC; }
+    u8 GetTAC() const { return m_TAC | 0xF8; }
+
+    void ResetDIV();
+    void SetTIMA(u8 val);
+    void SetTMA(u8 val);
+    void SetTAC(u8 val);
+
+    void Serialize(StateWriter &state) const;
+    void Deserialize(StateReader &state);
+
+private:
+    bool IsEnabled() const { return BIT(m_TAC, 2); }
+    u64 GetPeriod() const { return s_Dividers[m_TAC & 0b11]; }
+
+    // The signal TIMA counts falling edges of: enable AND the selected divider bit
+    bool GetSignal(u64 now) const;
 
-    void SetDIV(u16 val) { m_DIV = val; }
-    void SetTIMA(u8 val) { m_TIMA = val; }
-    void SetTMA(u8 val) { m_TMA = val; }
-    void SetTAC(u8 val) { m_TAC = val; }
+    void Increment(u64 edges);
+    void Schedule();
 
 private:
     static const u16 s_Dividers[];
 
 private:
-    u16 m_DIV = 0;
+    u64 m_DivBase = 0;      // Cycle at which the divider was last 0
+    u64 m_LastSync = 0;     // Cycle TIMA is up to date with
+    u64 m_NextOverflow = ~0ull;
     u8 m_TIMA = 0;
     u8 m_TMA = 0;
     u8 m_TAC = 0;
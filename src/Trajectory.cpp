@@ -0,0 +1,190 @@
+#include "Trajectory.hpp"
+#include "Gameboy.hpp"
+#include "Log.hpp"
+
+// Fixed size, so the row count can be rewritten in place
+static constexpr usize s_NpyHeaderSize = 128;
+
+bool TrajectoryWriter::NpyFile::Open(const std::string &path, const std::vector<usize> &rowShape) {
+    m_File.open(path, std::ios::binary);
+    if (!m_File) {
+        LOG_ERROR("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    m_RowShape = rowShape;
+    WriteHeader(0);
+    return true;
+}
+
+void TrajectoryWriter::NpyFile::WriteHeader(usize rows) {
+    std::string shape = "(" + std::to_string(rows) + ",";
+    for (usize dim : m_RowShape) {
+        shape += " " + std::to_string(dim) + ",";
+    }
+    if (!m_RowShape.empty()) shape.pop_back();
+    shape += ")";
+
+    // Magic, version 1.0, header length, then the dict padded with spaces and a newline
+    std::string header = "{'descr': '|u1', 'fortran_order': False, 'shape': " + shape + ", }";
+    header.resize(s_NpyHeaderSize - 10 - 1, ' ');
+    header += '\n';
+
+    u16 length = static_cast<u16>(header.size());
+    m_File.seekp(0);
+    m_File.write("\x93NUMPY\x01\x00", 8);
+    m_File.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    m_File.write(header.data(), header.size());
+}
+
+bool TrajectoryWriter::NpyFile::Close(usize rows) {
+    if (!m_File.is_open()) return true;
+
+    WriteHeader(rows);
+    m_File.close();
+    return !m_File.fail();
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    Close();
+}
+
+bool TrajectoryWriter::Open(const std::string &prefix, const std::vector<u16> &ramAddresses, usize batchFrames) {
+    Close();
+
+    if (!m_FramesFile.Open(prefix + ".frames.npy", { s_Height, s_Width }) ||
+        !m_InputsFile.Open(prefix + ".inputs.npy", {}) ||
+        !m_RamFile.Open(prefix + ".ram.npy", { ramAddresses.size() }))
+    {
+        return false;
+    }
+
+    m_RamAddresses = ramAddresses;
+    m_BatchFrames = std::max<usize>(batchFrames, 1);
+    m_Frames = 0;
+    m_Stalls = 0;
+
+    for (Batch &batch : m_Batches) {
+        batch.Frames.resize(m_BatchFrames * s_FrameSize);
+        batch.Inputs.resize(m_BatchFrames);
+        batch.Ram.resize(m_BatchFrames * m_RamAddresses.size());
+        batch.Count = 0;
+    }
+
+    m_Filling = &m_Batches[0];
+    m_Pending = nullptr;
+    m_Quit = false;
+    m_Thread = std::thread([this] { WriterLoop(); });
+    return true;
+}
+
+void TrajectoryWriter::Close() {
+    if (!IsOpen()) return;
+
+    if (m_Filling->Count > 0) {
+        Submit();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mtx);
+        m_Quit = true;
+    }
+    m_Cond.notify_all();
+    m_Thread.join();
+
+    bool ok = m_FramesFile.Close(m_Frames);
+    ok &= m_InputsFile.Close(m_Frames);
+    ok &= m_RamFile.Close(m_Frames);
+    if (!ok) {
+        LOG_ERROR("Writing the trajectory failed after %lu frames\n", m_Frames);
+    }
+
+    for (Batch &batch : m_Batches) {
+        batch = Batch();
+    }
+}
+
+void TrajectoryWriter::OnFrame() {
+    if (!IsOpen()) return;
+
+    Gameboy &gameboy = Gameboy::Get();
+    Batch &batch = *m_Filling;
+    usize row = batch.Count;
+
+    gameboy.GetPPU().CopyShades(&batch.Frames[row * s_FrameSize]);
+    batch.Inputs[row] = gameboy.GetUI().GetJoypad().GetButtons();
+
+    u8 *ram = &batch.Ram[row * m_RamAddresses.size()];
+    for (u16 addr : m_RamAddresses) {
+        *ram++ = gameboy.GetMemory().Read(addr);
+    }
+
+    batch.Count++;
+    m_Frames++;
+
+    if (batch.Count == m_BatchFrames) {
+        Submit();
+    }
+}
+
+// Hands the filled batch to the writer and continues in the other one, which the
+// writer has to be done with first
+void TrajectoryWriter::Submit() {
+    std::unique_lock<std::mutex> lock(m_Mtx);
+    if (m_Pending) {
+        m_Stalls++;
+        m_Cond.wait(lock, [this] { return m_Pending == nullptr; });
+    }
+
+    m_Pending = m_Filling;
+    m_Filling = (m_Filling == &m_Batches[0]) ? &m_Batches[1] : &m_Batches[0];
+    m_Filling->Count = 0;
+
+    lock.unlock();
+    m_Cond.notify_all();
+}
+
+void TrajectoryWriter::WriterLoop() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(m_Mtx);
+        m_Cond.wait(lock, [this] { return m_Pending || m_Quit; });
+        if (!m_Pending) break;
+
+        Batch &batch = *m_Pending;
+        lock.unlock();
+
+        m_FramesFile.Write(batch.Frames.data(), batch.Count * s_FrameSize);
+        m_InputsFile.Write(batch.Inputs.data(), batch.Count);
+        m_RamFile.Write(batch.Ram.data(), batch.Count * m_RamAddresses.size());
+
+        lock.lock();
+        m_Pending = nullptr;
+        lock.unlock();
+        m_Cond.notify_all();
+    }
+}
+
+bool TrajectoryWriter::ParseAddresses(const std::string &list, std::vector<u16> &addresses) {
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        usize dash = item.find('-');
+        std::string firstText = item.substr(0, dash);
+        std::string lastText = (dash == std::string::npos) ? firstText : item.substr(dash + 1);
+
+        char *firstEnd, *lastEnd;
+        unsigned long first = strtoul(firstText.c_str(), &firstEnd, 16);
+        unsigned long last = strtoul(lastText.c_str(), &lastEnd, 16);
+
+        if (firstText.empty() || lastText.empty() || *firstEnd || *lastEnd || first > last || last > 0xFFFF) {
+            LOG_ERROR("Bad address '%s' (expected hex addresses or ranges like C000-C0FF)\n", item.c_str());
+            return false;
+        }
+
+        for (unsigned long addr = first; addr <= last; addr++) {
+            addresses.push_back(static_cast<u16>(addr));
+        }
+    }
+
+    return true;
+}
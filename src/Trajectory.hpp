@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Common.hpp"
+
+// Training data: for every frame the screen as shades, the buttons latched for the
+// next frame and a chosen set of memory bytes, written as three NumPy arrays:
+//   <prefix>.frames.npy  uint8 (N, 144, 160)
+//   <prefix>.inputs.npy  uint8 (N,)          bits A, B, Select, Start, Right, Left, Up, Down
+//   <prefix>.ram.npy     uint8 (N, K)        one column per address
+//
+// Frames are gathered into one of two batches by the emulation thread while a
+// background thread writes out the other one.
+class TrajectoryWriter {
+public:
+    ~TrajectoryWriter();
+
+    bool Open(const std::string &prefix, const std::vector<u16> &ramAddresses, usize batchFrames = 64);
+    void Close();
+
+    bool IsOpen() const { return m_Thread.joinable(); }
+
+    // Called by the emulation thread once per frame
+    void OnFrame();
+
+    u64 GetFrames() const { return m_Frames; }
+    u64 GetBytes() const { return m_Frames * (1 + s_FrameSize + m_RamAddresses.size()); }
+
+    // Times the emulation thread had to wait for the writer to catch up
+    u64 GetStalls() const { return m_Stalls; }
+
+    // "C0A0,D000-D00F" style lists
+    static bool ParseAddresses(const std::string &list, std::vector<u16> &addresses);
+
+private:
+    // Array file whose row count is patched into the header when closed
+    class NpyFile {
+    public:
+        bool Open(const std::string &path, const std::vector<usize> &rowShape);
+        void Write(const u8 *data, usize size) { m_File.write(reinterpret_cast<const char*>(data), size); }
+        bool Close(usize rows);
+
+    private:
+        void WriteHeader(usize rows);
+
+    private:
+        std::ofstream m_File;
+        std::vector<usize> m_RowShape;
+    };
+
+    struct Batch {
+        std::vector<u8> Frames;
+        std::vector<u8> Inputs;
+        std::vector<u8> Ram;
+        usize Count = 0;
+    };
+
+    void WriterLoop();
+    void Submit();
+
+private:
+    static constexpr usize s_Width = 160;
+    static constexpr usize s_Height = 144;
+    static constexpr usize s_FrameSize = s_Width * s_Height;
+
+    NpyFile m_FramesFile;
+    NpyFile m_InputsFile;
+    NpyFile m_RamFile;
+
+    std::vector<u16> m_RamAddresses;
+    usize m_BatchFrames = 0;
+
+    Batch m_Batches[2];
+    Batch *m_Filling = nullptr;
+    Batch *m_Pending = nullptr;
+
+    std::thread m_Thread;
+    std::mutex m_Mtx;
+    std::condition_variable m_Cond;
+    bool m_Quit = false;
+
+    u64 m_Frames = 0;
+    u64 m_Stalls = 0;
+};
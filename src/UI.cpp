@@ -1,10 +1,21 @@
 #include "UI.hpp"
 #include "Gameboy.hpp"
+#include "Log.hpp"
 
 UI::UI()
     : m_WindowWidth(m_FrameWidth * (m_PixelSize + m_Spacing)),
       m_WindowHeight(m_FrameHeight * (m_PixelSize + m_Spacing))
-{
+{}
+
+// Copies never own a window
+UI::UI(const UI &other)
+    : m_WindowWidth(other.m_WindowWidth),
+      m_WindowHeight(other.m_WindowHeight),
+      m_Joypad(other.m_Joypad),
+      m_Input(other.m_Input)
+{}
+
+void UI::Open() {
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER);
 
     m_Window = SDL_CreateWindow("Gameboy Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, m_WindowWidth, m_WindowHeight, 0);
@@ -18,6 +29,8 @@ UI::UI()
 }
 
 UI::~UI() {
+    if (!m_Window) return;
+
     if (m_Controler) {
         SDL_GameControllerClose(m_Controler);
     }
@@ -36,55 +49,77 @@ void UI::HandleEvents() {
             Gameboy::Get().Quit();
         }
 
+        // F1-F4 save to slots 1-4, with Shift held they load
+        if (event.type == SDL_KEYDOWN && SDLK_F1 <= event.key.keysym.sym && event.key.keysym.sym <= SDLK_F4) {
+            std::string slot = std::to_string(event.key.keysym.sym - SDLK_F1 + 1);
+            if (event.key.keysym.mod & KMOD_SHIFT) {
+                Gameboy::Get().LoadStateSlot(slot);
+            } else {
+                Gameboy::Get().SaveStateSlot(slot);
+            }
+        }
+
         if (event.type == SDL_KEYDOWN) {
             switch (event.key.keysym.sym) {
-                case SDLK_w: m_Joypad.Up     = true; break;
-                case SDLK_a: m_Joypad.Left   = true; break;
-                case SDLK_s: m_Joypad.Down   = true; break;
-                case SDLK_d: m_Joypad.Right  = true; break;
-                case SDLK_p: m_Joypad.A      = true; break;
-                case SDLK_l: m_Joypad.B      = true; break;
-                case SDLK_b: m_Joypad.Select = true; break;
-                case SDLK_n: m_Joypad.Start  = true; break;
+                // Speed: '-' slower, '=' faster (the last step is uncapped), '0' back to 1x
+                case SDLK_MINUS:  Gameboy::Get().GetPacer().StepSpeed(-1); break;
+                case SDLK_EQUALS: Gameboy::Get().GetPacer().StepSpeed(+1); break;
+                case SDLK_0:      Gameboy::Get().GetPacer().SetSpeed(1.0); break;
+                case SDLK_j: {
+                    Gameboy &gameboy = Gameboy::Get();
+                    bool enabled = gameboy.SetJit(!gameboy.IsJitEnabled());
+                    LOG_INFO("JIT %s\n", enabled ? "on" : "off");
+                    break;
+                }
+                case SDLK_r: Gameboy::Get().GetRewind().SetActive(true); break;
+                case SDLK_w: m_Input.Up     = true; break;
+                case SDLK_a: m_Input.Left   = true; break;
+                case SDLK_s: m_Input.Down   = true; break;
+                case SDLK_d: m_Input.Right  = true; break;
+                case SDLK_p: m_Input.A      = true; break;
+                case SDLK_l: m_Input.B      = true; break;
+                case SDLK_b: m_Input.Select = true; break;
+                case SDLK_n: m_Input.Start  = true; break;
             }
         }
 
         if (event.type == SDL_KEYUP) {
             switch (event.key.keysym.sym) {
-                case SDLK_w: m_Joypad.Up     = false; break;
-                case SDLK_a: m_Joypad.Left   = false; break;
-                case SDLK_s: m_Joypad.Down   = false; break;
-                case SDLK_d: m_Joypad.Right  = false; break;
-                case SDLK_p: m_Joypad.A      = false; break;
-                case SDLK_l: m_Joypad.B      = false; break;
-                case SDLK_b: m_Joypad.Select = false; break;
-                case SDLK_n: m_Joypad.Start  = false; break;
+                case SDLK_r: Gameboy::Get().GetRewind().SetActive(false); break;
+                case SDLK_w: m_Input.Up     = false; break;
+                case SDLK_a: m_Input.Left   = false; break;
+                case SDLK_s: m_Input.Down   = false; break;
+                case SDLK_d: m_Input.Right  = false; break;
+                case SDLK_p: m_Input.A      = false; break;
+                case SDLK_l: m_Input.B      = false; break;
+                case SDLK_b: m_Input.Select = false; break;
+                case SDLK_n: m_Input.Start  = false; break;
             }
         }
 
         if (m_Controler && event.type == SDL_CONTROLLERBUTTONDOWN) {
             switch (event.cbutton.button) {
-                case SDL_CONTROLLER_BUTTON_DPAD_UP:    m_Joypad.Up     = true; break;
-                case SDL_CONTROLLER_BUTTON_DPAD_LEFT:  m_Joypad.Left   = true; break;
-                case SDL_CONTROLLER_BUTTON_DPAD_DOWN:  m_Joypad.Down   = true; break;
-                case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: m_Joypad.Right  = true; break;
-                case SDL_CONTROLLER_BUTTON_A:          m_Joypad.A      = true; break;
-                case SDL_CONTROLLER_BUTTON_B:          m_Joypad.B      = true; break;
-                case SDL_CONTROLLER_BUTTON_BACK:       m_Joypad.Select = true; break;
-                case SDL_CONTROLLER_BUTTON_START:      m_Joypad.Start  = true; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_UP:    m_Input.Up     = true; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_LEFT:  m_Input.Left   = true; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_DOWN:  m_Input.Down   = true; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: m_Input.Right  = true; break;
+                case SDL_CONTROLLER_BUTTON_A:          m_Input.A      = true; break;
+                case SDL_CONTROLLER_BUTTON_B:          m_Input.B      = true; break;
+                case SDL_CONTROLLER_BUTTON_BACK:       m_Input.Select = true; break;
+                case SDL_CONTROLLER_BUTTON_START:      m_Input.Start  = true; break;
             }
         }
 
         if (m_Controler && event.type == SDL_CONTROLLERBUTTONUP) {
             switch (event.cbutton.button) {
-                case SDL_CONTROLLER_BUTTON_DPAD_UP:    m_Joypad.Up     = false; break;
-                case SDL_CONTROLLER_BUTTON_DPAD_LEFT:  m_Joypad.Left   = false; break;
-                case SDL_CONTROLLER_BUTTON_DPAD_DOWN:  m_Joypad.Down   = false; break;
-                case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: m_Joypad.Right  = false; break;
-                case SDL_CONTROLLER_BUTTON_A:          m_Joypad.A      = false; break;
-                case SDL_CONTROLLER_BUTTON_B:          m_Joypad.B      = false; break;
-                case SDL_CONTROLLER_BUTTON_BACK:       m_Joypad.Select = false; break;
-                case SDL_CONTROLLER_BUTTON_START:      m_Joypad.Start  = false; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_UP:    m_Input.Up     = false; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_LEFT:  m_Input.Left   = false; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_DOWN:  m_Input.Down   = false; break;
+                case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: m_Input.Right  = false; break;
+                case SDL_CONTROLLER_BUTTON_A:          m_Input.A      = false; break;
+                case SDL_CONTROLLER_BUTTON_B:          m_Input.B      = false; break;
+                case SDL_CONTROLLER_BUTTON_BACK:       m_Input.Select = false; break;
+                case SDL_CONTROLLER_BUTTON_START:      m_Input.Start  = false; break;
             }
         }
     }
@@ -13,16 +13,44 @@ struct Joypad {
     bool Down     = false;
     bool Right    = false;
     bool Left     = false;
+
+    // One bit per button, in FF00 order: A, B, Select, Start, Right, Left, Up, Down
+    u8 GetButtons() const {
+        return (A << 0) | (B << 1) | (Select << 2) | (Start << 3) | (Right << 4) | (Left << 5) | (Up << 6) | (Down << 7);
+    }
+
+    void SetButtons(u8 buttons) {
+        A      = BIT(buttons, 0);
+        B      = BIT(buttons, 1);
+        Select = BIT(buttons, 2);
+        Start  = BIT(buttons, 3);
+        Right  = BIT(buttons, 4);
+        Left   = BIT(buttons, 5);
+        Up     = BIT(buttons, 6);
+        Down   = BIT(buttons, 7);
+    }
 };
 
 class UI {
 public:
     UI();
+    UI(const UI &other);
     ~UI();
 
+    // Creates the window, headless runs never call it
+    void Open();
+
     Joypad &GetJoypad() { return m_Joypad; }
+    const Joypad &GetJoypad() const { return m_Joypad; }
 
     void HandleEvents();
+
+    // Events only change the pending buttons, the game sees them from the next frame
+    // boundary on. This keeps a run reproducible from its per-frame inputs.
+    void LatchInput() { m_Joypad.SetButtons(m_Input.GetButtons()); }
+
+    // Headless drivers set the pending buttons directly
+    void SetInput(u8 buttons) { m_Input.SetButtons(buttons); }
     void Update(const std::vector<u32> &framebuffer);
 
 private:
@@ -33,11 +61,12 @@ private:
     usize m_WindowWidth;
     usize m_WindowHeight;
     
-    SDL_Window *m_Window;
-    SDL_Renderer *m_Renderer;
-    SDL_Texture *m_Texture;
-    SDL_Surface *m_Surface;
+    SDL_Window *m_Window = nullptr;
+    SDL_Renderer *m_Renderer = nullptr;
+    SDL_Texture *m_Texture = nullptr;
+    SDL_Surface *m_Surface = nullptr;
     SDL_GameController *m_Controler = nullptr;
 
     Joypad m_Joypad;
+    Joypad m_Input;
 };
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "WarmStart.hpp"
+#include "Gameboy.hpp"
+#include "Hash.hpp"
+#include "Log.hpp"
+
+#include <atomic>
+#include <filesystem>
+
+#include <unistd.h>
+
+bool WarmStart::Parse(const std::string &script) {
+    m_Inputs.clear();
+
+    std::stringstream ss(script);
+    std::string segment;
+    while (std::getline(ss, segment, ',')) {
+        usize colon = segment.find(':');
+        std::string count = segment.substr(0, colon);
+
+        if (count.empty() || count.find_first_not_of("0123456789") != std::string::npos) {
+            LOG_ERROR("Bad warm start segment '%s' (expected <frames>[:<buttons>])\n", segment.c_str());
+            return false;
+        }
+
+        u8 buttons = 0;
+        if (colon != std::string::npos) {
+            for (char c : segment.substr(colon + 1)) {
+                switch (c) {
+                    case 'A': buttons |= 1 << 0; break;
+                    case 'B': buttons |= 1 << 1; break;
+                    case 's': buttons |= 1 << 2; break;
+                    case 'S': buttons |= 1 << 3; break;
+                    case 'R': buttons |= 1 << 4; break;
+                    case 'L': buttons |= 1 << 5; break;
+                    case 'U': buttons |= 1 << 6; break;
+                    case 'D': buttons |= 1 << 7; break;
+                    default: {
+                        LOG_ERROR("Unknown button '%c' in warm start segment '%s'\n", c, segment.c_str());
+                        return false;
+                    }
+                }
+            }
+        }
+
+        // Checked before converting, so no count overflows
+        if (count.size() > 9 || m_Inputs.size() + std::stoul(count) > s_MaxFrames) {
+            LOG_ERROR("Warm start script '%s' is longer than %lu frames\n", script.c_str(), s_MaxFrames);
+            return false;
+        }
+
+        m_Inputs.insert(m_Inputs.end(), std::stoul(count), buttons);
+    }
+
+    return true;
+}
+
+u64 WarmStart::GetKey(Gameboy &gameboy) const {
+    // Everything the state depends on besides the script: a cached state from another
+    // core or layout would load fine and still differ from what emulating gives
+    u64 setup[] = { gameboy.GetCartrige().GetRomHash(), gameboy.IsAccurateTiming(), StateFormat::s_Version };
+    u64 key = gameboy.GetCheats().GetHash(Hash64(setup, sizeof(setup)));
+
+    // The length is part of the key, trailing idle frames change the state too
+    u64 length = m_Inputs.size();
+    return Hash64(m_Inputs.data(), m_Inputs.size(), Hash64(&length, sizeof(length), key));
+}
+
+WarmStart::State WarmStart::Find(u64 key, const std::string &path) {
+    {
+        std::lock_guard<std::mutex> lock(s_Mtx);
+        auto it = s_Cache.find(key);
+        if (it != s_Cache.end()) return it->second;
+    }
+
+    std::ifstream fs(path, std::ios::binary | std::ios::ate);
+    if (!fs) return nullptr;
+
+    auto state = std::make_shared<std::vector<u8>>(fs.tellg());
+    fs.seekg(0);
+    fs.read(reinterpret_cast<char*>(state->data()), state->size());
+    if (!fs) return nullptr;
+
+    std::lock_guard<std::mutex> lock(s_Mtx);
+    return s_Cache.emplace(key, state).first->second;
+}
+
+void WarmStart::Store(u64 key, const std::string &path, State state) {
+    {
+        std::lock_guard<std::mutex> lock(s_Mtx);
+        s_Cache[key] = state;
+    }
+
+    // Write next to the target and rename, so other instances (and processes) never
+    // read a torn cache. Each writer gets its own temporary name.
+    static std::atomic<u32> s_TmpCount = 0;
+    std::string tmpPath = path + ".tmp" + std::to_string(getpid()) + "-" + std::to_string(s_TmpCount++);
+
+    std::ofstream fs(tmpPath, std::ios::binary);
+    if (!fs) {
+        LOG_WARN("Could not write warm start cache %s\n", path.c_str());
+        return;
+    }
+
+    fs.write(reinterpret_cast<const char*>(state->data()), state->size());
+    fs.close();
+
+    std::error_code ec;
+    if (!fs) {
+        std::filesystem::remove(tmpPath, ec);
+        LOG_WARN("Could not write warm start cache %s\n", path.c_str());
+        return;
+    }
+
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmpPath, ec);
+        LOG_WARN("Could not write warm start cache %s (%s)\n", path.c_str(), ec.message().c_str());
+    }
+}
+
+bool WarmStart::Apply(Gameboy &gameboy, bool *hit) const {
+    u64 key = GetKey(gameboy);
+
+    char name[32];
+    snprintf(name, sizeof(name), ".%016lx.warm.state", key);
+    std::string path = gameboy.GetCartrige().GetFilename() + name;
+
+    // A cache file from an older state layout or another ROM fails to load and is remade
+    State state = Find(key, path);
+    // Frames are counted from the warm start, whether it was emulated or not
+    if (state && gameboy.LoadState(state->data(), state->size())) {
+        gameboy.GetUI().SetInput(0);
+        gameboy.GetPPU().SetCurrentFrame(0);
+        if (hit) *hit = true;
+        return true;
+    }
+
+    if (hit) *hit = false;
+    if (!gameboy.Reset()) return false;
+
+    for (u8 buttons : m_Inputs) {
+        gameboy.GetUI().SetInput(buttons);
+        gameboy.RunFrame();
+    }
+
+    gameboy.GetUI().SetInput(0);
+    gameboy.GetPPU().SetCurrentFrame(0);
+
+    auto saved = std::make_shared<std::vector<u8>>();
+    gameboy.SaveState(*saved);
+    Store(key, path, std::move(saved));
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Common.hpp"
+
+#include <memory>
+#include <unordered_map>
+
+class Gameboy;
+
+// The machine "so many frames after power on, with these buttons held", cached so
+// batch runs and training episodes don't emulate boot logos and title screens
+// every time. Entries are keyed by ROM hash, input script, cheats, timing core and
+// state format version, shared by every instance in the process and kept next to
+// the ROM as <rom>.<key>.warm.state across runs.
+class WarmStart {
+public:
+    // Comma separated "<frames>[:<buttons>]" segments, buttons being any of
+    // A, B, s (Select), S (Start), R, L, U, D. "300,5:S,60" idles 300 frames,
+    // holds Start for 5 and idles 60 more. At most s_MaxFrames in all.
+    bool Parse(const std::string &script);
+
+    const std::vector<u8> &GetInputs() const { return m_Inputs; }
+    u64 GetKey(Gameboy &gameboy) const;
+
+    // Puts `gameboy` in the scripted state in place, emulating the script from
+    // power on only the first time. `hit` tells whether it came from the cache.
+    bool Apply(Gameboy &gameboy, bool *hit = nullptr) const;
+
+private:
+    // An hour of frames
+    static constexpr usize s_MaxFrames = 60 * 60 * 60;
+
+    using State = std::shared_ptr<const std::vector<u8>>;
+
+    static State Find(u64 key, const std::string &path);
+    static void Store(u64 key, const std::string &path, State state);
+
+private:
+    std::vector<u8> m_Inputs;
+
+    static inline std::mutex s_Mtx;
+    static inline std::unordered_map<u64, State> s_Cache;
+};